@@ -33,14 +33,24 @@
 #include <sys/un.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
 #include <fcntl.h>
 #include <dirent.h>
 
 #include "hashtab.h"
+#include "lookupa.h"
 #include "jsonrpc_internal.h"
 #include "abus_internal.h"
 
 #include "sock_un.h"
+#include "shm_ring.h"
+#include "epoch.h"
+#include "timer_wheel.h"
+#ifdef HAVE_IO_URING
+#include "uring.h"
+#endif
 
 #define LogError(...)    do { fprintf(stderr, ##__VA_ARGS__); fprintf(stderr, "\n"); } while (0)
 #define LogDebug(...)    do { fprintf(stderr, ##__VA_ARGS__); fprintf(stderr, "\n"); } while (0)
@@ -51,24 +61,85 @@
 #define ABUS_EVENT_METHOD "event"
 #define ABUS_GET_METHOD "get"
 #define ABUS_SET_METHOD "set"
+#define ABUS_SHM_ATTACH_METHOD "shm_attach"
+
+/* upper bound of abus_conf_t.recv_batch */
+#define ABUS_RECV_BATCH_MAX 256
+/* upper bound of abus_conf_t.recv_threads */
+#define ABUS_RECV_THREADS_MAX 64
+
+/* received file descriptors land in json_rpc_t.fds */
+#if JSONRPC_FDS_MAX < UN_SOCK_FDS_MAX
+#error "JSONRPC_FDS_MAX too small"
+#endif
+
+/* max events handled per wake-up of the A-Bus thread */
+#define ABUS_EPOLL_EVENTS 16
+
+#ifdef HAVE_IO_URING
+/* submission queue depth, and receive buffers of the A-Bus thread ring */
+#define ABUS_URING_ENTRIES 256
+#define ABUS_URING_BUFS 64
+
+/* user_data of the multishot requests, sends carry their own pointer */
+#define ABUS_URING_RECV 1
+#define ABUS_URING_POLL 2
+
+static int abus_uring_resp_send(abus_t *abus, json_rpc_t *json_rpc);
+#endif
 
 /* for use by {service,method,event,attr}_lookup() */
 #define CreateIfNotThere true
 #define LookupOnly false
 
+/* unit of work of the pool, discarded if the pool goes away before running it */
+struct abus_task {
+	void *(*run)(void *);
+	void (*discard)(void *);
+	void *arg;
+};
+
+/* fixed set of threads running the threaded methods, off a bounded queue */
+struct abus_pool {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct abus_task *queue;
+	unsigned head, count, depth;
+	pthread_t *threads;
+	unsigned thread_nb;
+	bool stopping;
+	unsigned long rejected;
+};
+
 static void *abus_thread_routine(void *arg);
+static void *abus_recv_thread_routine(void *arg);
 static int abus_thread_stop(abus_t *abus);
-
-static int create_service_path(abus_t *abus, const char *service_name);
-static int remove_service_path(abus_t *abus, const char *service_name);
+static void abus_pool_destroy(struct abus_pool *pool);
+static void abus_serial_put(struct abus_serial *serial);
+
+static int create_service_path(abus_t *abus, const char *service_name, int *svc_sock);
+static void abus_registry_update(abus_t *abus);
+static void abus_registry_free(void *arg);
+static void abus_method_release(void *arg);
+static int remove_service_path(abus_t *abus, const char *service_name, int svc_sock);
 static void abus_req_introspect_service_cb(json_rpc_t *json_rpc, void *arg);
 static void abus_req_subscribe_service_cb(json_rpc_t *json_rpc, void *arg);
 static void abus_req_unsubscribe_service_cb(json_rpc_t *json_rpc, void *arg);
 static void abus_req_attr_get_cb(json_rpc_t *json_rpc, void *arg);
 static void abus_req_attr_set_cb(json_rpc_t *json_rpc, void *arg);
+static void abus_req_shm_attach_cb(json_rpc_t *json_rpc, void *arg);
 static int abus_req_service_list(abus_t *abus, json_rpc_t *json_rpc, int timeout);
 static int abus_unsubscribe_service(abus_t *abus, const char *service_name, const char *event_name);
-static json_rpc_t *abus_process_msg(abus_t *abus, const char *buffer, int len, const struct sockaddr *sock_src_addr, socklen_t sock_addrlen);
+static json_rpc_t *abus_process_msg(abus_t *abus, const char *buffer, int len, const abus_msg_src_t *src);
+static int abus_process_sock(abus_t *abus, int sock, int flags);
+static int abus_process_timers(abus_t *abus);
+static int abus_process_corks(abus_t *abus);
+static int abus_process_local_evts(abus_t *abus);
+static int abus_process_events(abus_t *abus, const struct epoll_event *events, int n);
+static void abus_corks_free(abus_t *abus);
+static void abus_local_evts_free(abus_t *abus);
+static void abus_req_slots_free(abus_t *abus);
+static void abus_close_sessions(abus_t *abus);
 static char json_type2char(int json_type);
 
 /*!
@@ -81,7 +152,15 @@ static char json_type2char(int json_type);
  */
 /*!
   \def ABUS_RPC_EXCL
-  \brief A-Bus service method flag requesting to guarantee only one outstanding callback at a time
+  \brief A-Bus service method flag requesting to guarantee only one outstanding callback at a time.
+  Combined with ABUS_RPC_THREADED, requests are queued and run one after the other
+  in arrival order, see also abus_set_method_serial_key()
+ */
+/*!
+  \def ABUS_RPC_STREAM
+  \brief A-Bus asynchronous request flag, for the response handler to take partial results,
+  see abus_stream_response(). Not supported with several receiving threads,
+  see abus_conf_t.recv_threads
  */
 /*!
   \var typedef void (*abus_callback_t)(json_rpc_t *json_rpc, void *arg)
@@ -123,6 +202,11 @@ const char *abus_get_copyright()
   When the external environement variable ABUS_MSG_VERBOSE is set to a non zero value,
   content of JSON-RPC messages will be displayed on the terminal.
 
+  When the external environement variable ABUS_ABSTRACT is set to a non zero value,
+  sockets are named in the Linux abstract namespace instead of the /tmp/abus directory.
+  This mode is shared by all the A-Bus handles of the process, and has to be
+  the same for the services and their clients.
+
   \param[in] conf pointer to the A-Bus conf to be applied, may be NULL for default conf
   \return pointer to an opaque handle for A-Bus operation if successful, a NULL pointer otherwise
  */
@@ -140,12 +224,19 @@ abus_t *abus_init(const abus_conf_t *conf)
 	if (p)
 		abus_msg_verbose = atoi(p);
 
+	p = getenv("ABUS_ABSTRACT");
+	abus_abstract = p ? atoi(p) : 0;
+
 	/* TODO: path prefix from env variable or conf file */
 
 	pthread_mutex_init(&abus->mutex, NULL);
+	pthread_cond_init(&abus->detached_cond, NULL);
+	pthread_mutex_init(&abus->req_mutex, NULL);
+	pthread_mutex_init(&abus->cork_mutex, NULL);
+	pthread_mutex_init(&abus->evt_mutex, NULL);
 
 	/* make sure A-bus directory exists before creating socket */
-	ret = mkdir(abus_prefix, 0777);
+	ret = abus_abstract ? 0 : mkdir(abus_prefix, 0777);
 	if (ret == -1 && errno != EEXIST) {
 		ret = -errno;
 		LogError("A-Bus mkdir '%s' failed: %s", abus_prefix, strerror(errno));
@@ -153,9 +244,21 @@ abus_t *abus_init(const abus_conf_t *conf)
 		return NULL;
 	}
 
+	un_sock_addr_cache_hold();
+
 	abus->sock = -1;
+	abus->epfd = -1;
+	abus->seq_sock = -1;
+	abus->stop_efd = -1;
+	abus->timer_fd = -1;
+	abus->cork_fd = -1;
+	abus->evt_fd = -1;
+	abus->local_evts_tail = &abus->local_evts;
 
 	abus->conf.poll_operation = false;
+	abus->conf.no_cached_sock = false;
+	abus->conf.recv_batch = 0;
+	abus->conf.seqpacket = false;
 
 	if (conf)
 		abus_set_conf(abus, conf);
@@ -186,6 +289,35 @@ int abus_get_conf(abus_t *abus, abus_conf_t *conf)
 	return 0;
 }
 
+/*!
+  Get statistics of A-Bus operation
+
+  \param[in] abus pointer to an opaque handle for A-Bus operation
+  \param[out] stats pointer to the statistics to be filled in
+  \return 0 if successful
+ */
+int abus_get_stats(abus_t *abus, abus_stats_t *stats)
+{
+	memset(stats, 0, sizeof(abus_stats_t));
+
+	pthread_mutex_lock(&abus->mutex);
+
+	if (abus->pool) {
+		pthread_mutex_lock(&abus->pool->mutex);
+		stats->pool_queued = abus->pool->count;
+		stats->pool_rejected = abus->pool->rejected;
+		pthread_mutex_unlock(&abus->pool->mutex);
+	}
+
+	pthread_mutex_unlock(&abus->mutex);
+
+#ifdef HAVE_IO_URING
+	stats->uring = __atomic_load_n(&abus->uring, __ATOMIC_RELAXED) != NULL;
+#endif
+
+	return 0;
+}
+
 static int set_fd_nonblock(int fd)
 {
 	int ret, flags = fcntl(fd, F_GETFL);
@@ -249,6 +381,7 @@ int abus_set_conf(abus_t *abus, const abus_conf_t *conf)
 	/* stop A-Bus thread */
 	if (want_thread_cancel) {
 		abus_thread_stop(abus);
+		abus_close_sessions(abus);
 		set_fd_nonblock(abus->sock);
 	}
 
@@ -278,12 +411,47 @@ static void set_thread_name(const char *th_new_name) { }
 static void get_thread_name(char *th_name) { th_name[0] = '\0'; }
 #endif
 
+/*
+   Startup of the receivers of the A-Bus socket, besides the A-Bus thread.
+   Not fatal, the A-Bus thread alone serves the socket.
+ */
+static void abus_launch_receivers(abus_t *abus)
+{
+	pthread_attr_t attr;
+	unsigned nb;
+	int ret;
+
+	if (abus->conf.recv_threads <= 1)
+		return;
+
+	nb = abus->conf.recv_threads < ABUS_RECV_THREADS_MAX ?
+			abus->conf.recv_threads - 1 : ABUS_RECV_THREADS_MAX - 1;
+
+	abus->recv_threads = malloc(nb * sizeof(pthread_t));
+	if (!abus->recv_threads)
+		return;
+
+	pthread_attr_init(&attr);
+
+	for (; abus->recv_thread_nb < nb; abus->recv_thread_nb++) {
+		ret = pthread_create(&abus->recv_threads[abus->recv_thread_nb], &attr,
+						&abus_recv_thread_routine, abus);
+		if (ret) {
+			LogError("%s: pthread_create() failed: %s", __func__, strerror(ret));
+			break;
+		}
+	}
+
+	pthread_attr_destroy(&attr);
+}
+
 /*
    Lazy creation of socket and startup of A-Bus thread.
  */
 static int abus_launch_thread_ondemand(abus_t *abus)
 {
 	pthread_attr_t attr;
+	socklen_t addrlen;
 	int ret;
 
 	/* launched already ? */
@@ -291,13 +459,51 @@ static int abus_launch_thread_ondemand(abus_t *abus)
 		return 0;
 
 	abus->sock = un_sock_create();
-	if (abus->sock < 0)
-		return abus->sock;
+	if (abus->sock < 0) {
+		ret = abus->sock;
+		abus->sock = -1;
+		return ret;
+	}
+
+	/* to tell the subscriptions of this very A-Bus */
+	addrlen = sizeof(abus->sock_addr);
+	memset(&abus->sock_addr, 0, sizeof(abus->sock_addr));
+	getsockname(abus->sock, (struct sockaddr *)&abus->sock_addr, &addrlen);
+
+	abus->epfd = un_sock_epoll_create(abus->sock);
+	if (abus->epfd < 0) {
+		ret = abus->epfd;
+		un_sock_close(abus->sock);
+		abus->sock = -1;
+		return ret;
+	}
 
 	/* don't want A-Bus thread? */
 	if (abus->conf.poll_operation)
 		return 0;
 
+	/* sessions are served by the A-Bus thread only.
+	   Not fatal, clients fall back to datagrams. */
+	abus->seq_sock = un_sock_seqpacket_listen();
+	if (abus->seq_sock >= 0 &&
+			un_sock_epoll_add(abus->epfd, abus->seq_sock, EPOLLIN, abus->seq_sock) != 0) {
+		un_sock_seqpacket_close(abus->seq_sock);
+		abus->seq_sock = -1;
+	}
+	if (abus->seq_sock < 0)
+		abus->seq_sock = -1;
+
+	/* io_uring_enter() is no cancellation point */
+	abus->stop_efd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+	if (abus->stop_efd == -1 ||
+			un_sock_epoll_add(abus->epfd, abus->stop_efd, EPOLLIN, abus->stop_efd) != 0) {
+		ret = abus->stop_efd == -1 ? -errno : -EIO;
+		if (abus->stop_efd != -1)
+			close(abus->stop_efd);
+		abus->stop_efd = -1;
+		return ret;
+	}
+
 	pthread_attr_init(&attr);
 	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
 
@@ -310,6 +516,9 @@ static int abus_launch_thread_ondemand(abus_t *abus)
 	}
 
 	pthread_attr_destroy(&attr);
+	abus->srv_thread_running = true;
+
+	abus_launch_receivers(abus);
 
 	return 0;
 }
@@ -326,10 +535,25 @@ static int abus_launch_thread_ondemand(abus_t *abus)
  */
 int abus_cleanup(abus_t *abus)
 {
-	if (abus->sock != -1) {
+	if (abus->sock != -1)
 		abus_thread_stop(abus);
+
+	/* wait for the threaded methods in progress, responding on the sockets */
+	if (abus->pool) {
+		abus_pool_destroy(abus->pool);
+		abus->pool = NULL;
+	}
+	pthread_mutex_lock(&abus->mutex);
+	while (abus->detached_nb > 0)
+		pthread_cond_wait(&abus->detached_cond, &abus->mutex);
+	pthread_mutex_unlock(&abus->mutex);
+
+	if (abus->sock != -1) {
+		abus_close_sessions(abus);
+		close(abus->epfd);
 		un_sock_close(abus->sock);
 
+		abus->epfd = -1;
 		abus->sock = -1;
 	}
 
@@ -343,16 +567,8 @@ int abus_cleanup(abus_t *abus)
 			if (service->method_htab) {
 				if (hfirst(service->method_htab)) do
 				{
-					abus_method_t *method;
 					free(hkey(service->method_htab));
-					method = hstuff(service->method_htab);
-					if (method->descr)
-						free(method->descr);
-					if (method->fmt)
-						free(method->fmt);
-					if (method->result_fmt)
-						free(method->result_fmt);
-					free(method);
+					abus_method_release(hstuff(service->method_htab));
 				}
 				while (hnext(service->method_htab));
 				hdestroy(service->method_htab);
@@ -402,7 +618,7 @@ int abus_cleanup(abus_t *abus)
 
 			pthread_mutex_destroy(&service->attr_mutex);
 
-			remove_service_path(abus, (const char*)hkey(abus->service_htab));
+			remove_service_path(abus, (const char*)hkey(abus->service_htab), service->sock);
 			free(hkey(abus->service_htab));
 			free(hstuff(abus->service_htab));
 		}
@@ -410,9 +626,31 @@ int abus_cleanup(abus_t *abus)
 		hdestroy(abus->service_htab);
 	}
 
-	if (abus->outstanding_req_htab)
-		hdestroy(abus->outstanding_req_htab);
+	/* left unanswered */
+	abus_req_slots_free(abus);
+
+	if (abus->timer_fd != -1)
+		close(abus->timer_fd);
+	free(abus->timers);
+
+	/* never sent */
+	abus_corks_free(abus);
+
+	/* never run */
+	abus_local_evts_free(abus);
 
+	/* no reader left */
+	if (abus->registry)
+		abus_registry_free(abus->registry);
+
+	free(abus->svc_socks);
+
+	un_sock_addr_cache_release();
+
+	pthread_mutex_destroy(&abus->evt_mutex);
+	pthread_mutex_destroy(&abus->cork_mutex);
+	pthread_mutex_destroy(&abus->req_mutex);
+	pthread_cond_destroy(&abus->detached_cond);
 	pthread_mutex_destroy(&abus->mutex);
 
 	free(abus);
@@ -420,37 +658,251 @@ int abus_cleanup(abus_t *abus)
 	return 0;
 }
 
-static void service_may_cleanup(abus_t *abus, abus_service_t *service, const char *service_name)
+/*
+  Remove the service when empty, returning it to be retired once
+  the registry got updated. Caller must hold abus->mutex.
+ */
+static abus_service_t *service_may_cleanup(abus_t *abus, abus_service_t *service, const char *service_name)
 {
 	/* no more stuff in service? */
 	if (hcount(service->method_htab) == 0 &&
 		hcount(service->event_htab) == 0 &&
 		hcount(service->attr_htab) == 0)
 	{
-		remove_service_path(abus, service_name);
+		remove_service_path(abus, service_name, service->sock);
 
 		hdestroy(service->method_htab);
 		hdestroy(service->event_htab);
 		hdestroy(service->attr_htab);
 
 		free(hkey(abus->service_htab));
-		free(hstuff(abus->service_htab));
 
 		hdel(abus->service_htab);
+
+		return service;
 	}
+
+	return NULL;
 }
 
 static int abus_resp_send(json_rpc_t *json_rpc)
 {
+	int payload_fd, ret;
+
+	ret = json_rpc_payload_seal(json_rpc, &payload_fd);
+	if (ret)
+		return ret;
+
+	if (json_rpc->shm_chan)
+		return shm_chan_send_resp(json_rpc->shm_chan, json_rpc->msgbuf, json_rpc->msglen,
+					&payload_fd, payload_fd != -1);
+
 	return un_sock_sendto_sock(json_rpc->sock, json_rpc->msgbuf, json_rpc->msglen,
-					(struct sockaddr*)&json_rpc->sock_src_addr, json_rpc->sock_addrlen);
+					(struct sockaddr*)&json_rpc->sock_src_addr, json_rpc->sock_addrlen,
+					&payload_fd, payload_fd != -1);
+}
+
+/* batch request being served, responded to at once when all its requests are */
+struct abus_batch {
+	pthread_mutex_t mutex;
+	unsigned pending;	/* requests not responded yet, plus one while dispatching */
+	json_rpc_t *resp;	/* batch response, along with where to send it */
+};
+
+static struct abus_batch *abus_batch_init(const abus_msg_src_t *src)
+{
+	struct abus_batch *batch;
+
+	batch = calloc(1, sizeof(*batch));
+	if (!batch)
+		return NULL;
+
+	batch->resp = json_rpc_init();
+	if (!batch->resp) {
+		free(batch);
+		return NULL;
+	}
+
+	memcpy(&batch->resp->sock_src_addr, src->addr, src->addrlen);
+	batch->resp->sock_addrlen = src->addrlen;
+	batch->resp->sock = src->sock;
+	if (src->shm_chan) {
+		shm_chan_get(src->shm_chan);
+		batch->resp->shm_chan = src->shm_chan;
+	}
+	if (src->peer) {
+		un_sock_peer_get(src->peer);
+		batch->resp->peer = src->peer;
+	}
+
+	pthread_mutex_init(&batch->mutex, NULL);
+	batch->pending = 1;
+
+	return batch;
+}
+
+/*
+  Have the response of a request wait for the batch response
+ */
+static void abus_batch_get(struct abus_batch *batch, json_rpc_t *json_rpc)
+{
+	pthread_mutex_lock(&batch->mutex);
+	batch->pending++;
+	pthread_mutex_unlock(&batch->mutex);
+
+	json_rpc->batch = batch;
+}
+
+/*
+  Drop a reference, sending the batch response with the last one
+ */
+static int abus_batch_put(struct abus_batch *batch)
+{
+	json_rpc_t *resp = batch->resp;
+	int ret = 0;
+	bool last;
+
+	pthread_mutex_lock(&batch->mutex);
+	last = --batch->pending == 0;
+	pthread_mutex_unlock(&batch->mutex);
+
+	if (!last)
+		return 0;
+
+	/* nothing to respond to notifications only */
+	if (resp->msglen > 0) {
+		if (resp->msgbuf[0] == '[')
+			resp->msgbuf[resp->msglen++] = ']';
+		ret = abus_resp_send(resp);
+	}
+
+	resp->msglen = 0;
+	json_rpc_cleanup(resp);
+	pthread_mutex_destroy(&batch->mutex);
+	free(batch);
+
+	return ret;
+}
+
+/*
+  Append the response of a request to the response of its batch
+ */
+static int abus_batch_resp(json_rpc_t *json_rpc)
+{
+	struct abus_batch *batch = json_rpc->batch;
+	json_rpc_t *resp = batch->resp;
+	int ret = 0;
+
+	json_rpc->batch = NULL;
+
+	/* a batch response is a single message, payloads do not fit */
+	json_rpc_payload_release(json_rpc);
+
+	pthread_mutex_lock(&batch->mutex);
+
+	if (json_rpc->msglen > 0 && !resp->msgbuf) {
+		resp->msgbuf = malloc(JSONRPC_RESP_SZ_MAX);
+		resp->msgbufsz = JSONRPC_RESP_SZ_MAX;
+		if (!resp->msgbuf)
+			ret = -ENOMEM;
+	}
+
+	if (json_rpc->msglen > 0 && resp->msgbuf) {
+		/* room for the separator and closing bracket */
+		if (resp->msglen + json_rpc->msglen + 2 > resp->msgbufsz &&
+				json_rpc_set_error(json_rpc, JSONRPC_INTERNAL_ERROR, "Batch response too large") == 0)
+			json_rpc_resp_finalize(json_rpc);
+
+		if (resp->msglen + json_rpc->msglen + 2 <= resp->msgbufsz) {
+			resp->msgbuf[resp->msglen] = resp->msglen == 0 ? '[' : ',';
+			resp->msglen++;
+			memcpy(resp->msgbuf + resp->msglen, json_rpc->msgbuf, json_rpc->msglen);
+			resp->msglen += json_rpc->msglen;
+		} else {
+			ret = -EMSGSIZE;
+		}
+	}
+
+	pthread_mutex_unlock(&batch->mutex);
+
+	abus_batch_put(batch);
+
+	return ret;
+}
+
+/* in-process call to a method of the same A-Bus, see abus_transaction_local() */
+struct abus_local_call {
+	completion_t completion;
+	json_rpc_t *resp;	/* the request served, once responded */
+	unsigned refs;	/* the caller, until it gave up, and the request */
+};
+
+static void abus_local_call_put(struct abus_local_call *call)
+{
+	if (__atomic_sub_fetch(&call->refs, 1, __ATOMIC_ACQ_REL) > 0)
+		return;
+
+	if (call->resp)
+		json_rpc_cleanup(call->resp);
+	free(call);
+}
+
+/*
+  Send the response of a request if any, within its batch response if
+  part of a batch request, then release the request
+ */
+static int abus_rpc_done(json_rpc_t *json_rpc)
+{
+	int ret = 0;
+
+	if (json_rpc->local) {
+		struct abus_local_call *call = json_rpc->local;
+
+		/* handed over as is to the caller */
+		json_rpc->local = NULL;
+		call->resp = json_rpc;
+		completion_complete(&call->completion);
+		abus_local_call_put(call);
+		return 0;
+	}
+
+	if (json_rpc->batch)
+		ret = abus_batch_resp(json_rpc);
+	else if (json_rpc->msglen)
+		ret = abus_resp_send(json_rpc);
+
+	json_rpc->msglen = 0;
+	json_rpc_cleanup(json_rpc);
+
+	return ret;
 }
 
 
 int abus_thread_stop(abus_t *abus)
 {
+	unsigned i;
+
+	if (!abus->srv_thread_running)
+		return 0;
+
+	for (i = 0; i < abus->recv_thread_nb; i++)
+		pthread_cancel(abus->recv_threads[i]);
+	for (i = 0; i < abus->recv_thread_nb; i++)
+		pthread_join(abus->recv_threads[i], NULL);
+
+	free(abus->recv_threads);
+	abus->recv_threads = NULL;
+	abus->recv_thread_nb = 0;
+
+	/* wake a waiting io_uring loop up, to act upon the cancellation */
 	pthread_cancel(abus->srv_thread);
+	eventfd_write(abus->stop_efd, 1);
 	pthread_join(abus->srv_thread, NULL);
+	abus->srv_thread_running = false;
+
+	epoll_ctl(abus->epfd, EPOLL_CTL_DEL, abus->stop_efd, NULL);
+	close(abus->stop_efd);
+	abus->stop_efd = -1;
 
 	return 0;
 }
@@ -468,721 +920,3608 @@ static void thread_routine_free(void *arg)
 /*!
 	Get the file descriptor of A-Bus system, for use in poll()/select()
 
+  Besides the A-Bus socket, the timers of asynchronous requests and
+  the corked requests need servicing, hence an epoll file descriptor
+  gathering them all is returned.
+
   \param[in] abus pointer to an opaque handle for A-Bus operation
-  \return   socket file descriptor, might be -1 if socket not opened already (i.e. no service declared).
+  \return   file descriptor, might be -1 if socket not opened already (i.e. no service declared).
   \sa abus_process_incoming()
  */
 int abus_get_fd(abus_t *abus)
 {
-	return abus->sock;
+	if (abus->sock == -1)
+		return -1;
+
+	return abus->epfd;
 }
 
 /*!
-	Process one incoming message from A-Bus socket.
+	Process the incoming messages and expired timers of A-Bus system.
 
-  This function is suitable for poll operation, as well as internal threaded operation.
+  This function is suitable for poll operation, it blocks until
+  something is to be processed.
 
   \param abus pointer to an opaque handle for A-Bus operation
   \return   0 if successful, non nul value otherwise
-  \todo		fix memory-leak of locally allocated buffer and json_rpc upon pthread_cancel()
   \sa abus_get_fd()
  */
 int abus_process_incoming(abus_t *abus)
 {
-	struct sockaddr_un sock_src_addr;
-	socklen_t sock_addrlen = sizeof(sock_src_addr);
-	json_rpc_t *json_rpc;
-	char *buffer;
-	ssize_t len;
+	struct epoll_event events[ABUS_EPOLL_EVENTS];
+	int n;
 
 	if (abus->sock == -1)
-		return -EPIPE;
+		return abus_process_sock(abus, abus->sock, 0);
 
-	if (abus->incoming_buffer) {
-		buffer = abus->incoming_buffer;
-	} else {
-		buffer = malloc(JSONRPC_REQ_SZ_MAX);
-		if (!buffer)
-			return -ENOMEM;
-	}
+	do {
+		n = epoll_wait(abus->epfd, events, ABUS_EPOLL_EVENTS, -1);
+	} while (n == -1 && errno == EINTR);
+	if (n == -1)
+		return -errno;
 
-	len = un_sock_recvfrom(abus->sock, buffer, JSONRPC_REQ_SZ_MAX,
-					(struct sockaddr*)&sock_src_addr,
-					&sock_addrlen);
-	if (len < 0) {
-		if (!abus->incoming_buffer)
-			free(buffer);
-		return len;
+	return abus_process_events(abus, events, n);
+}
+
+static const char *json_skip_ws(const char *p, const char *end)
+{
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+		p++;
+	return p;
+}
+
+/*
+  End of the JSON object starting at p, NULL if truncated.
+  Only nesting and strings matter, the object gets parsed afterwards anyway
+ */
+static const char *json_object_end(const char *p, const char *end)
+{
+	bool in_str = false;
+	int depth = 0;
+
+	for (; p < end; p++) {
+		if (in_str) {
+			if (*p == '\\')
+				p++;
+			else if (*p == '"')
+				in_str = false;
+		} else if (*p == '"') {
+			in_str = true;
+		} else if (*p == '{' || *p == '[') {
+			depth++;
+		} else if ((*p == '}' || *p == ']') && --depth == 0) {
+			return p+1;
+		}
 	}
 
-	json_rpc = abus_process_msg(abus, buffer, len, (const struct sockaddr *)&sock_src_addr, sock_addrlen);
+	return NULL;
+}
 
-	if (!abus->incoming_buffer)
-		free(buffer);
+/*
+  End of the JSON value starting at p, NULL if truncated or not a value
+ */
+static const char *json_value_end(const char *p, const char *end)
+{
+	const char *start = p;
 
-	/* json_rpc==NULL may not mean failure
-	   TODO: where to look at instead?
-	 */
+	if (p >= end)
+		return NULL;
 
-	if (json_rpc && !abus_method_is_threaded((abus_method_t*)json_rpc->cb_context)) {
-		if (json_rpc->msglen)
-			abus_resp_send(json_rpc);
+	if (*p == '{' || *p == '[')
+		return json_object_end(p, end);
 
-		json_rpc_cleanup(json_rpc);
+	if (*p == '"') {
+		for (p++; p < end; p++) {
+			if (*p == '\\')
+				p++;
+			else if (*p == '"')
+				return p+1;
+		}
+		return NULL;
 	}
 
-	return 0;
+	/* number, true, false or null */
+	while (p < end && *p != ',' && *p != ']' && *p != '}' &&
+			*p != ' ' && *p != '\t' && *p != '\n' && *p != '\r')
+		p++;
+
+	return p > start ? p : NULL;
 }
 
 /*
- \internal
+  Answer an element of a batch which is not a request object
  */
-void *abus_thread_routine(void *arg)
+static void abus_batch_invalid(struct abus_batch *batch)
 {
-	abus_t *abus = (abus_t *)arg;
-	char *buffer;
+	json_rpc_t *json_rpc;
 
-	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+	json_rpc = json_rpc_init();
+	if (!json_rpc)
+		return;
 
-	buffer = malloc(JSONRPC_REQ_SZ_MAX);
-	if (!buffer) {
-		LogError("%s: allocation failed: %s", __func__, strerror(errno));
-		pthread_exit(NULL);
-	}
+	abus_batch_get(batch, json_rpc);
 
-	/* NB: limited to 16 bytes according to prctl(2) */
-	memset(buffer, 0, 17);
-	strcpy(buffer, "abus:");
-	get_thread_name(buffer+5);
-	set_thread_name(buffer);
+	json_rpc_resp_init(json_rpc);
+	json_rpc_set_error(json_rpc, JSONRPC_INVALID_REQUEST, NULL);
+	if (json_rpc_resp_finalize(json_rpc) != 0)
+		json_rpc->msglen = 0;
 
-	pthread_cleanup_push(thread_routine_free, &abus->incoming_buffer);
+	abus_rpc_done(json_rpc);
+}
 
-	abus->incoming_buffer = buffer;
+static void abus_dispatch_msg(abus_t *abus, const char *buffer, int len, const abus_msg_src_t *src);
 
-	while ((volatile int)abus->conf.poll_operation == false) {
+/*
+  Process each request of a JSON-RPC batch, as well as each response of
+  a batch response. The responses of the requests go in one batch response.
+ */
+static void abus_dispatch_batch(abus_t *abus, const char *buffer, int len, const abus_msg_src_t *src)
+{
+	const char *p, *elem_end, *end = buffer + len;
+	abus_msg_src_t elem_src = *src;
+	struct abus_batch *batch;
+	int i, n = 0;
+
+	/* nobody could tell which request they go along with */
+	for (i = 0; i < src->fd_count; i++)
+		close(src->fds[i]);
+	elem_src.fds = NULL;
+	elem_src.fd_count = 0;
+
+	batch = abus_batch_init(src);
+	if (!batch)
+		return;
+	elem_src.batch = batch;
 
-		if (abus_process_incoming(abus) < 0)
+	p = json_skip_ws(buffer, end) + 1;
+
+	for (;;) {
+		p = json_skip_ws(p, end);
+		if (p >= end || *p == ']' || (elem_end = json_value_end(p, end)) == NULL)
 			break;
+
+		/* one Invalid Request per element not being an object */
+		if (*p == '{')
+			abus_dispatch_msg(abus, p, elem_end - p, &elem_src);
+		else
+			abus_batch_invalid(batch);
+		n++;
+
+		p = json_skip_ws(elem_end, end);
+		if (p < end && *p == ',')
+			p++;
 	}
 
-	pthread_cleanup_pop(1);
+	/* a single error for an empty or broken batch */
+	if (n == 0) {
+		json_rpc_resp_init(batch->resp);
+		json_rpc_set_error(batch->resp, (p < end && *p == ']') ?
+						JSONRPC_INVALID_REQUEST : JSONRPC_PARSE_ERROR, NULL);
+		json_rpc_resp_finalize(batch->resp);
+	}
 
-	return NULL;
+	abus_batch_put(batch);
+}
+
+/*
+  Process one received message, and send back the response, if any
+ */
+static void abus_dispatch_msg(abus_t *abus, const char *buffer, int len, const abus_msg_src_t *src)
+{
+	json_rpc_t *json_rpc;
+
+	/* keeps the methods looked up alive, even if undeclared meanwhile */
+	epoch_enter();
+
+	if (!src->batch && len > 0 && *json_skip_ws(buffer, buffer + len) == '[') {
+		abus_dispatch_batch(abus, buffer, len, src);
+		epoch_exit();
+		return;
+	}
+
+	json_rpc = abus_process_msg(abus, buffer, len, src);
+
+	/* json_rpc==NULL may not mean failure
+	   TODO: where to look at instead?
+	 */
+
+	if (json_rpc && !abus_method_is_threaded((abus_method_t*)json_rpc->cb_context)) {
+#ifdef HAVE_IO_URING
+		/* batched with the next wait of the A-Bus thread. Not for sessions,
+		   whose fd may get closed and reused before the submission. */
+		if (json_rpc->msglen && pthread_equal(pthread_self(), abus->srv_thread) &&
+				abus->uring && json_rpc->sock == abus->sock &&
+				!json_rpc->shm_chan && !json_rpc->payload && !json_rpc->batch &&
+				abus_uring_resp_send(abus, json_rpc) == 0)
+			json_rpc->msglen = 0;
+#endif
+		abus_rpc_done(json_rpc);
+	}
+
+	epoch_exit();
+}
+
+/*
+ \internal
+  Process one message received on the A-Bus socket, or on a service socket
+  in abstract mode. Responses go through the A-Bus socket.
+ */
+static int abus_process_sock(abus_t *abus, int sock, int flags)
+{
+	struct sockaddr_un sock_src_addr;
+	socklen_t sock_addrlen = sizeof(sock_src_addr);
+	abus_msg_src_t src;
+	int fds[UN_SOCK_FDS_MAX];
+	int nfds = 0;
+	char *buffer;
+	ssize_t len;
+
+	if (abus->sock == -1)
+		return -EPIPE;
+
+	if (abus->incoming_buffer) {
+		buffer = abus->incoming_buffer;
+	} else {
+		buffer = malloc(JSONRPC_REQ_SZ_MAX);
+		if (!buffer)
+			return -ENOMEM;
+	}
+
+	len = un_sock_recvmsg(sock, buffer, JSONRPC_REQ_SZ_MAX, flags,
+					(struct sockaddr*)&sock_src_addr,
+					&sock_addrlen, fds, &nfds);
+	if (len < 0) {
+		if (!abus->incoming_buffer)
+			free(buffer);
+		return len;
+	}
+
+	src.sock = abus->sock;
+	src.shm_chan = NULL;
+	src.peer = NULL;
+	src.addr = (const struct sockaddr *)&sock_src_addr;
+	src.addrlen = sock_addrlen;
+	src.batch = NULL;
+	src.fds = fds;
+	src.fd_count = nfds;
+
+	abus_dispatch_msg(abus, buffer, len, &src);
+
+	if (!abus->incoming_buffer)
+		free(buffer);
+
+	return 0;
+}
+
+#ifdef HAVE_RECVMMSG
+
+struct abus_rx_batch {
+	unsigned count;
+	struct mmsghdr *msgs;
+	struct iovec *iov;
+	struct sockaddr_un *addrs;
+	char *controls;
+	char *buffers;
+};
+
+static void abus_rx_batch_free(void *arg)
+{
+	struct abus_rx_batch **p = (struct abus_rx_batch **)arg;
+	struct abus_rx_batch *rx_batch = *p;
+
+	if (!rx_batch)
+		return;
+
+	free(rx_batch->msgs);
+	free(rx_batch->iov);
+	free(rx_batch->addrs);
+	free(rx_batch->controls);
+	free(rx_batch->buffers);
+	free(rx_batch);
+	*p = NULL;
+}
+
+static struct abus_rx_batch *abus_rx_batch_alloc(unsigned count)
+{
+	struct abus_rx_batch *rx_batch;
+	unsigned i;
+
+	rx_batch = calloc(1, sizeof(*rx_batch));
+	if (!rx_batch)
+		return NULL;
+
+	rx_batch->count = count;
+	rx_batch->msgs = calloc(count, sizeof(struct mmsghdr));
+	rx_batch->iov = calloc(count, sizeof(struct iovec));
+	rx_batch->addrs = calloc(count, sizeof(struct sockaddr_un));
+	rx_batch->controls = calloc(count, UN_SOCK_CONTROL_SZ);
+	rx_batch->buffers = malloc(count * JSONRPC_REQ_SZ_MAX);
+
+	if (!rx_batch->msgs || !rx_batch->iov || !rx_batch->addrs || !rx_batch->controls || !rx_batch->buffers) {
+		abus_rx_batch_free(&rx_batch);
+		return NULL;
+	}
+
+	for (i = 0; i < count; i++) {
+		rx_batch->iov[i].iov_base = rx_batch->buffers + i*JSONRPC_REQ_SZ_MAX;
+		rx_batch->iov[i].iov_len = JSONRPC_REQ_SZ_MAX;
+		rx_batch->msgs[i].msg_hdr.msg_iov = &rx_batch->iov[i];
+		rx_batch->msgs[i].msg_hdr.msg_iovlen = 1;
+		rx_batch->msgs[i].msg_hdr.msg_name = &rx_batch->addrs[i];
+		rx_batch->msgs[i].msg_hdr.msg_control = rx_batch->controls + i*UN_SOCK_CONTROL_SZ;
+	}
+
+	return rx_batch;
+}
+
+/*
+ \internal
+  Receive a batch of messages, and process them in arrival order.
+  Returns the number of messages processed, or -errno.
+ */
+static int abus_process_batch(abus_t *abus, int sock, int flags)
+{
+	struct abus_rx_batch *rx_batch = abus->rx_batch;
+	struct msghdr *msg_hdr;
+	abus_msg_src_t src;
+	int fds[UN_SOCK_FDS_MAX];
+	unsigned i;
+	int n;
+
+	if (abus->sock == -1)
+		return -EPIPE;
+
+	for (i = 0; i < rx_batch->count; i++)
+		rx_batch->msgs[i].msg_hdr.msg_controllen = UN_SOCK_CONTROL_SZ;
+
+	n = un_sock_recvmmsg(sock, rx_batch->msgs, rx_batch->count, flags);
+	if (n < 0)
+		return n;
+
+	src.sock = abus->sock;
+	src.shm_chan = NULL;
+	src.peer = NULL;
+	src.batch = NULL;
+	src.fds = fds;
+
+	for (i = 0; i < (unsigned)n; i++) {
+		msg_hdr = &rx_batch->msgs[i].msg_hdr;
+
+		src.addr = (const struct sockaddr *)&rx_batch->addrs[i];
+		src.addrlen = msg_hdr->msg_namelen;
+		src.fd_count = msg_hdr->msg_controllen ? un_sock_msg_fds(msg_hdr, fds, UN_SOCK_FDS_MAX) : 0;
+
+		abus_dispatch_msg(abus, rx_batch->iov[i].iov_base, rx_batch->msgs[i].msg_len, &src);
+	}
+
+	return n;
+}
+#endif
+
+/*
+  Accept pending SOCK_SEQPACKET sessions, and add them to the wait set
+ */
+static int abus_accept_sessions(abus_t *abus)
+{
+	int sock, ret;
+
+	un_sock_peer_t *peer;
+
+	while ((sock = accept4(abus->seq_sock, NULL, NULL, SOCK_CLOEXEC|SOCK_NONBLOCK)) != -1) {
+		if (abus->session_nb == abus->session_sz) {
+			unsigned sz = abus->session_sz ? 2*abus->session_sz : 8;
+			un_sock_peer_t **sessions = realloc(abus->sessions, sz * sizeof(*sessions));
+
+			if (!sessions) {
+				close(sock);
+				return -ENOMEM;
+			}
+			abus->sessions = sessions;
+			abus->session_sz = sz;
+		}
+
+		peer = un_sock_peer_new(sock);
+		if (!peer) {
+			close(sock);
+			return -ENOMEM;
+		}
+
+		ret = un_sock_epoll_add(abus->epfd, sock, EPOLLIN, sock);
+		if (ret) {
+			un_sock_peer_put(peer);
+			return ret;
+		}
+		abus->sessions[abus->session_nb++] = peer;
+	}
+
+	if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED)
+		return 0;
+
+	return -errno;
+}
+
+static void abus_close_session(abus_t *abus, unsigned idx)
+{
+	un_sock_peer_t *peer = abus->sessions[idx];
+
+	/* pending responses may still hold a reference, hence the explicit removal */
+	epoll_ctl(abus->epfd, EPOLL_CTL_DEL, peer->sock, NULL);
+	un_sock_peer_put(peer);
+
+	abus->sessions[idx] = abus->sessions[--abus->session_nb];
+}
+
+static void abus_close_shm_chan(abus_t *abus, unsigned idx)
+{
+	shm_chan_t *chan = abus->shm_chans[idx];
+
+	shm_chan_close(chan);
+
+	/* threaded methods may still hold a reference, hence the explicit removal */
+	epoll_ctl(abus->epfd, EPOLL_CTL_DEL, chan->req_efd, NULL);
+	epoll_ctl(abus->epfd, EPOLL_CTL_DEL, chan->hup_fd, NULL);
+	shm_chan_put(chan);
+
+	abus->shm_chans[idx] = abus->shm_chans[--abus->shm_chan_nb];
+}
+
+/*
+  Stop listening for sessions, and close the accepted ones
+  as well as the shared memory channels.
+  Only to be called when the A-Bus thread is not running.
+ */
+static void abus_close_sessions(abus_t *abus)
+{
+	while (abus->shm_chan_nb > 0)
+		abus_close_shm_chan(abus, abus->shm_chan_nb-1);
+	free(abus->shm_chans);
+	abus->shm_chans = NULL;
+	abus->shm_chan_sz = 0;
+
+	if (abus->seq_sock == -1)
+		return;
+
+	un_sock_seqpacket_close(abus->seq_sock);
+	abus->seq_sock = -1;
+
+	while (abus->session_nb > 0)
+		abus_close_session(abus, abus->session_nb-1);
+	free(abus->sessions);
+	abus->sessions = NULL;
+	abus->session_nb = abus->session_sz = 0;
+}
+
+/*
+ \internal
+  Process the messages pending on a session. Responses are sent back
+  on the session, hence the empty source address. The requests hold
+  a reference to the session, so that a late response of a threaded
+  method does not end up on a reused descriptor.
+ */
+static int abus_process_session(abus_t *abus, int sock)
+{
+	struct sockaddr_un sock_src_addr;
+	abus_msg_src_t src;
+	unsigned i;
+	ssize_t len;
+
+	/* stale event, closed earlier in the same wake-up */
+	for (i = 0; i < abus->session_nb; i++) {
+		if (abus->sessions[i]->sock == sock)
+			break;
+	}
+	if (i == abus->session_nb)
+		return 0;
+
+	memset(&sock_src_addr, 0, sizeof(sock_src_addr));
+
+	src.sock = sock;
+	src.shm_chan = NULL;
+	src.peer = abus->sessions[i];
+	src.addr = (const struct sockaddr *)&sock_src_addr;
+	src.addrlen = 0;
+	src.batch = NULL;
+	src.fds = NULL;
+	src.fd_count = 0;
+
+	while ((len = recv(sock, abus->incoming_buffer, JSONRPC_REQ_SZ_MAX, MSG_DONTWAIT)) > 0) {
+		if (abus_msg_verbose)
+			LogDebug("## %5d <- session %d:%d %.*s", getpid(), sock, (int)len,
+							(int)len, abus->incoming_buffer);
+
+		abus_dispatch_msg(abus, abus->incoming_buffer, len, &src);
+	}
+
+	/* peer gone */
+	if (len == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+		abus_close_session(abus, i);
+
+	return 0;
+}
+
+/*
+ \internal
+  Process the requests pending in a shared memory channel,
+  straight from the ring. Responses go back through the channel.
+ */
+static int abus_process_shm_chan(abus_t *abus, unsigned idx)
+{
+	shm_chan_t *chan = abus->shm_chans[idx];
+	struct sockaddr_un sock_src_addr;
+	abus_msg_src_t src;
+	const char *buffer;
+	uint64_t cnt;
+	int len;
+
+	if (read(chan->req_efd, &cnt, sizeof(cnt)) == -1 && errno != EAGAIN)
+		return -errno;
+
+	memset(&sock_src_addr, 0, sizeof(sock_src_addr));
+
+	src.sock = abus->sock;
+	src.shm_chan = chan;
+	src.peer = NULL;
+	src.addr = (const struct sockaddr *)&sock_src_addr;
+	src.addrlen = 0;
+	src.batch = NULL;
+	src.fds = NULL;
+	src.fd_count = 0;
+
+	while ((len = shm_ring_peek(&chan->req, &buffer)) > 0) {
+		if (abus_msg_verbose)
+			LogDebug("## %5d <- shm %d:%d %.*s", getpid(), chan->req_efd, len, len, buffer);
+
+		abus_dispatch_msg(abus, buffer, len, &src);
+		shm_ring_consume(&chan->req);
+	}
+
+	/* corrupted ring */
+	if (len < 0) {
+		LogError("%s: dropping channel: %s", __func__, strerror(-len));
+		abus_close_shm_chan(abus, idx);
+	}
+
+	return 0;
+}
+
+/*
+  Dispatch a wake-up of the A-Bus thread on a shared memory channel.
+  Returns 1 when fd does not belong to any.
+ */
+static int abus_process_shm_event(abus_t *abus, int fd)
+{
+	unsigned i;
+
+	for (i = 0; i < abus->shm_chan_nb; i++) {
+		if (fd == abus->shm_chans[i]->req_efd)
+			return abus_process_shm_chan(abus, i);
+
+		if (fd == abus->shm_chans[i]->hup_fd) {
+			/* client gone, unless requests are still pending */
+			abus_process_shm_chan(abus, i);
+			if (i < abus->shm_chan_nb && fd == abus->shm_chans[i]->hup_fd)
+				abus_close_shm_chan(abus, i);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/*
+  Tell whether fd is the socket of a service, in abstract mode
+ */
+static bool abus_is_svc_sock(abus_t *abus, int fd)
+{
+	bool found = false;
+	unsigned i;
+
+	pthread_mutex_lock(&abus->mutex);
+	for (i = 0; i < abus->svc_sock_nb && !found; i++)
+		found = abus->svc_socks[i] == fd;
+	pthread_mutex_unlock(&abus->mutex);
+
+	return found;
+}
+
+/*
+  Serve what the wait set reported, returns -errno on fatal error
+ */
+static int abus_process_events(abus_t *abus, const struct epoll_event *events, int n)
+{
+	int i, ret = 0;
+
+	for (i = 0; i < n && ret == 0; i++) {
+		int sock = events[i].data.fd;
+
+		if (sock == abus->seq_sock) {
+			ret = abus_accept_sessions(abus);
+			continue;
+		}
+		if (sock == abus->timer_fd) {
+			ret = abus_process_timers(abus);
+			continue;
+		}
+		if (sock == abus->cork_fd) {
+			ret = abus_process_corks(abus);
+			continue;
+		}
+		if (sock == abus->evt_fd) {
+			ret = abus_process_local_evts(abus);
+			continue;
+		}
+		if (sock == abus->stop_efd) {
+			pthread_testcancel();
+			continue;
+		}
+		if (sock != abus->sock && !abus_is_svc_sock(abus, sock)) {
+			ret = abus_process_shm_event(abus, events[i].data.fd);
+			if (ret == 1)
+				ret = abus_process_session(abus, events[i].data.fd);
+			continue;
+		}
+#ifdef HAVE_RECVMMSG
+		if (abus->rx_batch) {
+			/* drain the socket, a short batch meaning it got empty */
+			do {
+				ret = abus_process_batch(abus, sock, MSG_DONTWAIT);
+			} while (ret == (int)abus->rx_batch->count);
+
+			if (ret > 0)
+				ret = 0;
+		} else
+#endif
+		{
+			/* drain the socket, saving a wait per message under load */
+			do {
+				ret = abus_process_sock(abus, sock, MSG_DONTWAIT);
+			} while (ret == 0);
+		}
+
+		if (ret == -EAGAIN || ret == -EWOULDBLOCK)
+			ret = 0;
+	}
+
+	return ret;
+}
+
+#ifdef HAVE_IO_URING
+/* response in flight, until its completion */
+struct abus_uring_send {
+	struct abus_uring_send *prev, *next;
+	struct msghdr msg;
+	struct iovec iov;
+	struct sockaddr_un addr;
+	char buf[];
+};
+
+struct abus_uring {
+	uring_t ring;
+	struct abus_uring_send *sends;
+};
+
+static int abus_uring_resp_send(abus_t *abus, json_rpc_t *json_rpc)
+{
+	struct abus_uring *au = abus->uring;
+	struct abus_uring_send *send;
+	int ret;
+
+	send = malloc(sizeof(*send) + json_rpc->msglen);
+	if (!send)
+		return -ENOMEM;
+
+	memcpy(send->buf, json_rpc->msgbuf, json_rpc->msglen);
+	send->iov.iov_base = send->buf;
+	send->iov.iov_len = json_rpc->msglen;
+
+	memset(&send->msg, 0, sizeof(send->msg));
+	send->msg.msg_iov = &send->iov;
+	send->msg.msg_iovlen = 1;
+	memcpy(&send->addr, &json_rpc->sock_src_addr, json_rpc->sock_addrlen);
+	send->msg.msg_name = &send->addr;
+	send->msg.msg_namelen = json_rpc->sock_addrlen;
+
+	/* submission queue full: caller sends right away */
+	ret = uring_prep_sendmsg(&au->ring, json_rpc->sock, &send->msg, (uintptr_t)send);
+	if (ret) {
+		free(send);
+		return ret;
+	}
+
+	send->prev = NULL;
+	send->next = au->sends;
+	if (au->sends)
+		au->sends->prev = send;
+	au->sends = send;
+
+	return 0;
+}
+
+/*
+  Re-arm a multishot request, making room in the submission queue if needed
+ */
+static int abus_uring_rearm(abus_t *abus, int (*prep)(uring_t *, int, uint64_t), int fd, uint64_t user_data)
+{
+	int ret;
+
+	ret = prep(&abus->uring->ring, fd, user_data);
+	if (ret == -EBUSY) {
+		uring_submit_and_wait(&abus->uring->ring, 0);
+		ret = prep(&abus->uring->ring, fd, user_data);
+	}
+
+	return ret;
+}
+
+static void abus_uring_process_msg(abus_t *abus, const struct io_uring_cqe *cqe)
+{
+	uring_msg_t msg;
+	abus_msg_src_t src;
+	int fds[UN_SOCK_FDS_MAX];
+
+	if (uring_recvmsg_parse(&abus->uring->ring, cqe, &msg) != 0)
+		return;
+
+	src.sock = abus->sock;
+	src.shm_chan = NULL;
+	src.peer = NULL;
+	src.addr = msg.addr;
+	src.addrlen = msg.addrlen;
+	src.batch = NULL;
+	src.fds = fds;
+	src.fd_count = msg.ctl.msg_controllen ? un_sock_msg_fds(&msg.ctl, fds, UN_SOCK_FDS_MAX) : 0;
+
+	abus_dispatch_msg(abus, msg.payload, msg.payload_len, &src);
+}
+
+/*
+  Handle one completion, returns -errno if the loop cannot go on
+ */
+static int abus_uring_complete(abus_t *abus, const struct io_uring_cqe *cqe)
+{
+	struct abus_uring *au = abus->uring;
+	struct abus_uring_send *send;
+	struct epoll_event events[ABUS_EPOLL_EVENTS];
+	int n, ret = 0;
+
+	switch (cqe->user_data) {
+	case ABUS_URING_RECV:
+		if (cqe->res >= 0) {
+			abus_uring_process_msg(abus, cqe);
+			uring_buf_recycle(&au->ring, cqe);
+		} else if (cqe->res != -ENOBUFS) {
+			LogError("%s: io_uring receive failed: %s", __func__, strerror(-cqe->res));
+			return cqe->res;
+		}
+		/* ran out of buffers, or terminated */
+		if (!(cqe->flags & IORING_CQE_F_MORE))
+			ret = abus_uring_rearm(abus, uring_prep_recv_multishot, abus->sock, ABUS_URING_RECV);
+		break;
+
+	case ABUS_URING_POLL:
+		if (cqe->res < 0) {
+			LogError("%s: io_uring poll failed: %s", __func__, strerror(-cqe->res));
+			return cqe->res;
+		}
+		n = epoll_wait(abus->epfd, events, ABUS_EPOLL_EVENTS, 0);
+		if (n > 0)
+			ret = abus_process_events(abus, events, n);
+		if (ret >= 0 && !(cqe->flags & IORING_CQE_F_MORE))
+			ret = abus_uring_rearm(abus, uring_prep_poll_multishot, abus->epfd, ABUS_URING_POLL);
+		break;
+
+	default:
+		/* response sent, errors ignored as by un_sock_sendto_sock() callers */
+		send = (struct abus_uring_send *)(uintptr_t)cqe->user_data;
+		if (send->prev)
+			send->prev->next = send->next;
+		else
+			au->sends = send->next;
+		if (send->next)
+			send->next->prev = send->prev;
+		free(send);
+		break;
+	}
+
+	return ret < 0 ? ret : 0;
+}
+
+static void abus_uring_cleanup(void *arg)
+{
+	abus_t *abus = (abus_t *)arg;
+	struct abus_uring *au = abus->uring;
+	struct abus_uring_send *send;
+
+	abus->uring = NULL;
+
+	/* cancels the requests in flight */
+	uring_exit(&au->ring);
+
+	while ((send = au->sends) != NULL) {
+		au->sends = send->next;
+		free(send);
+	}
+	free(au);
+
+	/* back into the wait set, for the epoll loop or poll mode */
+	un_sock_epoll_add(abus->epfd, abus->sock, EPOLLIN, abus->sock);
+}
+
+/*
+  A-Bus thread loop on io_uring: multishot receive on the A-Bus socket,
+  responses submitted along with the next wait, and a multishot poll
+  of the wait set for the rest (sessions, shm channels, ...).
+  Returns when io_uring is not usable, for the epoll loop to take over.
+ */
+static int abus_uring_loop(abus_t *abus)
+{
+	struct abus_uring *au;
+	struct io_uring_cqe *cqe;
+	int ret;
+
+	au = calloc(1, sizeof(*au));
+	if (!au)
+		return -ENOMEM;
+
+	ret = uring_init(&au->ring, ABUS_URING_ENTRIES, ABUS_URING_BUFS,
+					sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_un) +
+					UN_SOCK_CONTROL_SZ + JSONRPC_REQ_SZ_MAX,
+					sizeof(struct sockaddr_un), UN_SOCK_CONTROL_SZ);
+	if (ret) {
+		free(au);
+		return ret;
+	}
+
+	epoll_ctl(abus->epfd, EPOLL_CTL_DEL, abus->sock, NULL);
+	abus->uring = au;
+
+	pthread_cleanup_push(abus_uring_cleanup, abus);
+
+	ret = uring_prep_recv_multishot(&au->ring, abus->sock, ABUS_URING_RECV);
+	if (ret == 0)
+		ret = uring_prep_poll_multishot(&au->ring, abus->epfd, ABUS_URING_POLL);
+
+	while (ret == 0 && (volatile int)abus->conf.poll_operation == false) {
+		/* unlike epoll_wait(), io_uring_enter() is no cancellation point,
+		   abus_thread_stop() wakes it up through stop_efd */
+		ret = uring_submit_and_wait(&au->ring, 1);
+
+		if (ret == -EINTR) {
+			ret = 0;
+			continue;
+		}
+		/* EBUSY: completions to be reaped first */
+		if (ret < 0 && ret != -EBUSY) {
+			LogError("%s: io_uring_enter failed: %s", __func__, strerror(-ret));
+			break;
+		}
+		ret = 0;
+
+		while (ret == 0 && (cqe = uring_peek_cqe(&au->ring)) != NULL) {
+			ret = abus_uring_complete(abus, cqe);
+			uring_cqe_seen(&au->ring);
+		}
+	}
+
+	pthread_cleanup_pop(1);
+
+	return ret;
+}
+#endif /* HAVE_IO_URING */
+
+/*
+ \internal
+ */
+void *abus_thread_routine(void *arg)
+{
+	abus_t *abus = (abus_t *)arg;
+	char *buffer;
+
+	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+
+	buffer = malloc(JSONRPC_REQ_SZ_MAX);
+	if (!buffer) {
+		LogError("%s: allocation failed: %s", __func__, strerror(errno));
+		pthread_exit(NULL);
+	}
+
+	/* NB: limited to 16 bytes according to prctl(2) */
+	memset(buffer, 0, 17);
+	strcpy(buffer, "abus:");
+	get_thread_name(buffer+5);
+	set_thread_name(buffer);
+
+	pthread_cleanup_push(thread_routine_free, &abus->incoming_buffer);
+
+	abus->incoming_buffer = buffer;
+
+#ifdef HAVE_RECVMMSG
+	pthread_cleanup_push(abus_rx_batch_free, &abus->rx_batch);
+
+	if (abus->conf.recv_batch > 1)
+		abus->rx_batch = abus_rx_batch_alloc(abus->conf.recv_batch < ABUS_RECV_BATCH_MAX ?
+					abus->conf.recv_batch : ABUS_RECV_BATCH_MAX);
+#endif
+
+#ifdef HAVE_IO_URING
+	/* falls back to epoll if io_uring is not available */
+	if (!abus_msg_verbose)
+		abus_uring_loop(abus);
+#endif
+
+	while ((volatile int)abus->conf.poll_operation == false) {
+		struct epoll_event events[ABUS_EPOLL_EVENTS];
+		int n;
+
+		n = epoll_wait(abus->epfd, events, ABUS_EPOLL_EVENTS, -1);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n == -1) {
+			LogError("%s: epoll_wait failed: %s", __func__, strerror(errno));
+			break;
+		}
+
+		if (abus_process_events(abus, events, n) < 0)
+			break;
+	}
+
+#ifdef HAVE_RECVMMSG
+	pthread_cleanup_pop(1);
+#endif
+	pthread_cleanup_pop(1);
+
+	return NULL;
+}
+
+/*
+ \internal
+  Additional receiver of the A-Bus socket. Sessions, shared memory
+  channels and service sockets in abstract mode stay with the A-Bus thread.
+ */
+void *abus_recv_thread_routine(void *arg)
+{
+	abus_t *abus = (abus_t *)arg;
+	struct sockaddr_un sock_src_addr;
+	socklen_t sock_addrlen;
+	abus_msg_src_t src;
+	int fds[UN_SOCK_FDS_MAX];
+	int nfds = 0;
+	char *buffer;
+	ssize_t len;
+
+	buffer = malloc(JSONRPC_REQ_SZ_MAX);
+	if (!buffer) {
+		LogError("%s: allocation failed: %s", __func__, strerror(errno));
+		return NULL;
+	}
+
+	set_thread_name("abus:rx");
+
+	pthread_cleanup_push(free, buffer);
+
+	src.sock = abus->sock;
+	src.shm_chan = NULL;
+	src.peer = NULL;
+	src.addr = (const struct sockaddr *)&sock_src_addr;
+	src.batch = NULL;
+	src.fds = fds;
+
+	for (;;) {
+		/* cancelled while waiting, never in the middle of a callback.
+		   One waiter woken per datagram, unlike with poll() */
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+
+		sock_addrlen = sizeof(sock_src_addr);
+		len = un_sock_recvmsg(abus->sock, buffer, JSONRPC_REQ_SZ_MAX, 0,
+						(struct sockaddr*)&sock_src_addr,
+						&sock_addrlen, fds, &nfds);
+
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+		if (len == -EINTR || len == -EAGAIN || len == -EWOULDBLOCK)
+			continue;
+		if (len < 0) {
+			LogError("%s: receive failed: %s", __func__, strerror(-len));
+			break;
+		}
+
+		src.addrlen = sock_addrlen;
+		src.fd_count = nfds;
+
+		abus_dispatch_msg(abus, buffer, len, &src);
+	}
+
+	pthread_cleanup_pop(1);
+
+	return NULL;
 }
 
 static void abus_service_path(const abus_t *abus, const char *service_name, char *service_path)
 {
-	/* TODO: prefix from env variable */
-	snprintf(service_path, UNIX_PATH_MAX-1, "%s/%s", abus_prefix, service_name);
+	/* TODO: prefix from env variable */
+	snprintf(service_path, UNIX_PATH_MAX-1, "%s/%s", abus_prefix, service_name);
+}
+
+/*
+  In abstract mode, the service gets a socket of its own, bound to its name.
+  Caller must hold abus->mutex.
+ */
+static int create_service_sock(abus_t *abus, const char *service_name)
+{
+	int sock, ret;
+
+	if (abus->svc_sock_nb == abus->svc_sock_sz) {
+		unsigned sz = abus->svc_sock_sz ? 2*abus->svc_sock_sz : 4;
+		int *svc_socks = realloc(abus->svc_socks, sz * sizeof(int));
+
+		if (!svc_socks)
+			return -ENOMEM;
+		abus->svc_socks = svc_socks;
+		abus->svc_sock_sz = sz;
+	}
+
+	sock = un_sock_create_svc(service_name);
+	if (sock < 0)
+		return sock;
+
+	ret = un_sock_epoll_add(abus->epfd, sock, EPOLLIN, sock);
+	if (ret) {
+		close(sock);
+		return ret;
+	}
+	abus->svc_socks[abus->svc_sock_nb++] = sock;
+
+	return sock;
+}
+
+/*
+  NB: '/' (slash) is forbidden in service_name
+ */
+static int create_service_path(abus_t *abus, const char *service_name, int *svc_sock)
+{
+	char service_path[UNIX_PATH_MAX];
+	char pid_rel_path[UNIX_PATH_MAX];
+	int ret;
+
+	*svc_sock = -1;
+
+	if (strchr(service_name, '/'))
+		return -EINVAL;
+
+	ret = abus_launch_thread_ondemand(abus);
+	if (ret)
+		return ret;
+
+	if (abus_abstract) {
+		if (strlen(service_name) == 0)
+			return 0;
+		ret = create_service_sock(abus, service_name);
+		if (ret < 0)
+			return ret;
+		*svc_sock = ret;
+		return 0;
+	}
+
+	snprintf(pid_rel_path, sizeof(pid_rel_path)-1, "_%d", getpid());
+
+	if (strlen(service_name) > 0) {
+
+		abus_service_path(abus, service_name, service_path);
+#if 0
+		struct stat svcstat;
+
+		ret = stat(service_path, &svcstat);
+		if (ret == 0) {
+			char str[32];
+			/* FIXME don't use abus_attr_get_str() because
+			   it's not using the AF_UNIX socket
+			 */
+			if (abus_attr_get_str(abus, service_name, "abus.version",
+										str, sizeof(str), 200) == 0)
+				return -EEXIST;
+		}
+#endif
+		unlink(service_path);
+	
+		/* /tmp/abus/<servicename> -> _<pid> */
+		ret = symlink(pid_rel_path, service_path);
+		if (ret == -1)
+			return -errno;
+	}
+
+	return 0;
+}
+
+static int remove_service_path(abus_t *abus, const char *service_name, int svc_sock)
+{
+	char service_path[UNIX_PATH_MAX];
+	unsigned i;
+
+	if (svc_sock != -1) {
+		for (i = 0; i < abus->svc_sock_nb; i++) {
+			if (abus->svc_socks[i] == svc_sock) {
+				abus->svc_socks[i] = abus->svc_socks[--abus->svc_sock_nb];
+				break;
+			}
+		}
+		/* closing removes it from the wait set */
+		close(svc_sock);
+		return 0;
+	}
+
+	if (strchr(service_name, '/'))
+		return -EINVAL;
+
+	abus_service_path(abus, service_name, service_path);
+
+	unlink(service_path);
+
+	return 0;
+}
+
+
+static int service_lookup(abus_t *abus, const char *service_name, bool create, abus_service_t **service_p)
+{
+	int srv_len = strlen(service_name);
+	abus_service_t *service;
+	abus_method_t *new_method;
+	abus_attr_t *new_attr;
+	int svc_sock;
+	int ret = 0;
+
+	if (!abus->service_htab)
+		abus->service_htab = hcreate(3);
+
+	if (hfind(abus->service_htab, service_name, srv_len)) {
+		service = hstuff(abus->service_htab);
+	} else if (!create) {
+		service = NULL;
+		ret = JSONRPC_NO_METHOD;
+	} else {
+		*service_p = NULL;
+		if (!abus_check_valid_service_name(service_name, JSONRPC_SVCNAME_SZ_MAX+1))
+			return JSONRPC_INVALID_REQUEST;
+
+		ret = create_service_path(abus, service_name, &svc_sock);
+		if (ret)
+			return ret;
+
+		service = calloc(1, sizeof(abus_service_t));
+		service->sock = svc_sock;
+
+		service->method_htab = hcreate(3);
+		service->event_htab = hcreate(3);
+		service->attr_htab = hcreate(3);
+		pthread_mutex_init(&service->attr_mutex, NULL);
+
+		hadd(abus->service_htab, strdup(service_name), srv_len, service);
+
+		new_attr = calloc(1, sizeof(abus_attr_t));
+		new_attr->flags = ABUS_RPC_CONST;
+		new_attr->auto_alloc = false;
+		new_attr->ref.type = JSON_STRING;
+		new_attr->ref.length = sizeof(abus_version);
+		new_attr->ref.u.data = (char*)abus_version;
+		new_attr->descr = strdup("Version of the A-Bus library for this service");
+		hadd(service->attr_htab, strdup("abus.version"), strlen("abus.version"), new_attr);
+
+		new_method = calloc(1, sizeof(abus_method_t));
+		new_method->callback = &abus_req_introspect_service_cb;
+		new_method->flags = 0;
+		new_method->arg = abus;
+		hadd(service->method_htab, strdup(ABUS_INTROSPECT_METHOD), strlen(ABUS_INTROSPECT_METHOD), new_method);
+
+		new_method = calloc(1, sizeof(abus_method_t));
+		new_method->callback = &abus_req_subscribe_service_cb;
+		new_method->flags = 0;
+		new_method->arg = abus;
+		hadd(service->method_htab, strdup(ABUS_SUBSCRIBE_METHOD), strlen(ABUS_SUBSCRIBE_METHOD), new_method);
+
+		new_method = calloc(1, sizeof(abus_method_t));
+		new_method->callback = &abus_req_unsubscribe_service_cb;
+		new_method->flags = 0;
+		new_method->arg = abus;
+		hadd(service->method_htab, strdup(ABUS_UNSUBSCRIBE_METHOD), strlen(ABUS_UNSUBSCRIBE_METHOD), new_method);
+
+		new_method = calloc(1, sizeof(abus_method_t));
+		new_method->callback = &abus_req_attr_get_cb;
+		new_method->flags = 0;
+		new_method->arg = abus;
+		hadd(service->method_htab, strdup(ABUS_GET_METHOD), strlen(ABUS_GET_METHOD), new_method);
+
+		new_method = calloc(1, sizeof(abus_method_t));
+		new_method->callback = &abus_req_attr_set_cb;
+		new_method->flags = 0;
+		new_method->arg = abus;
+		hadd(service->method_htab, strdup(ABUS_SET_METHOD), strlen(ABUS_SET_METHOD), new_method);
+
+		new_method = calloc(1, sizeof(abus_method_t));
+		new_method->callback = &abus_req_shm_attach_cb;
+		new_method->flags = 0;
+		new_method->arg = abus;
+		hadd(service->method_htab, strdup(ABUS_SHM_ATTACH_METHOD), strlen(ABUS_SHM_ATTACH_METHOD), new_method);
+
+		abus_registry_update(abus);
+	}
+	*service_p = service;
+
+	return ret;
+}
+
+/* registry snapshot, resolving names without abus->mutex */
+enum {
+	ABUS_REG_SERVICE,
+	ABUS_REG_METHOD,
+	ABUS_REG_EVENT,
+	ABUS_REG_ATTR,
+};
+
+struct abus_reg_entry {
+	const char *service_name;
+	const char *name;	/* "" for a service */
+	abus_service_t *service;
+	void *obj;	/* NULL for an empty entry */
+	uint32_t hash;
+	int kind;
+};
+
+/* open addressing, immutable once published */
+struct abus_registry {
+	unsigned mask;
+	struct abus_reg_entry *entries;
+	char *names;
+	/* while building */
+	unsigned count;
+	size_t names_len;
+	const char *service_name;
+};
+
+typedef void (*abus_reg_walk_cb_t)(struct abus_registry *reg, int kind, const char *service_name,
+				const char *name, abus_service_t *service, void *obj);
+
+static uint32_t abus_reg_hash(int kind, const char *service_name, const char *name)
+{
+	return hlookup((const ub1 *)name, strlen(name),
+				hlookup((const ub1 *)service_name, strlen(service_name), kind));
+}
+
+static void abus_registry_free(void *arg)
+{
+	struct abus_registry *reg = (struct abus_registry *)arg;
+
+	free(reg->entries);
+	free(reg->names);
+	free(reg);
+}
+
+static void abus_registry_count(struct abus_registry *reg, int kind, const char *service_name,
+				const char *name, abus_service_t *service, void *obj)
+{
+	reg->count++;
+	reg->names_len += strlen(kind == ABUS_REG_SERVICE ? service_name : name) + 1;
+}
+
+static void abus_registry_insert(struct abus_registry *reg, int kind, const char *service_name,
+				const char *name, abus_service_t *service, void *obj)
+{
+	struct abus_reg_entry *entry;
+	char *p = reg->names + reg->names_len;
+	unsigned i;
+	size_t len;
+
+	/* service names are copied once, and shared by their entries */
+	if (kind == ABUS_REG_SERVICE) {
+		len = strlen(service_name) + 1;
+		memcpy(p, service_name, len);
+		reg->service_name = p;
+		name = "";
+	} else {
+		len = strlen(name) + 1;
+		memcpy(p, name, len);
+		name = p;
+	}
+	reg->names_len += len;
+
+	entry = NULL;
+	for (i = abus_reg_hash(kind, reg->service_name, name) & reg->mask; ; i = (i+1) & reg->mask) {
+		entry = &reg->entries[i];
+		if (!entry->obj)
+			break;
+	}
+
+	entry->service_name = reg->service_name;
+	entry->name = name;
+	entry->service = service;
+	entry->obj = obj;
+	entry->hash = abus_reg_hash(kind, reg->service_name, name);
+	entry->kind = kind;
+}
+
+static void abus_registry_walk_htab(struct abus_registry *reg, int kind, const char *service_name,
+				abus_service_t *service, htab *t, abus_reg_walk_cb_t cb)
+{
+	if (hfirst(t)) do
+	{
+		cb(reg, kind, service_name, (const char *)hkey(t), service, hstuff(t));
+	}
+	while (hnext(t));
+}
+
+/* Caller must hold abus->mutex */
+static void abus_registry_walk(abus_t *abus, struct abus_registry *reg, abus_reg_walk_cb_t cb)
+{
+	if (!abus->service_htab || !hfirst(abus->service_htab))
+		return;
+
+	do
+	{
+		const char *service_name = (const char *)hkey(abus->service_htab);
+		abus_service_t *service = hstuff(abus->service_htab);
+
+		cb(reg, ABUS_REG_SERVICE, service_name, NULL, service, service);
+		abus_registry_walk_htab(reg, ABUS_REG_METHOD, service_name, service, service->method_htab, cb);
+		abus_registry_walk_htab(reg, ABUS_REG_EVENT, service_name, service, service->event_htab, cb);
+		abus_registry_walk_htab(reg, ABUS_REG_ATTR, service_name, service, service->attr_htab, cb);
+	}
+	while (hnext(abus->service_htab));
+}
+
+/*
+  Publish a new snapshot of the registry, after any change to it.
+  Objects removed from the htabs are to be retired after this call.
+  Upon allocation failure, readers fall back to the htabs under mutex.
+  Caller must hold abus->mutex.
+ */
+static void abus_registry_update(abus_t *abus)
+{
+	struct abus_registry *reg, *old;
+	unsigned sz;
+
+	reg = calloc(1, sizeof(*reg));
+	if (reg) {
+		abus_registry_walk(abus, reg, abus_registry_count);
+
+		/* at most half full */
+		for (sz = 8; sz < 2*reg->count; sz *= 2)
+			;
+		reg->mask = sz - 1;
+		reg->entries = calloc(sz, sizeof(struct abus_reg_entry));
+		reg->names = malloc(reg->names_len);
+
+		if (reg->entries && reg->names) {
+			reg->names_len = 0;
+			abus_registry_walk(abus, reg, abus_registry_insert);
+		} else {
+			abus_registry_free(reg);
+			reg = NULL;
+		}
+	}
+	if (!reg)
+		LogError("%s: allocation failed, lookups under mutex", __func__);
+
+	old = __atomic_exchange_n(&abus->registry, reg, __ATOMIC_SEQ_CST);
+	if (old)
+		epoch_retire(old, abus_registry_free);
+}
+
+/*
+  Lookup in the registry snapshot, caller must be within epoch_enter()/epoch_exit()
+  for the object to stay valid. Returns 1 when there's no snapshot.
+ */
+static int registry_lookup(abus_t *abus, int kind, const char *service_name, const char *name,
+				abus_service_t **service_p, void **obj)
+{
+	struct abus_registry *reg;
+	struct abus_reg_entry *entry;
+	uint32_t hash;
+	unsigned i;
+
+	reg = __atomic_load_n(&abus->registry, __ATOMIC_ACQUIRE);
+	if (!reg)
+		return 1;
+
+	hash = abus_reg_hash(kind, service_name, name);
+
+	for (i = hash & reg->mask; reg->entries[i].obj; i = (i+1) & reg->mask) {
+		entry = &reg->entries[i];
+
+		if (entry->hash == hash && entry->kind == kind &&
+				!strcmp(entry->name, name) && !strcmp(entry->service_name, service_name)) {
+			if (service_p)
+				*service_p = entry->service;
+			*obj = entry->obj;
+			return 0;
+		}
+	}
+
+	*obj = NULL;
+
+	return JSONRPC_NO_METHOD;
+}
+
+static void abus_method_free(abus_method_t *method)
+{
+	if (abus_method_is_excl(method))
+		pthread_mutex_destroy(&method->excl_mutex);
+	if (method->descr)
+		free(method->descr);
+	if (method->fmt)
+		free(method->fmt);
+	if (method->result_fmt)
+		free(method->result_fmt);
+	free(method);
+}
+
+/* releasers of the objects retired from the registry */
+static void abus_method_release(void *arg)
+{
+	abus_method_t *method = (abus_method_t *)arg;
+
+	/* queued requests keep the method alive until drained */
+	if (method->serial)
+		abus_serial_put(method->serial);
+	else
+		abus_method_free(method);
+}
+
+static void abus_event_release(void *arg)
+{
+	abus_event_t *event = (abus_event_t *)arg;
+
+	if (event->subscriber_htab) {
+		if (hfirst(event->subscriber_htab)) do
+		{
+			/* TODO: unsubscribe from remote services ? */
+			free(hkey(event->subscriber_htab));
+			free(hstuff(event->subscriber_htab));
+		}
+		while (hnext(event->subscriber_htab));
+		hdestroy(event->subscriber_htab);
+	}
+	if (event->descr)
+		free(event->descr);
+	if (event->fmt)
+		free(event->fmt);
+	free(event);
+}
+
+static void abus_attr_release(void *arg)
+{
+	abus_attr_t *attr = (abus_attr_t *)arg;
+
+	if (attr->descr)
+		free(attr->descr);
+	if (attr->auto_alloc && attr->ref.u.data)
+		free(attr->ref.u.data);
+	free(attr);
+}
+
+static void abus_service_release(void *arg)
+{
+	abus_service_t *service = (abus_service_t *)arg;
+
+	pthread_mutex_destroy(&service->attr_mutex);
+	free(service);
+}
+
+/*
+  Resolve a service without holding abus->mutex, see registry_lookup()
+ */
+static int service_find(abus_t *abus, const char *service_name, abus_service_t **service)
+{
+	int ret;
+
+	ret = registry_lookup(abus, ABUS_REG_SERVICE, service_name, "", NULL, (void **)service);
+	if (ret != 1)
+		return ret;
+
+	pthread_mutex_lock(&abus->mutex);
+	ret = service_lookup(abus, service_name, LookupOnly, service);
+	pthread_mutex_unlock(&abus->mutex);
+
+	return ret;
+}
+
+static int method_lookup(abus_t *abus, const char *service_name, const char *method_name, bool create, abus_service_t **service_p, abus_method_t **method)
+{
+	int mth_len = strlen(method_name);
+	abus_service_t *service;
+	int ret;
+
+	if (!create) {
+		ret = registry_lookup(abus, ABUS_REG_METHOD, service_name, method_name, service_p, (void **)method);
+		if (ret != 1)
+			return ret;
+	}
+
+	pthread_mutex_lock(&abus->mutex);
+
+	ret = service_lookup(abus, service_name, create, &service);
+
+	if (ret) {
+		pthread_mutex_unlock(&abus->mutex);
+		*method = NULL;
+		return ret;
+	}
+
+	if (service_p)
+		*service_p = service;
+
+	if (hfind(service->method_htab, method_name, mth_len)) {
+		*method = hstuff(service->method_htab);
+	} else if (!create) {
+		pthread_mutex_unlock(&abus->mutex);
+		*method = NULL;
+		return JSONRPC_NO_METHOD;
+	} else {
+		*method = calloc(1, sizeof(abus_method_t));
+		hadd(service->method_htab, strdup(method_name), mth_len, *method);
+		abus_registry_update(abus);
+	}
+
+	pthread_mutex_unlock(&abus->mutex);
+
+	return 0;
+}
+
+static int event_lookup(abus_t *abus, const char *service_name, const char *event_name, bool create, abus_service_t **service_p, abus_event_t **event)
+{
+	int evt_len = strlen(event_name);
+	abus_service_t *service;
+	int ret;
+
+	if (!create) {
+		ret = registry_lookup(abus, ABUS_REG_EVENT, service_name, event_name, service_p, (void **)event);
+		if (ret != 1)
+			return ret;
+	}
+
+	pthread_mutex_lock(&abus->mutex);
+
+	ret = service_lookup(abus, service_name, create, &service);
+
+	if (ret) {
+		pthread_mutex_unlock(&abus->mutex);
+		*event = NULL;
+		return ret;
+	}
+
+	if (service_p)
+		*service_p = service;
+
+	if (hfind(service->event_htab, event_name, evt_len)) {
+		*event = hstuff(service->event_htab);
+	} else if (!create) {
+		pthread_mutex_unlock(&abus->mutex);
+		*event = NULL;
+		return JSONRPC_NO_METHOD;
+	} else {
+		*event = calloc(1, sizeof(abus_event_t));
+		(*event)->subscriber_htab = hcreate(1);
+		hadd(service->event_htab, strdup(event_name), evt_len, *event);
+		abus_registry_update(abus);
+	}
+
+	pthread_mutex_unlock(&abus->mutex);
+
+	return 0;
+}
+
+/* completion queue of async requests */
+struct abus_cq {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	/* completed requests not reaped yet, room for all the bound ones */
+	json_rpc_t **ring;
+	unsigned ring_sz, head, count;
+	unsigned outstanding;	/* bound, not completed yet */
+	unsigned waiters;
+};
+
+/*
+  Queue a completed request to be reaped, NULL if cancelled
+ */
+static void abus_cq_push(struct abus_cq *cq, json_rpc_t *json_rpc)
+{
+	pthread_mutex_lock(&cq->mutex);
+
+	cq->outstanding--;
+	if (json_rpc)
+		cq->ring[(cq->head + cq->count++) & (cq->ring_sz-1)] = json_rpc;
+
+	if (cq->waiters > 0)
+		pthread_cond_broadcast(&cq->cond);
+
+	pthread_mutex_unlock(&cq->mutex);
+}
+
+/*
+  Mark an async request as done, releasing its response handler.
+  The request may be released by its owner as soon as published,
+  unless bound to a completion queue, where it gets reaped from
+ */
+static void abus_req_complete(abus_method_t *resp_handler, json_rpc_t *req_json_rpc, bool reap)
+{
+	struct abus_cq *cq = resp_handler->cq;
+
+	free(resp_handler);
+	/* mark as executed through req_json_rpc->cb_context */
+	__atomic_store_n(&req_json_rpc->cb_context, NULL, __ATOMIC_RELEASE);
+	/* last access, a waiter may release the request right away */
+	completion_complete(&req_json_rpc->completion);
+
+	if (cq)
+		abus_cq_push(cq, reap ? req_json_rpc : NULL);
+}
+
+static void abus_call_callback(abus_method_t *method, json_rpc_t *json_rpc)
+{
+	/* threaded ones are already run one at a time by their serial executor */
+	bool excl = abus_method_is_excl(method) && !abus_method_is_threaded(method);
+
+	if (method->callback) {
+		if (excl)
+			pthread_mutex_lock(&method->excl_mutex);
+
+		method->callback(json_rpc, method->arg);
+
+		if (excl)
+			pthread_mutex_unlock(&method->excl_mutex);
+	}
+
+	if (method->flags & ABUS_RPC_ASYNC) {
+		json_rpc_t *req_json_rpc;
+
+		req_json_rpc = json_rpc->async_req_context;
+
+		/* nobody to look at the response but the reaper of the request */
+		if (method->cq)
+			json_rpc_resp_move(req_json_rpc, json_rpc);
+
+		abus_req_complete(method, req_json_rpc, true);
+	}
+}
+
+/*
+  Execute RPC in its own thread
+ */
+static void *abus_threaded_rpc_routine(void *arg)
+{
+	json_rpc_t *json_rpc = (json_rpc_t *)arg;
+	abus_method_t *method = (abus_method_t *)json_rpc->cb_context;
+	int ret;
+
+	if (json_rpc->method_name)
+		set_thread_name(json_rpc->method_name);
+
+	abus_call_callback(method, json_rpc);
+
+	/* now owned by the method, until abus_complete_response() */
+	if (json_rpc->resp_deferred)
+		return NULL;
+
+	/* no response to a notification, even in error */
+	if (json_rpc->service_name && json_rpc->method_name &&
+					!json_val_is_undef(&json_rpc->id)) {
+		ret = json_rpc_resp_finalize(json_rpc);
+		if (ret != 0)
+			json_rpc->msglen = 0;
+	} else {
+		json_rpc->msglen = 0;
+	}
+
+	abus_rpc_done(json_rpc);
+
+	return NULL;
+}
+
+static void abus_thread_attr_init(abus_t *abus, pthread_attr_t *attr)
+{
+	int ret;
+
+	pthread_attr_init(attr);
+
+	if (abus->conf.thread_stack) {
+		ret = pthread_attr_setstacksize(attr, abus->conf.thread_stack);
+		if (ret)
+			LogError("%s: pthread_attr_setstacksize(%zu) failed: %s", __func__,
+							abus->conf.thread_stack, strerror(ret));
+	}
+}
+
+static void *abus_pool_worker(void *arg)
+{
+	struct abus_pool *pool = (struct abus_pool *)arg;
+	struct abus_task task;
+
+	pthread_mutex_lock(&pool->mutex);
+
+	for (;;) {
+		while (pool->count == 0 && !pool->stopping)
+			pthread_cond_wait(&pool->cond, &pool->mutex);
+		if (pool->stopping)
+			break;
+
+		task = pool->queue[pool->head];
+		pool->head = (pool->head + 1) % pool->depth;
+		pool->count--;
+
+		pthread_mutex_unlock(&pool->mutex);
+
+		task.run(task.arg);
+
+		pthread_mutex_lock(&pool->mutex);
+	}
+
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+static void abus_pool_destroy(struct abus_pool *pool)
+{
+	unsigned i;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->stopping = true;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < pool->thread_nb; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	/* left unanswered */
+	for (; pool->count > 0; pool->count--) {
+		struct abus_task *task = &pool->queue[pool->head];
+
+		task->discard(task->arg);
+		pool->head = (pool->head + 1) % pool->depth;
+	}
+
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool->threads);
+	free(pool->queue);
+	free(pool);
+}
+
+/* Caller must hold abus->mutex */
+static struct abus_pool *abus_pool_create(abus_t *abus)
+{
+	struct abus_pool *pool;
+	pthread_attr_t attr;
+	int ret;
+
+	pool = calloc(1, sizeof(*pool));
+	if (!pool)
+		return NULL;
+
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+
+	pool->depth = abus->conf.pool_queue > 0 ? abus->conf.pool_queue : 4*abus->conf.pool_size;
+	pool->queue = malloc(pool->depth * sizeof(struct abus_task));
+	pool->threads = malloc(abus->conf.pool_size * sizeof(pthread_t));
+	if (!pool->queue || !pool->threads) {
+		abus_pool_destroy(pool);
+		return NULL;
+	}
+
+	abus_thread_attr_init(abus, &attr);
+
+	for (; pool->thread_nb < (unsigned)abus->conf.pool_size; pool->thread_nb++) {
+		ret = pthread_create(&pool->threads[pool->thread_nb], &attr, &abus_pool_worker, pool);
+		if (ret) {
+			LogError("%s: pthread_create() failed: %s", __func__, strerror(ret));
+			break;
+		}
+	}
+
+	pthread_attr_destroy(&attr);
+
+	if (pool->thread_nb == 0) {
+		abus_pool_destroy(pool);
+		return NULL;
+	}
+
+	return pool;
+}
+
+/*
+  Queue a task for the pool, -EAGAIN if the queue is full
+ */
+static int abus_pool_submit(abus_t *abus, void *(*run)(void *), void (*discard)(void *), void *arg)
+{
+	struct abus_task *task;
+	struct abus_pool *pool;
+
+	pthread_mutex_lock(&abus->mutex);
+	if (!abus->pool)
+		abus->pool = abus_pool_create(abus);
+	pool = abus->pool;
+	pthread_mutex_unlock(&abus->mutex);
+
+	if (!pool)
+		return -ENOMEM;
+
+	pthread_mutex_lock(&pool->mutex);
+
+	if (pool->count == pool->depth) {
+		pool->rejected++;
+		pthread_mutex_unlock(&pool->mutex);
+		return -EAGAIN;
+	}
+
+	task = &pool->queue[(pool->head + pool->count) % pool->depth];
+	task->run = run;
+	task->discard = discard;
+	task->arg = arg;
+	pool->count++;
+	pthread_cond_signal(&pool->cond);
+
+	pthread_mutex_unlock(&pool->mutex);
+
+	return 0;
+}
+
+/* threaded request dropped unanswered */
+static void abus_threaded_rpc_discard(void *arg)
+{
+	json_rpc_t *json_rpc = (json_rpc_t *)arg;
+
+	json_rpc->msglen = 0;
+	abus_rpc_done(json_rpc);
+}
+
+/* task in a thread of its own, waited for by abus_cleanup() */
+struct abus_detached_task {
+	abus_t *abus;
+	void *(*run)(void *);
+	void *arg;
+};
+
+static void *abus_detached_routine(void *arg)
+{
+	struct abus_detached_task task = *(struct abus_detached_task *)arg;
+	abus_t *abus = task.abus;
+
+	free(arg);
+
+	task.run(task.arg);
+
+	pthread_mutex_lock(&abus->mutex);
+	if (--abus->detached_nb == 0)
+		pthread_cond_broadcast(&abus->detached_cond);
+	pthread_mutex_unlock(&abus->mutex);
+
+	return NULL;
+}
+
+/*
+  Run a task on the pool if configured, in its own thread otherwise
+ */
+static int abus_run_task(abus_t *abus, void *(*run)(void *), void (*discard)(void *), void *arg)
+{
+	struct abus_detached_task *task;
+	pthread_attr_t attr;
+	pthread_t th;
+	int ret;
+
+	if (abus->conf.pool_size > 0)
+		return abus_pool_submit(abus, run, discard, arg);
+
+	task = malloc(sizeof(*task));
+	if (!task)
+		return -ENOMEM;
+	task->abus = abus;
+	task->run = run;
+	task->arg = arg;
+
+	pthread_mutex_lock(&abus->mutex);
+	abus->detached_nb++;
+	pthread_mutex_unlock(&abus->mutex);
+
+	abus_thread_attr_init(abus, &attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	ret = pthread_create(&th, &attr, &abus_detached_routine, task);
+	pthread_attr_destroy(&attr);
+	if (ret != 0)
+	{
+		LogError("%s: pthread_create() failed: %s", __func__, strerror(ret));
+		free(task);
+		pthread_mutex_lock(&abus->mutex);
+		if (--abus->detached_nb == 0)
+			pthread_cond_broadcast(&abus->detached_cond);
+		pthread_mutex_unlock(&abus->mutex);
+		return -ret;
+	}
+
+	return 0;
+}
+
+struct abus_strand_req {
+	json_rpc_t *json_rpc;
+	struct abus_strand_req *next;
+};
+
+/* requests of a same key, in arrival order */
+struct abus_strand {
+	char *key;
+	struct abus_serial *serial;
+	struct abus_strand_req *head, *tail;
+};
+
+/*
+  Serial executor of a threaded method. A strand exists only while a task
+  is there to drain it, so requests wait in the queue, not in a thread.
+ */
+struct abus_serial {
+	pthread_mutex_t mutex;
+	htab *strand_htab;	// key value->struct abus_strand
+	char *key_name;	/* param selecting the strand, NULL for none */
+	abus_method_t *method;	/* freed along with the last reference */
+	unsigned refcount;	/* one for the method, one per strand */
+};
+
+static struct abus_serial *abus_serial_create(abus_method_t *method)
+{
+	struct abus_serial *serial;
+
+	serial = calloc(1, sizeof(*serial));
+	if (!serial)
+		return NULL;
+
+	serial->strand_htab = hcreate(2);
+	pthread_mutex_init(&serial->mutex, NULL);
+	serial->method = method;
+	serial->refcount = 1;
+
+	return serial;
+}
+
+static void abus_serial_put(struct abus_serial *serial)
+{
+	unsigned refcount;
+
+	pthread_mutex_lock(&serial->mutex);
+	refcount = --serial->refcount;
+	pthread_mutex_unlock(&serial->mutex);
+
+	if (refcount > 0)
+		return;
+
+	hdestroy(serial->strand_htab);
+	if (serial->key_name)
+		free(serial->key_name);
+	pthread_mutex_destroy(&serial->mutex);
+	abus_method_free(serial->method);
+	free(serial);
+}
+
+/* Caller must hold serial->mutex */
+static void abus_strand_remove(struct abus_serial *serial, struct abus_strand *strand)
+{
+	if (hfind(serial->strand_htab, strand->key, strlen(strand->key)))
+		hdel(serial->strand_htab);
+}
+
+static void *abus_serial_drain(void *arg)
+{
+	struct abus_strand *strand = (struct abus_strand *)arg;
+	struct abus_serial *serial = strand->serial;
+	struct abus_strand_req *req;
+	json_rpc_t *json_rpc;
+
+	pthread_mutex_lock(&serial->mutex);
+
+	while ((req = strand->head) != NULL) {
+		strand->head = req->next;
+		if (!strand->head)
+			strand->tail = NULL;
+
+		pthread_mutex_unlock(&serial->mutex);
+
+		json_rpc = req->json_rpc;
+		free(req);
+		abus_threaded_rpc_routine(json_rpc);
+
+		pthread_mutex_lock(&serial->mutex);
+	}
+
+	/* next request of this key gets a new strand */
+	abus_strand_remove(serial, strand);
+
+	pthread_mutex_unlock(&serial->mutex);
+
+	free(strand->key);
+	free(strand);
+	abus_serial_put(serial);
+
+	return NULL;
+}
+
+static void abus_serial_discard(void *arg)
+{
+	struct abus_strand *strand = (struct abus_strand *)arg;
+	struct abus_serial *serial = strand->serial;
+	struct abus_strand_req *req;
+
+	pthread_mutex_lock(&serial->mutex);
+
+	abus_strand_remove(serial, strand);
+
+	while ((req = strand->head) != NULL) {
+		strand->head = req->next;
+		abus_threaded_rpc_discard(req->json_rpc);
+		free(req);
+	}
+
+	pthread_mutex_unlock(&serial->mutex);
+
+	free(strand->key);
+	free(strand);
+	abus_serial_put(serial);
+}
+
+/*
+  Queue a threaded request behind the ones of its method sharing its key,
+  to be run one after the other by a single task.
+  Returns 1 if the method does not serialize its requests.
+ */
+static int abus_serial_submit(abus_t *abus, abus_method_t *method, json_rpc_t *json_rpc)
+{
+	struct abus_serial *serial = method->serial;
+	struct abus_strand *strand;
+	struct abus_strand_req *req;
+	const char *key = "";
+	size_t key_len = 0;
+	long long llint;
+	char buf[24];
+	int ret;
+
+	if (!serial)
+		return 1;
+
+	req = malloc(sizeof(*req));
+	if (!req)
+		return -ENOMEM;
+	req->json_rpc = json_rpc;
+	req->next = NULL;
+
+	pthread_mutex_lock(&serial->mutex);
+
+	/* an ABUS_RPC_EXCL method has a single strand */
+	if (!abus_method_is_excl(method)) {
+		if (!serial->key_name) {
+			pthread_mutex_unlock(&serial->mutex);
+			free(req);
+			return 1;
+		}
+		/* requests without the key share the "" strand */
+		if (json_rpc_get_strp(json_rpc, serial->key_name, &key, &key_len) != 0) {
+			key = "";
+			key_len = 0;
+			if (json_rpc_get_llint(json_rpc, serial->key_name, &llint) == 0) {
+				key_len = snprintf(buf, sizeof(buf), "%lld", llint);
+				key = buf;
+			}
+		}
+	}
+
+	if (hfind(serial->strand_htab, key, key_len)) {
+		strand = hstuff(serial->strand_htab);
+		if (strand->tail)
+			strand->tail->next = req;
+		else
+			strand->head = req;
+		strand->tail = req;
+
+		pthread_mutex_unlock(&serial->mutex);
+		return 0;
+	}
+
+	strand = calloc(1, sizeof(*strand));
+	if (strand)
+		strand->key = strndup(key, key_len);
+	if (!strand || !strand->key) {
+		pthread_mutex_unlock(&serial->mutex);
+		free(strand);
+		free(req);
+		return -ENOMEM;
+	}
+	strand->serial = serial;
+	strand->head = strand->tail = req;
+
+	hadd(serial->strand_htab, strand->key, key_len, strand);
+	serial->refcount++;
+
+	ret = abus_run_task(abus, &abus_serial_drain, &abus_serial_discard, strand);
+	if (ret) {
+		abus_strand_remove(serial, strand);
+		serial->refcount--;
+		free(strand->key);
+		free(strand);
+		free(req);
+	}
+
+	pthread_mutex_unlock(&serial->mutex);
+
+	return ret;
+}
+
+/* \internal to libabus
+ * json_rpc is to be malloc'ed for ABUS_RPC_THREADED
+ * TODO: there might be more than one call for subscribed events..
+ */
+static int abus_do_rpc(abus_t *abus, json_rpc_t *json_rpc, abus_method_t *method)
+{
+	if (abus_method_is_threaded(method)) {
+		int ret;
+
+		json_rpc->cb_context = method;
+
+		ret = abus_serial_submit(abus, method, json_rpc);
+		if (ret != 1)
+			return ret;
+
+		return abus_run_task(abus, &abus_threaded_rpc_routine, &abus_threaded_rpc_discard, json_rpc);
+
+	} else {
+		abus_call_callback(method, json_rpc);
+	}
+
+	return 0;
+}
+
+/*!
+	Decalare an A-Bus method
+
+  Redeclaration of an existing method is allowed.
+
+  Rem: there's no need to call abus_undecl_method() before calling abus_cleanup().
+
+  \param abus	pointer to A-Bus handle
+  \param[in] service_name	name of service where the method belongs to
+  \param[in] method_name	name of method to be exposed
+  \param[in] method_callback	pointer to call-back function
+  \param[in] flags	flags specifying method callback
+  \param[in] arg	cookie to be passed back to method_callback
+  \param[in] descr	string describing the method to be declared, may be NULL
+  \param[in] fmt	abus_format describing the argument of method, may be NULL
+  \param[in] result_fmt	abus_format describing the result of method, may be NULL
+
+  \return 0 if successful, non nul value otherwise
+  \sa abus_undecl_method()
+ */
+int abus_decl_method(abus_t *abus, const char *service_name, const char *method_name,
+				abus_callback_t method_callback, int flags, void *arg,
+				const char *descr, const char *fmt, const char *result_fmt)
+{
+	abus_method_t *method;
+	int ret;
+
+	ret = method_lookup(abus, service_name, method_name, CreateIfNotThere, NULL, &method);
+	if (ret)
+		return ret;
+
+	pthread_mutex_lock(&abus->mutex);
+
+	if ((flags & ABUS_RPC_THREADED) && !method->serial) {
+		method->serial = abus_serial_create(method);
+		if (!method->serial) {
+			pthread_mutex_unlock(&abus->mutex);
+			return -ENOMEM;
+		}
+	}
+
+	if (method->descr)
+		free(method->descr);
+	if (method->fmt)
+		free(method->fmt);
+	if (method->result_fmt)
+		free(method->result_fmt);
+
+	method->callback = method_callback;
+	method->flags = flags;
+	method->arg = arg;
+	method->descr = descr ? strdup(descr) : NULL;
+	method->fmt = fmt ? strdup(fmt) : NULL;
+	method->result_fmt = result_fmt ? strdup(result_fmt) : NULL;
+
+	if (abus_method_is_excl(method))
+		pthread_mutex_init(&method->excl_mutex, NULL);
+
+	pthread_mutex_unlock(&abus->mutex);
+
+	return 0;
+}
+
+/*!
+	Undeclare an A-Bus method
+
+  \param[in] service_name	name of service where the method belongs to
+  \param[in] method_name	name of method to be unexposed
+  \param abus	pointer to A-Bus handle
+  \return 0 if successful, non nul value otherwise
+  \sa abus_decl_method()
+ */
+int abus_undecl_method(abus_t *abus, const char *service_name, const char *method_name)
+{
+	abus_method_t *method;
+	abus_service_t *service, *gone;
+	int ret;
+
+	pthread_mutex_lock(&abus->mutex);
+
+	/* position the hashtabs at the elements to be removed */
+	ret = service_lookup(abus, service_name, LookupOnly, &service);
+	if (ret == 0 && !hfind(service->method_htab, method_name, strlen(method_name)))
+		ret = JSONRPC_NO_METHOD;
+	if (ret) {
+		pthread_mutex_unlock(&abus->mutex);
+		return ret;
+	}
+
+	method = hstuff(service->method_htab);
+	free(hkey(service->method_htab));
+	hdel(service->method_htab);
+
+	/* no more stuff in service? */
+	gone = service_may_cleanup(abus, service, service_name);
+
+	abus_registry_update(abus);
+
+	pthread_mutex_unlock(&abus->mutex);
+
+	/* callbacks in progress may still use them */
+	epoch_retire(method, abus_method_release);
+	if (gone)
+		epoch_retire(gone, abus_service_release);
+
+	return 0;
+}
+
+/*!
+	Serialize the requests of a threaded method per value of one of their parameters
+
+  Requests carrying the same value for the parameter key_name are run
+  one after the other, in arrival order, while requests with different values
+  may run concurrently. Waiting requests are queued, they do not hold a thread.
+  Requests without the parameter are serialized together.
+
+  Requests of a method flagged both ABUS_RPC_THREADED and ABUS_RPC_EXCL are
+  always run one at a time in arrival order, whatever the key.
+
+  \param abus	pointer to A-Bus handle
+  \param[in] service_name	name of service where the method belongs to
+  \param[in] method_name	name of method, declared ABUS_RPC_THREADED
+  \param[in] key_name	name of the parameter, or NULL to stop serializing
+  \return 0 if successful, -EINVAL if the method is not threaded, non nul value otherwise
+  \sa abus_decl_method()
+ */
+int abus_set_method_serial_key(abus_t *abus, const char *service_name, const char *method_name,
+				const char *key_name)
+{
+	abus_method_t *method;
+	struct abus_serial *serial;
+	char *old_key_name;
+	int ret;
+
+	/* method and serial executor cannot be released meanwhile */
+	epoch_enter();
+
+	ret = method_lookup(abus, service_name, method_name, LookupOnly, NULL, &method);
+	if (ret) {
+		epoch_exit();
+		return ret;
+	}
+
+	serial = method->serial;
+	if (!abus_method_is_threaded(method) || !serial) {
+		epoch_exit();
+		return -EINVAL;
+	}
+
+	pthread_mutex_lock(&serial->mutex);
+	old_key_name = serial->key_name;
+	serial->key_name = key_name ? strdup(key_name) : NULL;
+	pthread_mutex_unlock(&serial->mutex);
+
+	epoch_exit();
+
+	if (old_key_name)
+		free(old_key_name);
+
+	return 0;
+}
+
+
+/*!
+	Initialize for request method, client side
+
+  Implicit: expects a response, otherwise use notification/event
+
+  Rem: an empty \a service_name and a \a method_name of "*" will make
+  abus_request_method_invoke() get the list of running services on the machine.
+
+  \param[in] service_name	name of service where the method belongs to
+  \param[in] method_name	name of method to be later invoked
+  \param abus	pointer to A-Bus handle
+  \return json_rpc pointer to an opaque handle of a JSON RPC if successful, a NULL pointer otherwise
+  \sa abus_request_method_invoke(), abus_request_method_cleanup()
+ */
+json_rpc_t *abus_request_method_init(abus_t *abus, const char *service_name, const char *method_name)
+{
+	json_rpc_t *json_rpc;
+	unsigned id;
+	int ret;
+
+	/* (unsigned)-1 stands for no id, i.e. a notification */
+	do {
+		id = __atomic_fetch_add(&abus->id, 1, __ATOMIC_RELAXED);
+	} while (id == (unsigned)-1);
+
+	json_rpc = json_rpc_req_init(service_name, method_name, id);
+	if (!json_rpc)
+		return NULL;
+
+	/* nothing to wait for until invoked asynchronously */
+	completion_complete(&json_rpc->completion);
+
+	/* request for event subscribe MUST be sent on A-Bus socket
+	 * in order to get the notifications on that socket
+	 */
+	if (!strcmp(method_name, ABUS_SUBSCRIBE_METHOD)) {
+		/* A-Bus thread most likely already started/socket created
+		 * by abus_event_subscribe()
+		 */
+		ret = abus_launch_thread_ondemand(abus);
+		if (ret != 0) {
+			json_rpc_cleanup(json_rpc);
+			return NULL;
+		}
+		json_rpc->sock = abus->sock;
+	}
+
+	return json_rpc;
+}
+
+/* outstanding asynchronous request */
+struct abus_req {
+	json_rpc_t *json_rpc;
+	unsigned id;	/* slot in the low bits, generation above, rejecting stale responses */
+	struct abus_req *next, **pprev;
+	timer_wheel_entry_t timer;
+	int timeout;	/* restarted by each partial result of a streamed response */
+};
+
+#define ABUS_REQ_SLOTS_MIN 64
+
+/*
+  Numerical value of a request id, as allocated by abus_request_method_init()
+ */
+static int abus_req_id(const json_val_t *id_val, unsigned *id)
+{
+	const char *p = id_val->u.data;
+	unsigned long val = 0;
+	size_t i;
+
+	if (!p || id_val->length == 0 || id_val->length > 10)
+		return -EINVAL;
+
+	for (i = 0; i < id_val->length; i++) {
+		if (p[i] < '0' || p[i] > '9')
+			return -EINVAL;
+		val = val*10 + (p[i] - '0');
+	}
+	if (val > UINT_MAX)
+		return -EINVAL;
+
+	*id = val;
+
+	return 0;
+}
+
+/*
+  Ids are handed out in sequence, hence evenly spread over the slots.
+  Caller must hold abus->req_mutex
+ */
+static void abus_req_link(struct abus_req **slots, unsigned slot_nb, struct abus_req *req)
+{
+	struct abus_req **slot = &slots[req->id & (slot_nb-1)];
+
+	req->next = *slot;
+	if (req->next)
+		req->next->pprev = &req->next;
+	req->pprev = slot;
+	*slot = req;
+}
+
+static void abus_req_unlink(struct abus_req *req)
+{
+	*req->pprev = req->next;
+	if (req->next)
+		req->next->pprev = req->pprev;
+	req->next = NULL;
+	req->pprev = NULL;
+}
+
+static void abus_req_slots_free(abus_t *abus)
+{
+	struct abus_req *req, *next;
+	unsigned i;
+
+	for (i = 0; i < abus->req_slot_nb; i++) {
+		for (req = abus->req_slots[i]; req; req = next) {
+			next = req->next;
+			free(req);
+		}
+	}
+
+	free(abus->req_slots);
+	abus->req_slots = NULL;
+	abus->req_slot_nb = 0;
+	abus->req_count = 0;
+}
+
+/*
+  Keep about one request per slot.
+  Caller must hold abus->req_mutex
+ */
+static int abus_req_slots_grow(abus_t *abus)
+{
+	struct abus_req **slots, *req, *next;
+	unsigned i, slot_nb;
+
+	slot_nb = abus->req_slot_nb ? 2*abus->req_slot_nb : ABUS_REQ_SLOTS_MIN;
+
+	slots = calloc(slot_nb, sizeof(struct abus_req *));
+	if (!slots)
+		return -ENOMEM;
+
+	for (i = 0; i < abus->req_slot_nb; i++) {
+		for (req = abus->req_slots[i]; req; req = next) {
+			next = req->next;
+			abus_req_link(slots, slot_nb, req);
+		}
+	}
+
+	free(abus->req_slots);
+	abus->req_slots = slots;
+	abus->req_slot_nb = slot_nb;
+
+	return 0;
+}
+
+/* timer wheel ticks are milliseconds of CLOCK_MONOTONIC */
+static unsigned long abus_timer_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
+/*
+  Have timer_fd go off when the wheel needs to be advanced.
+  Caller must hold abus->req_mutex
+ */
+static void abus_timers_arm(abus_t *abus)
+{
+	struct itimerspec its;
+	unsigned long deadline = 0;
+	long next;
+
+	next = timer_wheel_next(abus->timers);
+	if (next >= 0)
+		deadline = abus->timers->now + next;
+
+	if (deadline == abus->timer_deadline)
+		return;
+
+	/* all zero disarms */
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = deadline / 1000;
+	its.it_value.tv_nsec = (deadline % 1000) * 1000000;
+
+	if (timerfd_settime(abus->timer_fd, TFD_TIMER_ABSTIME, &its, NULL) == -1) {
+		LogError("%s: timerfd_settime failed: %s", __func__, strerror(errno));
+		return;
+	}
+
+	abus->timer_deadline = deadline;
+}
+
+/*
+  Timer wheel, and its timer_fd polled by the A-Bus thread.
+  Caller must hold abus->req_mutex
+ */
+static int abus_timers_init(abus_t *abus)
+{
+	timer_wheel_t *timers;
+
+	if (abus->timers)
+		return 0;
+
+	timers = malloc(sizeof(*timers));
+	if (!timers)
+		return -ENOMEM;
+
+	abus->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+	if (abus->timer_fd == -1) {
+		free(timers);
+		return -errno;
+	}
+
+	if (un_sock_epoll_add(abus->epfd, abus->timer_fd, EPOLLIN, abus->timer_fd) != 0) {
+		close(abus->timer_fd);
+		abus->timer_fd = -1;
+		free(timers);
+		return -EIO;
+	}
+
+	timer_wheel_init(timers, abus_timer_now());
+	abus->timers = timers;
+
+	return 0;
 }
 
 /*
-  NB: '/' (slash) is forbidden in service_name
+	To be used by abus_request_method_invoke_async()
  */
-int create_service_path(abus_t *abus, const char *service_name)
+static int abus_req_track(abus_t *abus, json_rpc_t *json_rpc, int timeout)
 {
-	char service_path[UNIX_PATH_MAX];
-	char pid_rel_path[UNIX_PATH_MAX];
-	int ret;
+	struct abus_req *req;
+	int ret = 0;
 
-	if (strchr(service_name, '/'))
-		return -EINVAL;
+	req = calloc(1, sizeof(*req));
+	if (!req)
+		return -ENOMEM;
+	req->json_rpc = json_rpc;
+	req->timeout = timeout;
 
-	ret = abus_launch_thread_ondemand(abus);
-	if (ret)
+	ret = abus_req_id(&json_rpc->id, &req->id);
+	if (ret) {
+		free(req);
 		return ret;
+	}
 
-	snprintf(pid_rel_path, sizeof(pid_rel_path)-1, "_%d", getpid());
-
-	if (strlen(service_name) > 0) {
+	pthread_mutex_lock(&abus->req_mutex);
 
-		abus_service_path(abus, service_name, service_path);
-#if 0
-		struct stat svcstat;
+	if (abus->req_count >= abus->req_slot_nb)
+		ret = abus_req_slots_grow(abus);
 
-		ret = stat(service_path, &svcstat);
+	if (ret == 0 && timeout > 0) {
+		ret = abus_timers_init(abus);
 		if (ret == 0) {
-			char str[32];
-			/* FIXME don't use abus_attr_get_str() because
-			   it's not using the AF_UNIX socket
-			 */
-			if (abus_attr_get_str(abus, service_name, "abus.version",
-										str, sizeof(str), 200) == 0)
-				return -EEXIST;
+			/* the wheel stood still while empty */
+			if (timer_wheel_count(abus->timers) == 0)
+				timer_wheel_advance(abus->timers, abus_timer_now());
+
+			timer_wheel_add(abus->timers, &req->timer, abus_timer_now() + timeout);
+			abus_timers_arm(abus);
 		}
-#endif
-		unlink(service_path);
-	
-		/* /tmp/abus/<servicename> -> _<pid> */
-		ret = symlink(pid_rel_path, service_path);
-		if (ret == -1)
-			return -errno;
 	}
 
+	if (ret) {
+		pthread_mutex_unlock(&abus->req_mutex);
+		free(req);
+		return ret;
+	}
+
+	abus_req_link(abus->req_slots, abus->req_slot_nb, req);
+	abus->req_count++;
+
+	pthread_mutex_unlock(&abus->req_mutex);
+
 	return 0;
 }
 
-int remove_service_path(abus_t *abus, const char *service_name)
+/*
+  Outstanding request of an id, NULL if none.
+  Caller must hold abus->req_mutex
+ */
+static struct abus_req *abus_req_find_id(abus_t *abus, unsigned id)
 {
-	char service_path[UNIX_PATH_MAX];
+	struct abus_req *req;
 
-	if (strchr(service_name, '/'))
-		return -EINVAL;
+	if (!abus->req_slots)
+		return NULL;
 
-	abus_service_path(abus, service_name, service_path);
+	for (req = abus->req_slots[id & (abus->req_slot_nb-1)]; req; req = req->next) {
+		if (req->id == id)
+			return req;
+	}
 
-	unlink(service_path);
+	return NULL;
+}
 
-	return 0;
+static struct abus_req *abus_req_find(abus_t *abus, const json_val_t *id_val)
+{
+	unsigned id;
+
+	if (abus_req_id(id_val, &id) != 0)
+		return NULL;
+
+	return abus_req_find_id(abus, id);
 }
 
+/*
+  Take back the request an id belongs to, NULL if not outstanding,
+  e.g. answered already, timed out or cancelled
+ */
+static json_rpc_t *abus_req_untrack_id(abus_t *abus, unsigned id)
+{
+	struct abus_req *req;
+	json_rpc_t *json_rpc = NULL;
+
+	pthread_mutex_lock(&abus->req_mutex);
+
+	req = abus_req_find_id(abus, id);
+	if (req) {
+		abus_req_unlink(req);
+		abus->req_count--;
+		/* a later deadline of timer_fd only costs a spurious wake-up */
+		if (timer_wheel_pending(&req->timer))
+			timer_wheel_del(abus->timers, &req->timer);
+		json_rpc = req->json_rpc;
+	}
 
-static int service_lookup(abus_t *abus, const char *service_name, bool create, abus_service_t **service_p)
+	pthread_mutex_unlock(&abus->req_mutex);
+
+	free(req);
+
+	return json_rpc;
+}
+
+static json_rpc_t *abus_req_untrack(abus_t *abus, const json_val_t *id_val)
 {
-	int srv_len = strlen(service_name);
-	abus_service_t *service;
-	abus_method_t *new_method;
-	abus_attr_t *new_attr;
-	int ret = 0;
+	unsigned id;
 
-	if (!abus->service_htab)
-		abus->service_htab = hcreate(3);
+	if (abus_req_id(id_val, &id) != 0)
+		return NULL;
 
-	if (hfind(abus->service_htab, service_name, srv_len)) {
-		service = hstuff(abus->service_htab);
-	} else if (!create) {
-		service = NULL;
-		ret = JSONRPC_NO_METHOD;
-	} else {
-		*service_p = NULL;
-		if (!abus_check_valid_service_name(service_name, JSONRPC_SVCNAME_SZ_MAX+1))
-			return JSONRPC_INVALID_REQUEST;
+	return abus_req_untrack_id(abus, id);
+}
 
-		ret = create_service_path(abus, service_name);
-		if (ret)
-			return ret;
+/*
+  Hand a partial result of a streamed response to the response handler,
+  the request staying outstanding until the final response.
+  Always run from the receiving thread, the only one since streaming
+  is turned down with several receivers, hence in order.
+ */
+static void abus_req_partial(abus_t *abus, json_rpc_t *json_rpc)
+{
+	abus_callback_t callback = NULL;
+	abus_method_t *resp_handler;
+	struct abus_req *req;
+	void *arg = NULL;
+
+	pthread_mutex_lock(&abus->req_mutex);
+
+	req = abus_req_find(abus, &json_rpc->id);
+	if (req) {
+		resp_handler = req->json_rpc->cb_context;
+		callback = resp_handler->callback;
+		arg = resp_handler->arg;
+		json_rpc->async_req_context = req->json_rpc;
+
+		/* the stream is alive, give it another timeout */
+		if (timer_wheel_pending(&req->timer)) {
+			timer_wheel_del(abus->timers, &req->timer);
+			timer_wheel_add(abus->timers, &req->timer, abus_timer_now() + req->timeout);
+			abus_timers_arm(abus);
+		}
+	}
 
-		service = calloc(1, sizeof(abus_service_t));
+	pthread_mutex_unlock(&abus->req_mutex);
 
-		service->method_htab = hcreate(3);
-		service->event_htab = hcreate(3);
-		service->attr_htab = hcreate(3);
-		pthread_mutex_init(&service->attr_mutex, NULL);
+	if (callback)
+		callback(json_rpc, arg);
+}
 
-		hadd(abus->service_htab, strdup(service_name), srv_len, service);
+/*
+  Have the response handler of a request run as if its response
+  came back with error, e.g. -ETIMEDOUT
+ */
+static void abus_req_error(abus_t *abus, json_rpc_t *req_json_rpc, int error)
+{
+	abus_method_t *method = req_json_rpc->cb_context;
+	/* the response handler is released once run */
+	bool threaded = abus_method_is_threaded(method);
+	json_rpc_t *json_rpc;
+	int ret;
 
-		new_attr = calloc(1, sizeof(abus_attr_t));
-		new_attr->flags = ABUS_RPC_CONST;
-		new_attr->auto_alloc = false;
-		new_attr->ref.type = JSON_STRING;
-		new_attr->ref.length = sizeof(abus_version);
-		new_attr->ref.u.data = (char*)abus_version;
-		new_attr->descr = strdup("Version of the A-Bus library for this service");
-		hadd(service->attr_htab, strdup("abus.version"), strlen("abus.version"), new_attr);
+	/* published along with cb_context */
+	req_json_rpc->error_code = error;
 
-		new_method = calloc(1, sizeof(abus_method_t));
-		new_method->callback = &abus_req_introspect_service_cb;
-		new_method->flags = 0;
-		new_method->arg = abus;
-		hadd(service->method_htab, strdup(ABUS_INTROSPECT_METHOD), strlen(ABUS_INTROSPECT_METHOD), new_method);
+	json_rpc = json_rpc_init();
+	if (!json_rpc) {
+		/* still mark it as done, without calling back */
+		abus_req_complete(method, req_json_rpc, true);
+		return;
+	}
 
-		new_method = calloc(1, sizeof(abus_method_t));
-		new_method->callback = &abus_req_subscribe_service_cb;
-		new_method->flags = 0;
-		new_method->arg = abus;
-		hadd(service->method_htab, strdup(ABUS_SUBSCRIBE_METHOD), strlen(ABUS_SUBSCRIBE_METHOD), new_method);
+	json_rpc->error_code = error;
+	json_rpc->async_req_context = req_json_rpc;
 
-		new_method = calloc(1, sizeof(abus_method_t));
-		new_method->callback = &abus_req_unsubscribe_service_cb;
-		new_method->flags = 0;
-		new_method->arg = abus;
-		hadd(service->method_htab, strdup(ABUS_UNSUBSCRIBE_METHOD), strlen(ABUS_UNSUBSCRIBE_METHOD), new_method);
+	ret = abus_do_rpc(abus, json_rpc, method);
+	if (ret == 0 && threaded)
+		return;
+	if (ret)
+		abus_call_callback(method, json_rpc);
 
-		new_method = calloc(1, sizeof(abus_method_t));
-		new_method->callback = &abus_req_attr_get_cb;
-		new_method->flags = 0;
-		new_method->arg = abus;
-		hadd(service->method_htab, strdup(ABUS_GET_METHOD), strlen(ABUS_GET_METHOD), new_method);
+	json_rpc_cleanup(json_rpc);
+}
 
-		new_method = calloc(1, sizeof(abus_method_t));
-		new_method->callback = &abus_req_attr_set_cb;
-		new_method->flags = 0;
-		new_method->arg = abus;
-		hadd(service->method_htab, strdup(ABUS_SET_METHOD), strlen(ABUS_SET_METHOD), new_method);
+/*
+  Expire the async requests whose timeout elapsed, on timer_fd wake-up
+ */
+static int abus_process_timers(abus_t *abus)
+{
+	timer_wheel_entry_t *expired, *next;
+	struct abus_req *req;
+	uint64_t ticks;
+
+	/* non blocking, nothing to read on a spurious wake-up */
+	if (read(abus->timer_fd, &ticks, sizeof(ticks)) == -1 && errno != EAGAIN)
+		return -errno;
+
+	pthread_mutex_lock(&abus->req_mutex);
+
+	/* fired, to be armed again */
+	abus->timer_deadline = 0;
+
+	expired = timer_wheel_advance(abus->timers, abus_timer_now());
+
+	/* no longer reachable by a response or a cancel */
+	for (next = expired; next; next = next->next) {
+		req = (struct abus_req *)((char *)next - offsetof(struct abus_req, timer));
+		abus_req_unlink(req);
+		abus->req_count--;
 	}
-	*service_p = service;
 
-	return ret;
+	abus_timers_arm(abus);
+
+	pthread_mutex_unlock(&abus->req_mutex);
+
+	for (; expired; expired = next) {
+		next = expired->next;
+		req = (struct abus_req *)((char *)expired - offsetof(struct abus_req, timer));
+
+		abus_req_error(abus, req->json_rpc, -ETIMEDOUT);
+		free(req);
+	}
+
+	return 0;
 }
 
-static int method_lookup(abus_t *abus, const char *service_name, const char *method_name, bool create, abus_service_t **service_p, abus_method_t **method)
+
+/* the responses to a batch have to fit in a message as well */
+#define ABUS_CORK_SZ_DEFAULT (JSONRPC_REQ_SZ_MAX/4)
+
+/* async requests to a service held back, to go in one batch message */
+struct abus_cork {
+	char service_name[JSONRPC_SVCNAME_SZ_MAX];
+	char buf[JSONRPC_REQ_SZ_MAX];	/* "[" then the requests */
+	int len;
+	unsigned *ids;	/* to fail the requests if not sent */
+	unsigned nb, ids_sz;
+	struct abus_cork *next;
+};
+
+/*
+  Send the requests of a cork, a single one as is, several in a batch.
+  Caller must hold abus->cork_mutex, released while failing the requests
+ */
+static void abus_cork_send(abus_t *abus, struct abus_cork *cork)
 {
-	int mth_len = strlen(method_name);
-	abus_service_t *service;
+	unsigned i, nb, *ids;
 	int ret;
 
-	pthread_mutex_lock(&abus->mutex);
+	if (cork->nb == 0)
+		return;
 
-	ret = service_lookup(abus, service_name, create, &service);
+	if (cork->nb == 1) {
+		ret = un_sock_sendto_svc(abus->sock, cork->buf+1, cork->len-1, cork->service_name, NULL, 0);
+	} else {
+		cork->buf[cork->len++] = ']';
+		ret = un_sock_sendto_svc(abus->sock, cork->buf, cork->len, cork->service_name, NULL, 0);
+	}
 
-	if (ret) {
-		pthread_mutex_unlock(&abus->mutex);
-		*method = NULL;
-		return ret;
+	nb = cork->nb;
+	cork->len = 0;
+	cork->nb = 0;
+
+	if (ret == 0)
+		return;
+
+	/* the callbacks may issue requests in turn */
+	ids = cork->ids;
+	cork->ids = NULL;
+	cork->ids_sz = 0;
+
+	pthread_mutex_unlock(&abus->cork_mutex);
+
+	/* as if they failed right away, unless the timeout got them meanwhile */
+	for (i = 0; i < nb; i++) {
+		json_rpc_t *json_rpc = abus_req_untrack_id(abus, ids[i]);
+
+		if (json_rpc)
+			abus_req_error(abus, json_rpc, ret < 0 ? ret : -EIO);
 	}
+	free(ids);
 
-	if (service_p)
-		*service_p = service;
+	pthread_mutex_lock(&abus->cork_mutex);
+}
 
-	if (hfind(service->method_htab, method_name, mth_len)) {
-		*method = hstuff(service->method_htab);
-	} else if (!create) {
-		pthread_mutex_unlock(&abus->mutex);
-		*method = NULL;
-		return JSONRPC_NO_METHOD;
-	} else {
-		*method = calloc(1, sizeof(abus_method_t));
-		hadd(service->method_htab, strdup(method_name), mth_len, *method);
+/*
+  Have cork_fd go off once conf.cork_usec elapsed.
+  Caller must hold abus->cork_mutex
+ */
+static int abus_corks_arm(abus_t *abus)
+{
+	struct itimerspec its;
+
+	if (abus->cork_fd == -1) {
+		abus->cork_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+		if (abus->cork_fd == -1)
+			return -errno;
+
+		if (un_sock_epoll_add(abus->epfd, abus->cork_fd, EPOLLIN, abus->cork_fd) != 0) {
+			close(abus->cork_fd);
+			abus->cork_fd = -1;
+			return -EIO;
+		}
 	}
 
-	pthread_mutex_unlock(&abus->mutex);
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = abus->conf.cork_usec / 1000000;
+	its.it_value.tv_nsec = (abus->conf.cork_usec % 1000000) * 1000;
+
+	if (timerfd_settime(abus->cork_fd, 0, &its, NULL) == -1)
+		return -errno;
 
 	return 0;
 }
 
-static int event_lookup(abus_t *abus, const char *service_name, const char *event_name, bool create, abus_service_t **service_p, abus_event_t **event)
+/*
+  Send the requests held back for a service, for a request not to overtake them
+ */
+static void abus_corks_send_svc(abus_t *abus, const char *service_name)
 {
-	int evt_len = strlen(event_name);
-	abus_service_t *service;
+	struct abus_cork *cork;
+
+	if (!__atomic_load_n(&abus->corks, __ATOMIC_ACQUIRE))
+		return;
+
+	pthread_mutex_lock(&abus->cork_mutex);
+	for (cork = abus->corks; cork; cork = cork->next) {
+		if (!strcmp(cork->service_name, service_name))
+			abus_cork_send(abus, cork);
+	}
+	pthread_mutex_unlock(&abus->cork_mutex);
+}
+
+/*
+  Hold back a request until its cork gets sent, or send it right away
+  if corking is off, or for a request which cannot go in a batch.
+  The requests to a service are sent in order anyway
+ */
+static int abus_cork_sendto_svc(abus_t *abus, json_rpc_t *json_rpc, int *payload_fd)
+{
+	unsigned cork_size = abus->conf.cork_size;
+	struct abus_cork *cork, **pcork;
+	unsigned id;
 	int ret;
 
-	pthread_mutex_lock(&abus->mutex);
+	if (cork_size == 0 || cork_size > JSONRPC_REQ_SZ_MAX)
+		cork_size = ABUS_CORK_SZ_DEFAULT;
 
-	ret = service_lookup(abus, service_name, create, &service);
+	if (!abus->conf.cork_usec || *payload_fd != -1 || json_rpc->stream ||
+			json_rpc->msglen + 2 > (int)cork_size ||
+			abus_req_id(&json_rpc->id, &id) != 0) {
+		/* nothing held back, nothing to overtake */
+		abus_corks_send_svc(abus, json_rpc->service_name);
 
-	if (ret) {
-		pthread_mutex_unlock(&abus->mutex);
-		*event = NULL;
-		return ret;
+		return un_sock_sendto_svc(abus->sock, json_rpc->msgbuf, json_rpc->msglen, json_rpc->service_name,
+						payload_fd, *payload_fd != -1);
 	}
 
-	if (service_p)
-		*service_p = service;
+	pthread_mutex_lock(&abus->cork_mutex);
 
-	if (hfind(service->event_htab, event_name, evt_len)) {
-		*event = hstuff(service->event_htab);
-	} else if (!create) {
-		pthread_mutex_unlock(&abus->mutex);
-		*event = NULL;
-		return JSONRPC_NO_METHOD;
-	} else {
-		*event = calloc(1, sizeof(abus_event_t));
-		(*event)->subscriber_htab = hcreate(1);
-		hadd(service->event_htab, strdup(event_name), evt_len, *event);
+	for (pcork = &abus->corks; *pcork; pcork = &(*pcork)->next) {
+		if (!strcmp((*pcork)->service_name, json_rpc->service_name))
+			break;
+	}
+	cork = *pcork;
+
+	if (!cork) {
+		cork = calloc(1, sizeof(*cork));
+		if (!cork) {
+			pthread_mutex_unlock(&abus->cork_mutex);
+			return -ENOMEM;
+		}
+		strcpy(cork->service_name, json_rpc->service_name);
+		/* corks stay around until cleanup */
+		__atomic_store_n(pcork, cork, __ATOMIC_RELEASE);
 	}
 
-	pthread_mutex_unlock(&abus->mutex);
+	/* room for the separator and the closing bracket */
+	while (cork->len + json_rpc->msglen + 2 > (int)cork_size)
+		abus_cork_send(abus, cork);
 
-	return 0;
-}
+	if (cork->nb >= cork->ids_sz) {
+		unsigned ids_sz = cork->ids_sz ? cork->ids_sz*2 : 16;
+		unsigned *ids = realloc(cork->ids, ids_sz * sizeof(*ids));
 
-static void abus_call_callback(abus_method_t *method, json_rpc_t *json_rpc)
-{
-	if (method->callback) {
-		if (abus_method_is_excl(method))
-			pthread_mutex_lock(&method->excl_mutex);
+		if (!ids) {
+			pthread_mutex_unlock(&abus->cork_mutex);
+			return -ENOMEM;
+		}
+		cork->ids = ids;
+		cork->ids_sz = ids_sz;
+	}
 
-		method->callback(json_rpc, method->arg);
+	/* first one held back since the last flush */
+	ret = 0;
+	for (pcork = &abus->corks; *pcork && (*pcork)->nb == 0; pcork = &(*pcork)->next)
+		;
+	if (!*pcork)
+		ret = abus_corks_arm(abus);
 
-		if (abus_method_is_excl(method))
-			pthread_mutex_unlock(&method->excl_mutex);
+	if (ret != 0) {
+		pthread_mutex_unlock(&abus->cork_mutex);
+		return ret;
 	}
 
-	if (method->flags & ABUS_RPC_ASYNC) {
-		json_rpc_t *req_json_rpc;
+	cork->buf[cork->len++] = cork->nb == 0 ? '[' : ',';
+	memcpy(cork->buf + cork->len, json_rpc->msgbuf, json_rpc->msglen);
+	cork->len += json_rpc->msglen;
+	cork->ids[cork->nb++] = id;
 
-		req_json_rpc = json_rpc->async_req_context;
+	pthread_mutex_unlock(&abus->cork_mutex);
 
-		pthread_mutex_lock(&req_json_rpc->mutex);
-		/* mark as executed through req_json_rpc->cb_context */
-		req_json_rpc->cb_context = NULL;
-		pthread_cond_broadcast(&req_json_rpc->cond);
-		/* release resp_handler helper */
-		free(method);
-		pthread_mutex_unlock(&req_json_rpc->mutex);
-	}
+	return 0;
 }
 
-/*
-  Execute RPC in its own thread
+/*!
+	Send the asynchronous requests held back by corking
+
+  \param abus	pointer to A-Bus handle
+  \return   0 if successful, non nul value otherwise
+  \sa abus_conf_t.cork_usec
  */
-static void *abus_threaded_rpc_routine(void *arg)
+int abus_flush(abus_t *abus)
 {
-	json_rpc_t *json_rpc = (json_rpc_t *)arg;
-	abus_method_t *method = (abus_method_t *)json_rpc->cb_context;
-	int ret;
+	struct abus_cork *cork;
 
-	if (json_rpc->method_name)
-		set_thread_name(json_rpc->method_name);
+	if (!__atomic_load_n(&abus->corks, __ATOMIC_ACQUIRE))
+		return 0;
 
-	abus_call_callback(method, json_rpc);
+	pthread_mutex_lock(&abus->cork_mutex);
 
-	if (json_rpc->service_name && json_rpc->method_name &&
-					(!json_val_is_undef(&json_rpc->id) || json_rpc->error_code)) {
-		ret = json_rpc_resp_finalize(json_rpc);
-		if (ret == 0)
-			abus_resp_send(json_rpc);
-	}
+	for (cork = abus->corks; cork; cork = cork->next)
+		abus_cork_send(abus, cork);
 
-	json_rpc->msglen = 0;
-	json_rpc_cleanup(json_rpc);
+	pthread_mutex_unlock(&abus->cork_mutex);
 
-	return NULL;
+	return 0;
 }
 
-/* \internal to libabus
- * json_rpc is to be malloc'ed for ABUS_RPC_THREADED
- * TODO: there might be more than one call for subscribed events..
+/*
+  Send the corked requests once conf.cork_usec elapsed, on cork_fd wake-up
  */
-static int abus_do_rpc(abus_t *abus, json_rpc_t *json_rpc, abus_method_t *method)
+static int abus_process_corks(abus_t *abus)
 {
-	if (abus_method_is_threaded(method)) {
-		pthread_attr_t attr;
-		pthread_t th;
-		int ret;
+	uint64_t ticks;
 
-		json_rpc->cb_context = method;
+	/* non blocking, nothing to read on a spurious wake-up */
+	if (read(abus->cork_fd, &ticks, sizeof(ticks)) == -1 && errno != EAGAIN)
+		return -errno;
 
-		pthread_attr_init(&attr);
-		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	return abus_flush(abus);
+}
 
-		ret = pthread_create(&th, &attr, &abus_threaded_rpc_routine, json_rpc);
-		pthread_attr_destroy(&attr);
-		if (ret != 0)
-		{
-			LogError("%s: pthread_create() failed: %s", __func__, strerror(ret));
-			return -ret;
-		}
+static void abus_corks_free(abus_t *abus)
+{
+	struct abus_cork *cork;
 
-	} else {
-		abus_call_callback(method, json_rpc);
+	while ((cork = abus->corks) != NULL) {
+		abus->corks = cork->next;
+		free(cork->ids);
+		free(cork);
 	}
 
-	return 0;
+	if (abus->cork_fd != -1)
+		close(abus->cork_fd);
 }
 
 /*!
-	Decalare an A-Bus method
+	Wait for an asynchronous method request
 
-  Redeclaration of an existing method is allowed.
+  \param abus	pointer to A-Bus handle
+  \param json_rpc pointer to an opaque handle of a JSON RPC
+  \param[in] timeout waiting timeout in milliseconds
+  \return   0 if successful or reponse already received, -ETIMEDOUT if the request
+  	timed out, non nul value otherwise
+  \sa abus_request_method_invoke_async()
+ */
+int abus_request_method_wait_async(abus_t *abus, json_rpc_t *json_rpc, int timeout)
+{
+	int ret;
 
-  Rem: there's no need to call abus_undecl_method() before calling abus_cleanup().
+	/* returns at once if already completed */
+	ret = completion_wait(&json_rpc->completion, timeout);
+
+	/* expired by the A-Bus thread */
+	if (ret == 0 && json_rpc->error_code == -ETIMEDOUT)
+		ret = -ETIMEDOUT;
+
+	return ret;
+}
+
+/*!
+	Cancel an asynchronous method request
 
   \param abus	pointer to A-Bus handle
-  \param[in] service_name	name of service where the method belongs to
-  \param[in] method_name	name of method to be exposed
-  \param[in] method_callback	pointer to call-back function
-  \param[in] flags	flags specifying method callback
-  \param[in] arg	cookie to be passed back to method_callback
-  \param[in] descr	string describing the method to be declared, may be NULL
-  \param[in] fmt	abus_format describing the argument of method, may be NULL
-  \param[in] result_fmt	abus_format describing the result of method, may be NULL
+  \param json_rpc pointer to an opaque handle of a JSON RPC
+  \return   0 if successful, non nul value otherwise
+  \sa abus_request_method_invoke_async()
+ */
+int abus_request_method_cancel_async(abus_t *abus, json_rpc_t *json_rpc)
+{
+	json_rpc_t *json_rpc_found;
+	abus_method_t *resp_handler = __atomic_load_n(&json_rpc->cb_context, __ATOMIC_ACQUIRE);
 
-  \return 0 if successful, non nul value otherwise
-  \sa abus_undecl_method()
+	if (json_val_is_undef(&json_rpc->id) ||
+			(resp_handler && !(resp_handler->flags & ABUS_RPC_ASYNC)))
+		return -ENXIO;
+
+	json_rpc_found = abus_req_untrack(abus, &json_rpc->id);
+
+	if (json_rpc_found != json_rpc)
+		return -ENXIO;
+
+	/* untracked, nobody else completes it.
+	   Bust any abus_request_method_wait_async() waiting,
+	   a completion queue only forgets about it */
+	if (json_rpc->cb_context)
+		abus_req_complete(json_rpc->cb_context, json_rpc, false);
+	/* TODO return code if nothing to cancel ? */
+
+	return 0;
+}
+
+/*
+  Send an async request, its resp_handler released upon failure
  */
-int abus_decl_method(abus_t *abus, const char *service_name, const char *method_name,
-				abus_callback_t method_callback, int flags, void *arg,
-				const char *descr, const char *fmt, const char *result_fmt)
+static int abus_invoke_async(abus_t *abus, json_rpc_t *json_rpc, int timeout, abus_method_t *resp_handler)
 {
-	abus_method_t *method;
-	int ret;
+	int payload_fd, ret;
 
-	ret = method_lookup(abus, service_name, method_name, CreateIfNotThere, NULL, &method);
+	ret = abus_launch_thread_ondemand(abus);
 	if (ret)
-		return ret;
+		goto untracked;
 
-	pthread_mutex_lock(&abus->mutex);
+	/* partial results and final response could be handled out of order */
+	if ((resp_handler->flags & ABUS_RPC_STREAM) && abus->recv_thread_nb > 0) {
+		ret = -EOPNOTSUPP;
+		goto untracked;
+	}
 
-	if (method->descr)
-		free(method->descr);
-	if (method->fmt)
-		free(method->fmt);
-	if (method->result_fmt)
-		free(method->result_fmt);
+	/* partial results welcome by the response handler */
+	json_rpc->stream = (resp_handler->flags & ABUS_RPC_STREAM) != 0;
 
-	method->callback = method_callback;
-	method->flags = flags;
-	method->arg = arg;
-	method->descr = descr ? strdup(descr) : NULL;
-	method->fmt = fmt ? strdup(fmt) : NULL;
-	method->result_fmt = result_fmt ? strdup(result_fmt) : NULL;
+	ret = json_rpc_req_finalize(json_rpc);
 
-	if (abus_method_is_excl(method))
-		pthread_mutex_init(&method->excl_mutex, NULL);
+	json_rpc->cb_context = resp_handler;
+	json_rpc->error_code = 0;
+	completion_init(&json_rpc->completion);
 
-	pthread_mutex_unlock(&abus->mutex);
+	assert(!json_val_is_undef(&json_rpc->id));
+	ret = abus_req_track(abus, json_rpc, timeout);
+	if (ret != 0)
+		goto untracked;
+
+	ret = json_rpc_payload_seal(json_rpc, &payload_fd);
+	if (ret != 0)
+		goto failed;
+
+	/* send the request through serv socket, response coming from this sock */
+
+	ret = abus_cork_sendto_svc(abus, json_rpc, &payload_fd);
+	if (ret != 0)
+		goto failed;
+
+	json_rpc_payload_release(json_rpc);
 
 	return 0;
+
+failed:
+	/* unless a response or the timeout got it meanwhile */
+	if (abus_req_untrack(abus, &json_rpc->id) != json_rpc)
+		return ret;
+untracked:
+	json_rpc->cb_context = NULL;
+	/* nothing to wait for */
+	completion_complete(&json_rpc->completion);
+	/* neither sent nor completed */
+	if (resp_handler->cq)
+		abus_cq_push(resp_handler->cq, NULL);
+	free(resp_handler);
+	return ret;
 }
 
 /*!
-	Undeclare an A-Bus method
+  Asynchronous invocation of a RPC
+
+  When no response comes back within timeout, the callback is called by
+  the A-Bus thread with a response where json_rpc_get_error() gives -ETIMEDOUT.
 
-  \param[in] service_name	name of service where the method belongs to
-  \param[in] method_name	name of method to be unexposed
   \param abus	pointer to A-Bus handle
-  \return 0 if successful, non nul value otherwise
-  \sa abus_decl_method()
- */
-int abus_undecl_method(abus_t *abus, const char *service_name, const char *method_name)
+  \param json_rpc pointer to an opaque handle of a JSON RPC
+  \param[in] timeout	receiving timeout in milliseconds, 0 or negative for none
+  \param[in] callback	function to be called upon response or timeout. may be NULL.
+  \param[in] flags		ABUS_RPC flags
+  \param[in] arg			opaque pointer value to be passed to callback. may be NULL.
+  \return   0 if successful, non nul value otherwise
+
+  \sa abus_request_method_wait_async(), abus_request_method_cancel_async()
+  \todo implement abus_req_service_list() for async
+*/
+int abus_request_method_invoke_async(abus_t *abus, json_rpc_t *json_rpc, int timeout, abus_callback_t callback, int flags, void *arg)
 {
-	abus_method_t *method;
-	abus_service_t *service;
-	int ret;
+	abus_method_t *resp_handler;
 
-	ret = method_lookup(abus, service_name, method_name, LookupOnly, &service, &method);
-	if (ret)
-		return ret;
+	resp_handler = calloc(1, sizeof(abus_method_t));
+	if (!resp_handler)
+		return -ENOMEM;
+	resp_handler->callback = callback;
+	resp_handler->flags = (flags & ~ABUS_RPC_EXCL) | ABUS_RPC_ASYNC;
+	resp_handler->arg = arg;
 
-	if (!service || !method)
-		return JSONRPC_NO_METHOD;
+	return abus_invoke_async(abus, json_rpc, timeout, resp_handler);
+}
 
-	pthread_mutex_lock(&abus->mutex);
+/*!
+  Create a completion queue, to reap asynchronous requests in batches
 
-	if (abus_method_is_excl(method))
-		pthread_mutex_destroy(&method->excl_mutex);
+  \return   pointer to a completion queue if successful, NULL otherwise
+  \sa abus_request_method_invoke_cq(), abus_cq_wait(), abus_cq_cleanup()
+ */
+abus_cq_t *abus_cq_init(void)
+{
+	pthread_condattr_t attr;
+	abus_cq_t *cq;
 
-	if (method->descr)
-		free(method->descr);
+	cq = calloc(1, sizeof(*cq));
+	if (!cq)
+		return NULL;
 
-	if (method->fmt)
-		free(method->fmt);
+	pthread_mutex_init(&cq->mutex, NULL);
 
-	if (method->result_fmt)
-		free(method->result_fmt);
+	/* deadlines of abus_cq_wait() immune to wall clock changes */
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&cq->cond, &attr);
+	pthread_condattr_destroy(&attr);
 
-	/* FIXME: assumes the hashtab still pointing at element found */
-	free(hkey(service->method_htab));
-	free(hstuff(service->method_htab));
-	hdel(service->method_htab);
+	return cq;
+}
 
-	/* no more stuff in service? */
-	service_may_cleanup(abus, service, service_name);
+/*!
+  Release a completion queue
 
-	pthread_mutex_unlock(&abus->mutex);
+  \param cq	pointer to a completion queue
+  \return   0 if successful, -EBUSY if requests bound to it are still outstanding
+  \sa abus_cq_init()
+ */
+int abus_cq_cleanup(abus_cq_t *cq)
+{
+	if (!cq)
+		return 0;
+
+	pthread_mutex_lock(&cq->mutex);
+	if (cq->outstanding > 0) {
+		pthread_mutex_unlock(&cq->mutex);
+		return -EBUSY;
+	}
+	pthread_mutex_unlock(&cq->mutex);
+
+	pthread_cond_destroy(&cq->cond);
+	pthread_mutex_destroy(&cq->mutex);
+	free(cq->ring);
+	free(cq);
 
 	return 0;
 }
 
+/*
+  Account for one more request, making room to queue it upon completion
+ */
+static int abus_cq_bind(abus_cq_t *cq)
+{
+	json_rpc_t **ring;
+	unsigned i, ring_sz;
+
+	pthread_mutex_lock(&cq->mutex);
 
-/*!
-	Initialize for request method, client side
+	if (cq->count + cq->outstanding >= cq->ring_sz) {
+		ring_sz = cq->ring_sz ? cq->ring_sz*2 : 16;
+		ring = malloc(ring_sz * sizeof(*ring));
+		if (!ring) {
+			pthread_mutex_unlock(&cq->mutex);
+			return -ENOMEM;
+		}
+		for (i = 0; i < cq->count; i++)
+			ring[i] = cq->ring[(cq->head + i) & (cq->ring_sz-1)];
+		free(cq->ring);
+		cq->ring = ring;
+		cq->ring_sz = ring_sz;
+		cq->head = 0;
+	}
+	cq->outstanding++;
 
-  Implicit: expects a response, otherwise use notification/event
+	pthread_mutex_unlock(&cq->mutex);
 
-  Rem: an empty \a service_name and a \a method_name of "*" will make
-  abus_request_method_invoke() get the list of running services on the machine.
+	return 0;
+}
+
+/*!
+  Asynchronous invocation of a RPC, to be reaped from a completion queue
+
+  Once reaped through abus_cq_wait(), the request holds the response, or
+  the error -ETIMEDOUT when none came back within timeout, see json_rpc_get_error().
+  It must not be released before being reaped, unless cancelled.
 
-  \param[in] service_name	name of service where the method belongs to
-  \param[in] method_name	name of method to be later invoked
   \param abus	pointer to A-Bus handle
-  \return json_rpc pointer to an opaque handle of a JSON RPC if successful, a NULL pointer otherwise
-  \sa abus_request_method_invoke(), abus_request_method_cleanup()
- */
-json_rpc_t *abus_request_method_init(abus_t *abus, const char *service_name, const char *method_name)
+  \param json_rpc pointer to an opaque handle of a JSON RPC
+  \param[in] timeout	receiving timeout in milliseconds, 0 or negative for none
+  \param cq	pointer to a completion queue
+  \param[in] flags		ABUS_RPC flags
+  \return   0 if successful, non nul value otherwise
+
+  \sa abus_cq_init(), abus_cq_wait(), abus_request_method_cancel_async()
+*/
+int abus_request_method_invoke_cq(abus_t *abus, json_rpc_t *json_rpc, int timeout, abus_cq_t *cq, int flags)
 {
-	json_rpc_t *json_rpc;
+	abus_method_t *resp_handler;
 	int ret;
 
-	json_rpc = json_rpc_req_init(service_name, method_name, abus->id++);
-	if (!json_rpc)
-		return NULL;
+	resp_handler = calloc(1, sizeof(abus_method_t));
+	if (!resp_handler)
+		return -ENOMEM;
+	/* nothing to call back, hence to run in a thread of its own, nor to take partial results */
+	resp_handler->flags = (flags & ~(ABUS_RPC_EXCL|ABUS_RPC_THREADED|ABUS_RPC_STREAM)) | ABUS_RPC_ASYNC;
+	resp_handler->cq = cq;
 
-	/* request for event subscribe MUST be sent on A-Bus socket
-	 * in order to get the notifications on that socket
-	 */
-	if (!strcmp(method_name, ABUS_SUBSCRIBE_METHOD)) {
-		/* A-Bus thread most likely already started/socket created
-		 * by abus_event_subscribe()
-		 */
-		ret = abus_launch_thread_ondemand(abus);
-		if (ret != 0) {
-			json_rpc_cleanup(json_rpc);
-			return NULL;
-		}
-		json_rpc->sock = abus->sock;
+	ret = abus_cq_bind(cq);
+	if (ret != 0) {
+		free(resp_handler);
+		return ret;
 	}
 
-	return json_rpc;
+	return abus_invoke_async(abus, json_rpc, timeout, resp_handler);
 }
 
-/*
-	To be used by abus_request_method_invoke_async()
+/*!
+  Reap completed asynchronous requests from a completion queue
+
+  With ABUS_CQ_WAIT_ALL, wait until max requests completed or none
+  bound to the queue is outstanding anymore, otherwise return as soon as
+  at least one completed. Upon timeout, whatever completed is reaped.
+
+  \param cq	pointer to a completion queue
+  \param[out] json_rpc	array where to store the reaped requests
+  \param[in] max	size of the json_rpc array
+  \param[in] timeout	waiting timeout in milliseconds, negative to wait forever
+  \param[in] flags	ABUS_CQ_WAIT_ANY or ABUS_CQ_WAIT_ALL
+  \return   number of requests reaped, 0 if nothing to wait for,
+  	-ETIMEDOUT if none completed in time, non nul value otherwise
+  \sa abus_request_method_invoke_cq()
  */
-static int abus_req_track(abus_t *abus, json_rpc_t *json_rpc)
+int abus_cq_wait(abus_cq_t *cq, json_rpc_t **json_rpc, int max, int timeout, int flags)
 {
-	pthread_mutex_lock(&abus->mutex);
-
-	if (!abus->outstanding_req_htab)
-		abus->outstanding_req_htab = hcreate(1);
+	struct timespec deadline;
+	unsigned want;
+	int i, n, ret = 0;
 
-	/* no strndup() for key, since it shares the json_rpc memory */
-	hadd(abus->outstanding_req_htab, json_rpc->id.u.data, json_rpc->id.length, json_rpc);
+	if (max <= 0)
+		return -EINVAL;
 
-	pthread_mutex_unlock(&abus->mutex);
+	if (timeout > 0) {
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec  += timeout / 1000;
+		deadline.tv_nsec += (timeout % 1000) * 1000000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_nsec -= 1000000000;
+			deadline.tv_sec++;
+		}
+	}
 
-	return 0;
-}
+	pthread_mutex_lock(&cq->mutex);
 
-static json_rpc_t *abus_req_untrack(abus_t *abus, const json_val_t *id_val)
-{
-	json_rpc_t *json_rpc;
+	for (;;) {
+		if (flags & ABUS_CQ_WAIT_ALL)
+			want = cq->count + cq->outstanding < (unsigned)max ? cq->count + cq->outstanding : (unsigned)max;
+		else
+			want = cq->outstanding > 0 ? 1 : 0;
 
-	if (!abus->outstanding_req_htab)
-		return NULL;
+		if (cq->count >= want || ret != 0 || timeout == 0)
+			break;
 
-	pthread_mutex_lock(&abus->mutex);
+		cq->waiters++;
+		if (timeout < 0)
+			pthread_cond_wait(&cq->cond, &cq->mutex);
+		else
+			ret = pthread_cond_timedwait(&cq->cond, &cq->mutex, &deadline);
+		cq->waiters--;
+	}
 
-	if (hfind(abus->outstanding_req_htab, id_val->u.data, id_val->length)) {
-		json_rpc = hstuff(abus->outstanding_req_htab);
-		/* no free() for key, since it shared the json_rpc id val memory */
-		hdel(abus->outstanding_req_htab);
-	} else {
-		json_rpc = NULL;
+	n = cq->count < (unsigned)max ? (int)cq->count : max;
+	for (i = 0; i < n; i++) {
+		json_rpc[i] = cq->ring[cq->head];
+		cq->head = (cq->head + 1) & (cq->ring_sz-1);
 	}
+	cq->count -= n;
 
-	pthread_mutex_unlock(&abus->mutex);
+	if (n == 0 && (cq->outstanding > 0))
+		n = -ETIMEDOUT;
 
-	return json_rpc;
-}
+	pthread_mutex_unlock(&cq->mutex);
 
+	return n;
+}
 
-/*!
-	Wait for an asynchronous method request
 
-  \param abus	pointer to A-Bus handle
-  \param json_rpc pointer to an opaque handle of a JSON RPC
-  \param[in] timeout waiting timeout in milliseconds
-  \return   0 if successful or reponse already received, non nul value otherwise
-  \sa abus_request_method_invoke_async()
+/*
+  Get the shared memory channel of the calling thread to a service,
+  attaching a new one if needed.
+  Returns NULL when the service is to be reached by datagrams.
  */
-int abus_request_method_wait_async(abus_t *abus, json_rpc_t *json_rpc, int timeout)
+static shm_chan_t *abus_shm_chan_lookup(const char *service_name, int timeout)
 {
-	int ret;
-	struct timespec ts;
+	char buf[JSONRPC_SVCNAME_SZ_MAX + 128];
+	json_rpc_t *json_rpc;
+	shm_chan_t *chan;
+	int fds[SHM_FD_NB];
+	int len, ret;
+
+	if (shm_clnt_lookup(service_name, &chan) == 0)
+		return chan;
+
+	chan = shm_chan_create(fds);
+	if (!chan) {
+		/* not supported by this system, don't insist */
+		if (errno == ENOSYS)
+			shm_clnt_register(service_name, NULL);
+		return NULL;
+	}
 
-	if (!json_rpc->cb_context)
-		return 0;
+	len = snprintf(buf, sizeof(buf), "{\"jsonrpc\":\"2.0\",\"method\":\"%s.%s\",\"id\":0,\"params\":{}}",
+				service_name, ABUS_SHM_ATTACH_METHOD);
 
-	pthread_mutex_lock(&json_rpc->mutex);
+	ret = un_sock_transaction_fds(buf, len, sizeof(buf), service_name, timeout, fds, SHM_FD_NB, NULL, NULL);
 
-	clock_gettime(CLOCK_REALTIME, &ts);
+	/* the service has its own copy now */
+	close(fds[SHM_FD_MEM]);
+	close(fds[SHM_FD_HUP]);
 
-	ts.tv_sec  +=  timeout / 1000;
-	ts.tv_nsec += (timeout % 1000) * 1000000;
-	if (ts.tv_nsec >= 1000000000) {
-		ts.tv_nsec  -= 1000000000;
-		ts.tv_sec++;
+	/* service unreachable, let the datagram path report it */
+	if (ret < 0) {
+		shm_chan_put(chan);
+		return NULL;
 	}
 
-	ret = 0;
-	while (json_rpc->cb_context && ret == 0)
-			ret = pthread_cond_timedwait(&json_rpc->cond, &json_rpc->mutex, &ts);
+	json_rpc = json_rpc_init();
+	if (!json_rpc) {
+		shm_chan_put(chan);
+		return NULL;
+	}
 
-	pthread_mutex_unlock(&json_rpc->mutex);
+	ret = json_rpc_parse_msg(json_rpc, buf, ret);
+	if (ret || json_rpc->parsing_status != PARSING_OK || json_rpc->error_code) {
+		/* older or polling service, remember the refusal */
+		shm_chan_put(chan);
+		chan = NULL;
+	}
+	json_rpc_cleanup(json_rpc);
 
-	if (ret != 0)
-		return -ret;
+	if (shm_clnt_register(service_name, chan) != 0 && chan) {
+		shm_chan_put(chan);
+		chan = NULL;
+	}
 
-	return 0;
+	return chan;
 }
 
-/*!
-	Cancel an asynchronous method request
-
-  \param abus	pointer to A-Bus handle
-  \param json_rpc pointer to an opaque handle of a JSON RPC
-  \return   0 if successful, non nul value otherwise
-  \sa abus_request_method_invoke_async()
+/*
+  Send a request and get its response, picking the transport according to conf.
+  File descriptors passed along the request go by datagram on a socket of
+  their own, the ones of the response are stored in rfds if not NULL.
  */
-int abus_request_method_cancel_async(abus_t *abus, json_rpc_t *json_rpc)
+static int abus_transaction(abus_t *abus, int sock, void *buf, size_t len, size_t bufsz, const char *service_name, int timeout,
+				const int *fds, int nfds, int *rfds, int *rnfds)
 {
-	json_rpc_t *json_rpc_found;
-	abus_method_t *resp_handler = json_rpc->cb_context;
+	if (nfds > 0)
+		return un_sock_transaction_fds(buf, len, bufsz, service_name, timeout, fds, nfds, rfds, rnfds);
 
-	if (json_val_is_undef(&json_rpc->id) ||
-			(resp_handler && !(resp_handler->flags & ABUS_RPC_ASYNC)))
-		return -ENXIO;
+	if (sock != -1)
+		return un_sock_transaction(sock, buf, len, bufsz, service_name, timeout);
 
-	json_rpc_found = abus_req_untrack(abus, &json_rpc->id);
+	if (abus->conf.shm) {
+		shm_chan_t *chan;
+		int ret, retry = 1;
 
-	if (json_rpc_found != json_rpc)
-		return -ENXIO;
+		while ((chan = abus_shm_chan_lookup(service_name, timeout)) != NULL) {
+			ret = shm_chan_transaction(chan, buf, len, bufsz, timeout, rfds, rnfds);
+
+			/* a late response would be taken for the one of the next request */
+			if (ret < 0)
+				shm_clnt_forget(service_name);
 
-	pthread_mutex_lock(&json_rpc->mutex);
-	if (json_rpc->cb_context) {
-		free(json_rpc->cb_context);
-		json_rpc->cb_context = NULL;
-	    /* bust any abus_request_method_wait_async() waiting */
-		pthread_cond_broadcast(&json_rpc->cond);
+			/* once more if the service restarted since, nothing got sent then */
+			if (ret != -EPIPE || retry-- == 0)
+				return ret;
+		}
 	}
-	/* TODO return code if nothing to cancel ? */
-	pthread_mutex_unlock(&json_rpc->mutex);
 
-	return 0;
-}
+	if (abus->conf.seqpacket)
+		return un_sock_transaction_session(buf, len, bufsz, service_name, timeout, rfds, rnfds);
 
-/*!
-  Asynchronous invocation of a RPC
+	if (!abus->conf.no_cached_sock)
+		return un_sock_transaction_cached(buf, len, bufsz, service_name, timeout, rfds, rnfds);
 
-  \param abus	pointer to A-Bus handle
-  \param json_rpc pointer to an opaque handle of a JSON RPC
-  \param[in] timeout	receiving timeout in milliseconds
-  \param[in] callback	function to be called upon response or timeout. may be NULL.
-  \param[in] flags		ABUS_RPC flags
-  \param[in] arg			opaque pointer value to be passed to callback. may be NULL.
-  \return   0 if successful, non nul value otherwise
+	return un_sock_transaction_fds(buf, len, bufsz, service_name, timeout, NULL, 0, rfds, rnfds);
+}
 
-  \sa abus_request_method_wait_async(), abus_request_method_cancel_async()
-  \todo implement timeout callback
-  \todo implement abus_req_service_list() for async
-*/
-int abus_request_method_invoke_async(abus_t *abus, json_rpc_t *json_rpc, int timeout, abus_callback_t callback, int flags, void *arg)
+/*
+  Serve a request to a method of this A-Bus from the calling thread, as
+  abus_process_msg() would, without any socket round trip. Threaded
+  methods are handed to a worker. The other ones are only run from the
+  A-Bus thread, which serves them one at a time anyway.
+
+  *call_p gets where to wait for the response, call_p is NULL for a
+  notification. Returns 1 if the request is to go through the socket
+ */
+static int abus_serve_local(abus_t *abus, json_rpc_t *json_rpc, int payload_fd, struct abus_local_call **call_p)
 {
+	struct abus_local_call *call = NULL;
+	abus_method_t *method;
+	json_rpc_t *req;
 	int ret;
-	abus_method_t *resp_handler;
 
-	ret = abus_launch_thread_ondemand(abus);
-	if (ret)
-		return ret;
+	/* e.g. subscription, to be issued on the A-Bus socket */
+	if (json_rpc->sock != -1)
+		return 1;
 
-	ret = json_rpc_req_finalize(json_rpc);
+	/* keeps the method alive, even if undeclared meanwhile */
+	epoch_enter();
 
-	resp_handler = calloc(1, sizeof(abus_method_t));
-	resp_handler->callback = callback;
-	resp_handler->flags = (flags & ~ABUS_RPC_EXCL) | ABUS_RPC_ASYNC;
-	resp_handler->arg = arg;
+	if (method_lookup(abus, json_rpc->service_name, json_rpc->method_name, LookupOnly, NULL, &method) != 0 ||
+			(!abus_method_is_threaded(method) &&
+			 !(abus->srv_thread_running && pthread_equal(pthread_self(), abus->srv_thread)))) {
+		epoch_exit();
+		return 1;
+	}
 
-	json_rpc->cb_context = resp_handler;
+	req = json_rpc_init();
+	if (req && call_p) {
+		call = calloc(1, sizeof(*call));
+		if (!call) {
+			json_rpc_cleanup(req);
+			req = NULL;
+		}
+	}
+	if (!req) {
+		epoch_exit();
+		return -ENOMEM;
+	}
+	if (call) {
+		call->refs = 2;
+		req->local = call;
+		*call_p = call;
+	}
 
-	assert(!json_val_is_undef(&json_rpc->id));
-	abus_req_track(abus, json_rpc);
+	ret = json_rpc_parse_msg(req, json_rpc->msgbuf, json_rpc->msglen);
+	if (!req->error_code && (ret || req->parsing_status != PARSING_OK))
+		req->error_code = ret ? ret : JSONRPC_PARSE_ERROR;
+
+	/* as if passed along the message */
+	if (payload_fd != -1) {
+		req->fds[0] = fcntl(payload_fd, F_DUPFD_CLOEXEC, 0);
+		if (req->fds[0] == -1)
+			req->error_code = JSONRPC_INTERNAL_ERROR;
+		else
+			req->fd_count = 1;
+	}
 
-	/* send the request through serv socket, response coming from this sock */
+	json_rpc_resp_init(req);
 
-	ret = un_sock_sendto_svc(abus->sock, json_rpc->msgbuf, json_rpc->msglen, json_rpc->service_name);
-	if (ret != 0)
-		return ret;
+	ret = 0;
+	if (req->error_code == 0) {
+		ret = abus_do_rpc(abus, req, method);
+
+		/* responded to from a worker thread, which may be done with req already,
+		   or through abus_complete_response() */
+		if (ret == 0 && (abus_method_is_threaded(method) || req->resp_deferred)) {
+			epoch_exit();
+			return 0;
+		}
+	}
+
+	if (ret) {
+		/* threaded method not run (e.g. queue full) */
+		req->cb_context = NULL;
+		json_rpc_set_error(req, JSONRPC_SERVER_ERROR, NULL);
+	}
+	epoch_exit();
+
+	/* no response to a notification */
+	if (json_val_is_undef(&req->id) || json_rpc_resp_finalize(req) != 0)
+		req->msglen = 0;
+	abus_rpc_done(req);
 
 	return 0;
 }
 
+/*
+  Local counterpart of abus_transaction(), the response being swapped
+  into json_rpc->msgbuf. Returns its length, 0 if the method is not local
+ */
+static int abus_transaction_local(abus_t *abus, json_rpc_t *json_rpc, int timeout, int payload_fd)
+{
+	struct abus_local_call *call;
+	json_rpc_t *resp;
+	char *msgbuf;
+	int ret;
+
+	ret = abus_serve_local(abus, json_rpc, payload_fd, &call);
+	if (ret != 0)
+		return ret == 1 ? 0 : ret;
+
+	ret = completion_wait(&call->completion, timeout);
+	if (ret == 0) {
+		resp = call->resp;
+		call->resp = NULL;
+
+		if (resp->msglen > 0) {
+			/* the response of the method, without copy */
+			msgbuf = json_rpc->msgbuf;
+			json_rpc->msgbuf = resp->msgbuf;
+			json_rpc->msgbufsz = resp->msgbufsz;
+			resp->msgbuf = msgbuf;
+			ret = resp->msglen;
+
+			/* its payload, as if passed along the message */
+			if (json_rpc_payload_seal(resp, &payload_fd) == 0 && payload_fd != -1) {
+				json_rpc->fds[json_rpc->fd_count++] = payload_fd;
+				resp->payload_fd = -1;
+			}
+		} else {
+			ret = JSONRPC_INTERNAL_ERROR;
+		}
+
+		json_rpc_cleanup(resp);
+	}
+
+	abus_local_call_put(call);
+
+	return ret;
+}
 
 /*!
  * Synchronous invocation of a method
 
+  A threaded method declared on the same A-Bus handle is handed to a worker
+  without any socket round trip. Other methods of the same A-Bus handle are
+  served by the A-Bus thread as usual, but when called from the A-Bus thread
+  itself, e.g. from a callback, where they are run right away, regardless
+  of \a timeout.
+
   \param abus	pointer to A-Bus handle
   \param json_rpc pointer to an opaque handle of a JSON RPC
   \param[in] flags		ABUS_RPC flags
@@ -1192,7 +4531,7 @@ int abus_request_method_invoke_async(abus_t *abus, json_rpc_t *json_rpc, int tim
  */
 int abus_request_method_invoke(abus_t *abus, json_rpc_t *json_rpc, int flags, int timeout)
 {
-	int ret;
+	int payload_fd, ret;
 
 	ret = json_rpc_req_finalize(json_rpc);
 
@@ -1210,7 +4549,19 @@ int abus_request_method_invoke(abus_t *abus, json_rpc_t *json_rpc, int flags, in
 	 *
 	 * recycle req msgbuf
 	 */
-	ret = un_sock_transaction(json_rpc->sock, json_rpc->msgbuf, json_rpc->msglen, json_rpc->msgbufsz, json_rpc->service_name, timeout);
+	ret = json_rpc_payload_seal(json_rpc, &payload_fd);
+	if (ret)
+		return ret;
+
+	/* no round trip through a socket to a service of this A-Bus */
+	ret = abus_transaction_local(abus, json_rpc, timeout, payload_fd);
+	if (ret == 0)
+		ret = abus_transaction(abus, json_rpc->sock, json_rpc->msgbuf, json_rpc->msglen, json_rpc->msgbufsz, json_rpc->service_name, timeout,
+				&payload_fd, payload_fd != -1, json_rpc->fds, &json_rpc->fd_count);
+
+	/* make room for the payload of the response */
+	json_rpc_payload_release(json_rpc);
+
 	if (ret < 0)
 		return ret;
 
@@ -1228,7 +4579,266 @@ int abus_request_method_invoke(abus_t *abus, json_rpc_t *json_rpc, int flags, in
 	json_rpc->msgbuf = NULL;
 	json_rpc->msglen = 0;
 
-	return ret;
+	return ret;
+}
+
+/*!
+ * Invocation of a method without response, i.e. a JSON-RPC notification
+
+  The request is sent without "id", the service does not respond to it,
+  and the call does not wait. Errors of the method go unnoticed.
+  Like a synchronous call, it does not start the A-Bus thread.
+  As with abus_request_method_invoke(), a threaded method of the same
+  A-Bus handle is handed to a worker without any socket round trip.
+
+  \param abus	pointer to A-Bus handle
+  \param json_rpc pointer to an opaque handle of a JSON RPC
+  \param[in] flags		unused so far
+  \return   0 if successfully sent, non nul value otherwise
+  \sa abus_request_method_init(), abus_request_method_cleanup()
+ */
+int abus_request_method_notify(abus_t *abus, json_rpc_t *json_rpc, int flags)
+{
+	int payload_fd, ret;
+
+	if (json_rpc->service_name[0] == '\0')
+		return -EINVAL;
+
+	ret = json_rpc_req_drop_id(json_rpc);
+	if (ret)
+		return ret;
+
+	json_rpc->stream = false;
+	json_rpc_req_finalize(json_rpc);
+
+	ret = json_rpc_payload_seal(json_rpc, &payload_fd);
+	if (ret)
+		return ret;
+
+	ret = abus_serve_local(abus, json_rpc, payload_fd, NULL);
+	if (ret == 1) {
+		/* in order with the corked requests to that service */
+		abus_corks_send_svc(abus, json_rpc->service_name);
+
+		/* no response to receive, hence no need for the A-Bus socket */
+		ret = un_sock_sendto_svc_cached(json_rpc->msgbuf, json_rpc->msglen, json_rpc->service_name,
+						&payload_fd, payload_fd != -1);
+	}
+
+	json_rpc_payload_release(json_rpc);
+
+	free(json_rpc->msgbuf);
+	json_rpc->msgbuf = NULL;
+	json_rpc->msglen = 0;
+
+	return ret;
+}
+
+/*!
+ * Synchronous invocation of several methods of a service, in one round trip
+
+  The requests are sent as a single JSON-RPC batch. Each one then holds its
+  own response, or error, as with abus_request_method_invoke(). A request
+  left without response gets the error -ENOMSG.
+
+  \param abus	pointer to A-Bus handle
+  \param json_rpc array of pointers to requests to the same service, see abus_request_method_init()
+  \param[in] count	number of requests
+  \param[in] flags		ABUS_RPC flags
+  \param[in] timeout   receiving timeout in milliseconds
+  \return   0 if all the requests got a response, successful or not, -EMSGSIZE if the
+  	requests do not fit in one message, non nul value otherwise
+  \sa abus_request_method_invoke()
+ */
+int abus_request_batch_invoke(abus_t *abus, json_rpc_t **json_rpc, int count, int flags, int timeout)
+{
+	const char *p, *end, *elem_end;
+	json_rpc_t *resp;
+	int i, len, ret, answered = 0;
+	char *buf;
+
+	if (count <= 0 || json_rpc[0]->service_name[0] == '\0')
+		return -EINVAL;
+
+	/* '[', the requests once finalized, their separators and ']' */
+	len = 1;
+	for (i = 0; i < count; i++) {
+		if (strcmp(json_rpc[i]->service_name, json_rpc[0]->service_name) ||
+				json_val_is_undef(&json_rpc[i]->id) || json_rpc[i]->payload)
+			return -EINVAL;
+		len += json_rpc[i]->msglen + 3;
+	}
+	if (len > JSONRPC_REQ_SZ_MAX)
+		return -EMSGSIZE;
+
+	buf = malloc(JSONRPC_RESP_SZ_MAX);
+	if (!buf)
+		return -ENOMEM;
+
+	len = 0;
+	for (i = 0; i < count; i++) {
+		json_rpc_req_finalize(json_rpc[i]);
+		buf[len++] = i == 0 ? '[' : ',';
+		memcpy(buf + len, json_rpc[i]->msgbuf, json_rpc[i]->msglen);
+		len += json_rpc[i]->msglen;
+
+		free(json_rpc[i]->msgbuf);
+		json_rpc[i]->msgbuf = NULL;
+		json_rpc[i]->msglen = 0;
+		json_rpc[i]->error_code = -ENOMSG;
+	}
+	buf[len++] = ']';
+
+	ret = abus_transaction(abus, -1, buf, len, JSONRPC_RESP_SZ_MAX, json_rpc[0]->service_name,
+					timeout, NULL, 0, NULL, NULL);
+	if (ret < 0) {
+		free(buf);
+		return ret;
+	}
+
+	end = buf + ret;
+	p = json_skip_ws(buf, end);
+
+	/* the whole batch turned down, e.g. a parse error */
+	if (p < end && *p == '{') {
+		resp = json_rpc_init();
+		if (!resp) {
+			free(buf);
+			return -ENOMEM;
+		}
+		ret = json_rpc_parse_msg(resp, p, end - p);
+		if (resp->error_code)
+			ret = resp->error_code;
+		else if (!ret)
+			ret = JSONRPC_PARSE_ERROR;
+		json_rpc_cleanup(resp);
+		free(buf);
+		return ret;
+	}
+
+	for (p++; ; p++) {
+		p = json_skip_ws(p, end);
+		if (p >= end || *p != '{' || (elem_end = json_object_end(p, end)) == NULL)
+			break;
+
+		resp = json_rpc_init();
+		if (!resp)
+			break;
+		json_rpc_parse_msg(resp, p, elem_end - p);
+
+		/* in any order */
+		for (i = 0; i < count && !json_val_is_undef(&resp->id); i++) {
+			if (json_rpc[i]->error_code == -ENOMSG && resp->id.u.data &&
+					json_rpc[i]->id.length == resp->id.length &&
+					!memcmp(json_rpc[i]->id.u.data, resp->id.u.data, resp->id.length)) {
+				json_rpc_resp_move(json_rpc[i], resp);
+				answered++;
+				break;
+			}
+		}
+		json_rpc_cleanup(resp);
+
+		p = json_skip_ws(elem_end, end);
+		if (p >= end || *p != ',')
+			break;
+	}
+
+	free(buf);
+
+	return answered == count ? 0 : -ENOMSG;
+}
+
+/*!
+  Defer the response of the method request being served
+
+  To be called from the method callback, which may then return without
+  having filled the response. The request then belongs to the application,
+  until passed to abus_complete_response(), from any thread.
+
+  \param abus	pointer to A-Bus handle
+  \param json_rpc pointer to an opaque handle of the JSON RPC of the request
+  \return   0 if successful, -EINVAL if not a method request, non nul value otherwise
+  \sa abus_complete_response()
+ */
+int abus_defer_response(abus_t *abus, json_rpc_t *json_rpc)
+{
+	if (!json_rpc->service_name || !json_rpc->method_name ||
+			json_rpc->async_req_context || json_rpc->resp_deferred)
+		return -EINVAL;
+
+	json_rpc->resp_deferred = true;
+
+	return 0;
+}
+
+/*!
+  Send the deferred response of a method request, and release the request
+
+  The response is filled beforehand, as in a method callback, with
+  json_rpc_append_*() or json_rpc_set_error().
+
+  \param abus	pointer to A-Bus handle
+  \param json_rpc pointer to an opaque handle of the JSON RPC of the request
+  \return   0 if successful, non nul value otherwise
+  \sa abus_defer_response()
+ */
+int abus_complete_response(abus_t *abus, json_rpc_t *json_rpc)
+{
+	int send_ret, ret = 0;
+
+	if (!json_rpc->resp_deferred)
+		return -EINVAL;
+
+	/* nothing to respond to a notification, even in error */
+	if (json_val_is_undef(&json_rpc->id))
+		json_rpc->msglen = 0;
+	else if ((ret = json_rpc_resp_finalize(json_rpc)) != 0)
+		json_rpc->msglen = 0;
+
+	send_ret = abus_rpc_done(json_rpc);
+	if (ret == 0)
+		ret = send_ret;
+
+	/* length sent by the datagram transports */
+	return ret < 0 ? ret : 0;
+}
+
+/*!
+  Send the result filled so far as a partial result of a streamed response
+
+  To be called from the method callback, or on a deferred request, as many
+  times as needed, the final response being sent as usual afterwards.
+  Each partial result is then filled anew, as a response, with json_rpc_append_*().
+  The client must have invoked the method asynchronously with ABUS_RPC_STREAM,
+  its response handler getting each partial result, see json_rpc_is_partial().
+
+  \param abus	pointer to A-Bus handle
+  \param json_rpc pointer to an opaque handle of the JSON RPC of the request
+  \return   0 if successful, -EOPNOTSUPP if the client does not take partial results,
+  	-EINVAL if not a method request or an error got set, non nul value otherwise
+  \sa abus_request_method_invoke_async()
+ */
+int abus_stream_response(abus_t *abus, json_rpc_t *json_rpc)
+{
+	int ret;
+
+	if (!json_rpc->service_name || !json_rpc->method_name ||
+			json_rpc->async_req_context || json_rpc->error_code)
+		return -EINVAL;
+	/* one message for the responses of a whole batch */
+	if (!json_rpc->stream || json_rpc->batch)
+		return -EOPNOTSUPP;
+
+	ret = json_rpc_resp_finalize_partial(json_rpc);
+	if (ret == 0)
+		ret = abus_resp_send(json_rpc);
+
+	/* fresh result for the next one, whatever happened to this one */
+	json_rpc_payload_release(json_rpc);
+	if (json_rpc_resp_init(json_rpc) != 0 && ret >= 0)
+		ret = -ENOMEM;
+
+	return ret < 0 ? ret : 0;
 }
 
 /*!
@@ -1252,20 +4862,40 @@ int abus_request_method_cleanup(abus_t *abus, json_rpc_t *json_rpc)
 /*
  \internal
  */
-json_rpc_t *abus_process_msg(abus_t *abus, const char *buffer, int len, const struct sockaddr *sock_src_addr, socklen_t sock_addrlen)
+json_rpc_t *abus_process_msg(abus_t *abus, const char *buffer, int len, const abus_msg_src_t *src)
 {
 	json_rpc_t *json_rpc;
-	int ret;
+	int i, ret;
 	abus_method_t *method = NULL;
 
 	json_rpc = json_rpc_init();
-	if (!json_rpc)
+	if (!json_rpc) {
+		for (i = 0; i < src->fd_count; i++)
+			close(src->fds[i]);
 		return NULL;
+	}
+
+	memcpy(&json_rpc->sock_src_addr, src->addr, src->addrlen);
+	json_rpc->sock_addrlen = src->addrlen;
 
-	memcpy(&json_rpc->sock_src_addr, sock_src_addr, sock_addrlen);
-	json_rpc->sock_addrlen = sock_addrlen;
+	json_rpc->sock = src->sock;
+
+	if (src->shm_chan) {
+		shm_chan_get(src->shm_chan);
+		json_rpc->shm_chan = src->shm_chan;
+	}
+	if (src->peer) {
+		un_sock_peer_get(src->peer);
+		json_rpc->peer = src->peer;
+	}
 
-	json_rpc->sock = abus->sock;
+	/* passed file descriptors now belong to the json_rpc */
+	for (i = 0; i < src->fd_count; i++) {
+		if (i < JSONRPC_FDS_MAX)
+			json_rpc->fds[json_rpc->fd_count++] = src->fds[i];
+		else
+			close(src->fds[i]);
+	}
 
 	ret = json_rpc_parse_msg(json_rpc, buffer, len);
 	if (!json_rpc->error_code && (ret || json_rpc->parsing_status != PARSING_OK)) {
@@ -1278,6 +4908,9 @@ json_rpc_t *abus_process_msg(abus_t *abus, const char *buffer, int len, const st
 		/* this is a request */
 		/* TODO: more than one cb possible */
 
+		if (src->batch)
+			abus_batch_get(src->batch, json_rpc);
+
 		ret = method_lookup(abus, json_rpc->service_name, json_rpc->method_name, LookupOnly, NULL, &method);
 		if (ret)
 			json_rpc->error_code = ret;
@@ -1287,32 +4920,64 @@ json_rpc_t *abus_process_msg(abus_t *abus, const char *buffer, int len, const st
 		if (json_rpc->error_code == 0) {
 	
 			ret = abus_do_rpc(abus, json_rpc, method);
-			/* TODO act upon failed ret? */
 	
-			/* no response for notification or threaded methods */
-			if (abus_method_is_threaded(method))
-				return json_rpc;
+			/* responded to from a worker thread, which may be done with it already */
+			if (ret == 0 && abus_method_is_threaded(method))
+				return NULL;
 
-			if (json_val_is_undef(&json_rpc->id)) {
-				json_rpc->msglen = 0;
-				json_rpc_cleanup(json_rpc);
+			/* to be responded later, through abus_complete_response() */
+			if (ret == 0 && json_rpc->resp_deferred)
 				return NULL;
+
+			if (ret) {
+				/* threaded method not run (e.g. queue full), respond from here */
+				json_rpc->cb_context = NULL;
+				json_rpc_set_error(json_rpc, JSONRPC_SERVER_ERROR, NULL);
 			}
 		}
+
+		/* no response to a notification, even in error */
+		if (json_val_is_undef(&json_rpc->id)) {
+			json_rpc->msglen = 0;
+			abus_rpc_done(json_rpc);
+			return NULL;
+		}
 	}
 	else if (!json_val_is_undef(&json_rpc->id))
 	{
 		/* this is an async response */
 		json_rpc_t *req_json_rpc;
 
+		if (json_rpc->stream) {
+			abus_req_partial(abus, json_rpc);
+
+			json_rpc->msglen = 0;
+			json_rpc_cleanup(json_rpc);
+			return NULL;
+		}
+
 		req_json_rpc = abus_req_untrack(abus, &json_rpc->id);
 	
 		if (req_json_rpc) {
+			bool threaded;
+
 			method = req_json_rpc->cb_context;
 			json_rpc->async_req_context = req_json_rpc;
 
+			/* the method goes away along with the request once completed */
+			threaded = abus_method_is_threaded(method);
+
 			ret = abus_do_rpc(abus, json_rpc, method);
-			/* TODO act upon failed ret? */
+			/* released by the worker thread */
+			if (ret == 0 && threaded)
+				return NULL;
+			if (ret && threaded) {
+				/* no worker for the response handler, run it from here */
+				abus_call_callback(method, json_rpc);
+				json_rpc->msglen = 0;
+				json_rpc_cleanup(json_rpc);
+				return NULL;
+			}
 			return json_rpc;
 		}
 
@@ -1324,6 +4989,10 @@ json_rpc_t *abus_process_msg(abus_t *abus, const char *buffer, int len, const st
 		return NULL;
 	}
 
+	/* invalid one, answered within the batch response too */
+	if (src->batch && !json_rpc->batch)
+		abus_batch_get(src->batch, json_rpc);
+
 	ret = json_rpc_resp_finalize(json_rpc);
 	/* TODO act upon failed ret? */
 
@@ -1388,7 +5057,7 @@ int abus_forward_rpc(abus_t *abus, char *buffer, int *buflen, int flags, int tim
 	/*
 	 * rem: recycle req msgbuf
 	 */
-	ret = un_sock_transaction(-1, buffer, *buflen, JSONRPC_RESP_SZ_MAX, service_name, timeout);
+	ret = abus_transaction(abus, -1, buffer, *buflen, JSONRPC_RESP_SZ_MAX, service_name, timeout, NULL, 0, NULL, NULL);
 	if (ret < 0) {
 		return ret;
 	}
@@ -1439,7 +5108,8 @@ void abus_req_introspect_service_cb(json_rpc_t *json_rpc, void *arg)
 					!strncmp(ABUS_GET_METHOD, method_name, hkeyl(service->method_htab)) ||
 					!strncmp(ABUS_SET_METHOD, method_name, hkeyl(service->method_htab)) ||
 					!strncmp(ABUS_SUBSCRIBE_METHOD, method_name, hkeyl(service->method_htab)) ||
-					!strncmp(ABUS_UNSUBSCRIBE_METHOD, method_name, hkeyl(service->method_htab)))
+					!strncmp(ABUS_UNSUBSCRIBE_METHOD, method_name, hkeyl(service->method_htab)) ||
+					!strncmp(ABUS_SHM_ATTACH_METHOD, method_name, hkeyl(service->method_htab)))
 				continue;
 	
 			json_rpc_append_args(json_rpc, JSON_OBJECT_BEGIN, -1);
@@ -1541,14 +5211,57 @@ int abus_check_valid_service_name(const char *name, size_t maxlen)
 /*
   pseudo callback for internal use, to offer get accessor of service list
  */
+struct abus_service_list_ctx {
+	abus_t *abus;
+	json_rpc_t *json_rpc;
+	int timeout;
+};
+
+/*
+  Add the service to the list if it answers, returns non zero on JSON error only
+ */
+static int abus_service_list_add(const char *service_name, void *arg)
+{
+	struct abus_service_list_ctx *ctx = arg;
+	char str[32];
+
+	if (abus_attr_get_str(ctx->abus, service_name, "abus.version",
+				str, sizeof(str), ctx->timeout) != 0)
+		return 0;
+
+	/* add object to array and add key "name" & string to object */
+
+	if (json_rpc_add_object_to_array(ctx->json_rpc) != 0)
+		return -1;
+
+	ctx->json_rpc->last_param_key = strdup("name");
+	return json_rpc_add_val(ctx->json_rpc, JSON_STRING, (char *)service_name,
+				strlen(service_name)+1);
+}
+
 int abus_req_service_list(abus_t *abus, json_rpc_t *json_rpc, int timeout)
 {
-	DIR *dirp;
+	struct abus_service_list_ctx ctx = { abus, json_rpc, timeout };
+	DIR *dirp = NULL;
 	struct dirent *entry;
 	ssize_t ret = 0;
 	char service_path[UNIX_PATH_MAX];
 	char pid_rel_path[UNIX_PATH_MAX];
-	char str[32];
+
+	if (abus_abstract) {
+		json_rpc->last_key_token = TOK_PARAMS;
+
+		json_rpc->last_param_key = strdup("services");
+		if (json_rpc_add_array(json_rpc) != 0)
+			goto error_dir;
+
+		ret = un_sock_abstract_services(abus_service_list_add, &ctx);
+		if (ret)
+			goto error_dir;
+
+		json_rpc->parsing_status = PARSING_OK;
+		goto error_dir;
+	}
 
 	dirp = opendir(abus_prefix);
 	if (!dirp) {
@@ -1592,18 +5305,7 @@ int abus_req_service_list(abus_t *abus, json_rpc_t *json_rpc, int timeout)
 
 		/* TODO check pid is alive? */
 
-		if (abus_attr_get_str(abus, entry->d_name, "abus.version",
-					str, sizeof(str), timeout) != 0)
-			continue;
-
-		/* add object to array and add key "name" & string to object */
-
-		if (json_rpc_add_object_to_array(json_rpc) != 0)
-			goto error_dir;
-
-		json_rpc->last_param_key = strdup("name");
-		if (json_rpc_add_val(json_rpc, JSON_STRING, entry->d_name,
-					strlen(entry->d_name)+1) != 0)
+		if (abus_service_list_add(entry->d_name, &ctx) != 0)
 			goto error_dir;
 	}
 
@@ -1637,13 +5339,6 @@ static int snprint_event_method(char *str, size_t size, const char *service_name
 	return snprintf(str, size-1, EVTPREFIX"%s%%%s", service_name, event_name);
 }
 
-static const char *event_name_from_method(const char *str)
-{
-	if (strlen(str) > strlen(EVTPREFIX))
-		return str+strlen(EVTPREFIX);
-	return NULL;
-}
-
 
 /*!
 	Decalare an A-Bus event in a service
@@ -1695,41 +5390,34 @@ int abus_decl_event(abus_t *abus, const char *service_name, const char *event_na
 int abus_undecl_event(abus_t *abus, const char *service_name, const char *event_name)
 {
 	abus_event_t *event;
-	abus_service_t *service;
+	abus_service_t *service, *gone;
 	int ret;
 
-	ret = event_lookup(abus, service_name, event_name, LookupOnly, &service, &event);
-	if (ret)
-		return ret;
-
-	if (!service || !event)
-		return JSONRPC_NO_METHOD;
-
 	pthread_mutex_lock(&abus->mutex);
 
-	if (hfirst(event->subscriber_htab)) do
-	{
-		/* TODO: unsubscribe from remote services ? */
-		free(hkey(event->subscriber_htab));
-		free(hstuff(event->subscriber_htab));
+	/* position the hashtabs at the elements to be removed */
+	ret = service_lookup(abus, service_name, LookupOnly, &service);
+	if (ret == 0 && !hfind(service->event_htab, event_name, strlen(event_name)))
+		ret = JSONRPC_NO_METHOD;
+	if (ret) {
+		pthread_mutex_unlock(&abus->mutex);
+		return ret;
 	}
-	while (hnext(event->subscriber_htab));
-	hdestroy(event->subscriber_htab);
-
-	if (event->descr)
-		free(event->descr);
-	if (event->fmt)
-		free(event->fmt);
 
-	/* FIXME: assumes the hashtab still pointing at element found */
+	event = hstuff(service->event_htab);
 	free(hkey(service->event_htab));
-	free(hstuff(service->event_htab));
 	hdel(service->event_htab);
 
-	service_may_cleanup(abus, service, service_name);
+	gone = service_may_cleanup(abus, service, service_name);
+
+	abus_registry_update(abus);
 
 	pthread_mutex_unlock(&abus->mutex);
 
+	epoch_retire(event, abus_event_release);
+	if (gone)
+		epoch_retire(gone, abus_service_release);
+
 	return 0;
 }
 
@@ -1773,20 +5461,198 @@ json_rpc_t *abus_request_event_init(abus_t *abus, const char *service_name, cons
 	/* may be necessary in case of failed delivery.
 	   no need of strdup for service name
 	 */
+	pthread_mutex_lock(&abus->mutex);
 	if (!hfind(abus->service_htab, service_name, strlen(service_name))) {
+		pthread_mutex_unlock(&abus->mutex);
 		json_rpc_cleanup(json_rpc);
 		return NULL;
 	}
 	json_rpc->evt_service_name = (const char *)hkey(abus->service_htab);
+	pthread_mutex_unlock(&abus->mutex);
 
 	return json_rpc;
 }
 
+/* event for the plain callbacks of this A-Bus, waiting for the A-Bus thread */
+struct abus_local_evt {
+	struct abus_local_evt *next;
+	json_rpc_t *evt;	/* parsed event */
+	int count;	/* callbacks subscribed */
+};
+
+static void abus_local_evt_free(struct abus_local_evt *le)
+{
+	le->evt->msglen = 0;
+	json_rpc_cleanup(le->evt);
+	free(le);
+}
+
+/*
+  Run a plain event callback count times, each with a response of its own,
+  for nothing appended by a callback to be seen by the next one
+ */
+static void abus_event_run_local(abus_method_t *method, json_rpc_t *evt, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		evt->error_code = 0;
+		if (json_rpc_resp_init(evt) != 0)
+			break;
+		abus_call_callback(method, evt);
+	}
+}
+
+/*
+  Hand a parsed event over to the A-Bus thread, through evt_fd
+ */
+static int abus_local_evt_queue(abus_t *abus, json_rpc_t *evt, int count)
+{
+	struct abus_local_evt *le;
+	int ret = 0;
+
+	le = malloc(sizeof(*le));
+	if (!le)
+		return -ENOMEM;
+	le->next = NULL;
+	le->evt = evt;
+	le->count = count;
+
+	pthread_mutex_lock(&abus->evt_mutex);
+
+	if (abus->evt_fd == -1) {
+		abus->evt_fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+		if (abus->evt_fd == -1) {
+			ret = -errno;
+		} else if (un_sock_epoll_add(abus->epfd, abus->evt_fd, EPOLLIN, abus->evt_fd) != 0) {
+			close(abus->evt_fd);
+			abus->evt_fd = -1;
+			ret = -EIO;
+		}
+	}
+
+	if (ret == 0) {
+		*abus->local_evts_tail = le;
+		abus->local_evts_tail = &le->next;
+		eventfd_write(abus->evt_fd, 1);
+	}
+
+	pthread_mutex_unlock(&abus->evt_mutex);
+
+	if (ret)
+		free(le);
+
+	return ret;
+}
+
+/*
+  Run the events queued for the plain callbacks, on evt_fd wake-up
+ */
+static int abus_process_local_evts(abus_t *abus)
+{
+	struct abus_local_evt *le, *next;
+	abus_method_t *method;
+	eventfd_t val;
+
+	/* non blocking, nothing to read on a spurious wake-up */
+	eventfd_read(abus->evt_fd, &val);
+
+	pthread_mutex_lock(&abus->evt_mutex);
+	le = abus->local_evts;
+	abus->local_evts = NULL;
+	abus->local_evts_tail = &abus->local_evts;
+	pthread_mutex_unlock(&abus->evt_mutex);
+
+	for (; le; le = next) {
+		next = le->next;
+
+		/* keeps the method alive, even if unsubscribed meanwhile */
+		epoch_enter();
+		if (method_lookup(abus, le->evt->service_name, le->evt->method_name,
+						LookupOnly, NULL, &method) == 0)
+			abus_event_run_local(method, le->evt, le->count);
+		epoch_exit();
+
+		abus_local_evt_free(le);
+	}
+
+	return 0;
+}
+
+static void abus_local_evts_free(abus_t *abus)
+{
+	struct abus_local_evt *le;
+
+	while ((le = abus->local_evts) != NULL) {
+		abus->local_evts = le->next;
+		abus_local_evt_free(le);
+	}
+	abus->local_evts_tail = &abus->local_evts;
+
+	if (abus->evt_fd != -1)
+		close(abus->evt_fd);
+}
+
+/*
+  Run the event callbacks of this A-Bus subscribed count times, as
+  abus_process_msg() would, without any datagram. Threaded ones are
+  handed to workers, the plain ones are only run from the A-Bus thread.
+ */
+static void abus_event_deliver_local(abus_t *abus, json_rpc_t *json_rpc, int count)
+{
+	abus_method_t *method;
+	json_rpc_t *evt;
+	int i, ret;
+
+	/* keeps the method alive, even if unsubscribed meanwhile */
+	epoch_enter();
+
+	if (method_lookup(abus, json_rpc->service_name, json_rpc->method_name, LookupOnly, NULL, &method) != 0) {
+		epoch_exit();
+		return;
+	}
+
+	/* each run by a worker, and released there */
+	if (abus_method_is_threaded(method)) {
+		for (i = 0; i < count; i++)
+			abus_serve_local(abus, json_rpc, -1, NULL);
+		epoch_exit();
+		return;
+	}
+
+	/* parsed once, for all of them */
+	evt = json_rpc_init();
+	if (!evt) {
+		epoch_exit();
+		return;
+	}
+
+	ret = json_rpc_parse_msg(evt, json_rpc->msgbuf, json_rpc->msglen);
+	if (ret == 0 && evt->parsing_status != PARSING_OK)
+		ret = JSONRPC_PARSE_ERROR;
+
+	if (ret == 0 && abus->srv_thread_running && pthread_equal(pthread_self(), abus->srv_thread)) {
+		abus_event_run_local(method, evt, count);
+	} else if (ret == 0 && abus_local_evt_queue(abus, evt, count) == 0) {
+		/* now owned by the A-Bus thread */
+		epoch_exit();
+		return;
+	}
+
+	epoch_exit();
+
+	evt->msglen = 0;
+	json_rpc_cleanup(evt);
+}
+
 /*!
 	Publish (i.e. send) an event from a service
 
 	The notification is sent to all the subscribed end-points.
-	If notification delivery fails, the troublesome end-point get unsubscribed.
+	If the end-point of a subscriber is gone, it gets unsubscribed.
+	A subscriber whose receive queue is full just misses the notification.
+	The callbacks subscribed from the same A-Bus handle get the event
+	without any datagram, run by the A-Bus thread, unless threaded.
 
   \param abus	pointer to A-Bus handle
   \param json_rpc pointer to an opaque handle of a JSON RPC
@@ -1797,32 +5663,73 @@ json_rpc_t *abus_request_event_init(abus_t *abus, const char *service_name, cons
 int abus_request_event_publish(abus_t *abus, json_rpc_t *json_rpc, int flags)
 {
 	abus_event_t *event;
-	int ret;
+	const struct sockaddr **dest_addrs;
+	unsigned *keys;
+	int *errs;
+	int i, count, local;
 
-	ret = json_rpc_req_finalize(json_rpc);
+	json_rpc_req_finalize(json_rpc);
 
 	event = json_rpc->cb_context;
 
-	/* foreach subscribed A-Bus endpoints, deliver "id"-less rpc */
-	if (event->subscriber_htab && hfirst(event->subscriber_htab)) do {
-		struct sockaddr *sockaddrun;
+	pthread_mutex_lock(&abus->mutex);
 
-		sockaddrun = hstuff(event->subscriber_htab);
+	count = event->subscriber_htab ? hcount(event->subscriber_htab) : 0;
+	if (count == 0) {
+		pthread_mutex_unlock(&abus->mutex);
+		return 0;
+	}
 
-		ret = un_sock_sendto_sock(abus->sock, json_rpc->msgbuf, json_rpc->msglen,
-					(const struct sockaddr *)sockaddrun, un_sock_socklen(sockaddrun));
-		if (ret < 0) {
-			const char *event_name;
-			/* remove that subscriber if delivery failed */
-			LogDebug("%s(): get rid of gone subscriber", __func__);
+	dest_addrs = malloc(count * (sizeof(*dest_addrs) + sizeof(*keys) + sizeof(*errs)));
+	if (!dest_addrs) {
+		pthread_mutex_unlock(&abus->mutex);
+		return -ENOMEM;
+	}
+	keys = (unsigned *)(dest_addrs + count);
+	errs = (int *)(keys + count);
 
-			event_name = event_name_from_method(json_rpc->method_name);
-			if (event_name)
-				abus_unsubscribe_service(abus, json_rpc->evt_service_name, event_name);
+	/* snapshot the subscribed A-Bus endpoints, but the ones of this A-Bus */
+	i = 0;
+	local = 0;
+	if (hfirst(event->subscriber_htab)) do {
+		const struct sockaddr_un *addr = hstuff(event->subscriber_htab);
+
+		if (addr && !memcmp(addr, &abus->sock_addr, sizeof(*addr))) {
+			local++;
 			continue;
 		}
+		dest_addrs[i] = (const struct sockaddr *)addr;
+		memcpy(&keys[i], hkey(event->subscriber_htab), sizeof(unsigned));
+		i++;
 	}
 	while (hnext(event->subscriber_htab));
+	count = i;
+
+	/* deliver "id"-less rpc to all of them, batching the syscalls */
+	if (count > 0 && un_sock_sendto_multi(abus->sock, json_rpc->msgbuf, json_rpc->msglen,
+					dest_addrs, count, errs) > 0) {
+		for (i = 0; i < count; i++) {
+			/* a subscriber too slow to keep up only misses this one */
+			if (errs[i] != -ECONNREFUSED && errs[i] != -ENOENT)
+				continue;
+
+			/* remove that subscriber if gone */
+			LogDebug("%s(): get rid of gone subscriber", __func__);
+
+			if (hfind(event->subscriber_htab, &keys[i], sizeof(unsigned))) {
+				free(hkey(event->subscriber_htab));
+				free(hstuff(event->subscriber_htab));
+				hdel(event->subscriber_htab);
+			}
+		}
+	}
+
+	pthread_mutex_unlock(&abus->mutex);
+
+	free(dest_addrs);
+
+	if (local > 0)
+		abus_event_deliver_local(abus, json_rpc, local);
 
 	return 0;
 }
@@ -1975,7 +5882,8 @@ void abus_req_subscribe_service_cb(json_rpc_t *json_rpc, void *arg)
 		return;
 	}
 
-	/* FIXME: locking unneeded because the abus_thread is the only user? */
+	pthread_mutex_lock(&abus->mutex);
+
 	if (!event->subscriber_htab)
 		event->subscriber_htab = hcreate(1);
 
@@ -1986,10 +5894,67 @@ void abus_req_subscribe_service_cb(json_rpc_t *json_rpc, void *arg)
 
 	key = memdup(&event->uniq_subscriber_cnt, sizeof(event->uniq_subscriber_cnt));
 	event->uniq_subscriber_cnt++;
-	stuff = memdup(&json_rpc->sock_src_addr, json_rpc->sock_addrlen);
+	/* NUL padded, abstract names carry no terminator of their own */
+	stuff = calloc(1, sizeof(struct sockaddr_un));
+	if (stuff)
+		memcpy(stuff, &json_rpc->sock_src_addr, json_rpc->sock_addrlen);
 
 	/* TODO: add the withoutval flag to stuff */
 	hadd(event->subscriber_htab, key, sizeof(event->uniq_subscriber_cnt), stuff);
+
+	pthread_mutex_unlock(&abus->mutex);
+}
+
+/*
+  callback for internal use, to attach the shared memory channel
+  handed over along the request by a client
+ */
+void abus_req_shm_attach_cb(json_rpc_t *json_rpc, void *arg)
+{
+	abus_t *abus = (abus_t *)arg;
+	shm_chan_t *chan;
+	int ret;
+
+	/* channels are served by the A-Bus thread only, which owns the list */
+	if (abus->conf.poll_operation || json_rpc->fd_count != SHM_FD_NB ||
+			!pthread_equal(pthread_self(), abus->srv_thread)) {
+		json_rpc_set_error(json_rpc, JSONRPC_INVALID_REQUEST, NULL);
+		return;
+	}
+
+	if (abus->shm_chan_nb == abus->shm_chan_sz) {
+		unsigned sz = abus->shm_chan_sz ? 2*abus->shm_chan_sz : 8;
+		shm_chan_t **chans = realloc(abus->shm_chans, sz * sizeof(shm_chan_t *));
+
+		if (!chans) {
+			json_rpc_set_error(json_rpc, -ENOMEM, NULL);
+			return;
+		}
+		abus->shm_chans = chans;
+		abus->shm_chan_sz = sz;
+	}
+
+	/* the channel takes over the file descriptors */
+	json_rpc->fd_count = 0;
+	chan = shm_chan_attach(json_rpc->fds);
+	if (!chan) {
+		json_rpc_set_error(json_rpc, -errno, NULL);
+		return;
+	}
+
+	ret = un_sock_epoll_add(abus->epfd, chan->req_efd, EPOLLIN, chan->req_efd);
+	if (ret == 0) {
+		ret = un_sock_epoll_add(abus->epfd, chan->hup_fd, EPOLLIN, chan->hup_fd);
+		if (ret)
+			epoll_ctl(abus->epfd, EPOLL_CTL_DEL, chan->req_efd, NULL);
+	}
+	if (ret) {
+		shm_chan_put(chan);
+		json_rpc_set_error(json_rpc, ret, NULL);
+		return;
+	}
+
+	abus->shm_chans[abus->shm_chan_nb++] = chan;
 }
 
 int abus_unsubscribe_service(abus_t *abus, const char *service_name, const char *event_name)
@@ -2002,11 +5967,15 @@ int abus_unsubscribe_service(abus_t *abus, const char *service_name, const char
 		return ret ? ret : JSONRPC_INTERNAL_ERROR;
 	}
 
+	pthread_mutex_lock(&abus->mutex);
+
 	free(hkey(event->subscriber_htab));
 	free(hstuff(event->subscriber_htab));
 
 	hdel(event->subscriber_htab);
 
+	pthread_mutex_unlock(&abus->mutex);
+
 	return 0;
 }
 
@@ -2039,6 +6008,12 @@ static int attr_lookup(abus_t *abus, const char *service_name, const char *attr_
 	abus_service_t *service;
 	int ret;
 
+	if (!create) {
+		ret = registry_lookup(abus, ABUS_REG_ATTR, service_name, attr_name, service_p, (void **)attr);
+		if (ret != 1)
+			return ret;
+	}
+
 	pthread_mutex_lock(&abus->mutex);
 
 	ret = service_lookup(abus, service_name, create, &service);
@@ -2061,6 +6036,7 @@ static int attr_lookup(abus_t *abus, const char *service_name, const char *attr_
 	} else {
 		*attr = calloc(1, sizeof(abus_attr_t));
 		hadd(service->attr_htab, strdup(attr_name), attr_len, *attr);
+		abus_registry_update(abus);
 	}
 
 	pthread_mutex_unlock(&abus->mutex);
@@ -2095,9 +6071,13 @@ static int attr_append(abus_t *abus, json_rpc_t *json_rpc, const char *service_n
 	abus_attr_t *attr;
 	int ret, attr_name_len;
 
-	ret = attr_lookup(abus, service_name, attr_name, LookupOnly, &service, &attr);
-	if (ret == 0)
-		return attr_append_type(json_rpc, attr_name, attr->ref.type, attr->ref.u.data);
+	epoch_enter();
+	if (attr_lookup(abus, service_name, attr_name, LookupOnly, NULL, &attr) == 0) {
+		ret = attr_append_type(json_rpc, attr_name, attr->ref.type, attr->ref.u.data);
+		epoch_exit();
+		return ret;
+	}
+	epoch_exit();
 
 	attr_name_len = strlen(attr_name);
 	if (attr_name_len > 0 && attr_name[attr_name_len-1] != '.') {
@@ -2106,7 +6086,10 @@ static int attr_append(abus_t *abus, json_rpc_t *json_rpc, const char *service_n
 	}
 
 	/* iterate over prefix when exact match not found */
-	if (hfirst(service->attr_htab)) do
+	pthread_mutex_lock(&abus->mutex);
+
+	ret = service_lookup(abus, service_name, LookupOnly, &service);
+	if (ret == 0 && hfirst(service->attr_htab)) do
 	{
 		const char *key = (const char *)hkey(service->attr_htab);
 
@@ -2114,12 +6097,14 @@ static int attr_append(abus_t *abus, json_rpc_t *json_rpc, const char *service_n
 			attr = hstuff(service->attr_htab);
 			ret = attr_append_type(json_rpc, key, attr->ref.type, attr->ref.u.data);
 			if (ret)
-				return ret;
+				break;
 		}
 	}
 	while (hnext(service->attr_htab));
 
-	return 0;
+	pthread_mutex_unlock(&abus->mutex);
+
+	return ret;
 }
 
 /**
@@ -2316,35 +6301,37 @@ int abus_decl_attr_str(abus_t *abus, const char *service_name, const char *attr_
 int abus_undecl_attr(abus_t *abus, const char *service_name, const char *attr_name)
 {
 	abus_attr_t *attr;
-	abus_service_t *service;
+	abus_service_t *service, *gone;
 	int ret, flags;
 	char event_name[JSONRPC_METHNAME_SZ_MAX];
 
-	ret = attr_lookup(abus, service_name, attr_name, LookupOnly, &service, &attr);
-	if (ret)
-		return ret;
-
-	if (!service || !attr)
-		return JSONRPC_NO_METHOD;
-
 	pthread_mutex_lock(&abus->mutex);
 
-	if (attr->descr)
-		free(attr->descr);
-	if (attr->auto_alloc && attr->ref.u.data)
-		free(attr->ref.u.data);
+	/* position the hashtabs at the elements to be removed */
+	ret = service_lookup(abus, service_name, LookupOnly, &service);
+	if (ret == 0 && !hfind(service->attr_htab, attr_name, strlen(attr_name)))
+		ret = JSONRPC_NO_METHOD;
+	if (ret) {
+		pthread_mutex_unlock(&abus->mutex);
+		return ret;
+	}
 
+	attr = hstuff(service->attr_htab);
 	flags = attr->flags;
 
-	/* FIXME: assumes the hashtab still pointing at element found */
 	free(hkey(service->attr_htab));
-	free(hstuff(service->attr_htab));
 	hdel(service->attr_htab);
 
-	service_may_cleanup(abus, service, service_name);
+	gone = service_may_cleanup(abus, service, service_name);
+
+	abus_registry_update(abus);
 
 	pthread_mutex_unlock(&abus->mutex);
 
+	epoch_retire(attr, abus_attr_release);
+	if (gone)
+		epoch_retire(gone, abus_service_release);
+
 	/* unregister associated attr_changed events */
 	if (!(flags & ABUS_RPC_CONST)) {
 		snprintf(event_name, sizeof(event_name), ABUS_ATTR_CHANGED_PREFIX "%s", attr_name);
@@ -2444,12 +6431,15 @@ static int attr_get_type(abus_t *abus, const char *service_name, const char *att
 	int ret;
 
 	/* no RPC where attr's service is local to process/abus context */
+	epoch_enter();
 	if (attr_lookup(abus, service_name, attr_name, LookupOnly, &service, &attr) == 0) {
 		pthread_mutex_lock(&service->attr_mutex);
 		ret = attr_get_local(abus, attr, json_type, val, len);
 		pthread_mutex_unlock(&service->attr_mutex);
+		epoch_exit();
 		return ret;
 	}
+	epoch_exit();
 
     json_rpc = abus_request_method_init(abus, service_name, ABUS_GET_METHOD);
     if (!json_rpc)
@@ -2504,7 +6494,12 @@ static int attr_get_type(abus_t *abus, const char *service_name, const char *att
 	return ret;
 }
 
-static int attr_set_local(abus_t *abus, abus_attr_t *attr, const char *service_name, const char *attr_name, int json_type, const void *val, size_t len)
+/*
+  To be called with service->attr_mutex held. The change is to be published
+  once the mutex is released, for the onchange callbacks of in-process
+  subscribers run synchronously and may read the attribute back.
+ */
+static int attr_set_local(abus_attr_t *attr, int json_type, const void *val, size_t len, bool *changed)
 {
 	bool attr_changed = false;
 	long long ll_val;
@@ -2571,8 +6566,7 @@ static int attr_set_local(abus_t *abus, abus_attr_t *attr, const char *service_n
 		return -EINVAL;
 	}
 
-	if (attr_changed)
-		abus_attr_changed(abus, service_name, attr_name);
+	*changed = attr_changed;
 
 	return 0;
 }
@@ -2582,15 +6576,22 @@ static int attr_set_type(abus_t *abus, const char *service_name, const char *att
 	json_rpc_t *json_rpc;
 	abus_service_t *service;
 	abus_attr_t *attr;
+	bool changed;
 	int ret;
 
 	/* no RPC where attr's service is local to process/abus context */
+	epoch_enter();
 	if (attr_lookup(abus, service_name, attr_name, LookupOnly, &service, &attr) == 0) {
 		pthread_mutex_lock(&service->attr_mutex);
-		ret = attr_set_local(abus, attr, service_name, attr_name, json_type, val, len);
+		ret = attr_set_local(attr, json_type, val, len, &changed);
 		pthread_mutex_unlock(&service->attr_mutex);
+		epoch_exit();
+
+		if (ret == 0 && changed)
+			abus_attr_changed(abus, service_name, attr_name);
 		return ret;
 	}
+	epoch_exit();
 
 	json_rpc = abus_request_method_init(abus, service_name, ABUS_SET_METHOD);
 	if (!json_rpc)
@@ -2850,7 +6851,7 @@ void abus_req_attr_get_cb(json_rpc_t *json_rpc, void *arg)
 		return;
     }
 
-	ret = service_lookup(abus, json_rpc->service_name, LookupOnly, &service);
+	ret = service_find(abus, json_rpc->service_name, &service);
 	if (ret < 0) {
 		json_rpc_set_error(json_rpc, ret, NULL);
 		return;
@@ -2895,6 +6896,7 @@ void abus_req_attr_set_cb(json_rpc_t *json_rpc, void *arg)
 	int i, count;
 	size_t attr_len, len=0;
 	abus_attr_t *attr;
+	bool changed;
 	int ret;
 	int a;
 	bool b;
@@ -2908,15 +6910,16 @@ void abus_req_attr_set_cb(json_rpc_t *json_rpc, void *arg)
 		return;
     }
 
-	ret = service_lookup(abus, json_rpc->service_name, LookupOnly, &service);
+	ret = service_find(abus, json_rpc->service_name, &service);
 	if (ret < 0) {
 		json_rpc_set_error(json_rpc, ret, NULL);
 		return;
 	}
-	pthread_mutex_lock(&service->attr_mutex);
 
     for (i = 0; i<count; i++) {
 
+		pthread_mutex_lock(&service->attr_mutex);
+
 		/* Aim at i-th element within array "attr" */
 		json_rpc_get_point_at(json_rpc, "attr", i);
 
@@ -2966,16 +6969,18 @@ void abus_req_attr_set_cb(json_rpc_t *json_rpc, void *arg)
 		}
 
 		if (ret == 0)
-			ret = attr_set_local(abus, attr, json_rpc->service_name, attr_name, attr->ref.type, val, len);
+			ret = attr_set_local(attr, attr->ref.type, val, len, &changed);
+
+		pthread_mutex_unlock(&service->attr_mutex);
 
 		if (ret) {
 			json_rpc_set_error(json_rpc, ret, NULL);
-			pthread_mutex_unlock(&service->attr_mutex);
 			return;
 		}
-	}
 
-	pthread_mutex_unlock(&service->attr_mutex);
+		if (changed)
+			abus_attr_changed(abus, json_rpc->service_name, attr_name);
+	}
 
 	/* Aim back out of array */
 	json_rpc_get_point_at(json_rpc, NULL, 0);
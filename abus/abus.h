@@ -32,6 +32,7 @@ typedef void (*abus_callback_t)(json_rpc_t *json_rpc, void *arg);
 #define ABUS_RPC_EXCL		0x02
 #define ABUS_RPC_RDONLY		0x04
 #define ABUS_RPC_WITHOUTVAL	0x08
+#define ABUS_RPC_STREAM		0x10
 #define ABUS_RPC_ASYNC		0x40	/* internal use */
 #define ABUS_RPC_CONST		0x80
 /* TODO flags:
@@ -43,11 +44,69 @@ typedef struct abus_conf {
 	/** don't want A-Bus system thread */
 	bool poll_operation;
 
+	/** don't want per-thread cached socket for synchronous requests */
+	bool no_cached_sock;
+
+	/** max datagrams received per system call by the A-Bus thread,
+	    0 or 1 for one at a time. Taken into account upon thread start */
+	int recv_batch;
+
+	/** synchronous requests over connected sessions to the services,
+	    falling back to datagrams when a service does not accept them */
+	bool seqpacket;
+
+	/** synchronous requests over shared memory rings to the services,
+	    falling back to datagrams when a service does not accept them */
+	bool shm;
+
+	/** worker threads running the ABUS_RPC_THREADED methods, 0 for a new
+	    thread per request. Taken into account upon first threaded request */
+	int pool_size;
+
+	/** max requests waiting for a worker thread, 0 for 4 per worker */
+	int pool_queue;
+
+	/** stack size in bytes of the threads running ABUS_RPC_THREADED methods,
+	    0 for the system default */
+	size_t thread_stack;
+
+	/** threads receiving from the A-Bus socket, the A-Bus thread included,
+	    0 or 1 for the A-Bus thread only. With more, callbacks of methods
+	    not flagged ABUS_RPC_EXCL may run concurrently, and requests from
+	    a same client may be served out of order. Asynchronous requests
+	    flagged ABUS_RPC_STREAM are then turned down with -EOPNOTSUPP.
+	    Taken into account upon thread start */
+	int recv_threads;
+
+	/** asynchronous requests to a same service issued within that many
+	    microseconds coalesced into one batch message, 0 for none.
+	    In poll operation, they are sent from abus_process_incoming().
+	    See also abus_flush() */
+	unsigned cork_usec;
+
+	/** size in bytes of a batch message of corked requests sent without
+	    waiting for cork_usec to elapse, 0 for the default. The responses
+	    to the batch have to fit in a message too */
+	unsigned cork_size;
+
 } abus_conf_t;
 
+typedef struct abus_stats {
+	/** requests waiting for a worker thread */
+	unsigned pool_queued;
+
+	/** requests turned down with JSONRPC_SERVER_ERROR, the queue being full */
+	unsigned long pool_rejected;
+
+	/** A-Bus thread running its io_uring loop, see --enable-io-uring */
+	bool uring;
+
+} abus_stats_t;
+
 /* Opaque abus stuff */
 struct abus;
 typedef struct abus abus_t;
+typedef struct abus_cq abus_cq_t;
 
 /* user API */
 const char *abus_get_version();
@@ -57,9 +116,16 @@ abus_t *abus_init(const abus_conf_t *conf);
 int abus_cleanup(abus_t *abus);
 int abus_get_conf(abus_t *abus, abus_conf_t *conf);
 int abus_set_conf(abus_t *abus, const abus_conf_t *conf);
+int abus_get_stats(abus_t *abus, abus_stats_t *stats);
 
 int abus_decl_method(abus_t *abus, const char *service_name, const char *method_name, abus_callback_t method_callback, int flags, void *arg, const char *descr, const char *fmt, const char *result_fmt);
 int abus_undecl_method(abus_t *abus, const char *service_name, const char *method_name);
+int abus_set_method_serial_key(abus_t *abus, const char *service_name, const char *method_name, const char *key_name);
+
+/* response of a method sent later or in parts, from any thread */
+int abus_defer_response(abus_t *abus, json_rpc_t *json_rpc);
+int abus_complete_response(abus_t *abus, json_rpc_t *json_rpc);
+int abus_stream_response(abus_t *abus, json_rpc_t *json_rpc);
 
 int abus_get_fd(abus_t *abus);
 int abus_process_incoming(abus_t *abus);
@@ -68,14 +134,28 @@ int abus_process_incoming(abus_t *abus);
 
 json_rpc_t *abus_request_method_init(abus_t *abus, const char *service_name, const char *method_name);
 int abus_request_method_invoke(abus_t *abus, json_rpc_t *json_rpc, int flags, int timeout);
+int abus_request_method_notify(abus_t *abus, json_rpc_t *json_rpc, int flags);
 int abus_request_method_cleanup(abus_t *abus, json_rpc_t *json_rpc);
 
+/* several synchronous calls to a service in one JSON-RPC batch */
+int abus_request_batch_invoke(abus_t *abus, json_rpc_t **json_rpc, int count, int flags, int timeout);
+
 /* TODO: int abus_request_method_invoke_args(abus_t *abus, const char *service_name, const char *method_name, int flags, int timeout, ...); */
 
 /* asynchronous call, with callback upon response or timeout; callback can be threaded or not */
 int abus_request_method_invoke_async(abus_t *abus, json_rpc_t *json_rpc, int timeout, abus_callback_t callback, int flags, void *arg);
 int abus_request_method_wait_async(abus_t *abus, json_rpc_t *json_rpc, int timeout);
 int abus_request_method_cancel_async(abus_t *abus, json_rpc_t *json_rpc);
+int abus_flush(abus_t *abus);
+
+/* asynchronous calls reaped in batches from a completion queue */
+#define ABUS_CQ_WAIT_ANY	0x00
+#define ABUS_CQ_WAIT_ALL	0x01
+
+abus_cq_t *abus_cq_init(void);
+int abus_cq_cleanup(abus_cq_t *cq);
+int abus_request_method_invoke_cq(abus_t *abus, json_rpc_t *json_rpc, int timeout, abus_cq_t *cq, int flags);
+int abus_cq_wait(abus_cq_t *cq, json_rpc_t **json_rpc, int max, int timeout, int flags);
 
 /* publish/subscribe */
 int abus_decl_event(abus_t *abus, const char *service_name, const char *event_name, const char *descr, const char *fmt);
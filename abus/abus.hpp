@@ -35,6 +35,18 @@ public:
 	/*! Destructor */
 	virtual ~cABusRPC() {}
 
+	/*! Get the error of a response.
+		\return	0	if the response has no error, its error code otherwise
+		\sa json_rpc_get_error()
+	 */
+	int get_error()
+		{ return json_rpc_get_error(m_json_rpc); }
+	/*! Tell whether a response is a partial result of a streamed response
+		\sa json_rpc_is_partial()
+	 */
+	int is_partial()
+		{ return json_rpc_is_partial(m_json_rpc); }
+
 	/*! Get the JSON type of a parameter from a RPC.
 		\return a nul of positive number representing the JSON type (JSON_{INT,FLOAT,STRING,TRUE,FALSE,NULL}), a negative value in case of error
 		\sa json_rpc_get_type()
@@ -191,6 +203,10 @@ public:
 	int invoke(int flags, int timeout)
 		{ return abus_request_method_invoke(m_abus, m_json_rpc, flags, timeout); }
 
+	/*! Invoke the RPC as a notification, without response */
+	int notify(int flags)
+		{ return abus_request_method_notify(m_abus, m_json_rpc, flags); }
+
 	/*! Invoke the RPC asynchronously */
 	int invokeAsync(int flags, int timeout, abus_callback_t callback, void *arg)
 		{ return abus_request_method_invoke_async(m_abus, m_json_rpc, timeout, callback, flags, arg); }
@@ -203,6 +219,12 @@ public:
 	int cancelAsync(void)
 		{ return abus_request_method_cancel_async(m_abus, m_json_rpc); }
 
+	/*! Invoke the RPC asynchronously, to be reaped from a completion queue
+		\sa abus_cq_wait()
+	 */
+	int invokeCq(int flags, int timeout, abus_cq_t *cq)
+		{ return abus_request_method_invoke_cq(m_abus, m_json_rpc, timeout, cq, flags); }
+
 	/*! Append to a RPC an attribute
 		\return	0	if successful, non nul value otherwise
 		\sa abus_append_attr()
@@ -284,6 +306,16 @@ public:
 	 */
 	int set_conf(const abus_conf_t *conf)
 		{ return abus_set_conf(m_abus, conf); }
+	/*! Send the asynchronous requests held back by corking
+		\sa abus_flush()
+	 */
+	int flush()
+		{ return abus_flush(m_abus); }
+	/*! Get A-Bus statistics
+		\sa abus_get_stats()
+	 */
+	int get_stats(abus_stats_t *stats)
+		{ return abus_get_stats(m_abus, stats); }
 
 	/*! Get the file descriptor of A-Bus system, for use in poll()/select() */
 	int get_fd(void)
@@ -313,6 +345,34 @@ public:
 	int undecl_method(const char *service_name, const char *method_name)
 		{ return abus_undecl_method(m_abus, service_name, method_name); }
 
+	/*! Run in order the requests of a threaded method sharing a parameter value
+		\return	0	if successful, non nul value otherwise
+		\sa decl_method()
+	 */
+	int set_method_serial_key(const char *service_name, const char *method_name, const char *key_name)
+		{ return abus_set_method_serial_key(m_abus, service_name, method_name, key_name); }
+
+	/*! Defer the response of the method request being served
+		\return	0	if successful, non nul value otherwise
+		\sa complete_response()
+	 */
+	int defer_response(json_rpc_t *json_rpc)
+		{ return abus_defer_response(m_abus, json_rpc); }
+
+	/*! Send the deferred response of a method request, and release the request
+		\return	0	if successful, non nul value otherwise
+		\sa defer_response()
+	 */
+	int complete_response(json_rpc_t *json_rpc)
+		{ return abus_complete_response(m_abus, json_rpc); }
+
+	/*! Send the result filled so far as a partial result of a streamed response
+		\return	0	if successful, non nul value otherwise
+		\sa abus_stream_response()
+	 */
+	int stream_response(json_rpc_t *json_rpc)
+		{ return abus_stream_response(m_abus, json_rpc); }
+
 	/*! Instantiate a new RPC for invocation */
 	cABusRequestMethod *RequestMethod(const char *service_name, const char *method_name) {
 		cABusRequestMethod *p = new cABusRequestMethod(m_abus);
@@ -320,6 +380,13 @@ public:
 		return p;
 	}
 
+	/*! Invoke several RPC of a service synchronously, in one round trip
+		\return	0	if all of them got a response, non nul value otherwise
+		\sa abus_request_batch_invoke()
+	 */
+	int request_batch_invoke(json_rpc_t **json_rpc, int count, int flags, int timeout)
+		{ return abus_request_batch_invoke(m_abus, json_rpc, count, flags, timeout); }
+
 	/*! Declare a new event in a service */
 	int decl_event(const char *service_name, const char *event_name, const char *descr = NULL, const char *fmt = NULL)
 		{ return abus_decl_event(m_abus, service_name, event_name, descr, fmt); }
@@ -38,6 +38,8 @@ typedef struct abus_method {
 	char *fmt;
 	char *result_fmt;
 	pthread_mutex_t excl_mutex;	/* for ABUS_RPC_EXCL */
+	struct abus_serial *serial;	/* threaded requests run in order, see abus_serial_submit() */
+	struct abus_cq *cq;	/* async response handler only, where to reap the request */
 } abus_method_t;
 
 typedef struct abus_event {
@@ -56,6 +58,18 @@ typedef struct abus_attr {
 	bool auto_alloc;
 } abus_attr_t;
 
+/* where a message comes from, hence where to respond */
+typedef struct abus_msg_src {
+	int sock;
+	struct shm_chan *shm_chan;	/* shared memory channel, may be NULL */
+	struct un_sock_peer *peer;	/* accepted session, may be NULL */
+	const struct sockaddr *addr;
+	socklen_t addrlen;
+	int *fds;	/* passed along the message, handed over to the json_rpc */
+	int fd_count;
+	struct abus_batch *batch;	/* element of a batch request, may be NULL */
+} abus_msg_src_t;
+
 static inline int abus_method_is_threaded(const abus_method_t *method) { return method && (method->flags & ABUS_RPC_THREADED); }
 static inline int abus_method_is_excl(const abus_method_t *method) { return method && (method->flags & ABUS_RPC_EXCL); }
 
@@ -67,22 +81,70 @@ typedef struct abus_service {
 	htab *attr_htab;	// attr name->abus_attr_t
 
 	pthread_mutex_t attr_mutex;	/* for get/set */
+
+	int sock;	/* abstract namespace socket of its own, -1 otherwise */
 } abus_service_t;
 
 struct abus {
 	/* service */
 	htab *service_htab;	// service name->abus_service_t
 
-	/* async request */
-	htab *outstanding_req_htab;	// id string -> json_rpc_t
+	/* async requests, by id modulo req_slot_nb, under req_mutex */
+	struct abus_req **req_slots;
+	unsigned req_slot_nb, req_count;
+	pthread_mutex_t req_mutex;
+	/* expiry of the async requests, under req_mutex, created upon first use */
+	struct timer_wheel *timers;
+	int timer_fd;	/* in the A-Bus thread wait set, -1 until timers */
+	unsigned long timer_deadline;	/* tick timer_fd is armed for, 0 if disarmed */
+
+	/* async requests held back by service, see conf.cork_usec, under cork_mutex */
+	struct abus_cork *corks;
+	int cork_fd;	/* in the A-Bus thread wait set, -1 until corking */
+	pthread_mutex_t cork_mutex;
+
+	/* events for the plain callbacks of this A-Bus, run by the A-Bus thread, under evt_mutex */
+	struct abus_local_evt *local_evts, **local_evts_tail;
+	int evt_fd;	/* in the A-Bus thread wait set, -1 until such an event */
+	pthread_mutex_t evt_mutex;
 
 	pthread_t srv_thread;
+	bool srv_thread_running;	/* not in poll operation */
+	/* additional receivers of the A-Bus socket, see conf.recv_threads */
+	pthread_t *recv_threads;
+	unsigned recv_thread_nb;
 	int sock;
-	/* JSON RPC "id" field for requests */
+	struct sockaddr_un sock_addr;	/* of sock, NUL padded as subscriber addresses */
+	int epfd;	/* A-Bus thread wait set */
+	int seq_sock;	/* listening SOCK_SEQPACKET, may be -1 */
+	int stop_efd;	/* eventfd waking the A-Bus thread up to be cancelled, may be -1 */
+	/* accepted sessions, owned by the A-Bus thread */
+	struct un_sock_peer **sessions;
+	unsigned session_nb, session_sz;
+	/* service sockets in abstract mode, under mutex */
+	int *svc_socks;
+	unsigned svc_sock_nb, svc_sock_sz;
+	/* attached shared memory channels, owned by the A-Bus thread */
+	struct shm_chan **shm_chans;
+	unsigned shm_chan_nb, shm_chan_sz;
+	/* JSON RPC "id" field for requests, allocated atomically */
 	unsigned id;
 
 	/* preallocated buffer, may be NULL */
 	char *incoming_buffer;
+	/* preallocated batch receive buffers, may be NULL */
+	struct abus_rx_batch *rx_batch;
+	/* io_uring of the A-Bus thread, NULL unless running the io_uring loop */
+	struct abus_uring *uring;
+	/* workers for threaded methods, created upon first use, under mutex */
+	struct abus_pool *pool;
+	/* threads of threaded methods when no pool, under mutex */
+	unsigned detached_nb;
+	pthread_cond_t detached_cond;
+
+	/* snapshot of service_htab and below, for lookups without mutex.
+	   Replaced under mutex, read within epoch_enter()/epoch_exit() */
+	struct abus_registry *registry;
 
 	pthread_mutex_t mutex;
 
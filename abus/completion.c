@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2011-2012 Stephane Fillod
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Library General Public License as
+ *   published by the Free Software Foundation; either version 2.1 of
+ *   the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Library General Public License for more details.
+ */
+
+#include "abus_config.h"
+
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "completion.h"
+
+void completion_complete(completion_t *c)
+{
+	__atomic_store_n(&c->done, 1, __ATOMIC_SEQ_CST);
+
+	/* a waiter registered after this load sees done in FUTEX_WAIT */
+	if (__atomic_load_n(&c->waiters, __ATOMIC_SEQ_CST) > 0)
+		syscall(__NR_futex, &c->done, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/*
+  Wait up to timeout milliseconds against CLOCK_MONOTONIC,
+  0 once completed, -ETIMEDOUT otherwise
+ */
+int completion_wait(completion_t *c, int timeout)
+{
+	struct timespec deadline;
+	int ret = 0;
+
+	if (completion_done(c))
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec  += timeout / 1000;
+	deadline.tv_nsec += (timeout % 1000) * 1000000;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_nsec -= 1000000000;
+		deadline.tv_sec++;
+	}
+
+	__atomic_add_fetch(&c->waiters, 1, __ATOMIC_SEQ_CST);
+
+	while (!completion_done(c)) {
+		/* BITSET flavour for an absolute deadline, on CLOCK_MONOTONIC */
+		if (syscall(__NR_futex, &c->done, FUTEX_WAIT_BITSET_PRIVATE, 0,
+					&deadline, NULL, FUTEX_BITSET_MATCH_ANY) == -1 &&
+				errno == ETIMEDOUT) {
+			ret = completion_done(c) ? 0 : -ETIMEDOUT;
+			break;
+		}
+	}
+
+	__atomic_sub_fetch(&c->waiters, 1, __ATOMIC_SEQ_CST);
+
+	return ret;
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2011-2012 Stephane Fillod
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Library General Public License as
+ *   published by the Free Software Foundation; either version 2.1 of
+ *   the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Library General Public License for more details.
+ */
+
+#ifndef _COMPLETION_H
+#define _COMPLETION_H
+
+/*
+ * One-shot completion on a futex word, all zero when pending,
+ * hence nothing to initialize nor destroy within calloc'ed memory.
+ * Completing costs no system call unless somebody is waiting.
+ */
+
+typedef struct completion {
+	unsigned done;	/* futex word */
+	unsigned waiters;
+} completion_t;
+
+static inline void completion_init(completion_t *c)
+{
+	c->done = 0;
+	c->waiters = 0;
+}
+
+static inline int completion_done(const completion_t *c)
+{
+	return __atomic_load_n(&c->done, __ATOMIC_ACQUIRE);
+}
+
+void completion_complete(completion_t *c);
+int completion_wait(completion_t *c, int timeout);
+
+#endif /* _COMPLETION_H */
@@ -0,0 +1,234 @@
+/*
+ * Copyright (C) 2011-2012 Stephane Fillod
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Library General Public License as
+ *   published by the Free Software Foundation; either version 2.1 of
+ *   the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Library General Public License for more details.
+ */
+
+/*
+ * Epoch based reclamation.
+ *
+ * Each reader thread owns a slot, where it advertises the global epoch
+ * it entered at. An object retired at epoch E may be released once no
+ * slot advertises an epoch lower or equal to E.
+ */
+
+#include "abus_config.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "epoch.h"
+
+struct epoch_slot {
+	unsigned long epoch;	/* global epoch when entered, 0 when outside */
+	unsigned nesting;
+	bool used;
+	struct epoch_slot *next;
+};
+
+struct epoch_retired {
+	void *ptr;
+	void (*release)(void *);
+	unsigned long epoch;
+	struct epoch_retired *next;
+};
+
+static struct {
+	unsigned long epoch;
+	/* never freed, reused once their thread is gone */
+	struct epoch_slot *slots;
+	/* readers which could not get a slot */
+	unsigned long slotless;
+	struct epoch_retired *retired;
+	pthread_mutex_t mutex;	/* slot allocation and retired list */
+} epoch_state = {
+	.epoch = 1,
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static pthread_key_t epoch_key;
+static pthread_once_t epoch_key_once = PTHREAD_ONCE_INIT;
+
+static void epoch_slot_put(void *arg)
+{
+	struct epoch_slot *slot = (struct epoch_slot *)arg;
+
+	__atomic_store_n(&slot->epoch, 0, __ATOMIC_RELEASE);
+	slot->nesting = 0;
+	__atomic_store_n(&slot->used, false, __ATOMIC_RELEASE);
+}
+
+static void epoch_key_create(void)
+{
+	pthread_key_create(&epoch_key, epoch_slot_put);
+}
+
+/*
+  Slot of the calling thread, allocated upon its first read section
+ */
+static struct epoch_slot *epoch_slot_get(void)
+{
+	struct epoch_slot *slot;
+
+	pthread_once(&epoch_key_once, epoch_key_create);
+
+	slot = pthread_getspecific(epoch_key);
+	if (slot)
+		return slot;
+
+	pthread_mutex_lock(&epoch_state.mutex);
+
+	for (slot = epoch_state.slots; slot; slot = slot->next) {
+		if (!slot->used)
+			break;
+	}
+	if (!slot) {
+		slot = calloc(1, sizeof(*slot));
+		if (slot) {
+			slot->next = epoch_state.slots;
+			__atomic_store_n(&epoch_state.slots, slot, __ATOMIC_RELEASE);
+		}
+	}
+	if (slot)
+		slot->used = true;
+
+	pthread_mutex_unlock(&epoch_state.mutex);
+
+	if (slot && pthread_setspecific(epoch_key, slot) != 0) {
+		epoch_slot_put(slot);
+		slot = NULL;
+	}
+
+	return slot;
+}
+
+void epoch_enter(void)
+{
+	struct epoch_slot *slot = epoch_slot_get();
+
+	if (!slot) {
+		/* holds back any release until exit */
+		__atomic_add_fetch(&epoch_state.slotless, 1, __ATOMIC_SEQ_CST);
+		return;
+	}
+
+	if (slot->nesting++ > 0)
+		return;
+
+	__atomic_store_n(&slot->epoch, __atomic_load_n(&epoch_state.epoch, __ATOMIC_RELAXED),
+					__ATOMIC_RELAXED);
+	/* advertised before any access to the shared objects */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void epoch_exit(void)
+{
+	struct epoch_slot *slot = pthread_getspecific(epoch_key);
+
+	if (!slot) {
+		__atomic_sub_fetch(&epoch_state.slotless, 1, __ATOMIC_RELEASE);
+		return;
+	}
+
+	if (--slot->nesting == 0)
+		__atomic_store_n(&slot->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/*
+  Detach the retired objects no reader may see anymore.
+  Caller must hold epoch_state.mutex
+ */
+static struct epoch_retired *epoch_collect(void)
+{
+	struct epoch_retired *done = NULL, **p;
+	struct epoch_slot *slot;
+	unsigned long oldest = ~0UL, epoch;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&epoch_state.slotless, __ATOMIC_ACQUIRE) > 0)
+		return NULL;
+
+	for (slot = __atomic_load_n(&epoch_state.slots, __ATOMIC_ACQUIRE); slot; slot = slot->next) {
+		epoch = __atomic_load_n(&slot->epoch, __ATOMIC_ACQUIRE);
+		if (epoch != 0 && epoch < oldest)
+			oldest = epoch;
+	}
+
+	for (p = &epoch_state.retired; *p; ) {
+		struct epoch_retired *r = *p;
+
+		if (r->epoch < oldest) {
+			*p = r->next;
+			r->next = done;
+			done = r;
+		} else {
+			p = &r->next;
+		}
+	}
+
+	return done;
+}
+
+static void epoch_release(struct epoch_retired *done)
+{
+	while (done) {
+		struct epoch_retired *r = done;
+
+		done = r->next;
+		r->release(r->ptr);
+		free(r);
+	}
+}
+
+/*
+  Hand over an object unreachable by new readers, to be released
+  when the current ones are done. Never blocks on readers.
+ */
+void epoch_retire(void *ptr, void (*release)(void *))
+{
+	struct epoch_retired *r, *done;
+
+	r = malloc(sizeof(*r));
+
+	pthread_mutex_lock(&epoch_state.mutex);
+
+	/* better a leak than a use after free */
+	if (r) {
+		r->ptr = ptr;
+		r->release = release;
+		/* readers entering from now on cannot reach ptr */
+		r->epoch = __atomic_fetch_add(&epoch_state.epoch, 1, __ATOMIC_SEQ_CST);
+		r->next = epoch_state.retired;
+		epoch_state.retired = r;
+	}
+
+	done = epoch_collect();
+
+	pthread_mutex_unlock(&epoch_state.mutex);
+
+	epoch_release(done);
+}
+
+/*
+  Release what can be, without retiring anything
+ */
+void epoch_reclaim(void)
+{
+	struct epoch_retired *done;
+
+	pthread_mutex_lock(&epoch_state.mutex);
+	done = epoch_collect();
+	pthread_mutex_unlock(&epoch_state.mutex);
+
+	epoch_release(done);
+}
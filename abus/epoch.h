@@ -0,0 +1,33 @@
+/*
+ * Copyright (C) 2011-2012 Stephane Fillod
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Library General Public License as
+ *   published by the Free Software Foundation; either version 2.1 of
+ *   the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Library General Public License for more details.
+ */
+
+#ifndef _EPOCH_H
+#define _EPOCH_H
+
+/*
+ * Epoch based reclamation, process wide.
+ *
+ * Readers bracket their accesses to shared objects with epoch_enter() and
+ * epoch_exit(), which never block nor take any lock, and may be nested.
+ * Writers unpublish an object first, then hand it over to epoch_retire(),
+ * which releases it once no reader may still be looking at it.
+ */
+
+void epoch_enter(void);
+void epoch_exit(void);
+
+void epoch_retire(void *ptr, void (*release)(void *));
+void epoch_reclaim(void);
+
+#endif /* _EPOCH_H */
@@ -36,11 +36,16 @@
 #include <limits.h>
 #include <math.h>	/* HUGE_VAL */
 #include <locale.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "json.h"
 #include "hashtab.h"
 
 #include "jsonrpc_internal.h"
+#include "shm_ring.h"
+#include "sock_un.h"
 
 #define LogError(...)    do { fprintf(stderr, ##__VA_ARGS__); fprintf(stderr, "\n"); } while (0)
 #define LogDebug(...)    do { fprintf(stderr, ##__VA_ARGS__); fprintf(stderr, "\n"); } while (0)
@@ -109,13 +114,11 @@ json_rpc_t *json_rpc_init(void)
 		return NULL;
 
 	json_rpc->sock = -1;
+	json_rpc->payload_fd = -1;
 
 	json_rpc->parsing_status = PARSING_UNKNOWN;
 	json_rpc->params_htab = hcreate(3);
 
-	pthread_mutex_init(&json_rpc->mutex, NULL);
-	pthread_cond_init(&json_rpc->cond, NULL);
-
 	return json_rpc;
 }
 
@@ -124,9 +127,6 @@ void json_rpc_cleanup(json_rpc_t *json_rpc)
 	if (!json_rpc || !json_rpc->params_htab)
 		return;
 
-	pthread_cond_destroy(&json_rpc->cond);
-	pthread_mutex_destroy(&json_rpc->mutex);
-
 	if (hfirst(json_rpc->params_htab)) do
 	{
 		json_val_t *val;
@@ -171,6 +171,19 @@ void json_rpc_cleanup(json_rpc_t *json_rpc)
 	if (json_rpc->msgbuf)
 		free(json_rpc->msgbuf);
 
+	json_rpc_payload_release(json_rpc);
+
+	/* file descriptors left unclaimed by the method */
+	while (json_rpc->fd_count > 0) {
+		int fd = json_rpc->fds[--json_rpc->fd_count];
+		if (fd != -1)
+			close(fd);
+	}
+	if (json_rpc->shm_chan)
+		shm_chan_put(json_rpc->shm_chan);
+	if (json_rpc->peer)
+		un_sock_peer_put(json_rpc->peer);
+
 	free(json_rpc);
 }
 
@@ -313,7 +326,7 @@ int json_rpc_resp_init(json_rpc_t *json_rpc)
 	return 0;
 }
 
-int json_rpc_resp_finalize(json_rpc_t *json_rpc)
+static int json_rpc_resp_close(json_rpc_t *json_rpc, bool partial)
 {
 	int len;
 
@@ -323,7 +336,7 @@ int json_rpc_resp_finalize(json_rpc_t *json_rpc)
 
 	if (!json_val_is_undef(&json_rpc->id)) {
 		json_rpc->msglen += snprintf(msg_p(json_rpc), msg_rem(json_rpc),
-						"},\"id\":");
+						partial ? "},\"stream\":true,\"id\":" : "},\"id\":");
 
 		len = json_print_val(msg_p(json_rpc), msg_rem(json_rpc), &json_rpc->id);
 		if (len < 0)
@@ -337,6 +350,22 @@ int json_rpc_resp_finalize(json_rpc_t *json_rpc)
 	return 0;
 }
 
+int json_rpc_resp_finalize(json_rpc_t *json_rpc)
+{
+	return json_rpc_resp_close(json_rpc, false);
+}
+
+/*
+  Close a response as a partial result of a streamed one, more to come
+ */
+int json_rpc_resp_finalize_partial(json_rpc_t *json_rpc)
+{
+	if (json_val_is_undef(&json_rpc->id))
+		return -EINVAL;
+
+	return json_rpc_resp_close(json_rpc, true);
+}
+
 /*
   semi-optimized lexer for JSON-RPC keywords
 */
@@ -356,6 +385,7 @@ static enum json_rpc_key_token_e json_rpc_key_token(const char *data, size_t len
 			 */
 			[KEY_IDX('p')] = { "params", TOK_PARAMS },
 			[KEY_IDX('r')] = { "result", TOK_RESULT },
+			[KEY_IDX('s')] = { "stream", TOK_STREAM },
 		};
 	int key_idx = KEY_IDX(data[0]);
 
@@ -471,6 +501,12 @@ int json_rpc_parser_callback(void *userdata, int type, const char *data, size_t
 	case JSON_TRUE:
 	case JSON_FALSE:
 
+		if (!json_rpc->param_state && json_rpc->last_key_token == TOK_STREAM) {
+			json_rpc->stream = type == JSON_TRUE;
+			json_rpc->last_key_token = TOK_NONE;
+			break;
+		}
+
 		if (!json_rpc->param_state && json_rpc->last_key_token == TOK_ID) {
 			/* TODO: double check response's id matches the request */
 			json_val_free(&json_rpc->id);
@@ -601,6 +637,30 @@ int json_rpc_add_object_to_array(json_rpc_t *json_rpc)
 	return 0;
 }
 
+/*!
+	Get the error of a response
+
+  \param json_rpc pointer to an opaque handle of a JSON RPC
+  \return 0 if the response has no "error", its error code otherwise,
+  	-ETIMEDOUT when an asynchronous request got no response in time
+ */
+int json_rpc_get_error(json_rpc_t *json_rpc)
+{
+	return json_rpc->error_code;
+}
+
+/*!
+	Tell whether a response is a partial result of a streamed response
+
+  \param json_rpc pointer to an opaque handle of a JSON RPC
+  \return non nul if more partial results or the final response are to come, 0 otherwise
+  \sa abus_stream_response()
+ */
+int json_rpc_is_partial(json_rpc_t *json_rpc)
+{
+	return json_rpc->stream && !json_rpc->service_name;
+}
+
 /*!
 	Get the JSON RPC type of a paramter
 
@@ -998,9 +1058,41 @@ json_rpc_t *json_rpc_req_init(const char *service_name, const char *method_name,
 	return json_rpc;
 }
 
+/*
+  Turn a request into a notification, with no "id" member
+ */
+int json_rpc_req_drop_id(json_rpc_t *json_rpc)
+{
+	size_t off, len;
+
+	if (json_val_is_undef(&json_rpc->id))
+		return 0;
+
+	/* right after the method, as laid out by json_rpc_req_init() */
+	off = strlen("{\"jsonrpc\":\"2.0\",\"method\":\".\",") +
+			strlen(json_rpc->service_name) + strlen(json_rpc->method_name);
+	len = strlen("\"id\":,") + json_rpc->id.length;
+
+	if (off + len > (size_t)json_rpc->msglen || memcmp(json_rpc->msgbuf + off, "\"id\":", 5))
+		return -EINVAL;
+
+	memmove(json_rpc->msgbuf + off, json_rpc->msgbuf + off + len, json_rpc->msglen - off - len);
+	json_rpc->msglen -= len;
+
+	json_val_free(&json_rpc->id);
+
+	return 0;
+}
+
 int json_rpc_req_finalize(json_rpc_t *json_rpc)
 {
-	json_rpc->msglen += snprintf(msg_p(json_rpc), msg_rem(json_rpc), "}}");
+	/* e.g. an event published again */
+	if (json_rpc->req_finalized)
+		return 0;
+	json_rpc->req_finalized = true;
+
+	json_rpc->msglen += snprintf(msg_p(json_rpc), msg_rem(json_rpc),
+					json_rpc->stream ? "},\"stream\":true}" : "}}");
 
 	return 0;
 }
@@ -1042,6 +1134,232 @@ int json_rpc_set_error(json_rpc_t *json_rpc, int error_code, const char *message
 	return 0;
 }
 
+/*
+  Hand over the outcome of a response to another json_rpc, e.g. its request:
+  result params, error code and passed file descriptors
+ */
+void json_rpc_resp_move(json_rpc_t *dst, json_rpc_t *src)
+{
+	htab *params_htab = dst->params_htab;
+	int i;
+
+	if (params_htab && src->params_htab) {
+		dst->params_htab = src->params_htab;
+		/* whatever dst had goes along with src */
+		src->params_htab = params_htab;
+		dst->pointed_htab = NULL;
+		src->pointed_htab = NULL;
+	}
+
+	dst->error_code = src->error_code;
+	dst->parsing_status = src->parsing_status;
+
+	json_rpc_payload_release(dst);
+	while (dst->fd_count > 0) {
+		int fd = dst->fds[--dst->fd_count];
+		if (fd != -1)
+			close(fd);
+	}
+	for (i = 0; i < src->fd_count; i++)
+		dst->fds[i] = src->fds[i];
+	dst->fd_count = src->fd_count;
+	src->fd_count = 0;
+}
+
+void json_rpc_payload_release(json_rpc_t *json_rpc)
+{
+	if (json_rpc->payload)
+		munmap(json_rpc->payload, json_rpc->payload_len);
+	if (json_rpc->payload_fd != -1)
+		close(json_rpc->payload_fd);
+
+	json_rpc->payload_fd = -1;
+	json_rpc->payload = NULL;
+	json_rpc->payload_len = 0;
+	json_rpc->payload_sealed = false;
+	json_rpc->payload_in = false;
+}
+
+#ifdef HAVE_MEMFD_CREATE
+
+#define JSONRPC_PAYLOAD_SEALS (F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_WRITE)
+
+/*!
+	Allocate a binary payload to be sent along a RPC
+
+  The payload travels out of band, in a sealed memory file passed over the
+  A-Bus socket, hence is not bound by JSONRPC_REQ_SZ_MAX. The returned buffer
+  is to be filled in before the RPC is sent, and must not be accessed afterwards.
+
+  On the service side, allocating a payload for the response releases
+  the one received along the request.
+  Payloads are not conveyed by events.
+
+  \param json_rpc pointer to an opaque handle of a JSON RPC
+  \param[in] len length in bytes of the payload, non nul
+  \return pointer to a writable buffer of len bytes, NULL otherwise with errno set
+  \sa json_rpc_attach_payload(), json_rpc_get_payload()
+ */
+void *json_rpc_alloc_payload(json_rpc_t *json_rpc, size_t len)
+{
+	void *map;
+	int fd;
+
+	if (len == 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	json_rpc_payload_release(json_rpc);
+
+	fd = memfd_create("abus-payload", MFD_CLOEXEC|MFD_ALLOW_SEALING);
+	if (fd == -1)
+		return NULL;
+
+	if (ftruncate(fd, len) == -1) {
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		close(fd);
+		return NULL;
+	}
+
+	json_rpc->payload_fd = fd;
+	json_rpc->payload = map;
+	json_rpc->payload_len = len;
+
+	return map;
+}
+
+/*
+  Freeze the payload before sending it: the receiver is then guaranteed
+  its mapping won't change or vanish under its feet.
+  *fd gets the file descriptor to be passed along, -1 if no payload.
+ */
+int json_rpc_payload_seal(json_rpc_t *json_rpc, int *fd)
+{
+	*fd = json_rpc->payload_in ? -1 : json_rpc->payload_fd;
+
+	if (*fd == -1 || json_rpc->payload_sealed)
+		return 0;
+
+	/* no more writable mapping, otherwise F_SEAL_WRITE fails */
+	munmap(json_rpc->payload, json_rpc->payload_len);
+	json_rpc->payload = NULL;
+
+	if (fcntl(json_rpc->payload_fd, F_ADD_SEALS, JSONRPC_PAYLOAD_SEALS|F_SEAL_SEAL) == -1)
+		return -errno;
+
+	json_rpc->payload_sealed = true;
+
+	return 0;
+}
+
+/*!
+	Get the binary payload received along a RPC
+
+  The payload is mapped read-only, without copy, and stays valid
+  until the RPC is cleaned up.
+
+  \param json_rpc pointer to an opaque handle of a JSON RPC
+  \param[out] data pointer to location where to store the address of the payload
+  \param[out] len pointer to location where to store the length of the payload
+  \return	0 if successful, -ENOENT if no payload, non nul value otherwise
+  \sa json_rpc_alloc_payload()
+ */
+int json_rpc_get_payload(json_rpc_t *json_rpc, const void **data, size_t *len)
+{
+	struct stat st;
+	void *map;
+	int fd, seals;
+
+	if (json_rpc->payload_in) {
+		*data = json_rpc->payload;
+		*len = json_rpc->payload_len;
+		return 0;
+	}
+
+	/* a payload comes alone */
+	if (json_rpc->fd_count != 1)
+		return -ENOENT;
+
+	fd = json_rpc->fds[0];
+
+	/* only trust a payload the sender can no longer alter */
+	seals = fcntl(fd, F_GET_SEALS);
+	if (seals == -1 || (seals & JSONRPC_PAYLOAD_SEALS) != JSONRPC_PAYLOAD_SEALS)
+		return -EPERM;
+
+	if (fstat(fd, &st) == -1)
+		return -errno;
+	if (st.st_size == 0)
+		return -ENOENT;
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		return -errno;
+
+	json_rpc->fd_count = 0;
+	json_rpc_payload_release(json_rpc);
+
+	json_rpc->payload_fd = fd;
+	json_rpc->payload = map;
+	json_rpc->payload_len = st.st_size;
+	json_rpc->payload_sealed = true;
+	json_rpc->payload_in = true;
+
+	*data = map;
+	*len = st.st_size;
+
+	return 0;
+}
+
+#else
+
+void *json_rpc_alloc_payload(json_rpc_t *json_rpc, size_t len)
+{
+	errno = ENOSYS;
+	return NULL;
+}
+
+int json_rpc_payload_seal(json_rpc_t *json_rpc, int *fd)
+{
+	*fd = -1;
+	return 0;
+}
+
+int json_rpc_get_payload(json_rpc_t *json_rpc, const void **data, size_t *len)
+{
+	return -ENOENT;
+}
+
+#endif /* HAVE_MEMFD_CREATE */
+
+/*!
+	Attach a copy of a binary payload to be sent along a RPC
+
+  \param json_rpc pointer to an opaque handle of a JSON RPC
+  \param[in] data pointer to the payload
+  \param[in] len length in bytes of the payload, non nul
+  \return	0 if successful, non nul value otherwise
+  \sa json_rpc_alloc_payload()
+ */
+int json_rpc_attach_payload(json_rpc_t *json_rpc, const void *data, size_t len)
+{
+	void *buf;
+
+	buf = json_rpc_alloc_payload(json_rpc, len);
+	if (!buf)
+		return -errno;
+
+	memcpy(buf, data, len);
+
+	return 0;
+}
+
 static int json_rpc_is_comma_needed(const json_rpc_t *json_rpc)
 {
 	char prev_c;
@@ -68,6 +68,8 @@ typedef struct json_rpc json_rpc_t;
 int json_rpc_set_error(json_rpc_t *json_rpc, int error_code, const char *message);
 
 /* both sides */
+int json_rpc_get_error(json_rpc_t *json_rpc);
+int json_rpc_is_partial(json_rpc_t *json_rpc);
 int json_rpc_get_type(json_rpc_t *json_rpc, const char *name);
 
 int json_rpc_get_int(json_rpc_t *json_rpc, const char *name, int *val);
@@ -93,6 +95,11 @@ int json_rpc_append_vargs(json_rpc_t *json_rpc, va_list ap);
 int json_rpc_get_array_count(json_rpc_t *json_rpc, const char *name);
 int json_rpc_get_point_at(json_rpc_t *json_rpc, const char *name, int idx);
 
+/* binary payload, passed out of band */
+void *json_rpc_alloc_payload(json_rpc_t *json_rpc, size_t len);
+int json_rpc_attach_payload(json_rpc_t *json_rpc, const void *data, size_t len);
+int json_rpc_get_payload(json_rpc_t *json_rpc, const void **data, size_t *len);
+
 const char *json_rpc_strerror(int errnum);
 
 #ifdef __cplusplus
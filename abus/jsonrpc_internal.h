@@ -24,6 +24,10 @@
 #include "jsonrpc.h"
 #include "json.h"
 #include "hashtab.h"
+#include "completion.h"
+
+/* max file descriptors passed along a message */
+#define JSONRPC_FDS_MAX 4
 
 #define JSON_LLINT 32765
 #define JSON_ARRAY_HTAB 32766
@@ -52,6 +56,7 @@ enum json_rpc_key_token_e {
 		TOK_MESSAGE,
 		TOK_PARAMS,
 		TOK_RESULT,
+		TOK_STREAM,
 };
 
 struct json_rpc {
@@ -70,14 +75,36 @@ struct json_rpc {
 	void *async_req_context;	/* async req in response rpc */
 	const char *evt_service_name;	/* event only */
 
-	pthread_cond_t cond;
-	pthread_mutex_t mutex;
+	/* async request, completed once its response handler ran */
+	completion_t completion;
 
 	/* response */
 	int error_code;
 
 	struct sockaddr_un sock_src_addr;
 	socklen_t sock_addrlen;
+	struct shm_chan *shm_chan;	/* respond through shared memory */
+	struct un_sock_peer *peer;	/* accepted session sock belongs to, may be NULL */
+	struct abus_batch *batch;	/* batch request it belongs to, responded to as a whole */
+	struct abus_local_call *local;	/* in-process caller waiting for the response */
+
+	/* file descriptors passed along the message */
+	int fds[JSONRPC_FDS_MAX];
+	int fd_count;
+
+	/* binary payload, writable until sealed, read-only once received */
+	int payload_fd;
+	void *payload;
+	size_t payload_len;
+	bool payload_sealed;
+	bool payload_in;	/* received along the message, not to be sent back */
+
+	/* response left to abus_complete_response() by the method */
+	bool resp_deferred;
+	/* request: partial results welcome, response: partial result, more to come */
+	bool stream;
+	/* request closed, ready to be sent */
+	bool req_finalized;
 
 	/* parsing stuff */
 	bool param_state;
@@ -96,7 +123,11 @@ json_rpc_t *json_rpc_init(void);
 void json_rpc_cleanup(json_rpc_t *json_rpc);
 int json_rpc_resp_init(json_rpc_t *json_rpc);
 int json_rpc_resp_finalize(json_rpc_t *json_rpc);
+int json_rpc_resp_finalize_partial(json_rpc_t *json_rpc);
 int json_rpc_parse_msg(json_rpc_t *json_rpc, const char *buffer, size_t len);
+int json_rpc_payload_seal(json_rpc_t *json_rpc, int *fd);
+void json_rpc_payload_release(json_rpc_t *json_rpc);
+void json_rpc_resp_move(json_rpc_t *dst, json_rpc_t *src);
 int json_rpc_type_eq(int type1, int type2);
 int json_val_is_undef(const json_val_t *json_val);
 int json_rpc_add_val(json_rpc_t *json_rpc, int type, const char *data, size_t length);
@@ -107,5 +138,6 @@ int abus_check_valid_service_name(const char *name, size_t maxlen);
 /* service side */
 json_rpc_t *json_rpc_req_init(const char *service_name, const char *method_name, unsigned id);
 int json_rpc_req_finalize(json_rpc_t *json_rpc);
+int json_rpc_req_drop_id(json_rpc_t *json_rpc);
 
 #endif	/* _JSONRPC_INTERNAL_H */
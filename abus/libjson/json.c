@@ -918,7 +918,7 @@ int json_vprint_args(json_printer *printer,
                     va_list ap)
 {
 	const char *data;
-	size_t length;
+	int length;
 	int type, ret, total;
 
 	total = 0;
@@ -939,8 +939,9 @@ int json_vprint_args(json_printer *printer,
 		case JSON_KEY:
 		case JSON_STRING:
 			data = va_arg(ap, const char *);
-			length = va_arg(ap, size_t);
-			if (length == (size_t)-1)
+			/* callers pass plain int, -1 standing for strlen() */
+			length = va_arg(ap, int);
+			if (length < 0)
 				length = strlen(data);
 			ret = (*f)(printer, type, data, length);
 			break;
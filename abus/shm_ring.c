@@ -0,0 +1,579 @@
+/*
+ * Copyright (C) 2011-2012 Stephane Fillod
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Library General Public License as
+ *   published by the Free Software Foundation; either version 2.1 of
+ *   the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Library General Public License for more details.
+ */
+
+/*
+ * Shared memory transport: a pair of rings in a memfd per client thread
+ * and service process, with eventfd wake-ups.
+ *
+ * The client creates the channel, and hands over its file descriptors
+ * to the service with the "shm_attach" built-in method.
+ */
+
+#include "abus_config.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef HAVE_MEMFD_CREATE
+#include <sys/eventfd.h>
+#endif
+
+#include "jsonrpc.h"
+#include "sock_un.h"
+#include "shm_ring.h"
+
+#define LogError(...)    do { fprintf(stderr, ##__VA_ARGS__); fprintf(stderr, "\n"); } while (0)
+
+/* producer and consumer indexes on distinct cache lines */
+struct shm_ring_hdr {
+	uint32_t head;	/* written by consumer */
+	char pad1[60];
+	uint32_t tail;	/* written by producer */
+	uint32_t closed;	/* request ring: set by the service when detaching */
+	char pad2[56];
+};
+
+#define SHM_RING_MASK (SHM_RING_SZ-1)
+#define SHM_RING_WRAP 0xffffffffU
+/* record length flag: file descriptors sent ahead over the hang-up socket */
+#define SHM_REC_FDS 0x80000000U
+#define SHM_REC_LEN(len) (((len) + sizeof(uint32_t) + 7) & ~7U)
+
+#define SHM_MAP_SZ (2*(sizeof(struct shm_ring_hdr) + SHM_RING_SZ))
+
+/*
+ * Append a message, without blocking.
+ * Records are 8 bytes aligned, and never wrap: a marker tells
+ * the consumer to skip the end of the ring.
+ */
+static int shm_ring_push_rec(shm_ring_t *ring, const void *buf, uint32_t len, uint32_t flags)
+{
+	uint32_t head, tail, off, pad, rec;
+
+	rec = SHM_REC_LEN(len);
+	if (rec > SHM_RING_SZ/2)
+		return -EMSGSIZE;
+
+	tail = ring->hdr->tail;
+	head = __atomic_load_n(&ring->hdr->head, __ATOMIC_ACQUIRE);
+
+	off = tail & SHM_RING_MASK;
+	pad = SHM_RING_SZ - off < rec ? SHM_RING_SZ - off : 0;
+
+	if (SHM_RING_SZ - (tail - head) < pad + rec)
+		return -EAGAIN;
+
+	if (pad) {
+		*(uint32_t *)(ring->data + off) = SHM_RING_WRAP;
+		tail += pad;
+		off = 0;
+	}
+
+	*(uint32_t *)(ring->data + off) = len | flags;
+	memcpy(ring->data + off + sizeof(uint32_t), buf, len);
+
+	__atomic_store_n(&ring->hdr->tail, tail + rec, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+int shm_ring_push(shm_ring_t *ring, const void *buf, uint32_t len)
+{
+	return shm_ring_push_rec(ring, buf, len, 0);
+}
+
+/*
+ * Point at the oldest message, in place.
+ * Returns its length, 0 if the ring is empty, or -EBADMSG on garbage.
+ */
+int shm_ring_peek(shm_ring_t *ring, const char **buf)
+{
+	uint32_t head, tail, off, len;
+
+	head = ring->hdr->head;
+	tail = __atomic_load_n(&ring->hdr->tail, __ATOMIC_ACQUIRE);
+
+	if (tail - head > SHM_RING_SZ)
+		return -EBADMSG;
+
+	while (head != tail) {
+		off = head & SHM_RING_MASK;
+		len = *(const uint32_t *)(ring->data + off);
+
+		if (len == SHM_RING_WRAP) {
+			head += SHM_RING_SZ - off;
+			__atomic_store_n(&ring->hdr->head, head, __ATOMIC_RELEASE);
+			continue;
+		}
+
+		ring->peeked_fds = (len & SHM_REC_FDS) != 0;
+		len &= ~SHM_REC_FDS;
+
+		/* the peer may write anything into the ring */
+		if (SHM_REC_LEN(len) > SHM_RING_SZ - off || SHM_REC_LEN(len) > tail - head)
+			return -EBADMSG;
+
+		ring->peeked = len;
+		*buf = ring->data + off + sizeof(uint32_t);
+
+		return len;
+	}
+
+	return 0;
+}
+
+/*
+ * Release the message got from shm_ring_peek()
+ */
+void shm_ring_consume(shm_ring_t *ring)
+{
+	__atomic_store_n(&ring->hdr->head, ring->hdr->head + SHM_REC_LEN(ring->peeked), __ATOMIC_RELEASE);
+}
+
+#ifdef HAVE_MEMFD_CREATE
+
+static shm_chan_t *shm_chan_map(int memfd)
+{
+	shm_chan_t *chan;
+	char *map;
+
+	map = mmap(NULL, SHM_MAP_SZ, PROT_READ|PROT_WRITE, MAP_SHARED, memfd, 0);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	chan = calloc(1, sizeof(*chan));
+	if (!chan) {
+		munmap(map, SHM_MAP_SZ);
+		return NULL;
+	}
+
+	chan->map = map;
+	chan->req.hdr = (struct shm_ring_hdr *)map;
+	chan->req.data = map + sizeof(struct shm_ring_hdr);
+	map += sizeof(struct shm_ring_hdr) + SHM_RING_SZ;
+	chan->resp.hdr = (struct shm_ring_hdr *)map;
+	chan->resp.data = map + sizeof(struct shm_ring_hdr);
+
+	chan->req_efd = chan->resp_efd = chan->hup_fd = -1;
+	chan->refcount = 1;
+	pthread_mutex_init(&chan->resp_mutex, NULL);
+
+	return chan;
+}
+
+/*
+ * Client side: create a channel.
+ * fds[] get the file descriptors to be handed over to the service.
+ * fds[SHM_FD_MEM] and fds[SHM_FD_HUP] are to be closed by the caller
+ * once sent, the other ones belong to the channel.
+ */
+shm_chan_t *shm_chan_create(int fds[SHM_FD_NB])
+{
+	shm_chan_t *chan;
+	int memfd, sv[2];
+
+	memfd = memfd_create("abus-shm", MFD_CLOEXEC);
+	if (memfd == -1)
+		return NULL;
+
+	if (ftruncate(memfd, SHM_MAP_SZ) == -1) {
+		close(memfd);
+		return NULL;
+	}
+
+	/* fresh memfd is zero filled, hence empty rings */
+	chan = shm_chan_map(memfd);
+	if (!chan) {
+		close(memfd);
+		return NULL;
+	}
+
+	chan->req_efd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+	chan->resp_efd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+
+	if (chan->req_efd == -1 || chan->resp_efd == -1 ||
+			socketpair(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0, sv) == -1) {
+		shm_chan_put(chan);
+		close(memfd);
+		return NULL;
+	}
+	chan->hup_fd = sv[0];
+
+	fds[SHM_FD_MEM] = memfd;
+	fds[SHM_FD_REQ_EVT] = chan->req_efd;
+	fds[SHM_FD_RESP_EVT] = chan->resp_efd;
+	fds[SHM_FD_HUP] = sv[1];
+
+	return chan;
+}
+
+/*
+ * Service side: map a channel handed over by a client.
+ * Takes ownership of the file descriptors, even on failure.
+ */
+shm_chan_t *shm_chan_attach(const int fds[SHM_FD_NB])
+{
+	shm_chan_t *chan = NULL;
+	struct stat st;
+
+	if (fstat(fds[SHM_FD_MEM], &st) == 0 && st.st_size == (off_t)SHM_MAP_SZ)
+		chan = shm_chan_map(fds[SHM_FD_MEM]);
+
+	close(fds[SHM_FD_MEM]);
+
+	if (!chan) {
+		close(fds[SHM_FD_REQ_EVT]);
+		close(fds[SHM_FD_RESP_EVT]);
+		close(fds[SHM_FD_HUP]);
+		return NULL;
+	}
+
+	chan->req_efd = fds[SHM_FD_REQ_EVT];
+	chan->resp_efd = fds[SHM_FD_RESP_EVT];
+	chan->hup_fd = fds[SHM_FD_HUP];
+
+	return chan;
+}
+
+#else
+
+shm_chan_t *shm_chan_create(int fds[SHM_FD_NB])
+{
+	errno = ENOSYS;
+	return NULL;
+}
+
+shm_chan_t *shm_chan_attach(const int fds[SHM_FD_NB])
+{
+	int i;
+
+	for (i = 0; i < SHM_FD_NB; i++)
+		close(fds[i]);
+	errno = ENOSYS;
+	return NULL;
+}
+
+#endif /* HAVE_MEMFD_CREATE */
+
+void shm_chan_get(shm_chan_t *chan)
+{
+	__sync_add_and_fetch(&chan->refcount, 1);
+}
+
+void shm_chan_put(shm_chan_t *chan)
+{
+	if (__sync_sub_and_fetch(&chan->refcount, 1) != 0)
+		return;
+
+	munmap(chan->map, SHM_MAP_SZ);
+	if (chan->req_efd != -1)
+		close(chan->req_efd);
+	if (chan->resp_efd != -1)
+		close(chan->resp_efd);
+	if (chan->hup_fd != -1)
+		close(chan->hup_fd);
+	pthread_mutex_destroy(&chan->resp_mutex);
+	free(chan);
+}
+
+static void shm_chan_wake(int efd)
+{
+	uint64_t one = 1;
+
+	if (write(efd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+		LogError("%s: eventfd write failed: %s", __func__, strerror(errno));
+}
+
+/*
+ * Service side: queue a response, from the A-Bus thread or a threaded method.
+ * File descriptors cannot live in the ring, they go ahead over the
+ * hang-up socket, and the response is flagged accordingly.
+ */
+int shm_chan_send_resp(shm_chan_t *chan, const void *buf, uint32_t len, const int *fds, int nfds)
+{
+	char c = 0;
+	int ret = 0;
+
+	pthread_mutex_lock(&chan->resp_mutex);
+	if (nfds > 0)
+		ret = un_sock_sendto_sock(chan->hup_fd, &c, 1, NULL, 0, fds, nfds);
+	if (ret >= 0)
+		ret = shm_ring_push_rec(&chan->resp, buf, len, nfds > 0 ? SHM_REC_FDS : 0);
+	pthread_mutex_unlock(&chan->resp_mutex);
+
+	if (ret == 0)
+		shm_chan_wake(chan->resp_efd);
+
+	return ret;
+}
+
+static long long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Service side: tell the client the channel is no longer served,
+ * e.g. upon abus_cleanup(), for it to attach a new one
+ */
+void shm_chan_close(shm_chan_t *chan)
+{
+	__atomic_store_n(&chan->req.hdr->closed, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Client side: send request, and wait for the response into the same buffer.
+ * File descriptors passed along the response are stored in rfds.
+ * Any error leaves the channel unusable, since a late response
+ * would be taken for the one of the next request.
+ * Returns -EPIPE without sending anything if the service closed the channel.
+ */
+int shm_chan_transaction(shm_chan_t *chan, void *buf, size_t len, size_t bufsz, int timeout,
+				int *rfds, int *rnfds)
+{
+	struct pollfd pfd[2];
+	long long deadline;
+	const char *resp;
+	uint64_t cnt;
+	int ret;
+
+	if (__atomic_load_n(&chan->req.hdr->closed, __ATOMIC_ACQUIRE))
+		return -EPIPE;
+
+	ret = shm_ring_push(&chan->req, buf, len);
+	if (ret)
+		return ret;
+
+	shm_chan_wake(chan->req_efd);
+
+	deadline = now_ms() + timeout;
+
+	pfd[0].fd = chan->resp_efd;
+	pfd[0].events = POLLIN;
+	/* hang-up only, passed file descriptors are collected with the response */
+	pfd[1].fd = chan->hup_fd;
+	pfd[1].events = 0;
+
+	for (;;) {
+		ret = shm_ring_peek(&chan->resp, &resp);
+		if (ret < 0)
+			return ret;
+		if (ret > 0) {
+			if ((size_t)ret > bufsz)
+				return -EMSGSIZE;
+			memcpy(buf, resp, ret);
+			if (chan->resp.peeked_fds && rfds) {
+				char c;
+				ssize_t n;
+
+				n = un_sock_recvmsg(chan->hup_fd, &c, 1, MSG_DONTWAIT, NULL, NULL, rfds, rnfds);
+				if (n < 0)
+					ret = n;
+			}
+			shm_ring_consume(&chan->resp);
+			return ret;
+		}
+
+		ret = poll(pfd, 2, timeout < 0 ? -1 : (int)(deadline - now_ms() > 0 ? deadline - now_ms() : 0));
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret == -1)
+			return -errno;
+		if (ret == 0)
+			return -ETIMEDOUT;
+
+		if (pfd[0].revents & POLLIN) {
+			if (read(chan->resp_efd, &cnt, sizeof(cnt)) == -1 && errno != EAGAIN)
+				return -errno;
+			continue;
+		}
+
+		/* service went away, unless the response just got in */
+		if (pfd[1].revents) {
+			ret = shm_ring_peek(&chan->resp, &resp);
+			if (ret == 0)
+				return -ECONNRESET;
+		}
+	}
+}
+
+/*
+ * Per-thread channels of the client, by service name
+ */
+#define SHM_CLNT_CHANS_MAX 16
+
+struct shm_clnt_entry {
+	char service_name[JSONRPC_SVCNAME_SZ_MAX+1];
+	shm_chan_t *chan;	/* NULL when the service refused shared memory */
+	bool used;
+};
+
+struct shm_clnt {
+	pid_t pid;	/* mappings are not to be shared with a forked child */
+	struct shm_clnt_entry entries[SHM_CLNT_CHANS_MAX];
+	unsigned victim;
+};
+
+static pthread_key_t shm_clnt_key;
+static pthread_once_t shm_clnt_key_once = PTHREAD_ONCE_INIT;
+
+static void shm_clnt_entry_drop(struct shm_clnt_entry *entry)
+{
+	if (entry->chan)
+		shm_chan_put(entry->chan);
+	entry->chan = NULL;
+	entry->used = false;
+}
+
+static void shm_clnt_destroy(void *arg)
+{
+	struct shm_clnt *clnt = (struct shm_clnt *)arg;
+	int i;
+
+	for (i = 0; i < SHM_CLNT_CHANS_MAX; i++)
+		shm_clnt_entry_drop(&clnt->entries[i]);
+	free(clnt);
+}
+
+static void shm_clnt_key_create(void)
+{
+	pthread_key_create(&shm_clnt_key, shm_clnt_destroy);
+}
+
+static struct shm_clnt *shm_clnt_get(void)
+{
+	struct shm_clnt *clnt;
+	int i;
+
+	pthread_once(&shm_clnt_key_once, shm_clnt_key_create);
+
+	clnt = pthread_getspecific(shm_clnt_key);
+	if (!clnt) {
+		clnt = calloc(1, sizeof(*clnt));
+		if (!clnt)
+			return NULL;
+		clnt->pid = getpid();
+		pthread_setspecific(shm_clnt_key, clnt);
+	}
+
+	if (clnt->pid != getpid()) {
+		/* inherited from parent process */
+		for (i = 0; i < SHM_CLNT_CHANS_MAX; i++)
+			shm_clnt_entry_drop(&clnt->entries[i]);
+		clnt->pid = getpid();
+	}
+
+	return clnt;
+}
+
+static struct shm_clnt_entry *shm_clnt_find(struct shm_clnt *clnt, const char *service_name)
+{
+	int i;
+
+	for (i = 0; i < SHM_CLNT_CHANS_MAX; i++) {
+		if (clnt->entries[i].used && !strcmp(clnt->entries[i].service_name, service_name))
+			return &clnt->entries[i];
+	}
+
+	return NULL;
+}
+
+/*
+ * Returns 0 if known, with *chan possibly NULL if the service refused
+ * shared memory, -ENOENT if not attached yet
+ */
+int shm_clnt_lookup(const char *service_name, shm_chan_t **chan)
+{
+	struct shm_clnt *clnt;
+	struct shm_clnt_entry *entry;
+
+	clnt = shm_clnt_get();
+	if (!clnt)
+		return -ENOMEM;
+
+	entry = shm_clnt_find(clnt, service_name);
+	if (!entry)
+		return -ENOENT;
+
+	*chan = entry->chan;
+
+	return 0;
+}
+
+/*
+ * Remember the channel to a service, taking over the reference.
+ * A NULL chan records a refusal.
+ */
+int shm_clnt_register(const char *service_name, shm_chan_t *chan)
+{
+	struct shm_clnt *clnt;
+	struct shm_clnt_entry *entry;
+	int i;
+
+	if (strlen(service_name) >= sizeof(entry->service_name))
+		return -ENAMETOOLONG;
+
+	clnt = shm_clnt_get();
+	if (!clnt)
+		return -ENOMEM;
+
+	entry = shm_clnt_find(clnt, service_name);
+	if (!entry) {
+		/* free slot, otherwise recycle round-robin */
+		for (i = 0; i < SHM_CLNT_CHANS_MAX; i++) {
+			if (!clnt->entries[i].used)
+				break;
+		}
+		if (i == SHM_CLNT_CHANS_MAX)
+			i = clnt->victim++ % SHM_CLNT_CHANS_MAX;
+		entry = &clnt->entries[i];
+	}
+
+	shm_clnt_entry_drop(entry);
+
+	strcpy(entry->service_name, service_name);
+	entry->chan = chan;
+	entry->used = true;
+
+	return 0;
+}
+
+void shm_clnt_forget(const char *service_name)
+{
+	struct shm_clnt *clnt;
+	struct shm_clnt_entry *entry;
+
+	clnt = shm_clnt_get();
+	if (!clnt)
+		return;
+
+	entry = shm_clnt_find(clnt, service_name);
+	if (entry)
+		shm_clnt_entry_drop(entry);
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2011-2012 Stephane Fillod
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Library General Public License as
+ *   published by the Free Software Foundation; either version 2.1 of
+ *   the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Library General Public License for more details.
+ */
+
+#ifndef _SHM_RING_H
+#define _SHM_RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+/* data bytes per ring, power of 2 */
+#define SHM_RING_SZ (64*1024)
+
+/* file descriptors handed over to the service upon attach, in that order */
+enum {
+	SHM_FD_MEM,		/* memfd holding both rings */
+	SHM_FD_REQ_EVT,	/* eventfd, client -> service wake-up */
+	SHM_FD_RESP_EVT,	/* eventfd, service -> client wake-up */
+	SHM_FD_HUP,		/* socket end, hung up when the client goes away */
+	SHM_FD_NB
+};
+
+struct shm_ring_hdr;
+
+/* single producer, single consumer ring of length prefixed messages */
+typedef struct shm_ring {
+	struct shm_ring_hdr *hdr;
+	char *data;
+	uint32_t peeked;	/* consumer side, length of record peeked at */
+	bool peeked_fds;	/* consumer side, record comes with file descriptors */
+} shm_ring_t;
+
+/* request ring and response ring, between one client thread and a service */
+typedef struct shm_chan {
+	void *map;
+	shm_ring_t req;
+	shm_ring_t resp;
+	int req_efd;
+	int resp_efd;
+	int hup_fd;
+	int refcount;
+	pthread_mutex_t resp_mutex;	/* service side: threaded methods respond too */
+} shm_chan_t;
+
+int shm_ring_push(shm_ring_t *ring, const void *buf, uint32_t len);
+int shm_ring_peek(shm_ring_t *ring, const char **buf);
+void shm_ring_consume(shm_ring_t *ring);
+
+shm_chan_t *shm_chan_create(int fds[SHM_FD_NB]);
+shm_chan_t *shm_chan_attach(const int fds[SHM_FD_NB]);
+void shm_chan_get(shm_chan_t *chan);
+void shm_chan_put(shm_chan_t *chan);
+
+void shm_chan_close(shm_chan_t *chan);
+int shm_chan_send_resp(shm_chan_t *chan, const void *buf, uint32_t len, const int *fds, int nfds);
+int shm_chan_transaction(shm_chan_t *chan, void *buf, size_t len, size_t bufsz, int timeout,
+				int *rfds, int *rnfds);
+
+/* client side, per-thread channels */
+int shm_clnt_lookup(const char *service_name, shm_chan_t **chan);
+int shm_clnt_register(const char *service_name, shm_chan_t *chan);
+void shm_clnt_forget(const char *service_name);
+
+#endif /* _SHM_RING_H */
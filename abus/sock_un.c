@@ -20,22 +20,43 @@
 #include <fcntl.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <errno.h>
 #include <pthread.h>
+#include <time.h>
+
+#include <poll.h>
 
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
 
+#include "lookupa.h"
 #include "sock_un.h"
 
 #define LogError(...)    do { fprintf(stderr, ##__VA_ARGS__); fprintf(stderr, "\n"); } while (0)
 #define LogDebug(...)    do { fprintf(stderr, ##__VA_ARGS__); fprintf(stderr, "\n"); } while (0)
 
 
+/* listening socket path, appended to the "_<pid>" of the datagram socket */
+#define UN_SOCK_SEQPACKET_SUFFIX ".seq"
+
+/* send buffer of the A-Bus socket */
+#define UN_SOCK_SNDBUF (1024*1024)
+
+/* name prefix of the sockets in the abstract namespace */
+#define UN_SOCK_ABSTRACT_PREFIX "abus/"
+
+/* resolved service addresses, log2 of the number of cache slots */
+#define UN_SOCK_ADDR_CACHE_BITS 6
+
 const char *abus_prefix = "/tmp/abus";
 int abus_msg_verbose;
+int abus_abstract;
 
 static void un_sock_print_message(int out, const struct sockaddr *sockaddr, const char *msg, int msglen)
 {
@@ -61,11 +82,41 @@ static void set_fd_cloexec(int fd)
 #endif
 }
 
-int un_sock_create(void)
+/*
+ * Address of the socket named after a service or "_<pid>",
+ * either in the abus_prefix directory or in the abstract namespace.
+ * Returns the length of the address.
+ */
+static socklen_t un_sock_addr(struct sockaddr_un *sockaddrun, const char *name)
+{
+	int n;
+
+	memset(sockaddrun, 0, sizeof(*sockaddrun));
+	sockaddrun->sun_family = AF_UNIX;
+
+	if (!abus_abstract) {
+		/* TODO: prefix from env variable */
+		snprintf(sockaddrun->sun_path, sizeof(sockaddrun->sun_path)-1,
+						"%s/%s", abus_prefix, name);
+		return SUN_LEN(sockaddrun);
+	}
+
+	/* "\0abus/<name>", not NUL terminated */
+	n = snprintf(sockaddrun->sun_path+1, sizeof(sockaddrun->sun_path)-2,
+					UN_SOCK_ABSTRACT_PREFIX "%s", name);
+	if (n > (int)sizeof(sockaddrun->sun_path)-2)
+		n = sizeof(sockaddrun->sun_path)-2;
+
+	return offsetof(struct sockaddr_un, sun_path) + 1 + n;
+}
+
+static int un_sock_bind(const char *name, bool main_sock)
 {
 	struct sockaddr_un sockaddrun;
+	socklen_t addrlen;
 	int sock, ret;
 	int reuse_addr = 1;
+	int sndbuf = UN_SOCK_SNDBUF;
 
 	sock = socket(AF_UNIX, SOCK_DGRAM, 0);
 	if (sock < 0) {
@@ -76,12 +127,7 @@ int un_sock_create(void)
 
 	set_fd_cloexec(sock);
 
-	memset(&sockaddrun, 0, sizeof(sockaddrun));
-	sockaddrun.sun_family = AF_UNIX;
-
-	/* TODO: prefix from env variable */
-	snprintf(sockaddrun.sun_path, sizeof(sockaddrun.sun_path)-1,
-					"%s/_%d", abus_prefix, getpid());
+	addrlen = un_sock_addr(&sockaddrun, name);
 
 	/* So that we can re-bind to it without TIME_WAIT problems */
 	if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse_addr, sizeof(reuse_addr)) < 0)
@@ -92,7 +138,12 @@ int un_sock_create(void)
 		return ret;
 	}
 
-	if (bind(sock, (struct sockaddr *) &sockaddrun, SUN_LEN(&sockaddrun)) < 0)
+	/* Room for an event fanned out to plenty of subscribers,
+	   silently capped by net.core.wmem_max */
+	if (main_sock)
+		setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+	if (bind(sock, (struct sockaddr *) &sockaddrun, addrlen) < 0)
 	{
 		ret = -errno;
 		LogError("%s: failed to bind server socket: %s", __func__, strerror(errno));
@@ -103,6 +154,27 @@ int un_sock_create(void)
 	return sock;
 }
 
+int un_sock_create(void)
+{
+	char pid_name[32];
+
+	snprintf(pid_name, sizeof(pid_name), "_%d", getpid());
+
+	return un_sock_bind(pid_name, true);
+}
+
+/*
+ * In abstract mode, each service gets a socket of its own, named after it.
+ * Received requests are responded through the A-Bus socket.
+ */
+int un_sock_create_svc(const char *service_name)
+{
+	if (!abus_abstract)
+		return -EINVAL;
+
+	return un_sock_bind(service_name, false);
+}
+
 int un_sock_close(int sock)
 {
 	char pid_path[UNIX_PATH_MAX];
@@ -112,6 +184,10 @@ int un_sock_close(int sock)
 
 	close(sock);
 
+	/* nothing left behind in the abstract namespace */
+	if (abus_abstract)
+		return 0;
+
 	/* TODO: prefix from env variable */
 	snprintf(pid_path, sizeof(pid_path)-1, "%s/_%d", abus_prefix, getpid());
 
@@ -120,142 +196,684 @@ int un_sock_close(int sock)
 	return 0;
 }
 
+/*
+ * Call cb for each service bound in the abstract namespace, as listed
+ * in /proc/net/unix, until cb returns non zero.
+ */
+int un_sock_abstract_services(int (*cb)(const char *service_name, void *arg), void *arg)
+{
+	static const char prefix[] = "@" UN_SOCK_ABSTRACT_PREFIX;
+	char line[256];
+	char *name;
+	FILE *fp;
+	int ret = 0;
+
+	fp = fopen("/proc/net/unix", "re");
+	if (!fp)
+		return -errno;
+
+	while (ret == 0 && fgets(line, sizeof(line), fp)) {
+		/* path is the last field */
+		name = strstr(line, prefix);
+		if (!name)
+			continue;
+		name += sizeof(prefix)-1;
+		name[strcspn(name, " \n")] = '\0';
+
+		/* skip "_<pid>" sockets */
+		if (name[0] == '\0' || name[0] == '_')
+			continue;
+
+		ret = cb(name, arg);
+	}
+
+	fclose(fp);
+
+	return ret;
+}
+
 /*
  * \param[in] timeout   receiving timeout in milliseconds
- * \result 1 if data available for receive, 0 if timeout or -1 in case of error
+ * \result 1 if data available for receive, 0 if timeout or negative errno in case of error
  */
-static int select_for_read(int sock, int timeout)
+static int poll_for_read(int sock, int timeout)
 {
-	fd_set setr, sete;
-	struct timeval tv;
+	struct pollfd pfd;
 	int ret;
 
-	FD_ZERO(&setr);
-	FD_SET(sock, &setr);
+	pfd.fd = sock;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
 
-	memcpy(&sete, &setr, sizeof(fd_set));
+	do {
+		ret = poll(&pfd, 1, timeout);
+	} while (ret == -1 && errno == EINTR);
 
-	tv.tv_sec = timeout / 1000;
-	tv.tv_usec = (timeout % 1000) * 1000;
+	if (ret < 0)
+	{
+		ret = -errno;
+		LogError("%s: poll fails with error: %s", __func__, strerror(errno));
+		return ret;
+	}
+	if (ret == 0)
+	{
+		return 0;
+	}
+	if (!(pfd.revents & POLLIN) && (pfd.revents & (POLLERR|POLLHUP|POLLNVAL)))
+	{
+		LogError("%s: error detected on sock by poll", __func__);
+		return -EIO;
+	}
+	return 1;
+}
+
+/*
+ * Create an epoll instance with \a sock registered for read
+ */
+int un_sock_epoll_create(int sock)
+{
+	int epfd, ret;
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd == -1) {
+		ret = -errno;
+		LogError("%s: epoll_create failed: %s", __func__, strerror(errno));
+		return ret;
+	}
+
+	if (sock != -1) {
+		ret = un_sock_epoll_add(epfd, sock, EPOLLIN, sock);
+		if (ret != 0) {
+			close(epfd);
+			return ret;
+		}
+	}
+
+	return epfd;
+}
+
+int un_sock_epoll_add(int epfd, int fd, unsigned events, int data)
+{
+	struct epoll_event ev;
+	int ret;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.fd = data;
+
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+		ret = -errno;
+		LogError("%s: epoll_ctl failed: %s", __func__, strerror(-ret));
+		return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Wait on an epoll instance which registrations are kept from call to call
+ *
+ * \param[in] timeout   receiving timeout in milliseconds
+ * \result 1 if data available for receive, 0 if timeout or negative errno in case of error
+ */
+static int epoll_for_read(int epfd, int timeout)
+{
+	struct epoll_event ev;
+	int ret;
 
 	do {
-		ret = select(sock + 1, &setr, NULL, &sete, &tv);
+		ret = epoll_wait(epfd, &ev, 1, timeout);
 	} while (ret == -1 && errno == EINTR);
 
 	if (ret < 0)
 	{
 		ret = -errno;
-		LogError("%s: select fails with error: %s", __func__, strerror(errno));
+		LogError("%s: epoll_wait fails with error: %s", __func__, strerror(errno));
 		return ret;
 	}
 	if (ret == 0)
 	{
 		return 0;
 	}
-	if (FD_ISSET(sock, &sete))
+	if (!(ev.events & EPOLLIN) && (ev.events & (EPOLLERR|EPOLLHUP)))
 	{
-		LogError("%s: error detected on sock by select", __func__);
+		LogError("%s: error detected on sock by epoll", __func__);
 		return -EIO;
 	}
 	return 1;
 }
 
 
+/*
+ * sendto(), passing along file descriptors if any
+ */
+static ssize_t un_sock_sendmsg(int sock, const void *buf, size_t len, int flags,
+				const struct sockaddr *dest_addr, int addrlen, const int *fds, int nfds)
+{
+	char control[CMSG_SPACE(sizeof(int)*UN_SOCK_FDS_MAX)];
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+
+	if (nfds == 0)
+		return sendto(sock, buf, len, flags, dest_addr, addrlen);
+
+	if (nfds > UN_SOCK_FDS_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	iov.iov_base = (void *)buf;
+	iov.iov_len = len;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = (void *)dest_addr;
+	msg.msg_namelen = addrlen;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = CMSG_SPACE(sizeof(int)*nfds);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int)*nfds);
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(int)*nfds);
+
+	return sendmsg(sock, &msg, flags);
+}
+
+/*
+ * Process-wide cache of the "_<pid>" socket addresses the service symlinks
+ * point to, sparing the kernel the symlink follow on each send.
+ * A watcher thread, reported by inotify of the changes in the abus_prefix
+ * directory, invalidates the entry of the name being created or deleted.
+ * Lookups only take the read lock of their slot.
+ */
+struct un_sock_addr_entry {
+	pthread_rwlock_t lock;
+	unsigned seq;		/* bumped on each invalidation of the slot */
+	unsigned gen;		/* valid if equal to addr_cache.gen */
+	char service_name[UNIX_PATH_MAX];
+	struct sockaddr_un addr;
+	socklen_t addrlen;
+};
+
+/* bounds of the delay before watching again a missing abus_prefix, in ms */
+#define UN_SOCK_ADDR_WATCH_BACKOFF_MIN 100
+#define UN_SOCK_ADDR_WATCH_BACKOFF_MAX 10000
+
+static struct {
+	pthread_mutex_t mutex;	/* watcher start and stop */
+	unsigned gen;
+	bool watching;
+	bool has_watcher;
+	pthread_t watcher;
+	int users;
+	struct timespec next_watch;
+	int backoff_ms;
+	struct un_sock_addr_entry entries[hashsize(UN_SOCK_ADDR_CACHE_BITS)];
+} addr_cache = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.gen = 1,
+	.backoff_ms = UN_SOCK_ADDR_WATCH_BACKOFF_MIN,
+};
+
+static struct un_sock_addr_entry *un_sock_addr_cache_slot(const char *service_name, size_t name_len)
+{
+	return &addr_cache.entries[hlookup((const ub1 *)service_name, name_len, 0) &
+						hashmask(UN_SOCK_ADDR_CACHE_BITS)];
+}
 
-int un_sock_sendto_svc(int sock, const void *buf, size_t len, const char *service_name)
+/* Invalidate the entry of service_name, and any fill of its slot in progress */
+static void un_sock_addr_cache_drop(const char *service_name)
+{
+	struct un_sock_addr_entry *entry;
+
+	entry = un_sock_addr_cache_slot(service_name, strlen(service_name));
+
+	pthread_rwlock_wrlock(&entry->lock);
+	entry->seq++;
+	if (!strcmp(entry->service_name, service_name))
+		entry->gen = 0;
+	pthread_rwlock_unlock(&entry->lock);
+}
+
+static void un_sock_addr_watcher_cleanup(void *arg)
+{
+	close((int)(intptr_t)arg);
+}
+
+/* inotify events read at once by the watcher */
+#define UN_SOCK_ADDR_WATCH_BUFSZ 4096
+
+/* Process the inotify events until the watch is gone */
+static void un_sock_addr_watch_events(int fd, char *buf)
+{
+	const struct inotify_event *event;
+	bool watching = true;
+	ssize_t n;
+
+	while (watching) {
+		n = read(fd, buf, UN_SOCK_ADDR_WATCH_BUFSZ);
+		if (n == -1 && errno == EINTR)
+			continue;
+
+		/* directory gone, next lookup will watch again */
+		if (n <= 0)
+			watching = false;
+		for (event = (const struct inotify_event *)buf; n > 0 &&
+				(const char *)event < buf + n;
+				event = (const struct inotify_event *)((const char *)(event+1) + event->len)) {
+			if (event->mask & IN_IGNORED)
+				watching = false;
+			/* events were lost, any entry may be stale */
+			if (event->mask & IN_Q_OVERFLOW)
+				__atomic_add_fetch(&addr_cache.gen, 1, __ATOMIC_RELEASE);
+			if (event->len > 0)
+				un_sock_addr_cache_drop(event->name);
+		}
+	}
+}
+
+static void *un_sock_addr_watcher(void *arg)
+{
+	char *buf;
+
+	/* aligned enough for struct inotify_event */
+	buf = malloc(UN_SOCK_ADDR_WATCH_BUFSZ);
+
+	pthread_cleanup_push(un_sock_addr_watcher_cleanup, arg);
+	pthread_cleanup_push(free, buf);
+
+	if (buf)
+		un_sock_addr_watch_events((int)(intptr_t)arg, buf);
+
+	/* not watched anymore, nothing cached can be trusted */
+	__atomic_add_fetch(&addr_cache.gen, 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&addr_cache.watching, false, __ATOMIC_RELEASE);
+
+	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
+
+	return NULL;
+}
+
+/* Caller must hold addr_cache.mutex */
+static void un_sock_addr_watcher_stop(void)
+{
+	if (!addr_cache.has_watcher)
+		return;
+
+	/* a watcher which exited on its own is only joined */
+	pthread_cancel(addr_cache.watcher);
+	pthread_join(addr_cache.watcher, NULL);
+	addr_cache.has_watcher = false;
+
+	__atomic_add_fetch(&addr_cache.gen, 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&addr_cache.watching, false, __ATOMIC_RELEASE);
+}
+
+static void un_sock_addr_cache_atfork(void)
+{
+	unsigned i;
+
+	/* the watcher thread did not make it to the child */
+	addr_cache.gen++;
+	addr_cache.watching = false;
+	addr_cache.has_watcher = false;
+	addr_cache.backoff_ms = UN_SOCK_ADDR_WATCH_BACKOFF_MIN;
+	memset(&addr_cache.next_watch, 0, sizeof(addr_cache.next_watch));
+	pthread_mutex_init(&addr_cache.mutex, NULL);
+	for (i = 0; i < hashsize(UN_SOCK_ADDR_CACHE_BITS); i++)
+		pthread_rwlock_init(&addr_cache.entries[i].lock, NULL);
+}
+
+static void un_sock_addr_cache_init(void)
+{
+	unsigned i;
+
+	for (i = 0; i < hashsize(UN_SOCK_ADDR_CACHE_BITS); i++)
+		pthread_rwlock_init(&addr_cache.entries[i].lock, NULL);
+
+	pthread_atfork(NULL, NULL, un_sock_addr_cache_atfork);
+}
+
+static pthread_once_t addr_cache_once = PTHREAD_ONCE_INIT;
+
+/* Caller must hold addr_cache.mutex */
+static int un_sock_addr_cache_watch(void)
+{
+	int fd, ret;
+
+	fd = inotify_init1(IN_CLOEXEC);
+	if (fd == -1)
+		return -errno;
+
+	if (inotify_add_watch(fd, abus_prefix, IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|IN_DELETE_SELF) == -1) {
+		ret = -errno;
+		close(fd);
+		return ret;
+	}
+
+	ret = -pthread_create(&addr_cache.watcher, NULL, un_sock_addr_watcher, (void *)(intptr_t)fd);
+	if (ret) {
+		close(fd);
+		return ret;
+	}
+	addr_cache.has_watcher = true;
+
+	/* entries read before the watch may be stale */
+	__atomic_add_fetch(&addr_cache.gen, 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&addr_cache.watching, true, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/*
+ * Start watching abus_prefix again, at most once per backoff delay
+ * while the directory is missing.
+ * Returns true if watching.
+ */
+static bool un_sock_addr_cache_rewatch(void)
+{
+	struct timespec now;
+	bool watching;
+
+	pthread_mutex_lock(&addr_cache.mutex);
+
+	watching = addr_cache.watching;
+	if (watching || addr_cache.users == 0)
+		goto out;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (now.tv_sec < addr_cache.next_watch.tv_sec ||
+			(now.tv_sec == addr_cache.next_watch.tv_sec &&
+			 now.tv_nsec < addr_cache.next_watch.tv_nsec))
+		goto out;
+
+	/* reap the watcher which gave up */
+	un_sock_addr_watcher_stop();
+
+	watching = un_sock_addr_cache_watch() == 0;
+	if (watching) {
+		addr_cache.backoff_ms = UN_SOCK_ADDR_WATCH_BACKOFF_MIN;
+		goto out;
+	}
+
+	now.tv_sec += addr_cache.backoff_ms / 1000;
+	now.tv_nsec += (addr_cache.backoff_ms % 1000) * 1000000;
+	if (now.tv_nsec >= 1000000000) {
+		now.tv_sec++;
+		now.tv_nsec -= 1000000000;
+	}
+	addr_cache.next_watch = now;
+	addr_cache.backoff_ms *= 2;
+	if (addr_cache.backoff_ms > UN_SOCK_ADDR_WATCH_BACKOFF_MAX)
+		addr_cache.backoff_ms = UN_SOCK_ADDR_WATCH_BACKOFF_MAX;
+
+out:
+	pthread_mutex_unlock(&addr_cache.mutex);
+
+	return watching;
+}
+
+/* Caching is enabled while there's at least one user in the process */
+void un_sock_addr_cache_hold(void)
+{
+	pthread_once(&addr_cache_once, un_sock_addr_cache_init);
+
+	pthread_mutex_lock(&addr_cache.mutex);
+	addr_cache.users++;
+	pthread_mutex_unlock(&addr_cache.mutex);
+}
+
+/* The last user stops the watcher thread */
+void un_sock_addr_cache_release(void)
+{
+	pthread_mutex_lock(&addr_cache.mutex);
+	if (--addr_cache.users == 0) {
+		un_sock_addr_watcher_stop();
+		addr_cache.backoff_ms = UN_SOCK_ADDR_WATCH_BACKOFF_MIN;
+		memset(&addr_cache.next_watch, 0, sizeof(addr_cache.next_watch));
+	}
+	pthread_mutex_unlock(&addr_cache.mutex);
+}
+
+/*
+ * Resolved address of a service, returns true if found in the cache
+ * or resolved into it.
+ */
+static bool un_sock_addr_cache_get(const char *service_name, struct sockaddr_un *sockaddrun, socklen_t *addrlen)
+{
+	struct un_sock_addr_entry *entry;
+	char link_path[UNIX_PATH_MAX];
+	char pid_name[32];
+	size_t name_len;
+	unsigned gen, seq;
+	ssize_t n;
+
+	name_len = strlen(service_name);
+	if (abus_abstract || name_len >= sizeof(entry->service_name))
+		return false;
+
+	pthread_once(&addr_cache_once, un_sock_addr_cache_init);
+
+	if (!__atomic_load_n(&addr_cache.watching, __ATOMIC_ACQUIRE) &&
+			!un_sock_addr_cache_rewatch())
+		return false;
+
+	gen = __atomic_load_n(&addr_cache.gen, __ATOMIC_ACQUIRE);
+	entry = un_sock_addr_cache_slot(service_name, name_len);
+
+	pthread_rwlock_rdlock(&entry->lock);
+	if (entry->gen == gen && !strcmp(entry->service_name, service_name)) {
+		memcpy(sockaddrun, &entry->addr, entry->addrlen);
+		*addrlen = entry->addrlen;
+		pthread_rwlock_unlock(&entry->lock);
+		return true;
+	}
+	seq = entry->seq;
+	pthread_rwlock_unlock(&entry->lock);
+
+	snprintf(link_path, sizeof(link_path), "%s/%s", abus_prefix, service_name);
+
+	n = readlink(link_path, pid_name, sizeof(pid_name)-1);
+	if (n <= 0)
+		return false;
+	pid_name[n] = '\0';
+
+	/* socket name must be in same dir */
+	if (strchr(pid_name, '/'))
+		return false;
+
+	*addrlen = un_sock_addr(sockaddrun, pid_name);
+
+	/* not cached if the symlink changed meanwhile */
+	pthread_rwlock_wrlock(&entry->lock);
+	if (entry->seq == seq) {
+		memcpy(entry->service_name, service_name, name_len+1);
+		memcpy(&entry->addr, sockaddrun, *addrlen);
+		entry->addrlen = *addrlen;
+		entry->gen = gen;
+	}
+	pthread_rwlock_unlock(&entry->lock);
+
+	return true;
+}
+
+int un_sock_sendto_svc(int sock, const void *buf, size_t len, const char *service_name, const int *fds, int nfds)
 {
 	struct sockaddr_un sockaddrun;
+	socklen_t addrlen;
 	ssize_t ret;
+	bool cached;
 
-	sockaddrun.sun_family = AF_UNIX;
-
-	/* TODO: prefix from env variable */
-	snprintf(sockaddrun.sun_path, sizeof(sockaddrun.sun_path)-1,
-					"%s/%s", abus_prefix, service_name);
+	cached = un_sock_addr_cache_get(service_name, &sockaddrun, &addrlen);
+	if (!cached)
+		addrlen = un_sock_addr(&sockaddrun, service_name);
 
 	if (abus_msg_verbose)
 		un_sock_print_message(true, (const struct sockaddr *)&sockaddrun, buf, len);
 
-	ret = sendto(sock, buf, len, MSG_NOSIGNAL,
-					(const struct sockaddr *)&sockaddrun, SUN_LEN(&sockaddrun));
+	ret = un_sock_sendmsg(sock, buf, len, MSG_NOSIGNAL,
+					(const struct sockaddr *)&sockaddrun, addrlen, fds, nfds);
+	if (ret == -1 && cached && (errno == ECONNREFUSED || errno == ENOENT)) {
+		/* service restarted before the watcher caught up, go through the symlink */
+		un_sock_addr_cache_drop(service_name);
+		addrlen = un_sock_addr(&sockaddrun, service_name);
+		ret = un_sock_sendmsg(sock, buf, len, MSG_NOSIGNAL,
+					(const struct sockaddr *)&sockaddrun, addrlen, fds, nfds);
+	}
 	if (ret == -1) {
 		ret = -errno;
 		if (errno != ECONNREFUSED && errno != ENOENT)
 			LogError("%s(): sendto failed: %s", __func__, strerror(errno));
+		/* an abstract name vanishes along with its socket: no such service */
+		if (abus_abstract && ret == -ECONNREFUSED)
+			ret = -ENOENT;
 		return ret;
 	}
 
 	return 0;
 }
 
-int un_sock_sendto_sock(int sock, const void *buf, size_t len, const struct sockaddr *dest_addr, int addrlen)
+int un_sock_sendto_sock(int sock, const void *buf, size_t len, const struct sockaddr *dest_addr, int addrlen, const int *fds, int nfds)
 {
 	int ret;
 
 	if (abus_msg_verbose)
 		un_sock_print_message(true, dest_addr, buf, len);
 
-	ret = sendto(sock, buf, len, MSG_NOSIGNAL|MSG_DONTWAIT, dest_addr, addrlen);
+	ret = un_sock_sendmsg(sock, buf, len, MSG_NOSIGNAL|MSG_DONTWAIT, dest_addr, addrlen, fds, nfds);
 	return ret == -1 ? -errno : ret;
 }
 
-int un_sock_transaction(const int sockarg, void *buf, size_t len, size_t bufsz, const char *service_name, int timeout)
+/* max datagrams handed over to the kernel per sendmmsg() call */
+#define UN_SOCK_MMSG_MAX 64
+
+/*
+ * Send the same datagram to several destinations, in batches of sendmmsg().
+ * errs[i] is set to 0 or -errno for each destination.
+ * A destination failing with a full queue (-EAGAIN, -ENOBUFS) is skipped,
+ * only -ECONNREFUSED and -ENOENT tell it is gone.
+ * Returns the number of failed deliveries.
+ */
+int un_sock_sendto_multi(int sock, const void *buf, size_t len,
+				const struct sockaddr * const *dest_addrs, int count, int *errs)
 {
-	int sock, ret;
-	int passcred;
+	int i, failed = 0;
+#ifdef HAVE_SENDMMSG
+	struct mmsghdr msgs[UN_SOCK_MMSG_MAX];
+	struct iovec iov;
+	int j, n, sent;
 
-	if (sockarg == -1) {
-		sock = socket(AF_UNIX, SOCK_DGRAM, 0);
-		if (sock < 0) {
-			ret = -errno;
-			LogError("%s: failed to create socket: %s", __func__, strerror(errno));
-			return ret;
+	iov.iov_base = (void *)buf;
+	iov.iov_len = len;
+
+	for (i = 0; i < count; ) {
+		n = count - i < UN_SOCK_MMSG_MAX ? count - i : UN_SOCK_MMSG_MAX;
+
+		memset(msgs, 0, n * sizeof(struct mmsghdr));
+		for (j = 0; j < n; j++) {
+			msgs[j].msg_hdr.msg_name = (void *)dest_addrs[i+j];
+			msgs[j].msg_hdr.msg_namelen = un_sock_socklen(dest_addrs[i+j]);
+			msgs[j].msg_hdr.msg_iov = &iov;
+			msgs[j].msg_hdr.msg_iovlen = 1;
+
+			if (abus_msg_verbose)
+				un_sock_print_message(true, dest_addrs[i+j], buf, len);
 		}
-	
-		set_fd_cloexec(sock);
 
-		/* autobind */
-		passcred = 1;
-		ret = setsockopt(sock, SOL_SOCKET, SO_PASSCRED, &passcred, sizeof(passcred));
-		if (ret != 0) {
-			ret = -errno;
-			LogError("%s: abus clnt setsockopt(SO_PASSCRED): %s",
-					__func__, strerror(errno));
-			close(sock);
-			return ret;
+		sent = sendmmsg(sock, msgs, n, MSG_NOSIGNAL|MSG_DONTWAIT);
+		if (sent == -1) {
+			if (errno == EINTR)
+				continue;
+			/* the first datagram of the batch is the troublesome one */
+			errs[i++] = -errno;
+			failed++;
+			continue;
 		}
-	} else {
-		sock = sockarg;
+
+		for (j = 0; j < sent; j++)
+			errs[i+j] = 0;
+		i += sent;
+	}
+#else
+	for (i = 0; i < count; i++) {
+		errs[i] = un_sock_sendto_sock(sock, buf, len, dest_addrs[i], un_sock_socklen(dest_addrs[i]), NULL, 0);
+		if (errs[i] < 0)
+			failed++;
+		else
+			errs[i] = 0;
 	}
+#endif
 
-	ret = un_sock_sendto_svc(sock, buf, len, service_name);
-	if (ret != 0) {
-		if (sockarg == -1)
-			close(sock);
+	return failed;
+}
+
+/*
+ * Create an autobound client socket, suitable for a transaction
+ */
+static int un_sock_clnt_create(void)
+{
+	int sock, ret;
+	int passcred;
+
+	sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (sock < 0) {
+		ret = -errno;
+		LogError("%s: failed to create socket: %s", __func__, strerror(errno));
 		return ret;
 	}
 
-	ret = select_for_read(sock, timeout);
-	if (ret == -1) {
+	set_fd_cloexec(sock);
+
+	/* autobind */
+	passcred = 1;
+	ret = setsockopt(sock, SOL_SOCKET, SO_PASSCRED, &passcred, sizeof(passcred));
+	if (ret != 0) {
 		ret = -errno;
-		if (sockarg == -1)
-			close(sock);
+		LogError("%s: abus clnt setsockopt(SO_PASSCRED): %s",
+				__func__, strerror(errno));
+		close(sock);
 		return ret;
 	}
-	if (ret == 0) {
-		if (sockarg == -1)
-			close(sock);
+
+	return sock;
+}
+
+/*
+ * Send request, and wait for the response on the same socket.
+ * File descriptors passed along the response are stored in rfds, if not NULL.
+ */
+static int un_sock_xfer(int sock, int epfd, void *buf, size_t len, size_t bufsz, const char *service_name, int timeout,
+				const int *fds, int nfds, int *rfds, int *rnfds)
+{
+	int ret;
+
+	ret = un_sock_sendto_svc(sock, buf, len, service_name, fds, nfds);
+	if (ret != 0)
+		return ret;
+
+	if (epfd != -1)
+		ret = epoll_for_read(epfd, timeout);
+	else
+		ret = poll_for_read(sock, timeout);
+	if (ret < 0)
+		return ret;
+	if (ret == 0)
 		return -ETIMEDOUT;
-	}
 
 	/* recycle req buf */
 
+	if (rfds)
+		return un_sock_recvmsg(sock, buf, bufsz, 0, NULL, NULL, rfds, rnfds);
+
 	ret = recv(sock, buf, bufsz, 0);
 	if (ret == -1) {
 		ret = -errno;
 		LogError("%s(): abus clnt recv: %s", __func__, strerror(errno));
-		if (sockarg == -1)
-			close(sock);
 		return ret;
 	}
 	len = ret;
@@ -263,25 +881,486 @@ int un_sock_transaction(const int sockarg, void *buf, size_t len, size_t bufsz,
 	if (abus_msg_verbose)
 		un_sock_print_message(false, NULL, buf, len);
 
+	return ret;
+}
+
+int un_sock_transaction(const int sockarg, void *buf, size_t len, size_t bufsz, const char *service_name, int timeout)
+{
+	int sock, ret;
+
+	if (sockarg == -1) {
+		sock = un_sock_clnt_create();
+		if (sock < 0)
+			return sock;
+	} else {
+		sock = sockarg;
+	}
+
+	ret = un_sock_xfer(sock, -1, buf, len, bufsz, service_name, timeout, NULL, 0, NULL, NULL);
+
 	if (sockarg == -1)
 		close(sock);
 
 	return ret;
 }
 
-ssize_t un_sock_recvfrom(int sockfd, void *buf, size_t len,
-                        struct sockaddr *src_addr, socklen_t *addrlen)
+/*
+ * Same as un_sock_transaction(), on a socket of its own,
+ * passing along file descriptors with the request, and getting
+ * the ones of the response in rfds, if not NULL.
+ */
+int un_sock_transaction_fds(void *buf, size_t len, size_t bufsz, const char *service_name, int timeout,
+				const int *fds, int nfds, int *rfds, int *rnfds)
 {
+	int sock, ret;
+
+	sock = un_sock_clnt_create();
+	if (sock < 0)
+		return sock;
+
+	ret = un_sock_xfer(sock, -1, buf, len, bufsz, service_name, timeout, fds, nfds, rfds, rnfds);
+
+	close(sock);
+
+	return ret;
+}
+
+/*
+ * Per-thread client socket, saving a socket()/close() pair
+ * for each synchronous transaction.
+ */
+#define UN_SOCK_SESSIONS_MAX 16
+
+struct un_sock_session {
+	char service_name[UNIX_PATH_MAX];
+	int sock;	/* connected SOCK_SEQPACKET, -1 if unused */
+};
+
+struct un_sock_clnt {
+	pid_t pid;	/* sockets are not to be shared with a forked child */
+	int sock;
+	int epfd;	/* sock registered once for all */
+
+	struct un_sock_session sessions[UN_SOCK_SESSIONS_MAX];
+	unsigned session_victim;
+};
+
+static pthread_key_t clnt_key;
+static pthread_once_t clnt_key_once = PTHREAD_ONCE_INIT;
+
+static void un_sock_session_drop(struct un_sock_session *session)
+{
+	close(session->sock);
+	session->sock = -1;
+}
+
+static void un_sock_sessions_drop(struct un_sock_clnt *clnt)
+{
+	int i;
+
+	for (i = 0; i < UN_SOCK_SESSIONS_MAX; i++) {
+		if (clnt->sessions[i].sock != -1)
+			un_sock_session_drop(&clnt->sessions[i]);
+	}
+}
+
+static void clnt_destroy(void *arg)
+{
+	struct un_sock_clnt *clnt = (struct un_sock_clnt *)arg;
+
+	if (clnt->sock != -1) {
+		close(clnt->epfd);
+		close(clnt->sock);
+	}
+	un_sock_sessions_drop(clnt);
+	free(clnt);
+}
+
+static void clnt_key_create(void)
+{
+	pthread_key_create(&clnt_key, clnt_destroy);
+}
+
+static void un_sock_clnt_drop(struct un_sock_clnt *clnt)
+{
+	close(clnt->epfd);
+	close(clnt->sock);
+	clnt->sock = -1;
+}
+
+static struct un_sock_clnt *un_sock_clnt_get(void)
+{
+	struct un_sock_clnt *clnt;
+	int i;
+
+	pthread_once(&clnt_key_once, clnt_key_create);
+
+	clnt = pthread_getspecific(clnt_key);
+	if (!clnt) {
+		clnt = malloc(sizeof(*clnt));
+		if (!clnt)
+			return NULL;
+		clnt->pid = getpid();
+		clnt->sock = -1;
+		for (i = 0; i < UN_SOCK_SESSIONS_MAX; i++)
+			clnt->sessions[i].sock = -1;
+		clnt->session_victim = 0;
+		pthread_setspecific(clnt_key, clnt);
+	}
+
+	if (clnt->pid != getpid()) {
+		/* inherited from parent process */
+		if (clnt->sock != -1)
+			un_sock_clnt_drop(clnt);
+		un_sock_sessions_drop(clnt);
+		clnt->pid = getpid();
+	}
+
+	if (clnt->sock == -1) {
+		clnt->sock = un_sock_clnt_create();
+		if (clnt->sock < 0) {
+			clnt->sock = -1;
+			return NULL;
+		}
+		clnt->epfd = un_sock_epoll_create(clnt->sock);
+		if (clnt->epfd < 0) {
+			close(clnt->sock);
+			clnt->sock = -1;
+			return NULL;
+		}
+	}
+
+	return clnt;
+}
+
+/*
+ * Same as un_sock_transaction(), but using a socket cached for the calling thread.
+ */
+int un_sock_transaction_cached(void *buf, size_t len, size_t bufsz, const char *service_name, int timeout,
+				int *rfds, int *rnfds)
+{
+	struct un_sock_clnt *clnt;
+	int ret;
+
+	clnt = un_sock_clnt_get();
+	if (!clnt)
+		return un_sock_transaction_fds(buf, len, bufsz, service_name, timeout, NULL, 0, rfds, rnfds);
+
+	ret = un_sock_xfer(clnt->sock, clnt->epfd, buf, len, bufsz, service_name, timeout, NULL, 0, rfds, rnfds);
+
+	/* A late response would be received by the next transaction,
+	   hence trash the socket unless the service is plainly not there.
+	 */
+	if (ret < 0 && ret != -ENOENT && ret != -ECONNREFUSED)
+		un_sock_clnt_drop(clnt);
+
+	return ret;
+}
+
+/*
+ * Send a datagram expecting no response, from the socket cached for the calling thread.
+ */
+int un_sock_sendto_svc_cached(const void *buf, size_t len, const char *service_name, const int *fds, int nfds)
+{
+	struct un_sock_clnt *clnt;
+	int sock, ret;
+
+	clnt = un_sock_clnt_get();
+	if (clnt)
+		return un_sock_sendto_svc(clnt->sock, buf, len, service_name, fds, nfds);
+
+	sock = un_sock_clnt_create();
+	if (sock < 0)
+		return sock;
+
+	ret = un_sock_sendto_svc(sock, buf, len, service_name, fds, nfds);
+	close(sock);
+
+	return ret;
+}
+
+/*
+ * Listening SOCK_SEQPACKET socket of the process, next to its datagram socket
+ */
+static int un_sock_seqpacket_path(char *path, size_t size, const char *pid_name)
+{
+	int n;
+
+	n = snprintf(path, size, "%s/%s" UN_SOCK_SEQPACKET_SUFFIX, abus_prefix, pid_name);
+
+	return n < 0 || (size_t)n >= size ? -ENAMETOOLONG : 0;
+}
+
+int un_sock_seqpacket_listen(void)
+{
+	struct sockaddr_un sockaddrun;
+	char pid_name[32];
+	int sock, ret;
+
+	/* clients find the listening socket through the service symlink */
+	if (abus_abstract)
+		return -EOPNOTSUPP;
+
+	sock = socket(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC|SOCK_NONBLOCK, 0);
+	if (sock < 0) {
+		ret = -errno;
+		LogError("%s: failed to create socket: %s", __func__, strerror(errno));
+		return ret;
+	}
+
+	memset(&sockaddrun, 0, sizeof(sockaddrun));
+	sockaddrun.sun_family = AF_UNIX;
+	snprintf(pid_name, sizeof(pid_name), "_%d", getpid());
+	un_sock_seqpacket_path(sockaddrun.sun_path, sizeof(sockaddrun.sun_path), pid_name);
+
+	/* left over by a former process of the same pid */
+	unlink(sockaddrun.sun_path);
+
+	if (bind(sock, (struct sockaddr *)&sockaddrun, SUN_LEN(&sockaddrun)) < 0 ||
+			listen(sock, SOMAXCONN) < 0) {
+		ret = -errno;
+		LogError("%s: failed to bind/listen socket: %s", __func__, strerror(errno));
+		close(sock);
+		return ret;
+	}
+
+	return sock;
+}
+
+int un_sock_seqpacket_close(int sock)
+{
+	char path[UNIX_PATH_MAX];
+	char pid_name[32];
+
+	snprintf(pid_name, sizeof(pid_name), "_%d", getpid());
+	un_sock_seqpacket_path(path, sizeof(path), pid_name);
+	unlink(path);
+
+	return close(sock);
+}
+
+un_sock_peer_t *un_sock_peer_new(int sock)
+{
+	un_sock_peer_t *peer;
+
+	peer = malloc(sizeof(*peer));
+	if (!peer)
+		return NULL;
+
+	peer->sock = sock;
+	peer->refcount = 1;
+
+	return peer;
+}
+
+void un_sock_peer_get(un_sock_peer_t *peer)
+{
+	__sync_add_and_fetch(&peer->refcount, 1);
+}
+
+/*
+ * The descriptor stays open as long as a response may be sent on it,
+ * lest its number gets reused by another session or file meanwhile
+ */
+void un_sock_peer_put(un_sock_peer_t *peer)
+{
+	if (__sync_sub_and_fetch(&peer->refcount, 1) != 0)
+		return;
+
+	close(peer->sock);
+	free(peer);
+}
+
+/*
+ * Connect to the listening socket of the process serving service_name
+ */
+static int un_sock_session_connect(const char *service_name)
+{
+	struct sockaddr_un sockaddrun;
+	char link_path[UNIX_PATH_MAX];
+	char pid_name[UNIX_PATH_MAX];
+	ssize_t n;
+	int sock, ret;
+
+	if (abus_abstract)
+		return -EOPNOTSUPP;
+
+	snprintf(link_path, sizeof(link_path), "%s/%s", abus_prefix, service_name);
+
+	n = readlink(link_path, pid_name, sizeof(pid_name)-1);
+	if (n < 0)
+		return -errno;
+	pid_name[n] = '\0';
+
+	memset(&sockaddrun, 0, sizeof(sockaddrun));
+	sockaddrun.sun_family = AF_UNIX;
+	ret = un_sock_seqpacket_path(sockaddrun.sun_path, sizeof(sockaddrun.sun_path), pid_name);
+	if (ret)
+		return ret;
+
+	sock = socket(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0);
+	if (sock < 0)
+		return -errno;
+
+	if (connect(sock, (struct sockaddr *)&sockaddrun, SUN_LEN(&sockaddrun)) < 0) {
+		ret = -errno;
+		close(sock);
+		return ret;
+	}
+
+	return sock;
+}
+
+static struct un_sock_session *un_sock_session_get(struct un_sock_clnt *clnt, const char *service_name)
+{
+	struct un_sock_session *session;
+	int i, sock;
+
+	for (i = 0; i < UN_SOCK_SESSIONS_MAX; i++) {
+		session = &clnt->sessions[i];
+		if (session->sock != -1 && !strcmp(session->service_name, service_name))
+			return session;
+	}
+
+	sock = un_sock_session_connect(service_name);
+	if (sock < 0)
+		return NULL;
+
+	/* free slot, otherwise recycle the sessions round-robin */
+	for (i = 0; i < UN_SOCK_SESSIONS_MAX; i++) {
+		if (clnt->sessions[i].sock == -1)
+			break;
+	}
+	if (i == UN_SOCK_SESSIONS_MAX) {
+		i = clnt->session_victim++ % UN_SOCK_SESSIONS_MAX;
+		un_sock_session_drop(&clnt->sessions[i]);
+	}
+
+	session = &clnt->sessions[i];
+	snprintf(session->service_name, sizeof(session->service_name), "%s", service_name);
+	session->sock = sock;
+
+	return session;
+}
+
+/*
+ * Same as un_sock_transaction_cached(), but over a connected session
+ * to the service kept by the calling thread. Falls back to datagrams
+ * when the service does not accept sessions.
+ */
+int un_sock_transaction_session(void *buf, size_t len, size_t bufsz, const char *service_name, int timeout,
+				int *rfds, int *rnfds)
+{
+	struct un_sock_clnt *clnt;
+	struct un_sock_session *session;
 	ssize_t ret;
 
-	ret = recvfrom(sockfd, buf, len, 0, src_addr, addrlen);
+	clnt = un_sock_clnt_get();
+	if (!clnt)
+		return un_sock_transaction_fds(buf, len, bufsz, service_name, timeout, NULL, 0, rfds, rnfds);
+
+	session = un_sock_session_get(clnt, service_name);
+	if (!session)
+		return un_sock_transaction_cached(buf, len, bufsz, service_name, timeout, rfds, rnfds);
+
+	if (abus_msg_verbose)
+		un_sock_print_message(true, NULL, buf, len);
+
+	ret = send(session->sock, buf, len, MSG_NOSIGNAL);
+	if (ret == -1) {
+		/* e.g. service restarted since the session got connected */
+		un_sock_session_drop(session);
+		return un_sock_transaction_cached(buf, len, bufsz, service_name, timeout, rfds, rnfds);
+	}
+
+	ret = poll_for_read(session->sock, timeout);
+	if (ret <= 0) {
+		/* A late response would be received by the next transaction */
+		un_sock_session_drop(session);
+		return ret == 0 ? -ETIMEDOUT : ret;
+	}
+
+	if (rfds) {
+		ret = un_sock_recvmsg(session->sock, buf, bufsz, 0, NULL, NULL, rfds, rnfds);
+	} else {
+		ret = recv(session->sock, buf, bufsz, 0);
+		if (ret == -1)
+			ret = -errno;
+		else if (ret > 0 && abus_msg_verbose)
+			un_sock_print_message(false, NULL, buf, ret);
+	}
+	if (ret <= 0) {
+		ret = ret == 0 ? -ECONNRESET : ret;
+		un_sock_session_drop(session);
+	}
+
+	return ret;
+}
+
+/*
+ * Collect the file descriptors passed along a received message.
+ * Returns their count.
+ */
+int un_sock_msg_fds(struct msghdr *msg, int *fds, int max)
+{
+	struct cmsghdr *cmsg;
+	int i, n = 0, cnt;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+
+		cnt = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (i = 0; i < cnt; i++) {
+			int fd;
+
+			memcpy(&fd, CMSG_DATA(cmsg) + i*sizeof(int), sizeof(int));
+			if (n < max)
+				fds[n++] = fd;
+			else
+				close(fd);
+		}
+	}
+
+	return n;
+}
+
+/*
+ * recvfrom(), also getting the file descriptors passed along the message, if any.
+ * src_addr may be NULL for connected sockets.
+ */
+ssize_t un_sock_recvmsg(int sockfd, void *buf, size_t len, int flags,
+                        struct sockaddr *src_addr, socklen_t *addrlen, int *fds, int *nfds)
+{
+	char control[UN_SOCK_CONTROL_SZ];
+	struct msghdr msg;
+	struct iovec iov;
+	ssize_t ret;
+
+	iov.iov_base = buf;
+	iov.iov_len = len;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = src_addr;
+	msg.msg_namelen = src_addr ? *addrlen : 0;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	ret = recvmsg(sockfd, &msg, flags|MSG_CMSG_CLOEXEC);
 	if (ret == -1) {
 		ret = -errno;
 		return ret;
 	}
 
-	if (*addrlen < sizeof(struct sockaddr_un))
-		((char *)src_addr)[*addrlen] = '\0';
+	*nfds = msg.msg_controllen ? un_sock_msg_fds(&msg, fds, UN_SOCK_FDS_MAX) : 0;
+
+	if (src_addr) {
+		*addrlen = msg.msg_namelen;
+		if (*addrlen < sizeof(struct sockaddr_un))
+			((char *)src_addr)[*addrlen] = '\0';
+	}
 
 	if (abus_msg_verbose)
 		un_sock_print_message(false, src_addr, buf, ret);
@@ -289,3 +1368,38 @@ ssize_t un_sock_recvfrom(int sockfd, void *buf, size_t len,
 	return ret;
 }
 
+
+#ifdef HAVE_RECVMMSG
+/*
+ * Receive up to vlen datagrams in one go.
+ * Each msg_hdr must point to its buffer and its struct sockaddr_un,
+ * and may have room for passed file descriptors, see un_sock_msg_fds().
+ * Returns the number of datagrams received, or -errno.
+ */
+int un_sock_recvmmsg(int sockfd, struct mmsghdr *msgs, unsigned vlen, int flags)
+{
+	struct sockaddr_un *src_addr;
+	unsigned i;
+	int n;
+
+	for (i = 0; i < vlen; i++)
+		msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_un);
+
+	n = recvmmsg(sockfd, msgs, vlen, flags|MSG_CMSG_CLOEXEC, NULL);
+	if (n == -1)
+		return -errno;
+
+	for (i = 0; i < (unsigned)n; i++) {
+		src_addr = msgs[i].msg_hdr.msg_name;
+
+		if (msgs[i].msg_hdr.msg_namelen < sizeof(struct sockaddr_un))
+			((char *)src_addr)[msgs[i].msg_hdr.msg_namelen] = '\0';
+
+		if (abus_msg_verbose)
+			un_sock_print_message(false, (const struct sockaddr *)src_addr,
+						msgs[i].msg_hdr.msg_iov->iov_base, msgs[i].msg_len);
+	}
+
+	return n;
+}
+#endif
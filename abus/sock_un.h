@@ -19,26 +19,72 @@
 #include <sys/un.h>
 #include <sys/stat.h>
 #include <sys/types.h>
-
-#include "sock_un.h"
+#include <stddef.h>
+#include <string.h>
 
 #ifndef UNIX_PATH_MAX
 #define UNIX_PATH_MAX 108
 #endif
 
+/* max file descriptors passed along a message */
+#define UN_SOCK_FDS_MAX 4
+
+/* room for the ancillary data of a received message,
+   credentials come along on SO_PASSCRED client sockets */
+#define UN_SOCK_CONTROL_SZ (CMSG_SPACE(sizeof(int)*UN_SOCK_FDS_MAX) + CMSG_SPACE(sizeof(struct ucred)))
+
 extern const char *abus_prefix;
 extern int abus_msg_verbose;
+extern int abus_abstract;
 
 int un_sock_create(void);
+int un_sock_create_svc(const char *service_name);
 int un_sock_close(int sock);
-int un_sock_sendto_svc(int sock, const void *buf, size_t len, const char *service_name);
-int un_sock_sendto_sock(int sock, const void *buf, size_t len, const struct sockaddr *dest_addr, int addrlen);
+int un_sock_abstract_services(int (*cb)(const char *service_name, void *arg), void *arg);
+void un_sock_addr_cache_hold(void);
+void un_sock_addr_cache_release(void);
+int un_sock_sendto_svc(int sock, const void *buf, size_t len, const char *service_name, const int *fds, int nfds);
+int un_sock_sendto_svc_cached(const void *buf, size_t len, const char *service_name, const int *fds, int nfds);
+int un_sock_sendto_sock(int sock, const void *buf, size_t len, const struct sockaddr *dest_addr, int addrlen, const int *fds, int nfds);
+int un_sock_sendto_multi(int sock, const void *buf, size_t len,
+				const struct sockaddr * const *dest_addrs, int count, int *errs);
 int un_sock_transaction(const int sockarg, void *buf, size_t len, size_t bufsz, const char *service_name, int timeout);
-ssize_t un_sock_recvfrom(int sockfd, void *buf, size_t len, struct sockaddr *src_addr, socklen_t *addrlen);
+int un_sock_transaction_fds(void *buf, size_t len, size_t bufsz, const char *service_name, int timeout,
+				const int *fds, int nfds, int *rfds, int *rnfds);
+int un_sock_transaction_cached(void *buf, size_t len, size_t bufsz, const char *service_name, int timeout,
+				int *rfds, int *rnfds);
+int un_sock_transaction_session(void *buf, size_t len, size_t bufsz, const char *service_name, int timeout,
+				int *rfds, int *rnfds);
+int un_sock_seqpacket_listen(void);
+int un_sock_seqpacket_close(int sock);
+
+/* accepted session, closed once its last outstanding response is sent */
+typedef struct un_sock_peer {
+	int sock;
+	int refcount;
+} un_sock_peer_t;
+
+un_sock_peer_t *un_sock_peer_new(int sock);
+void un_sock_peer_get(un_sock_peer_t *peer);
+void un_sock_peer_put(un_sock_peer_t *peer);
+ssize_t un_sock_recvmsg(int sockfd, void *buf, size_t len, int flags, struct sockaddr *src_addr, socklen_t *addrlen,
+				int *fds, int *nfds);
+int un_sock_msg_fds(struct msghdr *msg, int *fds, int max);
+#ifdef HAVE_RECVMMSG
+int un_sock_recvmmsg(int sockfd, struct mmsghdr *msgs, unsigned vlen, int flags);
+#endif
+int un_sock_epoll_create(int sock);
+int un_sock_epoll_add(int epfd, int fd, unsigned events, int data);
 
 static inline int un_sock_socklen(const struct sockaddr *sockaddr)
 {
-	return SUN_LEN(((const struct sockaddr_un *)sockaddr));
+	const struct sockaddr_un *sockaddrun = (const struct sockaddr_un *)sockaddr;
+
+	/* abstract name, stored NUL padded */
+	if (sockaddrun->sun_path[0] == '\0')
+		return offsetof(struct sockaddr_un, sun_path) + 1 + strnlen(sockaddrun->sun_path+1, sizeof(sockaddrun->sun_path)-1);
+
+	return SUN_LEN(sockaddrun);
 }
 
 /* for debug purpose */
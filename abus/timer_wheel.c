@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2011-2012 Stephane Fillod
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Library General Public License as
+ *   published by the Free Software Foundation; either version 2.1 of
+ *   the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Library General Public License for more details.
+ */
+
+/*
+ * Hierarchical timer wheel.
+ *
+ * Level 0 has one slot per tick, level n one slot per 2^(8n) ticks.
+ * A timer sits in the finest level whose span covers it, and is moved
+ * down a level when the wheel reaches the start of its slot.
+ */
+
+#include "abus_config.h"
+
+#include <string.h>
+
+#include "timer_wheel.h"
+
+#define TIMER_WHEEL_MASK	(TIMER_WHEEL_SLOTS - 1)
+
+void timer_wheel_init(timer_wheel_t *wheel, unsigned long now)
+{
+	memset(wheel, 0, sizeof(*wheel));
+	wheel->now = now;
+}
+
+static void timer_wheel_place(timer_wheel_t *wheel, timer_wheel_entry_t *entry)
+{
+	timer_wheel_entry_t **slot;
+	unsigned long idx;
+	unsigned level, shift;
+
+	for (level = 0; level < TIMER_WHEEL_LEVELS-1; level++) {
+		shift = level * TIMER_WHEEL_BITS;
+		if ((entry->expires >> shift) - (wheel->now >> shift) < TIMER_WHEEL_SLOTS)
+			break;
+	}
+
+	shift = level * TIMER_WHEEL_BITS;
+	idx = entry->expires >> shift;
+	/* beyond the span of the wheel, wait in the farthest slot for another round */
+	if (idx - (wheel->now >> shift) >= TIMER_WHEEL_SLOTS)
+		idx = (wheel->now >> shift) + TIMER_WHEEL_SLOTS - 1;
+
+	slot = &wheel->slots[level][idx & TIMER_WHEEL_MASK];
+
+	entry->level = level;
+	entry->next = *slot;
+	if (entry->next)
+		entry->next->pprev = &entry->next;
+	entry->pprev = slot;
+	*slot = entry;
+
+	wheel->level_count[level]++;
+}
+
+/*
+  Arm a timer, to expire at tick expires, or next tick if already past.
+  The entry must not be pending.
+ */
+void timer_wheel_add(timer_wheel_t *wheel, timer_wheel_entry_t *entry, unsigned long expires)
+{
+	entry->expires = expires > wheel->now ? expires : wheel->now + 1;
+
+	timer_wheel_place(wheel, entry);
+}
+
+void timer_wheel_del(timer_wheel_t *wheel, timer_wheel_entry_t *entry)
+{
+	if (!entry->pprev)
+		return;
+
+	*entry->pprev = entry->next;
+	if (entry->next)
+		entry->next->pprev = entry->pprev;
+
+	entry->next = NULL;
+	entry->pprev = NULL;
+
+	wheel->level_count[entry->level]--;
+}
+
+static void timer_wheel_cascade(timer_wheel_t *wheel, unsigned level, unsigned idx)
+{
+	timer_wheel_entry_t *entry, *next;
+
+	entry = wheel->slots[level][idx];
+	wheel->slots[level][idx] = NULL;
+
+	for (; entry; entry = next) {
+		next = entry->next;
+		wheel->level_count[level]--;
+		timer_wheel_place(wheel, entry);
+	}
+}
+
+/*
+  Move the wheel forward up to tick now.
+  Returns the expired timers, no longer pending, linked through their next field.
+ */
+timer_wheel_entry_t *timer_wheel_advance(timer_wheel_t *wheel, unsigned long now)
+{
+	timer_wheel_entry_t *expired = NULL, **tail = &expired, *entry;
+	timer_wheel_entry_t **slot;
+	unsigned level, shift;
+
+	while (wheel->now < now) {
+		if (timer_wheel_count(wheel) == 0) {
+			wheel->now = now;
+			break;
+		}
+
+		/* nothing in the finest level, skip ahead to the next cascade */
+		if (wheel->level_count[0] == 0) {
+			if ((wheel->now | TIMER_WHEEL_MASK) >= now) {
+				wheel->now = now;
+				break;
+			}
+			wheel->now |= TIMER_WHEEL_MASK;
+		}
+
+		wheel->now++;
+
+		for (level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+			shift = level * TIMER_WHEEL_BITS;
+			if (wheel->now & ((1UL << shift) - 1))
+				break;
+			timer_wheel_cascade(wheel, level, (wheel->now >> shift) & TIMER_WHEEL_MASK);
+		}
+
+		slot = &wheel->slots[0][wheel->now & TIMER_WHEEL_MASK];
+		while ((entry = *slot) != NULL) {
+			timer_wheel_del(wheel, entry);
+			*tail = entry;
+			tail = &entry->next;
+		}
+	}
+
+	return expired;
+}
+
+/*
+  Ticks from now until the wheel has to be advanced, -1 if no timer is pending
+ */
+long timer_wheel_next(const timer_wheel_t *wheel)
+{
+	long next = -1;
+	unsigned i;
+
+	if (wheel->level_count[0] > 0) {
+		for (i = 1; i < TIMER_WHEEL_SLOTS; i++) {
+			if (wheel->slots[0][(wheel->now + i) & TIMER_WHEEL_MASK]) {
+				next = i;
+				break;
+			}
+		}
+	}
+
+	/* coarser timers get closer at each cascade */
+	if (timer_wheel_count(wheel) > wheel->level_count[0]) {
+		long cascade = (long)((wheel->now | TIMER_WHEEL_MASK) + 1 - wheel->now);
+
+		if (next == -1 || cascade < next)
+			next = cascade;
+	}
+
+	return next;
+}
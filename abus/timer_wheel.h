@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2011-2012 Stephane Fillod
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Library General Public License as
+ *   published by the Free Software Foundation; either version 2.1 of
+ *   the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Library General Public License for more details.
+ */
+
+#ifndef _TIMER_WHEEL_H
+#define _TIMER_WHEEL_H
+
+/*
+ * Hierarchical timer wheel, not thread safe.
+ *
+ * Time is counted in ticks, chosen by the user. Adding and removing
+ * a timer is O(1), so is expiring one, give or take its cascading
+ * down from the coarser levels, which happens at most once per level.
+ */
+
+#define TIMER_WHEEL_BITS	8
+#define TIMER_WHEEL_SLOTS	(1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS	4
+
+typedef struct timer_wheel_entry {
+	unsigned long expires;	/* tick */
+	struct timer_wheel_entry *next;
+	struct timer_wheel_entry **pprev;	/* NULL when not pending */
+	unsigned char level;
+} timer_wheel_entry_t;
+
+typedef struct timer_wheel {
+	unsigned long now;	/* last tick processed */
+	unsigned level_count[TIMER_WHEEL_LEVELS];
+	timer_wheel_entry_t *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+} timer_wheel_t;
+
+void timer_wheel_init(timer_wheel_t *wheel, unsigned long now);
+
+void timer_wheel_add(timer_wheel_t *wheel, timer_wheel_entry_t *entry, unsigned long expires);
+void timer_wheel_del(timer_wheel_t *wheel, timer_wheel_entry_t *entry);
+
+timer_wheel_entry_t *timer_wheel_advance(timer_wheel_t *wheel, unsigned long now);
+long timer_wheel_next(const timer_wheel_t *wheel);
+
+static inline int timer_wheel_pending(const timer_wheel_entry_t *entry)
+{
+	return entry->pprev != 0;
+}
+
+static inline unsigned timer_wheel_count(const timer_wheel_t *wheel)
+{
+	unsigned i, count = 0;
+
+	for (i = 0; i < TIMER_WHEEL_LEVELS; i++)
+		count += wheel->level_count[i];
+
+	return count;
+}
+
+#endif /* _TIMER_WHEEL_H */
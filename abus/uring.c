@@ -0,0 +1,368 @@
+/*
+ * Copyright (C) 2011-2012 Stephane Fillod
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Library General Public License as
+ *   published by the Free Software Foundation; either version 2.1 of
+ *   the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Library General Public License for more details.
+ */
+
+/*
+ * io_uring through the raw system calls, just what the A-Bus thread needs:
+ * multishot receive into a ring of provided buffers, multishot poll,
+ * and sendmsg submissions batched with the wait for completions.
+ */
+
+#include "abus_config.h"
+
+#ifdef HAVE_IO_URING
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+static int uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void uring_buf_add(uring_t *ring, unsigned bid, unsigned offset)
+{
+	struct io_uring_buf *buf;
+	unsigned short tail = ring->buf_ring->tail;
+
+	buf = &ring->buf_ring->bufs[(tail + offset) & (ring->buf_nb-1)];
+	buf->addr = (unsigned long)(ring->bufs + bid * ring->buf_sz);
+	buf->len = ring->buf_sz;
+	buf->bid = bid;
+}
+
+static void uring_buf_advance(uring_t *ring, unsigned count)
+{
+	__atomic_store_n(&ring->buf_ring->tail, ring->buf_ring->tail + count, __ATOMIC_RELEASE);
+}
+
+/*
+ * buf_nb must be a power of 2, buf_sz has to hold the name and control data
+ * on top of the largest message.
+ */
+int uring_init(uring_t *ring, unsigned entries, unsigned buf_nb, unsigned buf_sz,
+				socklen_t namelen, size_t controllen)
+{
+	struct io_uring_params p;
+	struct io_uring_buf_reg reg;
+	char *sq, *cq;
+	unsigned i;
+	int ret;
+
+	memset(ring, 0, sizeof(*ring));
+	ring->fd = -1;
+
+	memset(&p, 0, sizeof(p));
+	/* room for bursts of multishot completions */
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = 4*entries;
+
+	ring->fd = uring_setup(entries, &p);
+	if (ring->fd < 0) {
+		ring->fd = -1;
+		return -errno;
+	}
+
+	ring->sq_map_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_map_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_map_sz > ring->sq_map_sz)
+			ring->sq_map_sz = ring->cq_map_sz;
+		ring->cq_map_sz = 0;
+	}
+
+	ring->sq_map = mmap(NULL, ring->sq_map_sz, PROT_READ|PROT_WRITE,
+					MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_map == MAP_FAILED) {
+		ring->sq_map = NULL;
+		goto error;
+	}
+
+	if (ring->cq_map_sz) {
+		ring->cq_map = mmap(NULL, ring->cq_map_sz, PROT_READ|PROT_WRITE,
+					MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cq_map == MAP_FAILED) {
+			ring->cq_map = NULL;
+			goto error;
+		}
+	}
+
+	ring->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_sz, PROT_READ|PROT_WRITE,
+					MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		goto error;
+	}
+
+	sq = ring->sq_map;
+	cq = ring->cq_map ? ring->cq_map : ring->sq_map;
+
+	ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+	ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+	ring->sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+	ring->sq_entries = *(unsigned *)(sq + p.sq_off.ring_entries);
+
+	ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+	ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	ring->cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	/* provided buffers */
+	ring->buf_nb = buf_nb;
+	ring->buf_sz = buf_sz;
+	ring->buf_map_sz = buf_nb * sizeof(struct io_uring_buf);
+
+	ring->buf_ring = mmap(NULL, ring->buf_map_sz, PROT_READ|PROT_WRITE,
+					MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if (ring->buf_ring == MAP_FAILED) {
+		ring->buf_ring = NULL;
+		goto error;
+	}
+
+	ring->bufs = malloc((size_t)buf_nb * buf_sz);
+	if (!ring->bufs) {
+		errno = ENOMEM;
+		goto error;
+	}
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (unsigned long)ring->buf_ring;
+	reg.ring_entries = buf_nb;
+	reg.bgid = URING_BGID;
+
+	if (uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+		goto error;
+
+	for (i = 0; i < buf_nb; i++)
+		uring_buf_add(ring, i, i);
+	uring_buf_advance(ring, buf_nb);
+
+	ring->recv_msg.msg_namelen = namelen;
+	ring->recv_msg.msg_controllen = controllen;
+
+	return 0;
+
+error:
+	ret = -errno;
+	uring_exit(ring);
+	return ret;
+}
+
+void uring_exit(uring_t *ring)
+{
+	/* pending requests are cancelled along with the ring */
+	if (ring->fd != -1)
+		close(ring->fd);
+	ring->fd = -1;
+
+	if (ring->sqes)
+		munmap(ring->sqes, ring->sqes_sz);
+	if (ring->cq_map)
+		munmap(ring->cq_map, ring->cq_map_sz);
+	if (ring->sq_map)
+		munmap(ring->sq_map, ring->sq_map_sz);
+	if (ring->buf_ring)
+		munmap(ring->buf_ring, ring->buf_map_sz);
+	free(ring->bufs);
+
+	ring->sqes = NULL;
+	ring->cq_map = ring->sq_map = NULL;
+	ring->buf_ring = NULL;
+	ring->bufs = NULL;
+}
+
+/*
+ * Next free submission entry, cleared, or NULL if the queue is full
+ */
+struct io_uring_sqe *uring_get_sqe(uring_t *ring)
+{
+	struct io_uring_sqe *sqe;
+	unsigned head, tail;
+
+	head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	tail = *ring->sq_tail + ring->sq_pending;
+
+	if (tail - head >= ring->sq_entries)
+		return NULL;
+
+	sqe = &ring->sqes[tail & ring->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	ring->sq_array[tail & ring->sq_mask] = tail & ring->sq_mask;
+	ring->sq_pending++;
+
+	return sqe;
+}
+
+/*
+ * Submit the prepared entries, and wait for wait_nr completions
+ * in the same system call.
+ */
+int uring_submit_and_wait(uring_t *ring, unsigned wait_nr)
+{
+	unsigned tail, to_submit;
+	int ret;
+
+	tail = *ring->sq_tail + ring->sq_pending;
+	ring->sq_pending = 0;
+	__atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+	/* entries left over by an interrupted call included */
+	to_submit = tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+	ret = uring_enter(ring->fd, to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+
+	return ret < 0 ? -errno : ret;
+}
+
+struct io_uring_cqe *uring_peek_cqe(uring_t *ring)
+{
+	unsigned head, tail;
+
+	head = *ring->cq_head;
+	tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+	if (head == tail)
+		return NULL;
+
+	return &ring->cqes[head & ring->cq_mask];
+}
+
+void uring_cqe_seen(uring_t *ring)
+{
+	__atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+int uring_prep_recv_multishot(uring_t *ring, int sock, uint64_t user_data)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe(ring);
+
+	if (!sqe)
+		return -EBUSY;
+
+	sqe->opcode = IORING_OP_RECVMSG;
+	sqe->fd = sock;
+	sqe->addr = (unsigned long)&ring->recv_msg;
+	sqe->len = 1;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BGID;
+	sqe->user_data = user_data;
+
+	return 0;
+}
+
+int uring_prep_poll_multishot(uring_t *ring, int fd, uint64_t user_data)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe(ring);
+
+	if (!sqe)
+		return -EBUSY;
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = POLLIN;
+	sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->user_data = user_data;
+
+	return 0;
+}
+
+/* msg has to stay valid until completion */
+int uring_prep_sendmsg(uring_t *ring, int sock, const struct msghdr *msg, uint64_t user_data)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe(ring);
+
+	if (!sqe)
+		return -EBUSY;
+
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = sock;
+	sqe->addr = (unsigned long)msg;
+	sqe->len = 1;
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->user_data = user_data;
+
+	return 0;
+}
+
+/*
+ * Locate name, control data and payload of a multishot receive completion.
+ * The buffer is to be handed back with uring_buf_recycle() once processed.
+ */
+int uring_recvmsg_parse(uring_t *ring, const struct io_uring_cqe *cqe, uring_msg_t *msg)
+{
+	const struct io_uring_recvmsg_out *out;
+	const char *p;
+	unsigned bid, hdr;
+
+	if (cqe->res < 0)
+		return cqe->res;
+	if (!(cqe->flags & IORING_CQE_F_BUFFER))
+		return -ENOBUFS;
+
+	bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+	out = (const struct io_uring_recvmsg_out *)(ring->bufs + bid * ring->buf_sz);
+	p = (const char *)(out+1);
+
+	hdr = sizeof(*out) + ring->recv_msg.msg_namelen + ring->recv_msg.msg_controllen;
+	if ((unsigned)cqe->res < hdr)
+		return -EBADMSG;
+
+	msg->addr = (const struct sockaddr *)p;
+	msg->addrlen = out->namelen < ring->recv_msg.msg_namelen ?
+					out->namelen : ring->recv_msg.msg_namelen;
+
+	memset(&msg->ctl, 0, sizeof(msg->ctl));
+	if (out->controllen) {
+		msg->ctl.msg_control = (void *)(p + ring->recv_msg.msg_namelen);
+		msg->ctl.msg_controllen = out->controllen;
+	}
+
+	msg->payload = p + ring->recv_msg.msg_namelen + ring->recv_msg.msg_controllen;
+	msg->payload_len = cqe->res - hdr;
+	msg->truncated = (out->flags & MSG_TRUNC) != 0;
+
+	return 0;
+}
+
+void uring_buf_recycle(uring_t *ring, const struct io_uring_cqe *cqe)
+{
+	if (!(cqe->flags & IORING_CQE_F_BUFFER))
+		return;
+
+	uring_buf_add(ring, cqe->flags >> IORING_CQE_BUFFER_SHIFT, 0);
+	uring_buf_advance(ring, 1);
+}
+
+#endif /* HAVE_IO_URING */
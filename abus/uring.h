@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2011-2012 Stephane Fillod
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Library General Public License as
+ *   published by the Free Software Foundation; either version 2.1 of
+ *   the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Library General Public License for more details.
+ */
+
+#ifndef _URING_H
+#define _URING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+
+/* buffer group of the multishot receive */
+#define URING_BGID 0
+
+/* minimal io_uring wrapper, for a single issuer thread */
+typedef struct uring {
+	int fd;
+
+	/* submission queue */
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_array;
+	unsigned sq_mask;
+	unsigned sq_entries;
+	unsigned sq_pending;	/* prepared, not yet submitted */
+	struct io_uring_sqe *sqes;
+
+	/* completion queue */
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *sq_map, *cq_map;
+	size_t sq_map_sz, cq_map_sz, sqes_sz;
+
+	/* provided buffers, for the multishot receive */
+	struct io_uring_buf_ring *buf_ring;
+	char *bufs;
+	unsigned buf_nb;
+	unsigned buf_sz;
+	size_t buf_map_sz;
+
+	/* name and control room of each received message */
+	struct msghdr recv_msg;
+} uring_t;
+
+/* message received in a provided buffer */
+typedef struct uring_msg {
+	const struct sockaddr *addr;
+	socklen_t addrlen;
+	struct msghdr ctl;	/* control data only, for un_sock_msg_fds() */
+	const char *payload;
+	unsigned payload_len;
+	int truncated;
+} uring_msg_t;
+
+int uring_init(uring_t *ring, unsigned entries, unsigned buf_nb, unsigned buf_sz,
+				socklen_t namelen, size_t controllen);
+void uring_exit(uring_t *ring);
+
+struct io_uring_sqe *uring_get_sqe(uring_t *ring);
+int uring_submit_and_wait(uring_t *ring, unsigned wait_nr);
+struct io_uring_cqe *uring_peek_cqe(uring_t *ring);
+void uring_cqe_seen(uring_t *ring);
+
+int uring_prep_recv_multishot(uring_t *ring, int sock, uint64_t user_data);
+int uring_prep_poll_multishot(uring_t *ring, int fd, uint64_t user_data);
+int uring_prep_sendmsg(uring_t *ring, int sock, const struct msghdr *msg, uint64_t user_data);
+
+int uring_recvmsg_parse(uring_t *ring, const struct io_uring_cqe *cqe, uring_msg_t *msg);
+void uring_buf_recycle(uring_t *ring, const struct io_uring_cqe *cqe);
+
+#endif /* _URING_H */
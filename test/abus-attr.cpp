@@ -191,6 +191,42 @@ TEST_P(AbusAttrTest, AllTypes) {
 	 */
 }
 
+struct onchange_get {
+	abus_t *abus;
+	volatile int count;
+	int ret;
+	int val;
+};
+
+// reads the attribute back from the onchange callback
+static void attr_onchange_get_cb(json_rpc_t *, void *arg)
+{
+	struct onchange_get *get = (struct onchange_get *)arg;
+
+	get->ret = abus_attr_get_int(get->abus, SVC_NAME, "int", &get->val, RPC_TIMEOUT);
+	__sync_add_and_fetch(&get->count, 1);
+}
+
+TEST_P(AbusAttrTest, OnchangeGet) {
+	struct onchange_get get = { abus_svc_, 0, -1, 0 };
+	int i;
+
+	EXPECT_EQ(0, abus_attr_subscribe_onchange(abus_svc_, SVC_NAME, "int", attr_onchange_get_cb,
+					ABUS_RPC_FLAG_NONE, &get, RPC_TIMEOUT));
+
+	EXPECT_EQ(0, abus_attr_set_int(abus_, SVC_NAME, "int", 5, RPC_TIMEOUT));
+
+	for (i = 0; i < 100 && get.count == 0; i++)
+		usleep(10*1000);
+
+	EXPECT_EQ(1, get.count);
+	EXPECT_EQ(0, get.ret);
+	EXPECT_EQ(5, get.val);
+
+	EXPECT_EQ(0, abus_attr_unsubscribe_onchange(abus_svc_, SVC_NAME, "int", attr_onchange_get_cb,
+					&get, RPC_TIMEOUT));
+}
+
 // TODO: factorize with AbusAttrTest
 TEST_P(AbusAutoAttrTest, AllTypes) {
 	int a;
@@ -0,0 +1,1124 @@
+/*
+ * Copyright (C) 2011-2012 Stephane Fillod
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Library General Public License as
+ *   published by the Free Software Foundation; either version 2.1 of
+ *   the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Library General Public License for more details.
+ */
+
+/*
+ * abus-bench: micro-benchmarks of the A-Bus transport paths.
+ *
+ * Usage: abus-bench [bench name] [iterations]
+ * Without a bench name, all the benchmarks are run.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "abus.h"
+
+#define BENCH_SVC_NAME "benchsvc"
+#define BENCH_TIMEOUT 1000 /* ms */
+
+static int opt_iterations = 20000;
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double da = *(const double *)a, db = *(const double *)b;
+
+	return da < db ? -1 : da > db;
+}
+
+/*
+  Print rate and latency percentiles of a set of samples, in microseconds
+ */
+static void report(const char *name, double *samples, int count, double elapsed_us)
+{
+	qsort(samples, count, sizeof(double), cmp_double);
+
+	printf("%-28s %8d calls %10.0f calls/s  p50 %7.1f us  p99 %7.1f us\n",
+					name, count, count * 1e6 / elapsed_us,
+					samples[count/2], samples[(count*99)/100]);
+}
+
+static void svc_sum_cb(json_rpc_t *json_rpc, void *arg)
+{
+	int a, b;
+	int ret;
+
+	ret  = json_rpc_get_int(json_rpc, "a", &a);
+	if (ret == 0)
+		ret = json_rpc_get_int(json_rpc, "b", &b);
+
+	if (ret)
+		json_rpc_set_error(json_rpc, ret, NULL);
+	else
+		json_rpc_append_int(json_rpc, "res_value", a+b);
+}
+
+static abus_t *bench_svc_init(void)
+{
+	abus_t *abus;
+
+	abus = abus_init(NULL);
+	if (!abus)
+		return NULL;
+
+	if (abus_decl_method(abus, BENCH_SVC_NAME, "sum", &svc_sum_cb,
+					ABUS_RPC_FLAG_NONE, NULL,
+					"Compute summation of two integers",
+					"a:i:first operand,b:i:second operand",
+					"res_value:i:summation") != 0) {
+		abus_cleanup(abus);
+		return NULL;
+	}
+
+	return abus;
+}
+
+static int bench_sync_loop(abus_t *abus, const char *name, int count)
+{
+	json_rpc_t *json_rpc;
+	double *samples, t0, t1, start;
+	int i, ret = 0, res_value = 0;
+
+	samples = malloc(count * sizeof(double));
+	if (!samples)
+		return -ENOMEM;
+
+	start = now_us();
+
+	for (i = 0; i < count; i++) {
+		t0 = now_us();
+
+		json_rpc = abus_request_method_init(abus, BENCH_SVC_NAME, "sum");
+		if (!json_rpc) {
+			ret = -ENOMEM;
+			break;
+		}
+		json_rpc_append_int(json_rpc, "a", i);
+		json_rpc_append_int(json_rpc, "b", 1);
+
+		ret = abus_request_method_invoke(abus, json_rpc, ABUS_RPC_FLAG_NONE, BENCH_TIMEOUT);
+		if (ret == 0)
+			ret = json_rpc_get_int(json_rpc, "res_value", &res_value);
+		abus_request_method_cleanup(abus, json_rpc);
+
+		if (ret != 0 || res_value != i+1) {
+			fprintf(stderr, "%s: call %d failed: %s\n", name, i, abus_strerror(ret));
+			ret = ret ? ret : -EIO;
+			break;
+		}
+
+		t1 = now_us();
+		samples[i] = t1 - t0;
+	}
+
+	if (ret == 0)
+		report(name, samples, count, now_us() - start);
+
+	free(samples);
+
+	return ret;
+}
+
+/*
+  Synchronous calls from a distinct A-Bus context, so that the socket path is used
+ */
+static int bench_sync_calls(const char *name, const abus_conf_t *conf, int count)
+{
+	abus_t *abus;
+	int ret;
+
+	abus = abus_init(conf);
+	if (!abus)
+		return -ENOMEM;
+
+	ret = bench_sync_loop(abus, name, count);
+
+	abus_cleanup(abus);
+
+	return ret;
+}
+
+/*
+  Compare synchronous calls with and without the per-thread cached socket,
+  and over a connected session or a shared memory channel
+ */
+static int bench_sync(int count)
+{
+	abus_t *abus_svc;
+	abus_conf_t conf;
+	int ret;
+
+	abus_svc = bench_svc_init();
+	if (!abus_svc)
+		return -ENOMEM;
+
+	memset(&conf, 0, sizeof(conf));
+
+	conf.no_cached_sock = true;
+	ret = bench_sync_calls("sync, socket per call", &conf, count);
+
+	if (ret == 0) {
+		conf.no_cached_sock = false;
+		ret = bench_sync_calls("sync, cached socket", &conf, count);
+	}
+
+	if (ret == 0) {
+		conf.seqpacket = true;
+		ret = bench_sync_calls("sync, seqpacket session", &conf, count);
+	}
+
+	if (ret == 0) {
+		conf.seqpacket = false;
+		conf.shm = true;
+		ret = bench_sync_calls("sync, shm channel", &conf, count);
+	}
+
+	abus_cleanup(abus_svc);
+
+	return ret;
+}
+
+/*
+  Synchronous calls with the sockets named in /tmp/abus, then in the abstract namespace
+ */
+static int bench_abstract(int count)
+{
+	static const char *names[][2] = {
+		{ "path, socket per call", "path, cached socket" },
+		{ "abstract, socket per call", "abstract, cached socket" },
+	};
+	abus_t *abus_svc;
+	abus_conf_t conf;
+	int i, ret = 0;
+
+	memset(&conf, 0, sizeof(conf));
+
+	for (i = 0; i < 2 && ret == 0; i++) {
+		/* picked up by abus_init() */
+		setenv("ABUS_ABSTRACT", i ? "1" : "0", 1);
+
+		abus_svc = bench_svc_init();
+		if (!abus_svc) {
+			ret = -ENOMEM;
+			break;
+		}
+
+		conf.no_cached_sock = true;
+		ret = bench_sync_calls(names[i][0], &conf, count);
+
+		if (ret == 0) {
+			conf.no_cached_sock = false;
+			ret = bench_sync_calls(names[i][1], &conf, count);
+		}
+
+		abus_cleanup(abus_svc);
+	}
+
+	unsetenv("ABUS_ABSTRACT");
+	abus_cleanup(abus_init(NULL));
+
+	return ret;
+}
+
+/*
+  Same as bench_sync, but within a process holding plenty of file descriptors,
+  so that the A-Bus sockets get numbered beyond FD_SETSIZE.
+ */
+static int bench_highfd(int count)
+{
+	struct rlimit rlim;
+	abus_t *abus_svc;
+	abus_conf_t conf;
+	int *fds, i, nfds = 4096, ret;
+	char name[64];
+
+	if (getrlimit(RLIMIT_NOFILE, &rlim) == 0 && rlim.rlim_cur < (rlim_t)nfds + 64) {
+		rlim.rlim_cur = rlim.rlim_max < (rlim_t)nfds + 64 ? rlim.rlim_max : (rlim_t)nfds + 64;
+		setrlimit(RLIMIT_NOFILE, &rlim);
+		if (rlim.rlim_cur < (rlim_t)nfds + 64)
+			nfds = rlim.rlim_cur - 64;
+	}
+
+	fds = malloc(nfds * sizeof(int));
+	if (!fds)
+		return -ENOMEM;
+
+	for (i = 0; i < nfds; i++) {
+		fds[i] = open("/dev/null", O_RDONLY);
+		if (fds[i] == -1) {
+			nfds = i;
+			break;
+		}
+	}
+
+	abus_svc = bench_svc_init();
+	if (!abus_svc) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	memset(&conf, 0, sizeof(conf));
+
+	snprintf(name, sizeof(name), "sync, %d fds, per call", nfds);
+	conf.no_cached_sock = true;
+	ret = bench_sync_calls(name, &conf, count);
+
+	if (ret == 0) {
+		snprintf(name, sizeof(name), "sync, %d fds, cached", nfds);
+		conf.no_cached_sock = false;
+		ret = bench_sync_calls(name, &conf, count);
+	}
+
+	abus_cleanup(abus_svc);
+
+out:
+	for (i = 0; i < nfds; i++)
+		close(fds[i]);
+	free(fds);
+
+	return ret;
+}
+
+/*
+  Create a bare datagram socket subscribed to the "tick" event of the bench service
+ */
+static int fanout_subscriber(int idx)
+{
+	static const char req[] = "{\"jsonrpc\":\"2.0\",\"method\":\"" BENCH_SVC_NAME ".subscribe\","
+					"\"id\":1,\"params\":{\"event\":\"tick\"}}";
+	struct sockaddr_un sockaddrun;
+	struct timeval tv = { .tv_sec = 1 };
+	char buf[512];
+	int sock, ret;
+
+	sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (sock == -1)
+		return -errno;
+
+	/* subscribers are remembered by their pathname */
+	memset(&sockaddrun, 0, sizeof(sockaddrun));
+	sockaddrun.sun_family = AF_UNIX;
+	snprintf(sockaddrun.sun_path, sizeof(sockaddrun.sun_path), "/tmp/abus/_bench%d_%d", getpid(), idx);
+	unlink(sockaddrun.sun_path);
+	if (bind(sock, (struct sockaddr *)&sockaddrun, SUN_LEN(&sockaddrun)) == -1)
+		goto fail;
+
+	snprintf(sockaddrun.sun_path, sizeof(sockaddrun.sun_path), "/tmp/abus/%s", BENCH_SVC_NAME);
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	if (sendto(sock, req, sizeof(req)-1, 0, (struct sockaddr *)&sockaddrun, SUN_LEN(&sockaddrun)) == -1 ||
+			recv(sock, buf, sizeof(buf), 0) == -1)
+		goto fail;
+
+	return sock;
+
+fail:
+	ret = -errno;
+	close(sock);
+	return ret;
+}
+
+static int bench_fanout_subscribers(abus_t *abus_svc, int nsubs, int count)
+{
+	json_rpc_t *json_rpc;
+	double *samples, t0, elapsed = 0;
+	char name[64], buf[512];
+	int *socks, i, j, ret = 0;
+
+	socks = malloc(nsubs * sizeof(int));
+	samples = malloc(count * sizeof(double));
+	if (!socks || !samples) {
+		free(socks);
+		free(samples);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < nsubs; i++) {
+		socks[i] = fanout_subscriber(i);
+		if (socks[i] < 0) {
+			ret = socks[i];
+			nsubs = i;
+			goto out;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		t0 = now_us();
+
+		json_rpc = abus_request_event_init(abus_svc, BENCH_SVC_NAME, "tick");
+		if (!json_rpc) {
+			ret = -ENOMEM;
+			break;
+		}
+		json_rpc_append_int(json_rpc, "seq", i);
+		ret = abus_request_event_publish(abus_svc, json_rpc, 0);
+		abus_request_event_cleanup(abus_svc, json_rpc);
+		if (ret)
+			break;
+
+		samples[i] = now_us() - t0;
+		elapsed += samples[i];
+
+		/* untimed: drain the subscribers, so that none gets evicted on full queue */
+		for (j = 0; j < nsubs; j++) {
+			if (recv(socks[j], buf, sizeof(buf), MSG_DONTWAIT) == -1) {
+				fprintf(stderr, "fanout: subscriber %d missed event %d\n", j, i);
+				ret = -EIO;
+				goto out;
+			}
+		}
+	}
+
+	if (ret == 0) {
+		snprintf(name, sizeof(name), "fanout, %d subscribers", nsubs);
+		report(name, samples, count, elapsed);
+		printf("%-28s %8.0f deliveries/s\n", "", nsubs * count * 1e6 / elapsed);
+	}
+
+out:
+	/* get the subscribers evicted on next publish */
+	for (i = 0; i < nsubs; i++) {
+		snprintf(name, sizeof(name), "/tmp/abus/_bench%d_%d", getpid(), i);
+		unlink(name);
+		close(socks[i]);
+	}
+	json_rpc = abus_request_event_init(abus_svc, BENCH_SVC_NAME, "tick");
+	if (json_rpc) {
+		abus_request_event_publish(abus_svc, json_rpc, 0);
+		abus_request_event_cleanup(abus_svc, json_rpc);
+	}
+
+	free(socks);
+	free(samples);
+
+	return ret;
+}
+
+/*
+  Event publication rate against the number of subscribers
+ */
+static int bench_fanout(int count)
+{
+	static const int nsubs[] = { 1, 10, 100, 500 };
+	struct rlimit rlim;
+	abus_t *abus_svc;
+	unsigned i;
+	int n, ret = 0;
+
+	if (getrlimit(RLIMIT_NOFILE, &rlim) == 0 && rlim.rlim_cur < 1024) {
+		rlim.rlim_cur = rlim.rlim_max < 1024 ? rlim.rlim_max : 1024;
+		setrlimit(RLIMIT_NOFILE, &rlim);
+	}
+
+	abus_svc = bench_svc_init();
+	if (!abus_svc)
+		return -ENOMEM;
+
+	ret = abus_decl_event(abus_svc, BENCH_SVC_NAME, "tick", "Bench event", "seq:i:sequence number");
+
+	for (i = 0; ret == 0 && i < sizeof(nsubs)/sizeof(nsubs[0]); i++) {
+		/* keep the total number of deliveries within reason */
+		n = count * 10 / nsubs[i];
+		if (n > count)
+			n = count;
+		if (n < 100)
+			n = 100;
+		ret = bench_fanout_subscribers(abus_svc, nsubs[i], n);
+	}
+
+	abus_cleanup(abus_svc);
+
+	return ret;
+}
+
+static void svc_count_cb(json_rpc_t *json_rpc, void *arg)
+{
+	(*(int *)arg)++;
+}
+
+/*
+  Blast notifications at the A-Bus thread of a service, from a bare socket
+ */
+static int bench_storm_run(const char *name, int recv_batch, int count)
+{
+	static const char notif[] = "{\"jsonrpc\":\"2.0\",\"method\":\"" BENCH_SVC_NAME ".count\",\"params\":{}}";
+	static const char req[] = "{\"jsonrpc\":\"2.0\",\"method\":\"" BENCH_SVC_NAME ".count\",\"id\":1,\"params\":{}}";
+	struct sockaddr_un sockaddrun;
+	struct timeval tv = { .tv_sec = 1 };
+	abus_conf_t conf;
+	abus_t *abus_svc;
+	double start, elapsed;
+	char buf[512];
+	int i, sock, ret = 0, received = 0;
+
+	memset(&conf, 0, sizeof(conf));
+	conf.recv_batch = recv_batch;
+
+	abus_svc = abus_init(&conf);
+	if (!abus_svc)
+		return -ENOMEM;
+
+	ret = abus_decl_method(abus_svc, BENCH_SVC_NAME, "count", &svc_count_cb,
+					ABUS_RPC_FLAG_NONE, &received, NULL, NULL, NULL);
+	if (ret) {
+		abus_cleanup(abus_svc);
+		return ret;
+	}
+
+	sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (sock == -1) {
+		abus_cleanup(abus_svc);
+		return -errno;
+	}
+
+	/* autobind, for the final response */
+	memset(&sockaddrun, 0, sizeof(sockaddrun));
+	sockaddrun.sun_family = AF_UNIX;
+	bind(sock, (struct sockaddr *)&sockaddrun, sizeof(sa_family_t));
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	snprintf(sockaddrun.sun_path, sizeof(sockaddrun.sun_path), "/tmp/abus/%s", BENCH_SVC_NAME);
+
+	start = now_us();
+
+	for (i = 0; i < count && ret == 0; i++) {
+		if (sendto(sock, notif, sizeof(notif)-1, 0, (struct sockaddr *)&sockaddrun, SUN_LEN(&sockaddrun)) == -1)
+			ret = -errno;
+	}
+
+	/* once answered, all the notifications have been processed */
+	if (ret == 0 &&
+			(sendto(sock, req, sizeof(req)-1, 0, (struct sockaddr *)&sockaddrun, SUN_LEN(&sockaddrun)) == -1 ||
+			recv(sock, buf, sizeof(buf), 0) == -1))
+		ret = -errno;
+
+	elapsed = now_us() - start;
+
+	if (ret == 0)
+		printf("%-28s %8d msgs  %10.0f msgs/s\n", name, received, received * 1e6 / elapsed);
+
+	close(sock);
+	abus_cleanup(abus_svc);
+
+	return ret;
+}
+
+/*
+  Compare one recvfrom() per message against batched recvmmsg()
+ */
+static int bench_storm(int count)
+{
+	int ret;
+
+	ret = bench_storm_run("storm, recvfrom", 0, count*10);
+	if (ret == 0)
+		ret = bench_storm_run("storm, recvmmsg x32", 32, count*10);
+
+	return ret;
+}
+
+#define RECV_CLIENT_NB 8
+
+/* a few microseconds worth of work per request */
+static void svc_work_cb(json_rpc_t *json_rpc, void *arg)
+{
+	volatile unsigned x = 0;
+	int i;
+
+	for (i = 0; i < 20000; i++)
+		x += i;
+
+	json_rpc_append_int(json_rpc, "res_value", (int)(x & 1));
+}
+
+struct recv_client {
+	abus_t *abus;
+	int count;
+	int ret;
+};
+
+static void *recv_client_routine(void *arg)
+{
+	struct recv_client *clnt = (struct recv_client *)arg;
+	json_rpc_t *json_rpc;
+	int i;
+
+	for (i = 0; i < clnt->count && clnt->ret == 0; i++) {
+		json_rpc = abus_request_method_init(clnt->abus, BENCH_SVC_NAME, "work");
+		if (!json_rpc) {
+			clnt->ret = -ENOMEM;
+			break;
+		}
+		clnt->ret = abus_request_method_invoke(clnt->abus, json_rpc, ABUS_RPC_FLAG_NONE, BENCH_TIMEOUT);
+		abus_request_method_cleanup(clnt->abus, json_rpc);
+	}
+
+	return NULL;
+}
+
+/*
+  Requests/s of a service with n threads receiving, from concurrent clients
+ */
+static int bench_receivers_run(int recv_threads, int count)
+{
+	struct recv_client clnts[RECV_CLIENT_NB];
+	pthread_t threads[RECV_CLIENT_NB];
+	abus_conf_t conf;
+	abus_t *abus_svc, *abus;
+	double start, elapsed;
+	int i, ret = 0;
+
+	memset(&conf, 0, sizeof(conf));
+	conf.recv_threads = recv_threads;
+
+	abus_svc = abus_init(&conf);
+	abus = abus_init(NULL);
+	if (!abus_svc || !abus)
+		return -ENOMEM;
+
+	ret = abus_decl_method(abus_svc, BENCH_SVC_NAME, "work", &svc_work_cb,
+					ABUS_RPC_FLAG_NONE, NULL, NULL, NULL, NULL);
+
+	start = now_us();
+
+	for (i = 0; i < RECV_CLIENT_NB && ret == 0; i++) {
+		clnts[i].abus = abus;
+		clnts[i].count = count / RECV_CLIENT_NB;
+		clnts[i].ret = 0;
+		ret = -pthread_create(&threads[i], NULL, &recv_client_routine, &clnts[i]);
+	}
+	while (i-- > 0) {
+		pthread_join(threads[i], NULL);
+		if (ret == 0)
+			ret = clnts[i].ret;
+	}
+
+	elapsed = now_us() - start;
+
+	if (ret == 0)
+		printf("receivers, %d thread%s %14d calls %10.0f calls/s\n", recv_threads,
+						recv_threads > 1 ? "s" : " ", (count / RECV_CLIENT_NB) * RECV_CLIENT_NB,
+						(count / RECV_CLIENT_NB) * RECV_CLIENT_NB * 1e6 / elapsed);
+
+	abus_cleanup(abus);
+	abus_cleanup(abus_svc);
+
+	return ret;
+}
+
+/*
+  Scaling of a service against its number of receiver threads
+ */
+static int bench_receivers(int count)
+{
+	int n, ret = 0;
+
+	for (n = 1; n <= 8 && ret == 0; n *= 2)
+		ret = bench_receivers_run(n, count);
+
+	return ret;
+}
+
+/*
+  Cost of setting up and releasing a message, then asynchronous calls waited for.
+  The service is the client itself, only one A-Bus socket per process.
+ */
+static int bench_async(int count)
+{
+	abus_t *abus;
+	json_rpc_t *json_rpc;
+	double *samples, t0, start;
+	int i, ret = 0;
+
+	abus = bench_svc_init();
+	samples = malloc(count * sizeof(double));
+	if (!abus || !samples)
+		return -ENOMEM;
+
+	start = now_us();
+
+	for (i = 0; i < count*10; i++) {
+		json_rpc = abus_request_method_init(abus, BENCH_SVC_NAME, "sum");
+		if (!json_rpc) {
+			ret = -ENOMEM;
+			break;
+		}
+		abus_request_method_cleanup(abus, json_rpc);
+	}
+
+	if (ret == 0)
+		printf("%-28s %8d msgs  %10.1f ns/msg\n", "messages, init+cleanup",
+						count*10, (now_us() - start) * 1e3 / (count*10));
+
+	start = now_us();
+
+	for (i = 0; i < count && ret == 0; i++) {
+		t0 = now_us();
+
+		json_rpc = abus_request_method_init(abus, BENCH_SVC_NAME, "sum");
+		if (!json_rpc) {
+			ret = -ENOMEM;
+			break;
+		}
+		json_rpc_append_int(json_rpc, "a", i);
+		json_rpc_append_int(json_rpc, "b", 1);
+
+		ret = abus_request_method_invoke_async(abus, json_rpc, BENCH_TIMEOUT,
+						NULL, ABUS_RPC_FLAG_NONE, NULL);
+		if (ret == 0)
+			ret = abus_request_method_wait_async(abus, json_rpc, BENCH_TIMEOUT);
+		abus_request_method_cleanup(abus, json_rpc);
+
+		samples[i] = now_us() - t0;
+	}
+
+	if (ret == 0)
+		report("async, invoke+wait", samples, count, now_us() - start);
+
+	free(samples);
+	abus_cleanup(abus);
+
+	return ret;
+}
+
+#define BATCH_BENCH_WIDTH 32
+
+/*
+  Synchronous calls, one round trip each or BATCH_BENCH_WIDTH per batch
+ */
+static int bench_batch(int count)
+{
+	json_rpc_t *json_rpc[BATCH_BENCH_WIDTH];
+	abus_t *abus_svc, *abus;
+	double start;
+	int pass, i, done, width, ret = 0;
+
+	abus_svc = bench_svc_init();
+	abus = abus_init(NULL);
+	if (!abus_svc || !abus)
+		return -ENOMEM;
+
+	for (pass = 0; pass < 2 && ret == 0; pass++) {
+		start = now_us();
+
+		for (done = 0; done < count && ret == 0; done += width) {
+			width = count - done < BATCH_BENCH_WIDTH ? count - done : BATCH_BENCH_WIDTH;
+
+			for (i = 0; i < width; i++) {
+				json_rpc[i] = abus_request_method_init(abus, BENCH_SVC_NAME, "sum");
+				if (!json_rpc[i]) {
+					ret = -ENOMEM;
+					width = i;
+					break;
+				}
+				json_rpc_append_int(json_rpc[i], "a", i);
+				json_rpc_append_int(json_rpc[i], "b", 1);
+				if (pass == 0 && ret == 0)
+					ret = abus_request_method_invoke(abus, json_rpc[i], ABUS_RPC_FLAG_NONE, BENCH_TIMEOUT);
+			}
+			if (pass == 1 && ret == 0)
+				ret = abus_request_batch_invoke(abus, json_rpc, width, ABUS_RPC_FLAG_NONE, BENCH_TIMEOUT);
+
+			for (i = 0; i < width; i++)
+				abus_request_method_cleanup(abus, json_rpc[i]);
+		}
+
+		if (ret == 0)
+			printf("%-32s %8d calls %10.0f calls/s\n",
+							pass == 0 ? "sync, one call per round trip" : "sync, batches of 32 calls",
+							count, count * 1e6 / (now_us() - start));
+	}
+
+	abus_cleanup(abus);
+	abus_cleanup(abus_svc);
+
+	return ret;
+}
+
+#define CQ_BENCH_WIDTH 256
+
+/*
+  Fan out of asynchronous calls, collected one by one or reaped
+  in batches from a completion queue
+ */
+static int bench_cq(int count)
+{
+	json_rpc_t *json_rpc[CQ_BENCH_WIDTH];
+	abus_cq_t *cq;
+	abus_t *abus;
+	double start;
+	int pass, i, n, done, width, ret = 0;
+
+	abus = bench_svc_init();
+	cq = abus_cq_init();
+	if (!abus || !cq)
+		return -ENOMEM;
+
+	for (pass = 0; pass < 2 && ret == 0; pass++) {
+		start = now_us();
+
+		for (done = 0; done < count && ret == 0; done += width) {
+			width = count - done < CQ_BENCH_WIDTH ? count - done : CQ_BENCH_WIDTH;
+
+			for (i = 0; i < width && ret == 0; i++) {
+				json_rpc[i] = abus_request_method_init(abus, BENCH_SVC_NAME, "sum");
+				if (!json_rpc[i]) {
+					ret = -ENOMEM;
+					break;
+				}
+				json_rpc_append_int(json_rpc[i], "a", i);
+				json_rpc_append_int(json_rpc[i], "b", 1);
+				if (pass == 0)
+					ret = abus_request_method_invoke_async(abus, json_rpc[i], BENCH_TIMEOUT,
+									NULL, ABUS_RPC_FLAG_NONE, NULL);
+				else
+					ret = abus_request_method_invoke_cq(abus, json_rpc[i], BENCH_TIMEOUT,
+									cq, ABUS_RPC_FLAG_NONE);
+			}
+			if (ret)
+				break;
+
+			if (pass == 0) {
+				for (i = 0; i < width && ret == 0; i++)
+					ret = abus_request_method_wait_async(abus, json_rpc[i], BENCH_TIMEOUT);
+				n = width;
+			} else {
+				for (n = 0; n < width && ret >= 0; n += ret)
+					ret = abus_cq_wait(cq, json_rpc + n, width - n, BENCH_TIMEOUT, ABUS_CQ_WAIT_ALL);
+				if (ret > 0)
+					ret = 0;
+			}
+
+			for (i = 0; i < n; i++)
+				abus_request_method_cleanup(abus, json_rpc[i]);
+		}
+
+		if (ret == 0)
+			printf("fan out of %d, %-16s %8d calls %10.0f calls/s\n", CQ_BENCH_WIDTH,
+							pass == 0 ? "wait each" : "completion queue",
+							count, count * 1e6 / (now_us() - start));
+	}
+
+	abus_cq_cleanup(cq);
+	abus_cleanup(abus);
+
+	return ret;
+}
+
+#define TIMEOUT_BENCH_MS 500
+
+struct sink {
+	int sock;
+	volatile int stop;
+};
+
+/* swallow the requests, never answering */
+static void *sink_routine(void *arg)
+{
+	struct sink *sink = (struct sink *)arg;
+	char buf[512];
+
+	while (!sink->stop)
+		recv(sink->sock, buf, sizeof(buf), 0);
+
+	return NULL;
+}
+
+static void timeout_count_cb(json_rpc_t *json_rpc, void *arg)
+{
+	if (json_rpc_get_error(json_rpc) == -ETIMEDOUT)
+		(*(int *)arg)++;
+}
+
+/*
+  Async requests to a service which never answers, all left to time out
+ */
+static int bench_timeouts(int count)
+{
+	struct sockaddr_un sockaddrun;
+	struct timeval tv = { .tv_usec = 100000 };
+	struct sink sink = { .sock = -1 };
+	json_rpc_t **json_rpc;
+	pthread_t thread;
+	abus_t *abus;
+	double start, submitted, deadline;
+	int i, ret = 0;
+	volatile int expired = 0;
+
+	count *= 5;
+
+	json_rpc = calloc(count, sizeof(json_rpc_t *));
+	abus = abus_init(NULL);
+	sink.sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (!json_rpc || !abus || sink.sock == -1)
+		return -ENOMEM;
+
+	memset(&sockaddrun, 0, sizeof(sockaddrun));
+	sockaddrun.sun_family = AF_UNIX;
+	snprintf(sockaddrun.sun_path, sizeof(sockaddrun.sun_path), "/tmp/abus/%s", BENCH_SVC_NAME);
+	unlink(sockaddrun.sun_path);
+	if (bind(sink.sock, (struct sockaddr *)&sockaddrun, SUN_LEN(&sockaddrun)) == -1)
+		return -errno;
+	setsockopt(sink.sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	ret = -pthread_create(&thread, NULL, &sink_routine, &sink);
+	if (ret)
+		return ret;
+
+	start = now_us();
+
+	for (i = 0; i < count && ret == 0; i++) {
+		json_rpc[i] = abus_request_method_init(abus, BENCH_SVC_NAME, "sum");
+		if (!json_rpc[i]) {
+			ret = -ENOMEM;
+			break;
+		}
+		ret = abus_request_method_invoke_async(abus, json_rpc[i], TIMEOUT_BENCH_MS,
+						&timeout_count_cb, ABUS_RPC_FLAG_NONE, (void *)&expired);
+	}
+
+	submitted = now_us();
+	deadline = submitted + TIMEOUT_BENCH_MS * 1000. + 1e6;
+
+	while (ret == 0 && expired < count && now_us() < deadline)
+		usleep(1000);
+
+	if (ret == 0)
+		printf("timeouts %20d reqs  %10.0f reqs/s  all expired %.1f ms after the last one due\n",
+						expired, count * 1e6 / (submitted - start),
+						(now_us() - submitted) / 1e3 - TIMEOUT_BENCH_MS);
+	if (ret == 0 && expired != count)
+		ret = -ETIMEDOUT;
+
+	for (i = 0; i < count && json_rpc[i]; i++)
+		abus_request_method_cleanup(abus, json_rpc[i]);
+	free(json_rpc);
+
+	abus_cleanup(abus);
+
+	sink.stop = 1;
+	pthread_join(thread, NULL);
+	close(sink.sock);
+	unlink(sockaddrun.sun_path);
+
+	return ret;
+}
+
+/*
+  Same fan out, requests sent as issued vs corked then flushed
+ */
+static int bench_cork(int count)
+{
+	json_rpc_t *json_rpc[CQ_BENCH_WIDTH];
+	abus_conf_t conf;
+	abus_cq_t *cq;
+	abus_t *abus;
+	double start;
+	int pass, i, n, done, width, ret = 0;
+
+	abus = bench_svc_init();
+	cq = abus_cq_init();
+	if (!abus || !cq)
+		return -ENOMEM;
+
+	for (pass = 0; pass < 2 && ret == 0; pass++) {
+		abus_get_conf(abus, &conf);
+		conf.cork_usec = pass == 0 ? 0 : 1000;
+		abus_set_conf(abus, &conf);
+
+		start = now_us();
+
+		for (done = 0; done < count && ret == 0; done += width) {
+			width = count - done < CQ_BENCH_WIDTH ? count - done : CQ_BENCH_WIDTH;
+
+			for (i = 0; i < width && ret == 0; i++) {
+				json_rpc[i] = abus_request_method_init(abus, BENCH_SVC_NAME, "sum");
+				if (!json_rpc[i]) {
+					ret = -ENOMEM;
+					break;
+				}
+				json_rpc_append_int(json_rpc[i], "a", i);
+				json_rpc_append_int(json_rpc[i], "b", 1);
+				ret = abus_request_method_invoke_cq(abus, json_rpc[i], BENCH_TIMEOUT,
+								cq, ABUS_RPC_FLAG_NONE);
+			}
+			if (ret)
+				break;
+
+			abus_flush(abus);
+
+			for (n = 0; n < width && ret >= 0; n += ret)
+				ret = abus_cq_wait(cq, json_rpc + n, width - n, BENCH_TIMEOUT, ABUS_CQ_WAIT_ALL);
+			if (ret > 0)
+				ret = 0;
+
+			for (i = 0; i < n; i++)
+				abus_request_method_cleanup(abus, json_rpc[i]);
+		}
+
+		if (ret == 0)
+			printf("fan out of %d, %-16s %8d calls %10.0f calls/s\n", CQ_BENCH_WIDTH,
+							pass == 0 ? "sent as issued" : "corked",
+							count, count * 1e6 / (now_us() - start));
+	}
+
+	abus_cq_cleanup(cq);
+	abus_cleanup(abus);
+
+	return ret;
+}
+
+/*
+  Synchronous calls to a threaded method of the same A-Bus context, vs from another one
+ */
+static int bench_local(int count)
+{
+	abus_t *abus_svc;
+	int ret;
+
+	abus_svc = bench_svc_init();
+	if (!abus_svc)
+		return -ENOMEM;
+
+	/* only threaded methods are served without socket round trip */
+	ret = abus_decl_method(abus_svc, BENCH_SVC_NAME, "sum", &svc_sum_cb,
+					ABUS_RPC_THREADED, NULL, NULL, NULL, NULL);
+
+	if (ret == 0)
+		ret = bench_sync_calls("threaded, cached socket", NULL, count);
+
+	if (ret == 0)
+		ret = bench_sync_loop(abus_svc, "threaded, same A-Bus", count);
+
+	abus_cleanup(abus_svc);
+
+	return ret;
+}
+
+/*
+  Event publication to a subscriber of the same A-Bus context,
+  until its callback got the event
+ */
+static int bench_local_event(int count)
+{
+	json_rpc_t *json_rpc;
+	abus_t *abus;
+	double start;
+	int i, received = 0, ret;
+
+	abus = bench_svc_init();
+	if (!abus)
+		return -ENOMEM;
+
+	ret = abus_decl_event(abus, BENCH_SVC_NAME, "tick", "Bench event", "seq:i:sequence number");
+	if (ret == 0)
+		ret = abus_event_subscribe(abus, BENCH_SVC_NAME, "tick", &svc_count_cb,
+						ABUS_RPC_FLAG_NONE, &received, BENCH_TIMEOUT);
+
+	start = now_us();
+
+	for (i = 0; i < count && ret == 0; i++) {
+		json_rpc = abus_request_event_init(abus, BENCH_SVC_NAME, "tick");
+		if (!json_rpc) {
+			ret = -ENOMEM;
+			break;
+		}
+		json_rpc_append_int(json_rpc, "seq", i);
+		ret = abus_request_event_publish(abus, json_rpc, 0);
+		abus_request_event_cleanup(abus, json_rpc);
+
+		while (ret == 0 && __atomic_load_n(&received, __ATOMIC_ACQUIRE) < i+1)
+			usleep(0);
+	}
+
+	if (ret == 0)
+		printf("%-28s %8d events %10.0f events/s\n", "event, same A-Bus",
+						count, count * 1e6 / (now_us() - start));
+
+	abus_cleanup(abus);
+
+	return ret;
+}
+
+static const struct {
+	const char *name;
+	int (*run)(int count);
+	const char *descr;
+} benches[] = {
+	{ "sync", bench_sync, "synchronous calls, per transport" },
+	{ "abstract", bench_abstract, "synchronous calls, path vs abstract socket names" },
+	{ "highfd", bench_highfd, "synchronous calls, in a process with plenty of fds" },
+	{ "fanout", bench_fanout, "event publication, against subscriber count" },
+	{ "storm", bench_storm, "incoming message storm, with and without batched receive" },
+	{ "receivers", bench_receivers, "concurrent synchronous calls, against service receiver threads" },
+	{ "async", bench_async, "message setup cost, then asynchronous calls waited for" },
+	{ "timeouts", bench_timeouts, "expiry of outstanding async requests, 5x iterations" },
+	{ "cq", bench_cq, "fan out of asynchronous calls, reaped from a completion queue" },
+	{ "batch", bench_batch, "synchronous calls, one by one or in JSON-RPC batches" },
+	{ "cork", bench_cork, "fan out of asynchronous calls, corked or not" },
+	{ "local", bench_local, "synchronous calls, to a threaded method of the same A-Bus or not" },
+	{ "localevt", bench_local_event, "event publication, to a subscriber of the same A-Bus" },
+};
+
+int main(int argc, char **argv)
+{
+	unsigned i;
+	int ret = 0, found = 0;
+
+	if (argc > 2)
+		opt_iterations = atoi(argv[2]);
+
+	if (argc > 1 && !strcmp(argv[1], "-h")) {
+		printf("Usage: %s [bench name] [iterations]\n", argv[0]);
+		for (i = 0; i < sizeof(benches)/sizeof(benches[0]); i++)
+			printf("  %-12s %s\n", benches[i].name, benches[i].descr);
+		return EXIT_SUCCESS;
+	}
+
+	for (i = 0; i < sizeof(benches)/sizeof(benches[0]); i++) {
+		if (argc > 1 && strcmp(argv[1], benches[i].name))
+			continue;
+		found = 1;
+		ret = benches[i].run(opt_iterations);
+		if (ret != 0) {
+			fprintf(stderr, "%s: %s\n", benches[i].name, abus_strerror(ret));
+			break;
+		}
+	}
+
+	if (!found) {
+		fprintf(stderr, "%s: unknown bench '%s'\n", argv[0], argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
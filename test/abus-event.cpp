@@ -16,6 +16,12 @@
 #include <errno.h>
 #include <math.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
 
 #include <abus.h>
 #include <json.h>
@@ -29,6 +35,10 @@ static int msleep(int ms)
 	return usleep(ms*1000);
 }
 
+#ifndef UNIX_PATH_MAX
+#define UNIX_PATH_MAX 108
+#endif
+
 #define EVT_NAME "gtestevent"
 
 class AbusEvtTest : public AbusTest {
@@ -142,5 +152,185 @@ TEST_F(AbusEvtTest, TwoServicesSameEvtName) {
 	EXPECT_EQ(0, abus_undecl_event(abus_, SVC2_NAME, EVT_NAME));
 }
 
+struct local_evt {
+	pthread_t publisher;
+	volatile int count;
+	volatile int off_publisher;
+};
+
+static void event_local_cb(json_rpc_t *json_rpc, void *arg)
+{
+	struct local_evt *local = (struct local_evt *)arg;
+	int val;
+
+	EXPECT_EQ(0, json_rpc_get_int(json_rpc, "magicvalue", &val));
+	EXPECT_EQ(42, val);
+	if (!pthread_equal(local->publisher, pthread_self()))
+		__sync_add_and_fetch(&local->off_publisher, 1);
+	__sync_add_and_fetch(&local->count, 1);
+}
+
+struct local_pub {
+	abus_t *abus;
+	json_rpc_t *evt;
+	struct local_evt *local;
+	int inline_count;
+};
+
+// publishes from the A-Bus thread
+static void svc_publish_cb(json_rpc_t *, void *arg)
+{
+	struct local_pub *pub = (struct local_pub *)arg;
+	int count = pub->local->count;
+
+	EXPECT_EQ(0, abus_request_event_publish(pub->abus, pub->evt, ABUS_RPC_FLAG_NONE));
+	pub->inline_count = pub->local->count - count;
+}
+
+TEST_F(AbusEvtTest, LocalSubscriber) {
+	struct local_evt local;
+	struct local_pub pub;
+	json_rpc_t *json_rpc;
+	int i;
+
+	memset(&local, 0, sizeof(local));
+	local.publisher = pthread_self();
+
+	EXPECT_EQ(0, abus_event_subscribe(abus_, SVC_NAME, EVT_NAME, &event_local_cb, ABUS_RPC_FLAG_NONE, &local, RPC_TIMEOUT));
+
+	// no datagram, but run by the A-Bus thread, like the other plain callbacks
+	EXPECT_EQ(0, abus_request_event_publish(abus_, json_rpc_, ABUS_RPC_FLAG_NONE));
+	EXPECT_EQ(0, abus_request_event_publish(abus_, json_rpc_, ABUS_RPC_FLAG_NONE));
+	for (i = 0; i < 100 && local.count < 2; i++)
+		msleep(10);
+	EXPECT_EQ(2, local.count);
+	EXPECT_EQ(2, local.off_publisher);
+
+	// nothing more coming through the socket
+	msleep(100);
+	EXPECT_EQ(2, local.count);
+
+	// right away when published from the A-Bus thread itself
+	memset(&pub, 0, sizeof(pub));
+	pub.abus = abus_;
+	pub.evt = json_rpc_;
+	pub.local = &local;
+	EXPECT_EQ(0, abus_decl_method(abus_, SVC_NAME, "publish", &svc_publish_cb,
+					ABUS_RPC_FLAG_NONE, &pub, NULL, NULL, NULL));
+	json_rpc = abus_request_method_init(abus_, SVC_NAME, "publish");
+	ASSERT_TRUE(NULL != json_rpc);
+	EXPECT_EQ(0, abus_request_method_invoke(abus_, json_rpc, ABUS_RPC_FLAG_NONE, RPC_TIMEOUT));
+	EXPECT_EQ(0, abus_request_method_cleanup(abus_, json_rpc));
+	EXPECT_EQ(1, pub.inline_count);
+	EXPECT_EQ(3, local.count);
+	EXPECT_EQ(0, abus_undecl_method(abus_, SVC_NAME, "publish"));
+
+	EXPECT_EQ(0, abus_event_unsubscribe(abus_, SVC_NAME, EVT_NAME, &event_local_cb, &local, RPC_TIMEOUT));
+
+	EXPECT_EQ(0, abus_request_event_publish(abus_, json_rpc_, ABUS_RPC_FLAG_NONE));
+	msleep(100);
+	EXPECT_EQ(3, local.count);
+}
+
+// bare datagram end-point subscribing to EVT_NAME, like a remote process would do
+static int raw_subscriber(int idx)
+{
+	static const char req[] = "{\"jsonrpc\":\"2.0\",\"method\":\"" SVC_NAME ".subscribe\","
+					"\"id\":1,\"params\":{\"event\":\"" EVT_NAME "\"}}";
+	struct sockaddr_un sockaddrun;
+	struct timeval tv = { 1, 0 };
+	char buf[512];
+	int sock;
+
+	sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (sock == -1)
+		return -1;
+
+	memset(&sockaddrun, 0, sizeof(sockaddrun));
+	sockaddrun.sun_family = AF_UNIX;
+	snprintf(sockaddrun.sun_path, sizeof(sockaddrun.sun_path), "/tmp/abus/_gtest%d_%d", getpid(), idx);
+	unlink(sockaddrun.sun_path);
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	if (bind(sock, (struct sockaddr *)&sockaddrun, SUN_LEN(&sockaddrun)) == -1)
+		return -1;
+
+	snprintf(sockaddrun.sun_path, sizeof(sockaddrun.sun_path), "/tmp/abus/%s", SVC_NAME);
+	if (sendto(sock, req, sizeof(req)-1, 0, (struct sockaddr *)&sockaddrun, SUN_LEN(&sockaddrun)) == -1 ||
+			recv(sock, buf, sizeof(buf), 0) == -1)
+		return -1;
+
+	return sock;
+}
+
+static void raw_subscriber_close(int sock, int idx)
+{
+	char path[UNIX_PATH_MAX];
+
+	snprintf(path, sizeof(path), "/tmp/abus/_gtest%d_%d", getpid(), idx);
+	unlink(path);
+	close(sock);
+}
+
+TEST_F(AbusEvtTest, GoneSubscriber) {
+#define EVT_CLNT_NB 100
+	int sock[EVT_CLNT_NB];
+	char buf[512];
+	int i;
+
+	// client side, plenty of them
+	for (i = 0; i < EVT_CLNT_NB; i++) {
+		sock[i] = raw_subscriber(i);
+		ASSERT_LE(0, sock[i]);
+	}
+
+	// service side
+	EXPECT_EQ(0, abus_request_event_publish(abus_, json_rpc_, ABUS_RPC_FLAG_NONE));
+
+	for (i = 0; i < EVT_CLNT_NB; i++)
+		EXPECT_LT(0, recv(sock[i], buf, sizeof(buf), 0));
+
+	// some subscribers go away without unsubscribing
+	for (i = 0; i < EVT_CLNT_NB; i += 3)
+		raw_subscriber_close(sock[i], i);
+
+	// the other ones keep on being served, the gone ones get evicted
+	EXPECT_EQ(0, abus_request_event_publish(abus_, json_rpc_, ABUS_RPC_FLAG_NONE));
+	EXPECT_EQ(0, abus_request_event_publish(abus_, json_rpc_, ABUS_RPC_FLAG_NONE));
+
+	for (i = 0; i < EVT_CLNT_NB; i++) {
+		if (i % 3 == 0)
+			continue;
+		EXPECT_LT(0, recv(sock[i], buf, sizeof(buf), 0));
+		EXPECT_LT(0, recv(sock[i], buf, sizeof(buf), 0));
+		EXPECT_EQ(-1, recv(sock[i], buf, sizeof(buf), MSG_DONTWAIT));
+		raw_subscriber_close(sock[i], i);
+	}
+}
+
+TEST_F(AbusEvtTest, SlowSubscriber) {
+#define EVT_FLOOD_NB 1000
+	char buf[512];
+	int sock, i, n;
+
+	sock = raw_subscriber(0);
+	ASSERT_LE(0, sock);
+
+	// way more than the receive queue of the subscriber can hold
+	for (i = 0; i < EVT_FLOOD_NB; i++)
+		EXPECT_EQ(0, abus_request_event_publish(abus_, json_rpc_, ABUS_RPC_FLAG_NONE));
+
+	for (n = 0; recv(sock, buf, sizeof(buf), MSG_DONTWAIT) > 0; n++)
+		;
+	EXPECT_LT(0, n);
+	EXPECT_GT(EVT_FLOOD_NB, n);
+
+	// still subscribed once it caught up
+	EXPECT_EQ(0, abus_request_event_publish(abus_, json_rpc_, ABUS_RPC_FLAG_NONE));
+	EXPECT_LT(0, recv(sock, buf, sizeof(buf), 0));
+
+	raw_subscriber_close(sock, 0);
+}
+
 // TODO: subscribe to inexistant service/event, etc.
 
@@ -16,6 +16,14 @@
 #include <errno.h>
 #include <math.h>
 #include <unistd.h>
+#include <poll.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <abus.h>
 #include <json.h>
@@ -47,6 +55,7 @@ class AbusReqTest : public AbusTest {
 
         abus_decl_method_member(AbusReqTest, async_resp_cb);
         abus_decl_method_member(AbusReqTest, svc_slow_sum_cb) ;
+        abus_decl_method_member(AbusReqTest, svc_payload_cb) ;
         int m_res_value;
 
 	    json_rpc_t *json_rpc_;
@@ -65,6 +74,31 @@ void AbusReqTest::svc_slow_sum_cb(json_rpc_t *json_rpc)
 	svc_sum_cb(json_rpc);
 }
 
+// checks the payload of the request, responds with a payload of "size" bytes
+void AbusReqTest::svc_payload_cb(json_rpc_t *json_rpc)
+{
+	const void *data;
+	unsigned char *buf;
+	size_t len, i;
+	int size, sum = 0;
+
+	if (json_rpc_get_payload(json_rpc, &data, &len) == 0) {
+		for (i = 0; i < len; i++)
+			sum += ((const unsigned char *)data)[i];
+	} else {
+		len = 0;
+	}
+
+	json_rpc_append_int(json_rpc, "len", len);
+	json_rpc_append_int(json_rpc, "sum", sum);
+
+	if (json_rpc_get_int(json_rpc, "size", &size) == 0 && size > 0) {
+		buf = (unsigned char *)json_rpc_alloc_payload(json_rpc, size);
+		if (buf)
+			memset(buf, 0x5a, size);
+	}
+}
+
 class AbusJtypesTest : public AbusTest {
     protected:
         virtual void SetUp() {
@@ -132,6 +166,29 @@ TEST_F(AbusReqTest, BasicSvc) {
 	EXPECT_EQ(2+3, m_res_value);
 }
 
+// the other tests go through the io_uring loop as well in such a build
+TEST_F(AbusReqTest, UringLoop) {
+	abus_stats_t stats;
+
+	EXPECT_EQ(0, json_rpc_append_int(json_rpc_, "a", 2));
+	EXPECT_EQ(0, json_rpc_append_int(json_rpc_, "b", 3));
+	EXPECT_EQ(0, abus_request_method_invoke(abus_, json_rpc_, ABUS_RPC_FLAG_NONE, RPC_TIMEOUT));
+
+#ifdef ABUS_TEST_URING
+	// entered once the A-Bus thread is up
+	for (int i = 0; i < 100; i++) {
+		EXPECT_EQ(0, abus_get_stats(abus_, &stats));
+		if (stats.uring)
+			break;
+		msleep(10);
+	}
+	EXPECT_TRUE(stats.uring);
+#else
+	EXPECT_EQ(0, abus_get_stats(abus_, &stats));
+	EXPECT_FALSE(stats.uring);
+#endif
+}
+
 TEST_F(AbusReqTest, PlentyOfParams) {
     char parm_name[16];
 
@@ -319,6 +376,576 @@ TEST_F(AbusReqTest, CancelAsyncReq) {
 	EXPECT_EQ(0, m_res_value);
 }
 
+TEST_F(AbusReqTest, CachedSockAfterTimeout) {
+	abus_t *abus_clnt;
+	json_rpc_t *json_rpc;
+
+	// distinct context, so that the request goes through a socket
+	abus_clnt = abus_init(NULL);
+	EXPECT_TRUE(NULL != abus_clnt);
+
+	// redeclare with a sloooww handler
+	EXPECT_EQ(0, abus_decl_method_cxx(abus_, SVC_NAME, "sum", this, svc_slow_sum_cb,
+					ABUS_RPC_FLAG_NONE,
+					"Compute slow summation of two integers",
+					"a:i:first operand,b:i:second operand",
+					"res_value:i:summation"));
+
+	json_rpc = abus_request_method_init(abus_clnt, SVC_NAME, "sum");
+	EXPECT_TRUE(NULL != json_rpc);
+	EXPECT_EQ(0, json_rpc_append_int(json_rpc, "a", 1));
+	EXPECT_EQ(0, json_rpc_append_int(json_rpc, "b", 2));
+	EXPECT_EQ(-ETIMEDOUT, abus_request_method_invoke(abus_clnt, json_rpc, ABUS_RPC_FLAG_NONE, 100));
+	EXPECT_EQ(0, abus_request_method_cleanup(abus_clnt, json_rpc));
+
+	EXPECT_EQ(0, abus_decl_method_cxx(abus_, SVC_NAME, "sum", this, svc_sum_cb,
+					ABUS_RPC_FLAG_NONE,
+					"Compute summation of two integers",
+					"a:i:first operand,b:i:second operand",
+					"res_value:i:summation"));
+
+	// the late response of the timed out request must not be picked up
+	json_rpc = abus_request_method_init(abus_clnt, SVC_NAME, "sum");
+	EXPECT_TRUE(NULL != json_rpc);
+	EXPECT_EQ(0, json_rpc_append_int(json_rpc, "a", 10));
+	EXPECT_EQ(0, json_rpc_append_int(json_rpc, "b", 20));
+	EXPECT_EQ(0, abus_request_method_invoke(abus_clnt, json_rpc, ABUS_RPC_FLAG_NONE, RPC_TIMEOUT));
+	EXPECT_EQ(0, json_rpc_get_int(json_rpc, "res_value", &m_res_value));
+	EXPECT_EQ(10+20, m_res_value);
+	EXPECT_EQ(0, abus_request_method_cleanup(abus_clnt, json_rpc));
+
+	EXPECT_EQ(0, abus_cleanup(abus_clnt));
+}
+
+TEST_F(AbusReqTest, SeqpacketSession) {
+	abus_t *abus_clnt;
+	abus_conf_t conf;
+	json_rpc_t *json_rpc;
+	char seq_path[64];
+	int i;
+
+	// the service accepts sessions
+	snprintf(seq_path, sizeof(seq_path), "/tmp/abus/_%d.seq", getpid());
+	EXPECT_EQ(0, access(seq_path, F_OK));
+
+	memset(&conf, 0, sizeof(conf));
+	conf.seqpacket = true;
+
+	abus_clnt = abus_init(&conf);
+	EXPECT_TRUE(NULL != abus_clnt);
+
+	// same session re-used
+	for (i = 0; i < 3; i++) {
+		json_rpc = abus_request_method_init(abus_clnt, SVC_NAME, "sum");
+		EXPECT_TRUE(NULL != json_rpc);
+		EXPECT_EQ(0, json_rpc_append_int(json_rpc, "a", i));
+		EXPECT_EQ(0, json_rpc_append_int(json_rpc, "b", 100));
+		EXPECT_EQ(0, abus_request_method_invoke(abus_clnt, json_rpc, ABUS_RPC_FLAG_NONE, RPC_TIMEOUT));
+		EXPECT_EQ(0, json_rpc_get_int(json_rpc, "res_value", &m_res_value));
+		EXPECT_EQ(i+100, m_res_value);
+		EXPECT_EQ(0, abus_request_method_cleanup(abus_clnt, json_rpc));
+	}
+
+	// timed out request drops the session
+	EXPECT_EQ(0, abus_decl_method_cxx(abus_, SVC_NAME, "sum", this, svc_slow_sum_cb,
+					ABUS_RPC_FLAG_NONE, NULL, NULL, NULL));
+
+	m_res_value = 0;
+	json_rpc = abus_request_method_init(abus_clnt, SVC_NAME, "sum");
+	EXPECT_TRUE(NULL != json_rpc);
+	EXPECT_EQ(-ETIMEDOUT, abus_request_method_invoke(abus_clnt, json_rpc, ABUS_RPC_FLAG_NONE, 100));
+	EXPECT_EQ(0, abus_request_method_cleanup(abus_clnt, json_rpc));
+
+	EXPECT_EQ(0, abus_decl_method_cxx(abus_, SVC_NAME, "sum", this, svc_sum_cb,
+					ABUS_RPC_FLAG_NONE,
+					"Compute summation of two integers",
+					"a:i:first operand,b:i:second operand",
+					"res_value:i:summation"));
+
+	json_rpc = abus_request_method_init(abus_clnt, SVC_NAME, "sum");
+	EXPECT_TRUE(NULL != json_rpc);
+	EXPECT_EQ(0, json_rpc_append_int(json_rpc, "a", 10));
+	EXPECT_EQ(0, json_rpc_append_int(json_rpc, "b", 20));
+	EXPECT_EQ(0, abus_request_method_invoke(abus_clnt, json_rpc, ABUS_RPC_FLAG_NONE, RPC_TIMEOUT));
+	EXPECT_EQ(0, json_rpc_get_int(json_rpc, "res_value", &m_res_value));
+	EXPECT_EQ(10+20, m_res_value);
+	EXPECT_EQ(0, abus_request_method_cleanup(abus_clnt, json_rpc));
+
+	// unknown service still reported as such
+	json_rpc = abus_request_method_init(abus_clnt, "gtestnosvc", "sum");
+	EXPECT_TRUE(NULL != json_rpc);
+	EXPECT_EQ(-ENOENT, abus_request_method_invoke(abus_clnt, json_rpc, ABUS_RPC_FLAG_NONE, RPC_TIMEOUT));
+	EXPECT_EQ(0, abus_request_method_cleanup(abus_clnt, json_rpc));
+
+	EXPECT_EQ(0, abus_cleanup(abus_clnt));
+}
+
+// number of shared memory channel mappings in this process
+static int count_shm_maps()
+{
+	char line[256];
+	FILE *fp;
+	int cnt = 0;
+
+	fp = fopen("/proc/self/maps", "r");
+	if (!fp)
+		return -1;
+	while (fgets(line, sizeof(line), fp)) {
+		if (strstr(line, "abus-shm"))
+			cnt++;
+	}
+	fclose(fp);
+	return cnt;
+}
+
+TEST_F(AbusReqTest, ShmChannel) {
+	abus_t *abus_clnt;
+	abus_conf_t conf;
+	json_rpc_t *json_rpc;
+	int i;
+
+	memset(&conf, 0, sizeof(conf));
+	conf.shm = true;
+
+	abus_clnt = abus_init(&conf);
+	EXPECT_TRUE(NULL != abus_clnt);
+
+	// same channel re-used
+	for (i = 0; i < 3; i++) {
+		json_rpc = abus_request_method_init(abus_clnt, SVC_NAME, "sum");
+		EXPECT_TRUE(NULL != json_rpc);
+		EXPECT_EQ(0, json_rpc_append_int(json_rpc, "a", i));
+		EXPECT_EQ(0, json_rpc_append_int(json_rpc, "b", 100));
+		EXPECT_EQ(0, abus_request_method_invoke(abus_clnt, json_rpc, ABUS_RPC_FLAG_NONE, RPC_TIMEOUT));
+		EXPECT_EQ(0, json_rpc_get_int(json_rpc, "res_value", &m_res_value));
+		EXPECT_EQ(i+100, m_res_value);
+		EXPECT_EQ(0, abus_request_method_cleanup(abus_clnt, json_rpc));
+	}
+
+	// mapped by both the client thread and the service
+	EXPECT_EQ(2, count_shm_maps());
+
+	// timed out request drops the channel
+	EXPECT_EQ(0, abus_decl_method_cxx(abus_, SVC_NAME, "sum", this, svc_slow_sum_cb,
+					ABUS_RPC_FLAG_NONE, NULL, NULL, NULL));
+
+	m_res_value = 0;
+	json_rpc = abus_request_method_init(abus_clnt, SVC_NAME, "sum");
+	EXPECT_TRUE(NULL != json_rpc);
+	EXPECT_EQ(-ETIMEDOUT, abus_request_method_invoke(abus_clnt, json_rpc, ABUS_RPC_FLAG_NONE, 100));
+	EXPECT_EQ(0, abus_request_method_cleanup(abus_clnt, json_rpc));
+
+	EXPECT_EQ(0, abus_decl_method_cxx(abus_, SVC_NAME, "sum", this, svc_sum_cb,
+					ABUS_RPC_FLAG_NONE,
+					"Compute summation of two integers",
+					"a:i:first operand,b:i:second operand",
+					"res_value:i:summation"));
+
+	json_rpc = abus_request_method_init(abus_clnt, SVC_NAME, "sum");
+	EXPECT_TRUE(NULL != json_rpc);
+	EXPECT_EQ(0, json_rpc_append_int(json_rpc, "a", 10));
+	EXPECT_EQ(0, json_rpc_append_int(json_rpc, "b", 20));
+	EXPECT_EQ(0, abus_request_method_invoke(abus_clnt, json_rpc, ABUS_RPC_FLAG_NONE, RPC_TIMEOUT));
+	EXPECT_EQ(0, json_rpc_get_int(json_rpc, "res_value", &m_res_value));
+	EXPECT_EQ(10+20, m_res_value);
+	EXPECT_EQ(0, abus_request_method_cleanup(abus_clnt, json_rpc));
+
+	// unknown service still reported as such
+	json_rpc = abus_request_method_init(abus_clnt, "gtestnosvc", "sum");
+	EXPECT_TRUE(NULL != json_rpc);
+	EXPECT_EQ(-ENOENT, abus_request_method_invoke(abus_clnt, json_rpc, ABUS_RPC_FLAG_NONE, RPC_TIMEOUT));
+	EXPECT_EQ(0, abus_request_method_cleanup(abus_clnt, json_rpc));
+
+	EXPECT_EQ(0, abus_cleanup(abus_clnt));
+}
+
+TEST_F(AbusReqTest, Payload) {
+	abus_t *abus_clnt;
+	abus_conf_t conf;
+	json_rpc_t *json_rpc;
+	unsigned char *buf;
+	const void *data;
+	size_t len, i;
+	int req_len = 1024*1024;
+	int resp_len = 256*1024;
+	int sum = 0, res, k;
+
+	EXPECT_EQ(0, abus_decl_method_cxx(abus_, SVC_NAME, "payload", this, svc_payload_cb,
+					ABUS_RPC_FLAG_NONE, NULL, NULL, NULL));
+
+	// way beyond JSONRPC_REQ_SZ_MAX, both ways
+	json_rpc = abus_request_method_init(abus_, SVC_NAME, "payload");
+	EXPECT_TRUE(NULL != json_rpc);
+	buf = (unsigned char *)json_rpc_alloc_payload(json_rpc, req_len);
+	ASSERT_TRUE(NULL != buf);
+	for (k = 0; k < req_len; k++) {
+		buf[k] = k & 0xff;
+		sum += k & 0xff;
+	}
+	EXPECT_EQ(0, json_rpc_append_int(json_rpc, "size", resp_len));
+	EXPECT_EQ(0, abus_request_method_invoke(abus_, json_rpc, ABUS_RPC_FLAG_NONE, RPC_TIMEOUT));
+	EXPECT_EQ(0, json_rpc_get_int(json_rpc, "len", &res));
+	EXPECT_EQ(req_len, res);
+	EXPECT_EQ(0, json_rpc_get_int(json_rpc, "sum", &res));
+	EXPECT_EQ(sum, res);
+	EXPECT_EQ(0, json_rpc_get_payload(json_rpc, &data, &len));
+	EXPECT_EQ((size_t)resp_len, len);
+	for (i = 0; i < len && ((const unsigned char *)data)[i] == 0x5a; i++)
+		;
+	EXPECT_EQ(len, i);
+	EXPECT_EQ(0, abus_request_method_cleanup(abus_, json_rpc));
+
+	// small payload, none in response
+	json_rpc = abus_request_method_init(abus_, SVC_NAME, "payload");
+	EXPECT_TRUE(NULL != json_rpc);
+	EXPECT_EQ(0, json_rpc_attach_payload(json_rpc, "abc", 3));
+	EXPECT_EQ(0, abus_request_method_invoke(abus_, json_rpc, ABUS_RPC_FLAG_NONE, RPC_TIMEOUT));
+	EXPECT_EQ(0, json_rpc_get_int(json_rpc, "sum", &res));
+	EXPECT_EQ('a'+'b'+'c', res);
+	EXPECT_EQ(-ENOENT, json_rpc_get_payload(json_rpc, &data, &len));
+	EXPECT_EQ(0, abus_request_method_cleanup(abus_, json_rpc));
+
+	// response payload through the shared memory channel and the session
+	for (k = 0; k < 2; k++) {
+		memset(&conf, 0, sizeof(conf));
+		conf.shm = k == 0;
+		conf.seqpacket = k == 1;
+
+		abus_clnt = abus_init(&conf);
+		EXPECT_TRUE(NULL != abus_clnt);
+
+		json_rpc = abus_request_method_init(abus_clnt, SVC_NAME, "payload");
+		EXPECT_TRUE(NULL != json_rpc);
+		EXPECT_EQ(0, json_rpc_append_int(json_rpc, "size", resp_len));
+		EXPECT_EQ(0, abus_request_method_invoke(abus_clnt, json_rpc, ABUS_RPC_FLAG_NONE, RPC_TIMEOUT));
+		EXPECT_EQ(0, json_rpc_get_int(json_rpc, "len", &res));
+		EXPECT_EQ(0, res);
+		EXPECT_EQ(0, json_rpc_get_payload(json_rpc, &data, &len));
+		EXPECT_EQ((size_t)resp_len, len);
+		EXPECT_EQ(0, abus_request_method_cleanup(abus_clnt, json_rpc));
+
+		EXPECT_EQ(0, abus_cleanup(abus_clnt));
+	}
+}
+
+TEST_F(AbusReqTest, HighFdNumber) {
+	abus_t *abus_clnt;
+	json_rpc_t *json_rpc;
+	int fds[FD_SETSIZE+16];
+	int i, nfds;
+
+	// push the sockets of the client context beyond FD_SETSIZE
+	for (nfds = 0; nfds < FD_SETSIZE+16; nfds++) {
+		fds[nfds] = dup(0);
+		if (fds[nfds] == -1)
+			break;
+	}
+
+	abus_clnt = abus_init(NULL);
+	EXPECT_TRUE(NULL != abus_clnt);
+
+	json_rpc = abus_request_method_init(abus_clnt, SVC_NAME, "sum");
+	EXPECT_TRUE(NULL != json_rpc);
+	EXPECT_EQ(0, json_rpc_append_int(json_rpc, "a", 3));
+	EXPECT_EQ(0, json_rpc_append_int(json_rpc, "b", 4));
+	EXPECT_EQ(0, abus_request_method_invoke(abus_clnt, json_rpc, ABUS_RPC_FLAG_NONE, RPC_TIMEOUT));
+	EXPECT_EQ(0, json_rpc_get_int(json_rpc, "res_value", &m_res_value));
+	EXPECT_EQ(3+4, m_res_value);
+	EXPECT_EQ(0, abus_request_method_cleanup(abus_clnt, json_rpc));
+
+	EXPECT_EQ(0, abus_cleanup(abus_clnt));
+
+	for (i = 0; i < nfds; i++)
+		close(fds[i]);
+}
+
+static int bind_fake_svc(const char *pid_name)
+{
+	struct sockaddr_un sockaddrun;
+	int sock;
+
+	memset(&sockaddrun, 0, sizeof(sockaddrun));
+	sockaddrun.sun_family = AF_UNIX;
+	snprintf(sockaddrun.sun_path, sizeof(sockaddrun.sun_path), "/tmp/abus/%s", pid_name);
+	unlink(sockaddrun.sun_path);
+
+	sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (sock != -1 && bind(sock, (struct sockaddr *)&sockaddrun, SUN_LEN(&sockaddrun)) == -1) {
+		close(sock);
+		sock = -1;
+	}
+
+	return sock;
+}
+
+// a symlink re-pointed to another live socket is followed right away
+TEST_F(AbusReqTest, AddrCacheInvalidation) {
+	json_rpc_t *json_rpc;
+	char buf[256];
+	int sock1, sock2, i;
+
+	sock1 = bind_fake_svc("_gtestfake1");
+	sock2 = bind_fake_svc("_gtestfake2");
+	EXPECT_NE(-1, sock1);
+	EXPECT_NE(-1, sock2);
+
+	unlink("/tmp/abus/gtestfake");
+	EXPECT_EQ(0, symlink("_gtestfake1", "/tmp/abus/gtestfake"));
+
+	for (i = 0; i < 2; i++) {
+		if (i == 1) {
+			// what a service restart does
+			unlink("/tmp/abus/gtestfake");
+			EXPECT_EQ(0, symlink("_gtestfake2", "/tmp/abus/gtestfake"));
+		}
+
+		json_rpc = abus_request_method_init(abus_, "gtestfake", "sum");
+		EXPECT_TRUE(NULL != json_rpc);
+		EXPECT_EQ(-ETIMEDOUT, abus_request_method_invoke(abus_, json_rpc, ABUS_RPC_FLAG_NONE, 50));
+		EXPECT_EQ(0, abus_request_method_cleanup(abus_, json_rpc));
+
+		EXPECT_LT(0, recv(i == 0 ? sock1 : sock2, buf, sizeof(buf), MSG_DONTWAIT));
+		EXPECT_EQ(-1, recv(i == 0 ? sock2 : sock1, buf, sizeof(buf), MSG_DONTWAIT));
+	}
+
+	unlink("/tmp/abus/gtestfake");
+	unlink("/tmp/abus/_gtestfake1");
+	unlink("/tmp/abus/_gtestfake2");
+	close(sock1);
+	close(sock2);
+}
+
+TEST_F(AbusReqTest, AbstractNamespace) {
+	abus_t *abus_svc, *abus_clnt;
+	json_rpc_t *json_rpc;
+	const char *pname;
+	size_t name_len;
+	int i;
+
+	// mode picked up by abus_init(), for the whole process
+	setenv("ABUS_ABSTRACT", "1", 1);
+
+	abus_svc = abus_init(NULL);
+	EXPECT_TRUE(NULL != abus_svc);
+	EXPECT_EQ(0, abus_decl_method_cxx(abus_svc, "gtestabs", "sum", this, svc_sum_cb,
+					ABUS_RPC_FLAG_NONE,
+					"Compute summation of two integers",
+					"a:i:first operand,b:i:second operand",
+					"res_value:i:summation"));
+
+	// nothing left in the file system
+	EXPECT_EQ(-1, access("/tmp/abus/gtestabs", F_OK));
+
+	abus_clnt = abus_init(NULL);
+	EXPECT_TRUE(NULL != abus_clnt);
+
+	for (i = 0; i < 3; i++) {
+		json_rpc = abus_request_method_init(abus_clnt, "gtestabs", "sum");
+		EXPECT_TRUE(NULL != json_rpc);
+		EXPECT_EQ(0, json_rpc_append_int(json_rpc, "a", i));
+		EXPECT_EQ(0, json_rpc_append_int(json_rpc, "b", 100));
+		EXPECT_EQ(0, abus_request_method_invoke(abus_clnt, json_rpc, ABUS_RPC_FLAG_NONE, RPC_TIMEOUT));
+		EXPECT_EQ(0, json_rpc_get_int(json_rpc, "res_value", &m_res_value));
+		EXPECT_EQ(i+100, m_res_value);
+		EXPECT_EQ(0, abus_request_method_cleanup(abus_clnt, json_rpc));
+	}
+
+	// discovered without the /tmp/abus directory
+	json_rpc = abus_request_method_init(abus_clnt, "", "*");
+	EXPECT_TRUE(NULL != json_rpc);
+	EXPECT_EQ(0, abus_request_method_invoke(abus_clnt, json_rpc, ABUS_RPC_FLAG_NONE, RPC_TIMEOUT));
+	EXPECT_EQ(1, json_rpc_get_array_count(json_rpc, "services"));
+	EXPECT_EQ(0, json_rpc_get_point_at(json_rpc, "services", 0));
+	EXPECT_EQ(0, json_rpc_get_strp(json_rpc, "name", &pname, &name_len));
+	EXPECT_STREQ("gtestabs", pname);
+	EXPECT_EQ(0, abus_request_method_cleanup(abus_clnt, json_rpc));
+
+	// path based services are out of reach
+	json_rpc = abus_request_method_init(abus_clnt, SVC_NAME, "sum");
+	EXPECT_TRUE(NULL != json_rpc);
+	EXPECT_EQ(-ENOENT, abus_request_method_invoke(abus_clnt, json_rpc, ABUS_RPC_FLAG_NONE, RPC_TIMEOUT));
+	EXPECT_EQ(0, abus_request_method_cleanup(abus_clnt, json_rpc));
+
+	EXPECT_EQ(0, abus_cleanup(abus_clnt));
+	EXPECT_EQ(0, abus_cleanup(abus_svc));
+
+	// back to path mode for the fixture
+	unsetenv("ABUS_ABSTRACT");
+	abus_cleanup(abus_init(NULL));
+}
+
+static void svc_count_cb(json_rpc_t *json_rpc, void *arg)
+{
+	int *count = (int *)arg;
+
+	(*count)++;
+	json_rpc_append_int(json_rpc, "count", *count);
+}
+
+TEST(AbusBatchTest, BurstInOrder) {
+#define BURST_NB 50
+	static const char notif[] = "{\"jsonrpc\":\"2.0\",\"method\":\"" SVC_NAME ".count\",\"params\":{}}";
+	static const char req[] = "{\"jsonrpc\":\"2.0\",\"method\":\"" SVC_NAME ".count\",\"id\":1,\"params\":{}}";
+	struct sockaddr_un sockaddrun;
+	struct timeval tv = { 1, 0 };
+	abus_conf_t conf;
+	abus_t *abus;
+	char buf[512];
+	int count = 0;
+	int i, sock;
+	ssize_t len;
+
+	memset(&conf, 0, sizeof(conf));
+	conf.recv_batch = 8;
+
+	abus = abus_init(&conf);
+	ASSERT_TRUE(NULL != abus);
+	EXPECT_EQ(0, abus_decl_method(abus, SVC_NAME, "count", &svc_count_cb,
+					ABUS_RPC_FLAG_NONE, &count, NULL, NULL, NULL));
+
+	// bare autobound socket, sending a burst of notifications
+	sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+	ASSERT_LE(0, sock);
+	memset(&sockaddrun, 0, sizeof(sockaddrun));
+	sockaddrun.sun_family = AF_UNIX;
+	ASSERT_EQ(0, bind(sock, (struct sockaddr *)&sockaddrun, sizeof(sa_family_t)));
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	snprintf(sockaddrun.sun_path, sizeof(sockaddrun.sun_path), "/tmp/abus/%s", SVC_NAME);
+	for (i = 0; i < BURST_NB; i++)
+		EXPECT_EQ((ssize_t)sizeof(notif)-1, sendto(sock, notif, sizeof(notif)-1, 0,
+							(struct sockaddr *)&sockaddrun, SUN_LEN(&sockaddrun)));
+
+	// the request has to be processed after all the notifications
+	EXPECT_EQ((ssize_t)sizeof(req)-1, sendto(sock, req, sizeof(req)-1, 0,
+							(struct sockaddr *)&sockaddrun, SUN_LEN(&sockaddrun)));
+	len = recv(sock, buf, sizeof(buf)-1, 0);
+	ASSERT_LT(0, len);
+	buf[len] = '\0';
+	EXPECT_TRUE(NULL != strstr(buf, "\"count\":51"));
+	EXPECT_EQ(BURST_NB+1, count);
+
+	close(sock);
+	EXPECT_EQ(0, abus_cleanup(abus));
+}
+
+TEST_F(AbusReqTest, Notify) {
+#define NOTIFY_NB 10
+	abus_t *abus_clnt;
+	json_rpc_t *json_rpc;
+	int i, res_value, count = 0;
+
+	EXPECT_EQ(0, abus_decl_method(abus_, SVC_NAME, "count", &svc_count_cb,
+					ABUS_RPC_FLAG_NONE, &count, NULL, NULL, NULL));
+
+	for (i = 0; i < NOTIFY_NB; i++) {
+		json_rpc = abus_request_method_init(abus_, SVC_NAME, "count");
+		ASSERT_TRUE(NULL != json_rpc);
+		EXPECT_EQ(0, abus_request_method_notify(abus_, json_rpc, ABUS_RPC_FLAG_NONE));
+		EXPECT_EQ(0, abus_request_method_cleanup(abus_, json_rpc));
+	}
+
+	// no error coming back
+	json_rpc = abus_request_method_init(abus_, SVC_NAME, "nosuchmethod");
+	ASSERT_TRUE(NULL != json_rpc);
+	EXPECT_EQ(0, abus_request_method_notify(abus_, json_rpc, ABUS_RPC_FLAG_NONE));
+	EXPECT_EQ(0, abus_request_method_cleanup(abus_, json_rpc));
+
+	// a pure client notifies without an A-Bus thread of its own
+	abus_clnt = abus_init(NULL);
+	ASSERT_TRUE(NULL != abus_clnt);
+	json_rpc = abus_request_method_init(abus_clnt, SVC_NAME, "count");
+	ASSERT_TRUE(NULL != json_rpc);
+	EXPECT_EQ(0, abus_request_method_notify(abus_clnt, json_rpc, ABUS_RPC_FLAG_NONE));
+	EXPECT_EQ(0, abus_request_method_cleanup(abus_clnt, json_rpc));
+	EXPECT_EQ(-1, abus_get_fd(abus_clnt));
+	EXPECT_EQ(0, abus_cleanup(abus_clnt));
+
+	// the request has to be processed after all the notifications
+	json_rpc = abus_request_method_init(abus_, SVC_NAME, "count");
+	ASSERT_TRUE(NULL != json_rpc);
+	EXPECT_EQ(0, abus_request_method_invoke(abus_, json_rpc, ABUS_RPC_FLAG_NONE, RPC_TIMEOUT));
+	EXPECT_EQ(0, json_rpc_get_int(json_rpc, "count", &res_value));
+	EXPECT_EQ(NOTIFY_NB+2, res_value);
+	EXPECT_EQ(0, abus_request_method_cleanup(abus_, json_rpc));
+
+	EXPECT_EQ(0, abus_undecl_method(abus_, SVC_NAME, "count"));
+}
+
+// tells whether run from the thread of the caller
+static void svc_caller_thread_cb(json_rpc_t *json_rpc, void *arg)
+{
+	pthread_t *caller = (pthread_t *)arg;
+	int delay;
+
+	if (json_rpc_get_int(json_rpc, "delay", &delay) == 0)
+		msleep(delay);
+
+	json_rpc_append_bool(json_rpc, "caller_thread", pthread_equal(*caller, pthread_self()));
+}
+
+// calls "where" of the same A-Bus, from the A-Bus thread
+static void svc_nested_cb(json_rpc_t *json_rpc, void *arg)
+{
+	abus_t *abus = (abus_t *)arg;
+	json_rpc_t *nested;
+
+	nested = abus_request_method_init(abus, SVC_NAME, "where");
+	if (!nested)
+		return;
+
+	json_rpc_append_int(json_rpc, "res", abus_request_method_invoke(abus, nested, ABUS_RPC_FLAG_NONE, RPC_TIMEOUT));
+	abus_request_method_cleanup(abus, nested);
+}
+
+TEST_F(AbusReqTest, LocalCall) {
+	pthread_t caller = pthread_self();
+	json_rpc_t *json_rpc;
+	bool caller_thread;
+	int i, res;
+
+	EXPECT_EQ(0, abus_decl_method(abus_, SVC_NAME, "where", &svc_caller_thread_cb,
+					ABUS_RPC_FLAG_NONE, &caller, NULL, NULL, NULL));
+	EXPECT_EQ(0, abus_decl_method(abus_, SVC_NAME, "twhere", &svc_caller_thread_cb,
+					ABUS_RPC_THREADED, &caller, NULL, NULL, NULL));
+	EXPECT_EQ(0, abus_decl_method(abus_, SVC_NAME, "nested", &svc_nested_cb,
+					ABUS_RPC_FLAG_NONE, abus_, NULL, NULL, NULL));
+
+	// plain methods run by the A-Bus thread, threaded ones in their own thread
+	for (i = 0; i < 2; i++) {
+		json_rpc = abus_request_method_init(abus_, SVC_NAME, i == 0 ? "where" : "twhere");
+		ASSERT_TRUE(NULL != json_rpc);
+		EXPECT_EQ(0, abus_request_method_invoke(abus_, json_rpc, ABUS_RPC_FLAG_NONE, RPC_TIMEOUT));
+		EXPECT_EQ(0, json_rpc_get_bool(json_rpc, "caller_thread", &caller_thread));
+		EXPECT_FALSE(caller_thread);
+		EXPECT_EQ(0, abus_request_method_cleanup(abus_, json_rpc));
+	}
+
+	// late responses, of a plain and of a threaded method
+	for (i = 0; i < 2; i++) {
+		json_rpc = abus_request_method_init(abus_, SVC_NAME, i == 0 ? "where" : "twhere");
+		ASSERT_TRUE(NULL != json_rpc);
+		EXPECT_EQ(0, json_rpc_append_int(json_rpc, "delay", 200));
+		EXPECT_EQ(-ETIMEDOUT, abus_request_method_invoke(abus_, json_rpc, ABUS_RPC_FLAG_NONE, 50));
+		EXPECT_EQ(0, abus_request_method_cleanup(abus_, json_rpc));
+		msleep(300);
+	}
+
+	// a plain method called from the A-Bus thread is run right away
+	json_rpc = abus_request_method_init(abus_, SVC_NAME, "nested");
+	ASSERT_TRUE(NULL != json_rpc);
+	EXPECT_EQ(0, abus_request_method_invoke(abus_, json_rpc, ABUS_RPC_FLAG_NONE, RPC_TIMEOUT));
+	EXPECT_EQ(0, json_rpc_get_int(json_rpc, "res", &res));
+	EXPECT_EQ(0, res);
+	EXPECT_EQ(0, abus_request_method_cleanup(abus_, json_rpc));
+
+	// unknown method still reported as such
+	json_rpc = abus_request_method_init(abus_, SVC_NAME, "nosuchmethod");
+	ASSERT_TRUE(NULL != json_rpc);
+	EXPECT_EQ(JSONRPC_NO_METHOD, abus_request_method_invoke(abus_, json_rpc, ABUS_RPC_FLAG_NONE, RPC_TIMEOUT));
+	EXPECT_EQ(0, abus_request_method_cleanup(abus_, json_rpc));
+}
+
 TEST_F(AbusJtypesTest, AllTypes)
 {
 	int a = INT_MAX, res_a;
@@ -590,6 +1217,988 @@ TEST_F(AbusReqTest, ThreadedExclMethod) {
 	EXPECT_EQ(200+300, m_res_value);
 }
 
+static void async_count_cb(json_rpc_t * /*json_rpc*/, void *arg)
+{
+	int *count = (int *)arg;
+
+	(*count)++;
+}
+
+TEST_F(AbusReqTest, ThreadedPool) {
+	abus_conf_t conf;
+	abus_stats_t stats;
+	json_rpc_t *json_rpc[2];
+	int i, count = 0;
+
+	// one worker, one request waiting at most
+	EXPECT_EQ(0, abus_get_conf(abus_, &conf));
+	conf.pool_size = 1;
+	conf.pool_queue = 1;
+	conf.thread_stack = 256*1024;
+	EXPECT_EQ(0, abus_set_conf(abus_, &conf));
+
+	EXPECT_EQ(0, abus_decl_method_cxx(abus_, SVC_NAME, "sum", this, svc_slow_sum_cb,
+					ABUS_RPC_THREADED, NULL, NULL, NULL));
+
+	// first one running, second one queued
+	for (i = 0; i < 2; i++) {
+		json_rpc[i] = abus_request_method_init(abus_, SVC_NAME, "sum");
+		EXPECT_TRUE(NULL != json_rpc[i]);
+		EXPECT_EQ(0, json_rpc_append_int(json_rpc[i], "a", i));
+		EXPECT_EQ(0, json_rpc_append_int(json_rpc[i], "b", 1));
+		EXPECT_EQ(0, abus_request_method_invoke_async(abus_, json_rpc[i], 2*RPC_TIMEOUT,
+						async_count_cb, ABUS_RPC_FLAG_NONE, &count));
+		// let the worker pick up the first one
+		msleep(50);
+	}
+
+	// third one turned down
+	EXPECT_EQ(0, json_rpc_append_int(json_rpc_, "a", 2));
+	EXPECT_EQ(0, json_rpc_append_int(json_rpc_, "b", 1));
+	EXPECT_EQ(JSONRPC_SERVER_ERROR, abus_request_method_invoke(abus_, json_rpc_, ABUS_RPC_FLAG_NONE, RPC_TIMEOUT));
+
+	EXPECT_EQ(0, abus_get_stats(abus_, &stats));
+	EXPECT_EQ(1U, stats.pool_queued);
+	EXPECT_EQ(1UL, stats.pool_rejected);
+
+	for (i = 0; i < 2; i++) {
+		EXPECT_EQ(0, abus_request_method_wait_async(abus_, json_rpc[i], 2*RPC_TIMEOUT));
+		EXPECT_EQ(0, abus_request_method_cleanup(abus_, json_rpc[i]));
+	}
+	EXPECT_EQ(2, count);
+
+	EXPECT_EQ(0, abus_get_stats(abus_, &stats));
+	EXPECT_EQ(0U, stats.pool_queued);
+}
+
+static void async_error_cb(json_rpc_t *json_rpc, void *arg)
+{
+	*(int *)arg = json_rpc_get_error(json_rpc);
+}
+
+TEST_F(AbusReqTest, AsyncTimeout) {
+	int error = 0;
+
+	// response after 400ms
+	EXPECT_EQ(0, abus_decl_method_cxx(abus_, SVC_NAME, "sum", this, svc_slow_sum_cb,
+					ABUS_RPC_THREADED, NULL, NULL, NULL));
+
+	EXPECT_EQ(0, json_rpc_append_int(json_rpc_, "a", 1));
+	EXPECT_EQ(0, json_rpc_append_int(json_rpc_, "b", 2));
+
+	EXPECT_EQ(0, abus_request_method_invoke_async(abus_, json_rpc_, 100,
+					async_error_cb, ABUS_RPC_FLAG_NONE, &error));
+
+	EXPECT_EQ(-ETIMEDOUT, abus_request_method_wait_async(abus_, json_rpc_, RPC_TIMEOUT));
+	EXPECT_EQ(-ETIMEDOUT, error);
+
+	// late response to be dropped
+	msleep(500);
+}
+
+// service end-point never responding, for the requests to time out
+static int blackhole_svc(const char *service_name)
+{
+	struct sockaddr_un sockaddrun;
+	int sock;
+
+	sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (sock == -1)
+		return -1;
+
+	memset(&sockaddrun, 0, sizeof(sockaddrun));
+	sockaddrun.sun_family = AF_UNIX;
+	snprintf(sockaddrun.sun_path, sizeof(sockaddrun.sun_path), "/tmp/abus/%s", service_name);
+	unlink(sockaddrun.sun_path);
+
+	if (bind(sock, (struct sockaddr *)&sockaddrun, sizeof(sockaddrun)) == -1) {
+		close(sock);
+		return -1;
+	}
+
+	return sock;
+}
+
+TEST(AbusPollTest, AsyncTimeout) {
+	abus_t *abus;
+	abus_conf_t conf;
+	json_rpc_t *json_rpc;
+	int error = 0;
+	int i, svc_sock;
+
+	svc_sock = blackhole_svc("gtestpoll");
+	EXPECT_NE(-1, svc_sock);
+
+	memset(&conf, 0, sizeof(conf));
+	conf.poll_operation = true;
+
+	abus = abus_init(&conf);
+	EXPECT_TRUE(NULL != abus);
+
+	json_rpc = abus_request_method_init(abus, "gtestpoll", "sum");
+	EXPECT_TRUE(NULL != json_rpc);
+
+	EXPECT_EQ(0, abus_request_method_invoke_async(abus, json_rpc, 100,
+					async_error_cb, ABUS_RPC_FLAG_NONE, &error));
+
+	// the timer goes off through the application loop
+	for (i = 0; i < 10 && error == 0; i++) {
+		struct pollfd pfd;
+
+		pfd.fd = abus_get_fd(abus);
+		pfd.events = POLLIN;
+		EXPECT_NE(-1, pfd.fd);
+
+		if (poll(&pfd, 1, 100) > 0) {
+			EXPECT_EQ(0, abus_process_incoming(abus));
+		}
+	}
+	EXPECT_EQ(-ETIMEDOUT, error);
+
+	EXPECT_EQ(0, abus_request_method_cleanup(abus, json_rpc));
+	EXPECT_EQ(0, abus_cleanup(abus));
+
+	close(svc_sock);
+	unlink("/tmp/abus/gtestpoll");
+}
+
+TEST(AbusPollTest, CorkedRequests) {
+	abus_t *abus;
+	abus_conf_t conf;
+	json_rpc_t *json_rpc[2];
+	char buf[512];
+	ssize_t len = -1;
+	int error = 0;
+	int i, svc_sock;
+
+	svc_sock = blackhole_svc("gtestpoll");
+	EXPECT_NE(-1, svc_sock);
+
+	memset(&conf, 0, sizeof(conf));
+	conf.poll_operation = true;
+	conf.cork_usec = 2000;
+
+	abus = abus_init(&conf);
+	EXPECT_TRUE(NULL != abus);
+
+	for (i = 0; i < 2; i++) {
+		json_rpc[i] = abus_request_method_init(abus, "gtestpoll", "sum");
+		EXPECT_TRUE(NULL != json_rpc[i]);
+		EXPECT_EQ(0, abus_request_method_invoke_async(abus, json_rpc[i], RPC_TIMEOUT,
+						async_error_cb, ABUS_RPC_FLAG_NONE, &error));
+	}
+
+	// held back, until the application loop sends them in one batch
+	EXPECT_EQ(-1, recv(svc_sock, buf, sizeof(buf), MSG_DONTWAIT));
+
+	for (i = 0; i < 10 && len == -1; i++) {
+		struct pollfd pfd;
+
+		pfd.fd = abus_get_fd(abus);
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, 10) > 0) {
+			EXPECT_EQ(0, abus_process_incoming(abus));
+		}
+
+		len = recv(svc_sock, buf, sizeof(buf), MSG_DONTWAIT);
+	}
+	EXPECT_LT(0, len);
+	EXPECT_EQ('[', buf[0]);
+	EXPECT_EQ(0, error);
+
+	for (i = 0; i < 2; i++) {
+		EXPECT_EQ(0, abus_request_method_cancel_async(abus, json_rpc[i]));
+		EXPECT_EQ(0, abus_request_method_cleanup(abus, json_rpc[i]));
+	}
+	EXPECT_EQ(0, abus_cleanup(abus));
+
+	close(svc_sock);
+	unlink("/tmp/abus/gtestpoll");
+}
+
+#define ASYNC_THREAD_NB 4
+#define ASYNC_REQ_NB 50
+
+struct async_clnt {
+	abus_t *abus;
+	int sum;
+	int errors;
+};
+
+static void async_sum_cb(json_rpc_t *json_rpc, void *arg)
+{
+	int res_value = 0;
+
+	if (json_rpc_get_int(json_rpc, "res_value", &res_value) == 0)
+		__atomic_add_fetch((int *)arg, res_value, __ATOMIC_RELAXED);
+}
+
+static void *async_clnt_routine(void *arg)
+{
+	struct async_clnt *clnt = (struct async_clnt *)arg;
+	json_rpc_t *json_rpc;
+	int i;
+
+	for (i = 0; i < ASYNC_REQ_NB; i++) {
+		json_rpc = abus_request_method_init(clnt->abus, SVC_NAME, "sum");
+		if (!json_rpc) {
+			clnt->errors++;
+			continue;
+		}
+		json_rpc_append_int(json_rpc, "a", i);
+		json_rpc_append_int(json_rpc, "b", 1);
+		if (abus_request_method_invoke_async(clnt->abus, json_rpc, RPC_TIMEOUT,
+						async_sum_cb, ABUS_RPC_FLAG_NONE, &clnt->sum) != 0 ||
+				abus_request_method_wait_async(clnt->abus, json_rpc, RPC_TIMEOUT) != 0)
+			clnt->errors++;
+		abus_request_method_cleanup(clnt->abus, json_rpc);
+	}
+
+	return NULL;
+}
+
+TEST_F(AbusReqTest, AsyncConcurrent) {
+	struct async_clnt clnts[ASYNC_THREAD_NB];
+	pthread_t threads[ASYNC_THREAD_NB];
+	int i;
+
+	// responses matched to their requests whatever the issuing thread
+	for (i = 0; i < ASYNC_THREAD_NB; i++) {
+		clnts[i].abus = abus_;
+		clnts[i].sum = 0;
+		clnts[i].errors = 0;
+		EXPECT_EQ(0, pthread_create(&threads[i], NULL, &async_clnt_routine, &clnts[i]));
+	}
+
+	for (i = 0; i < ASYNC_THREAD_NB; i++) {
+		EXPECT_EQ(0, pthread_join(threads[i], NULL));
+		EXPECT_EQ(0, clnts[i].errors);
+		EXPECT_EQ(ASYNC_REQ_NB*(ASYNC_REQ_NB-1)/2 + ASYNC_REQ_NB, clnts[i].sum);
+	}
+}
+
+#define CQ_REQ_NB 100
+
+TEST_F(AbusReqTest, CqWaitAll) {
+	json_rpc_t *json_rpc[CQ_REQ_NB], *reaped[CQ_REQ_NB];
+	abus_cq_t *cq;
+	int i, n, res_value, sum = 0, count = 0;
+
+	cq = abus_cq_init();
+	ASSERT_TRUE(NULL != cq);
+
+	// nothing bound, nothing to wait for
+	EXPECT_EQ(0, abus_cq_wait(cq, reaped, CQ_REQ_NB, RPC_TIMEOUT, ABUS_CQ_WAIT_ALL));
+
+	for (i = 0; i < CQ_REQ_NB; i++) {
+		json_rpc[i] = abus_request_method_init(abus_, SVC_NAME, "sum");
+		ASSERT_TRUE(NULL != json_rpc[i]);
+		EXPECT_EQ(0, json_rpc_append_int(json_rpc[i], "a", i));
+		EXPECT_EQ(0, json_rpc_append_int(json_rpc[i], "b", 1));
+		EXPECT_EQ(0, abus_request_method_invoke_cq(abus_, json_rpc[i], RPC_TIMEOUT, cq, ABUS_RPC_FLAG_NONE));
+	}
+
+	// in two batches
+	while (count < CQ_REQ_NB) {
+		n = abus_cq_wait(cq, reaped, CQ_REQ_NB/2, RPC_TIMEOUT, ABUS_CQ_WAIT_ALL);
+		ASSERT_EQ(CQ_REQ_NB/2, n);
+		for (i = 0; i < n; i++) {
+			EXPECT_EQ(0, json_rpc_get_error(reaped[i]));
+			EXPECT_EQ(0, json_rpc_get_int(reaped[i], "res_value", &res_value));
+			sum += res_value;
+			EXPECT_EQ(0, abus_request_method_cleanup(abus_, reaped[i]));
+		}
+		count += n;
+	}
+	EXPECT_EQ(CQ_REQ_NB*(CQ_REQ_NB-1)/2 + CQ_REQ_NB, sum);
+
+	EXPECT_EQ(0, abus_cq_wait(cq, reaped, CQ_REQ_NB, 0, ABUS_CQ_WAIT_ANY));
+	EXPECT_EQ(0, abus_cq_cleanup(cq));
+}
+
+TEST_F(AbusReqTest, CqWaitAny) {
+	json_rpc_t *slow_rpc, *reaped[2];
+	abus_cq_t *cq;
+	int res_value;
+
+	// response after 400ms
+	EXPECT_EQ(0, abus_decl_method_cxx(abus_, SVC_NAME, "slow_sum", this, svc_slow_sum_cb,
+					ABUS_RPC_THREADED, NULL, NULL, NULL));
+
+	cq = abus_cq_init();
+	ASSERT_TRUE(NULL != cq);
+
+	slow_rpc = abus_request_method_init(abus_, SVC_NAME, "slow_sum");
+	ASSERT_TRUE(NULL != slow_rpc);
+	EXPECT_EQ(0, json_rpc_append_int(slow_rpc, "a", 3));
+	EXPECT_EQ(0, json_rpc_append_int(slow_rpc, "b", 4));
+	EXPECT_EQ(0, abus_request_method_invoke_cq(abus_, slow_rpc, RPC_TIMEOUT, cq, ABUS_RPC_FLAG_NONE));
+
+	EXPECT_EQ(0, json_rpc_append_int(json_rpc_, "a", 1));
+	EXPECT_EQ(0, json_rpc_append_int(json_rpc_, "b", 2));
+	EXPECT_EQ(0, abus_request_method_invoke_cq(abus_, json_rpc_, RPC_TIMEOUT, cq, ABUS_RPC_FLAG_NONE));
+
+	// the fast one, without waiting for the slow one
+	EXPECT_EQ(1, abus_cq_wait(cq, reaped, 2, RPC_TIMEOUT, ABUS_CQ_WAIT_ANY));
+	EXPECT_EQ(json_rpc_, reaped[0]);
+	EXPECT_EQ(0, json_rpc_get_int(json_rpc_, "res_value", &res_value));
+	EXPECT_EQ(3, res_value);
+
+	EXPECT_EQ(-ETIMEDOUT, abus_cq_wait(cq, reaped, 2, 100, ABUS_CQ_WAIT_ANY));
+	EXPECT_EQ(-EBUSY, abus_cq_cleanup(cq));
+
+	EXPECT_EQ(1, abus_cq_wait(cq, reaped, 2, RPC_TIMEOUT, ABUS_CQ_WAIT_ANY));
+	EXPECT_EQ(slow_rpc, reaped[0]);
+	EXPECT_EQ(0, json_rpc_get_int(slow_rpc, "res_value", &res_value));
+	EXPECT_EQ(7, res_value);
+	abus_request_method_cleanup(abus_, slow_rpc);
+
+	EXPECT_EQ(0, abus_cq_cleanup(cq));
+}
+
+#define SERIAL_REQ_NB 6
+
+struct serial_ctx {
+	pthread_mutex_t mutex;
+	int running, max_running;
+	int order[SERIAL_REQ_NB];
+	int done;
+};
+
+static void svc_serial_cb(json_rpc_t *json_rpc, void *arg)
+{
+	struct serial_ctx *ctx = (struct serial_ctx *)arg;
+	int n = -1;
+
+	json_rpc_get_int(json_rpc, "n", &n);
+
+	pthread_mutex_lock(&ctx->mutex);
+	if (++ctx->running > ctx->max_running)
+		ctx->max_running = ctx->running;
+	pthread_mutex_unlock(&ctx->mutex);
+
+	msleep(50);
+
+	pthread_mutex_lock(&ctx->mutex);
+	ctx->running--;
+	if (ctx->done < SERIAL_REQ_NB)
+		ctx->order[ctx->done++] = n;
+	pthread_mutex_unlock(&ctx->mutex);
+}
+
+static void serial_invoke_all(abus_t *abus, bool keyed)
+{
+	json_rpc_t *json_rpc[SERIAL_REQ_NB];
+	int i, count = 0;
+
+	for (i = 0; i < SERIAL_REQ_NB; i++) {
+		json_rpc[i] = abus_request_method_init(abus, SVC_NAME, "serial");
+		EXPECT_TRUE(NULL != json_rpc[i]);
+		EXPECT_EQ(0, json_rpc_append_int(json_rpc[i], "n", i));
+		if (keyed) {
+			EXPECT_EQ(0, json_rpc_append_int(json_rpc[i], "key", i%2));
+		}
+		EXPECT_EQ(0, abus_request_method_invoke_async(abus, json_rpc[i], 2*RPC_TIMEOUT,
+						async_count_cb, ABUS_RPC_FLAG_NONE, &count));
+	}
+
+	for (i = 0; i < SERIAL_REQ_NB; i++) {
+		EXPECT_EQ(0, abus_request_method_wait_async(abus, json_rpc[i], 2*RPC_TIMEOUT));
+		EXPECT_EQ(0, abus_request_method_cleanup(abus, json_rpc[i]));
+	}
+	EXPECT_EQ(SERIAL_REQ_NB, count);
+}
+
+TEST_F(AbusReqTest, ThreadedExclSerial) {
+	struct serial_ctx ctx;
+	int i;
+
+	memset(&ctx, 0, sizeof(ctx));
+	pthread_mutex_init(&ctx.mutex, NULL);
+
+	EXPECT_EQ(0, abus_decl_method(abus_, SVC_NAME, "serial", svc_serial_cb,
+					ABUS_RPC_THREADED|ABUS_RPC_EXCL, &ctx, NULL, NULL, NULL));
+
+	serial_invoke_all(abus_, false);
+
+	// one at a time, in arrival order
+	EXPECT_EQ(1, ctx.max_running);
+	EXPECT_EQ(SERIAL_REQ_NB, ctx.done);
+	for (i = 0; i < SERIAL_REQ_NB; i++)
+		EXPECT_EQ(i, ctx.order[i]);
+
+	EXPECT_EQ(0, abus_undecl_method(abus_, SVC_NAME, "serial"));
+	pthread_mutex_destroy(&ctx.mutex);
+}
+
+TEST_F(AbusReqTest, SerialKey) {
+	struct serial_ctx ctx;
+	int i, last[2] = { -1, -1 };
+
+	memset(&ctx, 0, sizeof(ctx));
+	pthread_mutex_init(&ctx.mutex, NULL);
+
+	EXPECT_EQ(-EINVAL, abus_set_method_serial_key(abus_, SVC_NAME, "sum", "a"));
+
+	EXPECT_EQ(0, abus_decl_method(abus_, SVC_NAME, "serial", svc_serial_cb,
+					ABUS_RPC_THREADED, &ctx, NULL, NULL, NULL));
+	EXPECT_EQ(0, abus_set_method_serial_key(abus_, SVC_NAME, "serial", "key"));
+
+	serial_invoke_all(abus_, true);
+
+	// both keys concurrently, each one in arrival order
+	EXPECT_EQ(2, ctx.max_running);
+	EXPECT_EQ(SERIAL_REQ_NB, ctx.done);
+	for (i = 0; i < SERIAL_REQ_NB; i++) {
+		EXPECT_LT(last[ctx.order[i]%2], ctx.order[i]);
+		last[ctx.order[i]%2] = ctx.order[i];
+	}
+
+	EXPECT_EQ(0, abus_undecl_method(abus_, SVC_NAME, "serial"));
+	pthread_mutex_destroy(&ctx.mutex);
+}
+
+struct defer_ctx {
+	abus_t *abus;
+	json_rpc_t *json_rpc;
+	pthread_t thread;
+	int deferred;
+};
+
+// answers from another thread, 100ms later
+static void *defer_complete_routine(void *arg)
+{
+	struct defer_ctx *ctx = (struct defer_ctx *)arg;
+	int a = 0, b = 0;
+
+	msleep(100);
+
+	json_rpc_get_int(ctx->json_rpc, "a", &a);
+	json_rpc_get_int(ctx->json_rpc, "b", &b);
+	json_rpc_append_int(ctx->json_rpc, "res_value", a + b);
+
+	EXPECT_EQ(0, abus_complete_response(ctx->abus, ctx->json_rpc));
+
+	return NULL;
+}
+
+static void svc_defer_cb(json_rpc_t *json_rpc, void *arg)
+{
+	struct defer_ctx *ctx = (struct defer_ctx *)arg;
+
+	EXPECT_EQ(0, abus_defer_response(ctx->abus, json_rpc));
+	EXPECT_EQ(-EINVAL, abus_defer_response(ctx->abus, json_rpc));
+
+	ctx->json_rpc = json_rpc;
+	ctx->deferred++;
+	EXPECT_EQ(0, pthread_create(&ctx->thread, NULL, &defer_complete_routine, ctx));
+}
+
+class AbusDeferTest : public AbusReqTest,
+					public ::testing::WithParamInterface<int> {
+};
+
+TEST_P(AbusDeferTest, DeferredResponse) {
+	struct defer_ctx ctx;
+	int res_value = 0;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.abus = abus_;
+
+	EXPECT_EQ(0, abus_decl_method(abus_, SVC_NAME, "defer", svc_defer_cb,
+					GetParam(), &ctx, NULL, NULL, NULL));
+
+	json_rpc_t *json_rpc = abus_request_method_init(abus_, SVC_NAME, "defer");
+	ASSERT_TRUE(NULL != json_rpc);
+	EXPECT_EQ(0, json_rpc_append_int(json_rpc, "a", 2));
+	EXPECT_EQ(0, json_rpc_append_int(json_rpc, "b", 3));
+
+	// the method returned at once, its response came later
+	EXPECT_EQ(0, abus_request_method_invoke(abus_, json_rpc, ABUS_RPC_FLAG_NONE, RPC_TIMEOUT));
+	EXPECT_EQ(0, json_rpc_get_int(json_rpc, "res_value", &res_value));
+	EXPECT_EQ(5, res_value);
+	EXPECT_EQ(1, ctx.deferred);
+
+	EXPECT_EQ(0, pthread_join(ctx.thread, NULL));
+	EXPECT_EQ(0, abus_request_method_cleanup(abus_, json_rpc));
+
+	// not a request being served
+	EXPECT_EQ(-EINVAL, abus_complete_response(abus_, json_rpc_));
+}
+
+INSTANTIATE_TEST_CASE_P(AbusDeferVariations, AbusDeferTest,
+				::testing::Values(ABUS_RPC_FLAG_NONE, ABUS_RPC_THREADED));
+
+#define BATCH_REQ_NB 12
+
+TEST_F(AbusReqTest, BatchRequest) {
+	json_rpc_t *json_rpc[BATCH_REQ_NB];
+	int i, res_value;
+
+	EXPECT_EQ(0, abus_decl_method_cxx(abus_, SVC_NAME, "tsum", this, svc_sum_cb,
+					ABUS_RPC_THREADED, NULL, NULL, NULL));
+
+	// plain and threaded methods, the last one unknown
+	for (i = 0; i < BATCH_REQ_NB; i++) {
+		json_rpc[i] = abus_request_method_init(abus_, SVC_NAME,
+						i == BATCH_REQ_NB-1 ? "nosuchmethod" : (i%2 ? "tsum" : "sum"));
+		ASSERT_TRUE(NULL != json_rpc[i]);
+		EXPECT_EQ(0, json_rpc_append_int(json_rpc[i], "a", i));
+		EXPECT_EQ(0, json_rpc_append_int(json_rpc[i], "b", 100));
+	}
+
+	EXPECT_EQ(0, abus_request_batch_invoke(abus_, json_rpc, BATCH_REQ_NB, ABUS_RPC_FLAG_NONE, RPC_TIMEOUT));
+
+	for (i = 0; i < BATCH_REQ_NB-1; i++) {
+		EXPECT_EQ(0, json_rpc_get_error(json_rpc[i]));
+		EXPECT_EQ(0, json_rpc_get_int(json_rpc[i], "res_value", &res_value));
+		EXPECT_EQ(i + 100, res_value);
+	}
+	EXPECT_EQ(JSONRPC_NO_METHOD, json_rpc_get_error(json_rpc[BATCH_REQ_NB-1]));
+
+	for (i = 0; i < BATCH_REQ_NB; i++)
+		EXPECT_EQ(0, abus_request_method_cleanup(abus_, json_rpc[i]));
+
+	// all of them to the same service
+	json_rpc[0] = abus_request_method_init(abus_, SVC_NAME, "sum");
+	json_rpc[1] = abus_request_method_init(abus_, "othersvc", "sum");
+	EXPECT_EQ(-EINVAL, abus_request_batch_invoke(abus_, json_rpc, 2, ABUS_RPC_FLAG_NONE, RPC_TIMEOUT));
+	abus_request_method_cleanup(abus_, json_rpc[0]);
+	abus_request_method_cleanup(abus_, json_rpc[1]);
+}
+
+// count of the occurrences of needle in haystack
+static int strcount(const char *haystack, const char *needle)
+{
+	int n = 0;
+
+	while ((haystack = strstr(haystack, needle)) != NULL) {
+		haystack += strlen(needle);
+		n++;
+	}
+
+	return n;
+}
+
+TEST_F(AbusReqTest, BatchInvalidElements) {
+	static const char mixed[] = "[{\"jsonrpc\":\"2.0\",\"method\":\"" SVC_NAME ".sum\",\"id\":1,"
+					"\"params\":{\"a\":1,\"b\":2}}, 1, \"foo\", [3],"
+					"{\"jsonrpc\":\"2.0\",\"method\":\"" SVC_NAME ".sum\",\"id\":2,"
+					"\"params\":{\"a\":3,\"b\":4}}]";
+	static const char numbers[] = "[1,2]";
+	struct sockaddr_un sockaddrun;
+	struct timeval tv = { 1, 0 };
+	char buf[1024];
+	ssize_t len;
+	int sock;
+
+	sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+	ASSERT_LE(0, sock);
+	memset(&sockaddrun, 0, sizeof(sockaddrun));
+	sockaddrun.sun_family = AF_UNIX;
+	ASSERT_EQ(0, bind(sock, (struct sockaddr *)&sockaddrun, sizeof(sa_family_t)));
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	snprintf(sockaddrun.sun_path, sizeof(sockaddrun.sun_path), "/tmp/abus/%s", SVC_NAME);
+
+	// both requests answered, along with an error for each invalid element
+	EXPECT_EQ((ssize_t)sizeof(mixed)-1, sendto(sock, mixed, sizeof(mixed)-1, 0,
+							(struct sockaddr *)&sockaddrun, SUN_LEN(&sockaddrun)));
+	len = recv(sock, buf, sizeof(buf)-1, 0);
+	ASSERT_LT(0, len);
+	buf[len] = '\0';
+	EXPECT_EQ('[', buf[0]);
+	EXPECT_TRUE(NULL != strstr(buf, "\"res_value\":3"));
+	EXPECT_TRUE(NULL != strstr(buf, "\"res_value\":7"));
+	EXPECT_EQ(3, strcount(buf, "-32600"));
+
+	EXPECT_EQ((ssize_t)sizeof(numbers)-1, sendto(sock, numbers, sizeof(numbers)-1, 0,
+							(struct sockaddr *)&sockaddrun, SUN_LEN(&sockaddrun)));
+	len = recv(sock, buf, sizeof(buf)-1, 0);
+	ASSERT_LT(0, len);
+	buf[len] = '\0';
+	EXPECT_EQ('[', buf[0]);
+	EXPECT_EQ(2, strcount(buf, "-32600"));
+	EXPECT_EQ(0, strcount(buf, "-32700"));
+
+	close(sock);
+}
+
+#define CORK_REQ_NB 20
+
+TEST_F(AbusReqTest, CorkedRequests) {
+	json_rpc_t *json_rpc[CORK_REQ_NB], *reaped[CORK_REQ_NB];
+	abus_conf_t conf, saved_conf;
+	abus_cq_t *cq;
+	int i, n, res_value, sum;
+
+	cq = abus_cq_init();
+	ASSERT_TRUE(NULL != cq);
+
+	EXPECT_EQ(0, abus_get_conf(abus_, &saved_conf));
+	conf = saved_conf;
+
+	// held back 2 ms, then on abus_flush() within a 10 s window
+	for (n = 0; n < 2; n++) {
+		conf.cork_usec = n == 0 ? 2000 : 10000000;
+		EXPECT_EQ(0, abus_set_conf(abus_, &conf));
+
+		for (i = 0; i < CORK_REQ_NB; i++) {
+			json_rpc[i] = abus_request_method_init(abus_, SVC_NAME, "sum");
+			ASSERT_TRUE(NULL != json_rpc[i]);
+			EXPECT_EQ(0, json_rpc_append_int(json_rpc[i], "a", i));
+			EXPECT_EQ(0, json_rpc_append_int(json_rpc[i], "b", 1));
+			EXPECT_EQ(0, abus_request_method_invoke_cq(abus_, json_rpc[i], 2*RPC_TIMEOUT, cq, ABUS_RPC_FLAG_NONE));
+		}
+		if (n == 1) {
+			EXPECT_EQ(0, abus_flush(abus_));
+		}
+
+		ASSERT_EQ(CORK_REQ_NB, abus_cq_wait(cq, reaped, CORK_REQ_NB, RPC_TIMEOUT, ABUS_CQ_WAIT_ALL));
+
+		sum = 0;
+		for (i = 0; i < CORK_REQ_NB; i++) {
+			EXPECT_EQ(0, json_rpc_get_error(reaped[i]));
+			EXPECT_EQ(0, json_rpc_get_int(reaped[i], "res_value", &res_value));
+			sum += res_value;
+			EXPECT_EQ(0, abus_request_method_cleanup(abus_, reaped[i]));
+		}
+		EXPECT_EQ(CORK_REQ_NB*(CORK_REQ_NB-1)/2 + CORK_REQ_NB, sum);
+	}
+
+	EXPECT_EQ(0, abus_set_conf(abus_, &saved_conf));
+	EXPECT_EQ(0, abus_cq_cleanup(cq));
+}
+
+#define STREAM_CHUNK_NB 5
+
+struct stream_ctx {
+	abus_t *abus;
+	int streamed;
+	int partial_nb, row_sum;
+	int final_nb, count;
+};
+
+// one row per partial result, the row count in the final response
+static void svc_stream_cb(json_rpc_t *json_rpc, void *arg)
+{
+	struct stream_ctx *ctx = (struct stream_ctx *)arg;
+	int i, ret = 0;
+
+	for (i = 0; i < STREAM_CHUNK_NB && ret == 0; i++) {
+		json_rpc_append_int(json_rpc, "row", i);
+		ret = abus_stream_response(ctx->abus, json_rpc);
+		if (ret == 0)
+			ctx->streamed++;
+	}
+	// the client takes it all at once, the rows are not sent
+	if (ret == -EOPNOTSUPP)
+		i = 0;
+
+	json_rpc_append_int(json_rpc, "count", i);
+}
+
+static void stream_resp_cb(json_rpc_t *json_rpc, void *arg)
+{
+	struct stream_ctx *ctx = (struct stream_ctx *)arg;
+	int val;
+
+	if (json_rpc_is_partial(json_rpc)) {
+		EXPECT_EQ(0, ctx->final_nb);
+		EXPECT_EQ(0, json_rpc_get_int(json_rpc, "row", &val));
+		EXPECT_EQ(ctx->partial_nb, val);
+		ctx->partial_nb++;
+		ctx->row_sum += val;
+	} else {
+		EXPECT_EQ(0, json_rpc_get_int(json_rpc, "count", &ctx->count));
+		ctx->final_nb++;
+	}
+}
+
+TEST_F(AbusReqTest, StreamedResponse) {
+	struct stream_ctx ctx;
+	json_rpc_t *json_rpc;
+	int count = -1;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.abus = abus_;
+
+	EXPECT_EQ(0, abus_decl_method(abus_, SVC_NAME, "rows", svc_stream_cb,
+					ABUS_RPC_FLAG_NONE, &ctx, NULL, NULL, NULL));
+
+	json_rpc = abus_request_method_init(abus_, SVC_NAME, "rows");
+	ASSERT_TRUE(NULL != json_rpc);
+
+	EXPECT_EQ(0, abus_request_method_invoke_async(abus_, json_rpc, RPC_TIMEOUT,
+					stream_resp_cb, ABUS_RPC_STREAM, &ctx));
+	EXPECT_EQ(0, abus_request_method_wait_async(abus_, json_rpc, RPC_TIMEOUT));
+
+	EXPECT_EQ(STREAM_CHUNK_NB, ctx.streamed);
+	EXPECT_EQ(STREAM_CHUNK_NB, ctx.partial_nb);
+	EXPECT_EQ(STREAM_CHUNK_NB*(STREAM_CHUNK_NB-1)/2, ctx.row_sum);
+	EXPECT_EQ(1, ctx.final_nb);
+	EXPECT_EQ(STREAM_CHUNK_NB, ctx.count);
+	EXPECT_EQ(0, abus_request_method_cleanup(abus_, json_rpc));
+
+	// a synchronous client gets the final response only
+	ctx.streamed = 0;
+	json_rpc = abus_request_method_init(abus_, SVC_NAME, "rows");
+	ASSERT_TRUE(NULL != json_rpc);
+	EXPECT_EQ(0, abus_request_method_invoke(abus_, json_rpc, ABUS_RPC_FLAG_NONE, RPC_TIMEOUT));
+	EXPECT_EQ(0, json_rpc_is_partial(json_rpc));
+	EXPECT_EQ(0, json_rpc_get_int(json_rpc, "count", &count));
+	EXPECT_EQ(0, count);
+	EXPECT_EQ(0, ctx.streamed);
+	EXPECT_EQ(0, abus_request_method_cleanup(abus_, json_rpc));
+}
+
+static void svc_slow_cb(json_rpc_t * /*json_rpc*/, void * /*arg*/)
+{
+	msleep(400);
+}
+
+static void svc_slow_count_cb(json_rpc_t *json_rpc, void *arg)
+{
+	msleep(200);
+	svc_count_cb(json_rpc, arg);
+}
+
+TEST(AbusCleanupTest, ThreadedMethodInProgress) {
+	static const char req[] = "{\"jsonrpc\":\"2.0\",\"method\":\"" SVC_NAME ".count\",\"id\":1,\"params\":{}}";
+	struct sockaddr_un sockaddrun;
+	struct timeval tv = { 1, 0 };
+	abus_conf_t conf;
+	abus_t *abus;
+	char buf[512];
+	int k, sock, count;
+	ssize_t len;
+
+	// in a thread of its own, then on the pool
+	for (k = 0; k < 2; k++) {
+		memset(&conf, 0, sizeof(conf));
+		conf.pool_size = k;
+
+		count = 0;
+		abus = abus_init(&conf);
+		ASSERT_TRUE(NULL != abus);
+		EXPECT_EQ(0, abus_decl_method(abus, SVC_NAME, "count", &svc_slow_count_cb,
+						ABUS_RPC_THREADED, &count, NULL, NULL, NULL));
+
+		sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+		ASSERT_LE(0, sock);
+		memset(&sockaddrun, 0, sizeof(sockaddrun));
+		sockaddrun.sun_family = AF_UNIX;
+		ASSERT_EQ(0, bind(sock, (struct sockaddr *)&sockaddrun, sizeof(sa_family_t)));
+		setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+		snprintf(sockaddrun.sun_path, sizeof(sockaddrun.sun_path), "/tmp/abus/%s", SVC_NAME);
+		EXPECT_EQ((ssize_t)sizeof(req)-1, sendto(sock, req, sizeof(req)-1, 0,
+								(struct sockaddr *)&sockaddrun, SUN_LEN(&sockaddrun)));
+
+		// the method is running when cleaning up, still responds
+		msleep(50);
+		EXPECT_EQ(0, abus_cleanup(abus));
+		EXPECT_EQ(1, count);
+
+		len = recv(sock, buf, sizeof(buf)-1, MSG_DONTWAIT);
+		ASSERT_LT(0, len);
+		buf[len] = '\0';
+		EXPECT_TRUE(NULL != strstr(buf, "\"count\":1"));
+
+		close(sock);
+	}
+}
+
+struct fail_ctx {
+	abus_t *abus;
+	json_rpc_t *json_rpc;
+	pthread_t thread;
+	volatile int count;
+};
+
+static void svc_fail_cb(json_rpc_t *json_rpc, void *arg)
+{
+	struct fail_ctx *ctx = (struct fail_ctx *)arg;
+
+	json_rpc_set_error(json_rpc, JSONRPC_INVALID_METHOD, NULL);
+	__sync_add_and_fetch(&ctx->count, 1);
+}
+
+static void *defer_fail_routine(void *arg)
+{
+	struct fail_ctx *ctx = (struct fail_ctx *)arg;
+
+	json_rpc_set_error(ctx->json_rpc, JSONRPC_INVALID_METHOD, NULL);
+	EXPECT_EQ(0, abus_complete_response(ctx->abus, ctx->json_rpc));
+	__sync_add_and_fetch(&ctx->count, 1);
+
+	return NULL;
+}
+
+static void svc_defer_fail_cb(json_rpc_t *json_rpc, void *arg)
+{
+	struct fail_ctx *ctx = (struct fail_ctx *)arg;
+
+	EXPECT_EQ(0, abus_defer_response(ctx->abus, json_rpc));
+	ctx->json_rpc = json_rpc;
+	EXPECT_EQ(0, pthread_create(&ctx->thread, NULL, &defer_fail_routine, ctx));
+}
+
+TEST(AbusNotifTest, NoErrorResponse) {
+	static const char notif[] = "{\"jsonrpc\":\"2.0\",\"method\":\"" SVC_NAME ".tfail\",\"params\":{}}";
+	static const char dnotif[] = "{\"jsonrpc\":\"2.0\",\"method\":\"" SVC_NAME ".dfail\",\"params\":{}}";
+	static const char req[] = "{\"jsonrpc\":\"2.0\",\"method\":\"" SVC_NAME ".tfail\",\"id\":1,\"params\":{}}";
+	struct sockaddr_un sockaddrun;
+	struct timeval tv = { 1, 0 };
+	struct fail_ctx ctx;
+	char buf[512];
+	int i, sock;
+	ssize_t len;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.abus = abus_init(NULL);
+	ASSERT_TRUE(NULL != ctx.abus);
+	EXPECT_EQ(0, abus_decl_method(ctx.abus, SVC_NAME, "tfail", &svc_fail_cb,
+					ABUS_RPC_THREADED, &ctx, NULL, NULL, NULL));
+	EXPECT_EQ(0, abus_decl_method(ctx.abus, SVC_NAME, "dfail", &svc_defer_fail_cb,
+					ABUS_RPC_FLAG_NONE, &ctx, NULL, NULL, NULL));
+
+	sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+	ASSERT_LE(0, sock);
+	memset(&sockaddrun, 0, sizeof(sockaddrun));
+	sockaddrun.sun_family = AF_UNIX;
+	ASSERT_EQ(0, bind(sock, (struct sockaddr *)&sockaddrun, sizeof(sa_family_t)));
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	snprintf(sockaddrun.sun_path, sizeof(sockaddrun.sun_path), "/tmp/abus/%s", SVC_NAME);
+	EXPECT_EQ((ssize_t)sizeof(notif)-1, sendto(sock, notif, sizeof(notif)-1, 0,
+							(struct sockaddr *)&sockaddrun, SUN_LEN(&sockaddrun)));
+	EXPECT_EQ((ssize_t)sizeof(dnotif)-1, sendto(sock, dnotif, sizeof(dnotif)-1, 0,
+							(struct sockaddr *)&sockaddrun, SUN_LEN(&sockaddrun)));
+
+	// failed notifications from a worker or deferred, nothing comes back
+	for (i = 0; i < 100 && ctx.count < 2; i++)
+		msleep(10);
+	EXPECT_EQ(2, ctx.count);
+	pthread_join(ctx.thread, NULL);
+	msleep(50);
+	EXPECT_EQ(-1, recv(sock, buf, sizeof(buf)-1, MSG_DONTWAIT));
+
+	// unlike a failed request
+	EXPECT_EQ((ssize_t)sizeof(req)-1, sendto(sock, req, sizeof(req)-1, 0,
+							(struct sockaddr *)&sockaddrun, SUN_LEN(&sockaddrun)));
+	len = recv(sock, buf, sizeof(buf)-1, 0);
+	ASSERT_LT(0, len);
+	buf[len] = '\0';
+	EXPECT_TRUE(NULL != strstr(buf, "\"error\""));
+
+	close(sock);
+	EXPECT_EQ(0, abus_cleanup(ctx.abus));
+}
+
+TEST(AbusRecvTest, SlowMethodNotBlocking) {
+	abus_conf_t conf;
+	abus_t *abus;
+	json_rpc_t *json_rpc, *slow_rpc;
+	int slow_done = 0, count = 0, res_value = 0;
+
+	memset(&conf, 0, sizeof(conf));
+	conf.recv_threads = 2;
+
+	abus = abus_init(&conf);
+	ASSERT_TRUE(NULL != abus);
+	EXPECT_EQ(0, abus_decl_method(abus, SVC_NAME, "slow", &svc_slow_cb,
+					ABUS_RPC_FLAG_NONE, NULL, NULL, NULL, NULL));
+	EXPECT_EQ(0, abus_decl_method(abus, SVC_NAME, "count", &svc_count_cb,
+					ABUS_RPC_FLAG_NONE, &count, NULL, NULL, NULL));
+
+	slow_rpc = abus_request_method_init(abus, SVC_NAME, "slow");
+	ASSERT_TRUE(NULL != slow_rpc);
+	EXPECT_EQ(0, abus_request_method_invoke_async(abus, slow_rpc, 2*RPC_TIMEOUT,
+					async_count_cb, ABUS_RPC_FLAG_NONE, &slow_done));
+
+	// served by the other receiver, well before the slow one is done
+	msleep(50);
+	json_rpc = abus_request_method_init(abus, SVC_NAME, "count");
+	ASSERT_TRUE(NULL != json_rpc);
+	EXPECT_EQ(0, abus_request_method_invoke(abus, json_rpc, ABUS_RPC_FLAG_NONE, 200));
+	EXPECT_EQ(0, json_rpc_get_int(json_rpc, "count", &res_value));
+	EXPECT_EQ(1, res_value);
+	EXPECT_EQ(0, abus_request_method_cleanup(abus, json_rpc));
+	EXPECT_EQ(0, slow_done);
+
+	EXPECT_EQ(0, abus_request_method_wait_async(abus, slow_rpc, 2*RPC_TIMEOUT));
+	EXPECT_EQ(0, abus_request_method_cleanup(abus, slow_rpc));
+	EXPECT_EQ(1, slow_done);
+
+	EXPECT_EQ(0, abus_cleanup(abus));
+}
+
+TEST(AbusRecvTest, StreamNotSupported) {
+	abus_conf_t conf;
+	abus_t *abus;
+	json_rpc_t *json_rpc;
+	int done = 0;
+
+	memset(&conf, 0, sizeof(conf));
+	conf.recv_threads = 2;
+
+	abus = abus_init(&conf);
+	ASSERT_TRUE(NULL != abus);
+
+	// partial results would be received along the final response by any thread
+	json_rpc = abus_request_method_init(abus, SVC_NAME, "rows");
+	ASSERT_TRUE(NULL != json_rpc);
+	EXPECT_EQ(-EOPNOTSUPP, abus_request_method_invoke_async(abus, json_rpc, RPC_TIMEOUT,
+					async_count_cb, ABUS_RPC_STREAM, &done));
+	EXPECT_EQ(0, abus_request_method_cleanup(abus, json_rpc));
+	EXPECT_EQ(0, done);
+
+	EXPECT_EQ(0, abus_cleanup(abus));
+}
+
+TEST(AbusRegistryTest, UndeclWhileRunning) {
+	abus_t *abus;
+	json_rpc_t *json_rpc, *slow_rpc;
+	int slow_done = 0, count = 0;
+
+	abus = abus_init(NULL);
+	ASSERT_TRUE(NULL != abus);
+	EXPECT_EQ(0, abus_decl_method(abus, SVC_NAME, "slow", &svc_slow_cb,
+					ABUS_RPC_EXCL, NULL, NULL, NULL, NULL));
+	EXPECT_EQ(0, abus_decl_method(abus, SVC_NAME, "count", &svc_count_cb,
+					ABUS_RPC_FLAG_NONE, &count, NULL, NULL, NULL));
+
+	slow_rpc = abus_request_method_init(abus, SVC_NAME, "slow");
+	ASSERT_TRUE(NULL != slow_rpc);
+	EXPECT_EQ(0, abus_request_method_invoke_async(abus, slow_rpc, 2*RPC_TIMEOUT,
+					async_count_cb, ABUS_RPC_FLAG_NONE, &slow_done));
+
+	// gone from the registry, while its callback is still running
+	msleep(100);
+	EXPECT_EQ(0, abus_undecl_method(abus, SVC_NAME, "slow"));
+	EXPECT_EQ(JSONRPC_NO_METHOD, abus_undecl_method(abus, SVC_NAME, "slow"));
+
+	EXPECT_EQ(0, abus_request_method_wait_async(abus, slow_rpc, 2*RPC_TIMEOUT));
+	EXPECT_EQ(0, abus_request_method_cleanup(abus, slow_rpc));
+	EXPECT_EQ(1, slow_done);
+
+	json_rpc = abus_request_method_init(abus, SVC_NAME, "slow");
+	ASSERT_TRUE(NULL != json_rpc);
+	EXPECT_EQ(JSONRPC_NO_METHOD, abus_request_method_invoke(abus, json_rpc, ABUS_RPC_FLAG_NONE, RPC_TIMEOUT));
+	EXPECT_EQ(0, abus_request_method_cleanup(abus, json_rpc));
+
+	// declared again
+	EXPECT_EQ(0, abus_decl_method(abus, SVC_NAME, "slow", &svc_count_cb,
+					ABUS_RPC_FLAG_NONE, &count, NULL, NULL, NULL));
+	json_rpc = abus_request_method_init(abus, SVC_NAME, "slow");
+	ASSERT_TRUE(NULL != json_rpc);
+	EXPECT_EQ(0, abus_request_method_invoke(abus, json_rpc, ABUS_RPC_FLAG_NONE, RPC_TIMEOUT));
+	EXPECT_EQ(0, abus_request_method_cleanup(abus, json_rpc));
+	EXPECT_EQ(1, count);
+
+	EXPECT_EQ(0, abus_cleanup(abus));
+}
+
 // TODO:
 // - plenty of async reqs (and with ABUS_RPC_EXCL)
 // - http://code.google.com/p/abus/wiki/CornerCases